@@ -16,19 +16,32 @@
 #include "commit.h"
 #include "tag.h"
 
+/*
+ * Objects are carved out of slabs.  The first slab of each type holds
+ * BLOCKING objects and every later one as many as were allocated
+ * before it, up to MAX_BLOCKING, so that the number of slabs grows
+ * with the log of the object count rather than linearly with it.
+ * The tail of a big slab that is never used is never touched either,
+ * so the operating system does not have to back it with memory.
+ */
 #define BLOCKING 1024
+#define MAX_BLOCKING (1024 * 1024)
 
 #define DEFINE_ALLOCATOR(name, type)				\
 static unsigned int name##_allocs;				\
 void *alloc_##name##_node(void)					\
 {								\
-	static int nr;						\
+	static unsigned int nr;					\
 	static type *block;					\
 	void *ret;						\
 								\
 	if (!nr) {						\
-		nr = BLOCKING;					\
-		block = xmalloc(BLOCKING * sizeof(type));	\
+		nr = name##_allocs;				\
+		if (nr < BLOCKING)				\
+			nr = BLOCKING;				\
+		if (nr > MAX_BLOCKING)				\
+			nr = MAX_BLOCKING;			\
+		block = xmalloc(nr * sizeof(type));		\
 	}							\
 	nr--;							\
 	name##_allocs++;					\
@@ -0,0 +1,37 @@
+/*
+ * Builtin "git commit-graph".
+ */
+#include "cache.h"
+#include "builtin.h"
+#include "commit.h"
+#include "commit-graph.h"
+#include "parse-options.h"
+
+static const char * const builtin_commit_graph_usage[] = {
+	N_("git commit-graph write"),
+	N_("git commit-graph verify"),
+	NULL
+};
+
+int cmd_commit_graph(int argc, const char **argv, const char *prefix)
+{
+	struct option options[] = {
+		OPT_END()
+	};
+
+	git_config(git_default_config, NULL);
+	argc = parse_options(argc, argv, prefix, options,
+			     builtin_commit_graph_usage,
+			     PARSE_OPT_STOP_AT_NON_OPTION);
+	if (argc != 1)
+		usage_with_options(builtin_commit_graph_usage, options);
+
+	save_commit_buffer = 0;
+	if (!strcmp(argv[0], "write"))
+		return !!write_commit_graph();
+	if (!strcmp(argv[0], "verify"))
+		return !!verify_commit_graph();
+
+	error(_("unknown subcommand: %s"), argv[0]);
+	usage_with_options(builtin_commit_graph_usage, options);
+}
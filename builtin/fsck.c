@@ -13,6 +13,7 @@
 #include "dir.h"
 #include "progress.h"
 #include "streaming.h"
+#include "thread-utils.h"
 
 #define REACHABLE 0x0001
 #define SEEN      0x0002
@@ -31,6 +32,7 @@ static int write_lost_and_found;
 static int verbose;
 static int show_progress = -1;
 static int show_dangling = 1;
+static int nr_threads = -1;
 #define ERROR_OBJECT 01
 #define ERROR_REACHABLE 02
 #define ERROR_PACK 04
@@ -63,16 +65,6 @@ static int objerror(struct object *obj, const char *err, ...)
 	return -1;
 }
 
-__attribute__((format (printf, 3, 4)))
-static int fsck_error_func(struct object *obj, int type, const char *err, ...)
-{
-	va_list params;
-	va_start(params, err);
-	objreport(obj, (type == FSCK_WARN) ? "warning" : "error", err, params);
-	va_end(params);
-	return (type == FSCK_WARN) ? 0 : 1;
-}
-
 static struct object_array pending;
 
 static int mark_object(struct object *obj, int type, void *data)
@@ -288,21 +280,147 @@ static void check_connectivity(void)
 	}
 }
 
-static int fsck_obj(struct object *obj)
+#ifndef NO_PTHREADS
+
+static int threads_active;
+static pthread_mutex_t work_mutex;
+static pthread_mutex_t free_mutex;
+static try_to_free_t old_try_to_free_routine;
+static void (*work_fn)(int);
+static int work_next, work_nr;
+
+static void try_to_free_from_threads(size_t size)
 {
-	if (obj->flags & SEEN)
-		return 0;
-	obj->flags |= SEEN;
+	pthread_mutex_lock(&free_mutex);
+	old_try_to_free_routine(size);
+	pthread_mutex_unlock(&free_mutex);
+}
 
-	if (verbose)
-		fprintf(stderr, "Checking %s %s\n",
-			typename(obj->type), sha1_to_hex(obj->sha1));
+static void *run_work(void *data)
+{
+	for (;;) {
+		int i;
+
+		pthread_mutex_lock(&work_mutex);
+		i = work_next++;
+		pthread_mutex_unlock(&work_mutex);
+		if (i >= work_nr)
+			return NULL;
+		work_fn(i);
+	}
+}
 
-	if (fsck_walk(obj, mark_used, NULL))
-		objerror(obj, "broken links");
-	if (fsck_object(obj, check_strict, fsck_error_func))
-		return -1;
+#endif
+
+/*
+ * Call fn(0), ..., fn(nr - 1) from as many threads as we may use.
+ * The calls must not touch the object hash, the pack windows or
+ * anything else shared, and must not print.
+ */
+static void run_in_threads(void (*fn)(int), int nr)
+{
+	int i;
+
+#ifndef NO_PTHREADS
+	if (nr_threads > 1 && nr > 1) {
+		int nr_workers = nr_threads < nr ? nr_threads : nr;
+		pthread_t *thread = xmalloc(nr_workers * sizeof(*thread));
+
+		work_fn = fn;
+		work_next = 0;
+		work_nr = nr;
+		pthread_mutex_init(&work_mutex, NULL);
+		pthread_mutex_init(&free_mutex, NULL);
+		old_try_to_free_routine =
+			set_try_to_free_routine(try_to_free_from_threads);
+		threads_active = 1;
+		for (i = 0; i < nr_workers; i++) {
+			int ret = pthread_create(&thread[i], NULL, run_work, NULL);
+			if (ret)
+				die(_("unable to create thread: %s"), strerror(ret));
+		}
+		for (i = 0; i < nr_workers; i++)
+			pthread_join(thread[i], NULL);
+		threads_active = 0;
+		set_try_to_free_routine(old_try_to_free_routine);
+		pthread_mutex_destroy(&free_mutex);
+		pthread_mutex_destroy(&work_mutex);
+		free(thread);
+		return;
+	}
+#endif
+	for (i = 0; i < nr; i++)
+		fn(i);
+}
+
+/*
+ * fsck_obj() only parses an object and marks what it points at;
+ * fsck_object() is then run on a whole batch of objects at once,
+ * in threads, with its messages collected per object.  Once the
+ * batch is done, the messages are shown in the order the objects
+ * were given to fsck_obj(), whatever the number of threads.
+ */
+#define CHECK_BATCH 1024
+
+struct check_entry {
+	struct object *obj;	/* NULL if it could not be read */
+	char hex[41];
+	unsigned int broken_links:1;
+	unsigned int bad_sha1:1;
+	int result;
+	struct strbuf out;
+};
 
+static struct check_entry check_queue[CHECK_BATCH];
+static int check_nr;
+static struct check_entry *current_check;
+
+#ifndef NO_PTHREADS
+static pthread_key_t check_key;
+#endif
+
+static struct check_entry *get_current_check(void)
+{
+#ifndef NO_PTHREADS
+	if (threads_active)
+		return pthread_getspecific(check_key);
+#endif
+	return current_check;
+}
+
+__attribute__((format (printf, 3, 4)))
+static int queue_fsck_error(struct object *obj, int type, const char *err, ...)
+{
+	struct check_entry *e = get_current_check();
+	va_list params;
+
+	/* sha1_to_hex() is not safe to call from threads */
+	strbuf_addf(&e->out, "%s in %s %s: ",
+		    (type == FSCK_WARN) ? "warning" : "error",
+		    typename(obj->type), e->hex);
+	va_start(params, err);
+	strbuf_vaddf(&e->out, err, params);
+	va_end(params);
+	strbuf_addch(&e->out, '\n');
+	return (type == FSCK_WARN) ? 0 : 1;
+}
+
+static void check_one(int i)
+{
+	struct check_entry *e = &check_queue[i];
+
+	if (!e->obj)
+		return;
+#ifndef NO_PTHREADS
+	if (threads_active)
+		pthread_setspecific(check_key, e);
+#endif
+	current_check = e;
+	e->result = fsck_object(e->obj, check_strict, queue_fsck_error);
+}
+
+static void finish_obj(struct object *obj)
+{
 	if (obj->type == OBJ_TREE) {
 		struct tree *item = (struct tree *) obj;
 
@@ -328,7 +446,69 @@ static int fsck_obj(struct object *obj)
 			printf(" (%s) in %s\n", tag->tag, sha1_to_hex(tag->object.sha1));
 		}
 	}
+}
+
+static void flush_checks(void)
+{
+	int i;
+
+	if (!check_nr)
+		return;
+
+	/* fsck_commit() looks at the grafts, which are read lazily */
+	lookup_commit_graft(null_sha1);
+	run_in_threads(check_one, check_nr);
+
+	for (i = 0; i < check_nr; i++) {
+		struct check_entry *e = &check_queue[i];
+		struct object *obj = e->obj;
 
+		if (!obj) {
+			if (e->bad_sha1)
+				error("sha1 mismatch %s", e->hex);
+			errors_found |= ERROR_OBJECT;
+			error("%s: object corrupt or missing", e->hex);
+			continue;
+		}
+
+		if (verbose)
+			fprintf(stderr, "Checking %s %s\n",
+				typename(obj->type), e->hex);
+		if (e->broken_links)
+			objerror(obj, "broken links");
+		fputs(e->out.buf, stderr);
+		strbuf_release(&e->out);
+		if (!e->result)
+			finish_obj(obj);
+	}
+	check_nr = 0;
+}
+
+static struct check_entry *queue_check(const unsigned char *sha1)
+{
+	struct check_entry *e;
+
+	if (check_nr == CHECK_BATCH)
+		flush_checks();
+	e = &check_queue[check_nr++];
+	memset(e, 0, sizeof(*e));
+	strbuf_init(&e->out, 0);
+	memcpy(e->hex, sha1_to_hex(sha1), sizeof(e->hex));
+	return e;
+}
+
+static int fsck_obj(struct object *obj)
+{
+	struct check_entry *e;
+
+	if (obj->flags & SEEN)
+		return 0;
+	obj->flags |= SEEN;
+
+	e = queue_check(obj->sha1);
+	e->obj = obj;
+	if (fsck_walk(obj, mark_used, NULL))
+		e->broken_links = 1;
 	return 0;
 }
 
@@ -336,9 +516,8 @@ static int fsck_sha1(const unsigned char *sha1)
 {
 	struct object *obj = parse_object(sha1);
 	if (!obj) {
-		errors_found |= ERROR_OBJECT;
-		return error("%s: object corrupt or missing",
-			     sha1_to_hex(sha1));
+		queue_check(sha1);
+		return -1;
 	}
 	return fsck_obj(obj);
 }
@@ -349,8 +528,8 @@ static int fsck_obj_buffer(const unsigned char *sha1, enum object_type type,
 	struct object *obj;
 	obj = parse_object_buffer(sha1, type, size, buffer, eaten);
 	if (!obj) {
-		errors_found |= ERROR_OBJECT;
-		return error("%s: object corrupt or missing", sha1_to_hex(sha1));
+		queue_check(sha1);
+		return -1;
 	}
 	return fsck_obj(obj);
 }
@@ -364,6 +543,18 @@ static int fsck_obj_buffer(const unsigned char *sha1, enum object_type type,
 struct sha1_entry {
 	unsigned long ino;
 	unsigned char sha1[20];
+	char *path;
+
+	/* filled in by read_loose() */
+	enum object_type type;
+	unsigned long size;
+	void *buffer;
+	enum {
+		LOOSE_OK,
+		LOOSE_CORRUPT,
+		LOOSE_BAD_SHA1,
+		LOOSE_TOO_BIG
+	} status;
 };
 
 static struct {
@@ -378,6 +569,70 @@ static int ino_compare(const void *_a, const void *_b)
 	return ino1 < ino2 ? -1 : ino1 > ino2 ? 1 : 0;
 }
 
+/* Read, inflate and hash one loose object; called from threads. */
+static void read_loose(int i)
+{
+	struct sha1_entry *entry = sha1_list.entry[i];
+	unsigned char real_sha1[20];
+
+	if (read_loose_object(entry->path, &entry->type, &entry->size,
+			      &entry->buffer)) {
+		entry->status = LOOSE_CORRUPT;
+		return;
+	}
+	if (!entry->buffer) {
+		entry->status = LOOSE_TOO_BIG;
+		return;
+	}
+	hash_sha1_file(entry->buffer, entry->size, typename(entry->type),
+		       real_sha1);
+	if (hashcmp(entry->sha1, real_sha1)) {
+		entry->status = LOOSE_BAD_SHA1;
+		free(entry->buffer);
+		entry->buffer = NULL;
+		return;
+	}
+	if (entry->type == OBJ_BLOB) {
+		/* checked already; nobody looks at blob contents */
+		free(entry->buffer);
+		entry->buffer = NULL;
+	}
+	entry->status = LOOSE_OK;
+}
+
+static void fsck_loose(struct sha1_entry *entry)
+{
+	struct object *obj;
+	int eaten = 0;
+
+	switch (entry->status) {
+	case LOOSE_TOO_BIG:
+		/* let parse_object() stream it */
+		fsck_sha1(entry->sha1);
+		return;
+	case LOOSE_BAD_SHA1:
+		queue_check(entry->sha1)->bad_sha1 = 1;
+		return;
+	case LOOSE_CORRUPT:
+		queue_check(entry->sha1);
+		return;
+	case LOOSE_OK:
+		break;
+	}
+
+	obj = lookup_object(entry->sha1);
+	if (!obj || !obj->parsed)
+		obj = parse_object_buffer(entry->sha1, entry->type,
+					  entry->size, entry->buffer, &eaten);
+	if (!eaten)
+		free(entry->buffer);
+	if (!obj) {
+		queue_check(entry->sha1);
+		return;
+	}
+	fsck_obj(obj);
+}
+
 static void fsck_sha1_list(void)
 {
 	int i, nr = sha1_list.nr;
@@ -385,24 +640,27 @@ static void fsck_sha1_list(void)
 	if (SORT_DIRENT)
 		qsort(sha1_list.entry, nr,
 		      sizeof(struct sha1_entry *), ino_compare);
+	run_in_threads(read_loose, nr);
 	for (i = 0; i < nr; i++) {
 		struct sha1_entry *entry = sha1_list.entry[i];
-		unsigned char *sha1 = entry->sha1;
 
 		sha1_list.entry[i] = NULL;
-		fsck_sha1(sha1);
+		fsck_loose(entry);
+		free(entry->path);
 		free(entry);
 	}
 	sha1_list.nr = 0;
 }
 
-static void add_sha1_list(unsigned char *sha1, unsigned long ino)
+static void add_sha1_list(unsigned char *sha1, unsigned long ino,
+			  const char *path)
 {
-	struct sha1_entry *entry = xmalloc(sizeof(*entry));
+	struct sha1_entry *entry = xcalloc(1, sizeof(*entry));
 	int nr;
 
 	entry->ino = ino;
 	hashcpy(entry->sha1, sha1);
+	entry->path = xstrdup(path);
 	nr = sha1_list.nr;
 	if (nr == MAX_SHA1_ENTRIES) {
 		fsck_sha1_list();
@@ -440,7 +698,8 @@ static void fsck_dir(int i, char *path)
 		if (is_dot_or_dotdot(de->d_name))
 			continue;
 		if (is_loose_object_file(de, name, sha1)) {
-			add_sha1_list(sha1, DIRENT_SORT_HINT(de));
+			add_sha1_list(sha1, DIRENT_SORT_HINT(de),
+				      mkpath("%s/%s", path, de->d_name));
 			continue;
 		}
 		if (!prefixcmp(de->d_name, "tmp_obj_"))
@@ -551,6 +810,7 @@ static void fsck_object_dir(const char *path)
 	}
 	stop_progress(&progress);
 	fsck_sha1_list();
+	flush_checks();
 }
 
 static int fsck_head_link(void)
@@ -622,9 +882,23 @@ static struct option fsck_opts[] = {
 	OPT_BOOLEAN(0, "lost-found", &write_lost_and_found,
 				N_("write dangling objects in .git/lost-found")),
 	OPT_BOOL(0, "progress", &show_progress, N_("show progress")),
+	OPT_INTEGER(0, "threads", &nr_threads,
+		    N_("use <n> threads to check objects")),
 	OPT_END(),
 };
 
+static int fsck_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "pack.threads")) {
+		verify_pack_threads = git_config_int(var, value);
+		if (verify_pack_threads < 0)
+			die(_("invalid number of threads specified (%d)"),
+			    verify_pack_threads);
+		return 0;
+	}
+	return git_default_config(var, value, cb);
+}
+
 int cmd_fsck(int argc, const char **argv, const char *prefix)
 {
 	int i, heads;
@@ -633,6 +907,7 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 	errors_found = 0;
 	read_replace_refs = 0;
 
+	git_config(fsck_config, NULL);
 	argc = parse_options(argc, argv, prefix, fsck_opts, fsck_usage, 0);
 
 	if (show_progress == -1)
@@ -640,6 +915,20 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 	if (verbose)
 		show_progress = 0;
 
+	if (nr_threads < 0)
+		nr_threads = verify_pack_threads;
+	else
+		verify_pack_threads = nr_threads;
+	if (!nr_threads)
+		nr_threads = online_cpus();
+#ifdef NO_PTHREADS
+	if (nr_threads != 1)
+		warning(_("no threads support, ignoring --threads"));
+	nr_threads = 1;
+#else
+	pthread_key_create(&check_key, NULL);
+#endif
+
 	if (write_lost_and_found) {
 		check_full = 1;
 		include_reflogs = 0;
@@ -678,6 +967,7 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 			if (verify_pack(p, fsck_obj_buffer,
 					progress, count))
 				errors_found |= ERROR_PACK;
+			flush_checks();
 			count += p->num_objects;
 		}
 		stop_progress(&progress);
@@ -9,6 +9,7 @@
 #include "quote.h"
 #include "parse-options.h"
 #include "exec_cmd.h"
+#include "bulk-checkin.h"
 
 static void hash_fd(int fd, const char *type, int write_object, const char *path)
 {
@@ -118,6 +119,10 @@ int cmd_hash_object(int argc, const char **argv, const char *prefix)
 		usage_with_options(hash_object_usage, hash_object_options);
 	}
 
+	/* With core.bulkCheckin, write all objects to a single pack */
+	if (write_object && core_bulk_checkin)
+		plug_bulk_checkin();
+
 	if (hashstdin)
 		hash_fd(0, type, write_object, vpath);
 
@@ -133,5 +138,6 @@ int cmd_hash_object(int argc, const char **argv, const char *prefix)
 	if (stdin_paths)
 		hash_stdin_paths(type, write_object);
 
+	unplug_bulk_checkin();
 	return 0;
 }
@@ -13,7 +13,7 @@
 #include "thread-utils.h"
 
 static const char index_pack_usage[] =
-"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
+"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict] [--[no-]rev-index] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
 
 struct object_entry {
 	struct pack_idx_entry idx;
@@ -260,7 +260,7 @@ static void use(int bytes)
 {
 	if (bytes > input_len)
 		die(_("used more bytes than were available"));
-	input_crc32 = crc32(input_crc32, input_buffer + input_offset, bytes);
+	input_crc32 = git_crc32(input_crc32, input_buffer + input_offset, bytes);
 	input_len -= bytes;
 	input_offset += bytes;
 
@@ -413,16 +413,17 @@ static void *unpack_entry_data(unsigned long offset, unsigned long size,
 	char hdr[32];
 	int hdrlen;
 
-	if (!is_delta_type(type)) {
+	if (type == OBJ_BLOB && size > big_file_threshold) {
+		/* hash large blobs on the way, as we do not keep them */
 		hdrlen = sprintf(hdr, "%s %lu", typename(type), size) + 1;
 		git_SHA1_Init(&c);
 		git_SHA1_Update(&c, hdr, hdrlen);
-	} else
-		sha1 = NULL;
-	if (type == OBJ_BLOB && size > big_file_threshold)
 		buf = fixed_buf;
-	else
+	} else {
+		/* the caller hashes what we return, maybe in a thread */
+		sha1 = NULL;
 		buf = xmalloc(size);
+	}
 
 	memset(&stream, 0, sizeof(stream));
 	git_inflate_init(&stream);
@@ -987,6 +988,141 @@ static void *threaded_second_pass(void *data)
 }
 #endif
 
+/*
+ * Non-delta objects are hashed in batches of up to BASE_BATCH, which
+ * lets hash_sha1_files() work on several of them at once.
+ */
+#define BASE_BATCH 16
+#define BASE_BATCH_BYTES (1024 * 1024)
+
+struct base_object {
+	struct object_entry *obj;
+	void *data;
+};
+
+static void hash_base_objects(struct base_object *base, int nr)
+{
+	struct hash_sha1_request req[BASE_BATCH];
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		struct object_entry *obj = base[i].obj;
+		req[i].buf = base[i].data;
+		req[i].len = obj->size;
+		req[i].type = typename(obj->type);
+		req[i].sha1 = obj->idx.sha1;
+	}
+	hash_sha1_files(req, nr);
+	for (i = 0; i < nr; i++) {
+		struct object_entry *obj = base[i].obj;
+		sha1_object(base[i].data, NULL, obj->size, obj->type,
+			    obj->idx.sha1);
+		free(base[i].data);
+	}
+}
+
+#ifndef NO_PTHREADS
+/*
+ * The input stream has to be read and inflated in order, as only
+ * inflating an object tells where the next one starts, but hashing
+ * and checking the inflated non-delta objects is left to threads,
+ * which take them off the queue in batches.  The queue between them
+ * is bounded in entries and in bytes.
+ */
+#define FIRST_PASS_QUEUE_BYTES (32 * 1024 * 1024)
+
+static struct base_object *first_pass_queue;
+static int first_pass_alloc, first_pass_first, first_pass_nr;
+static unsigned long first_pass_bytes;
+static int first_pass_done;
+static pthread_cond_t first_pass_avail;
+static pthread_cond_t first_pass_room;
+
+static void *threaded_first_pass(void *data)
+{
+	for (;;) {
+		struct base_object batch[BASE_BATCH];
+		int nr = 0;
+
+		work_lock();
+		while (first_pass_nr < BASE_BATCH &&
+		       first_pass_bytes < BASE_BATCH_BYTES && !first_pass_done)
+			pthread_cond_wait(&first_pass_avail, &work_mutex);
+		if (!first_pass_nr) {
+			work_unlock();
+			break;
+		}
+		while (first_pass_nr && nr < BASE_BATCH) {
+			batch[nr] = first_pass_queue[first_pass_first];
+			first_pass_first = (first_pass_first + 1) % first_pass_alloc;
+			first_pass_nr--;
+			first_pass_bytes -= batch[nr].obj->size;
+			nr++;
+		}
+		pthread_cond_signal(&first_pass_room);
+		work_unlock();
+
+		hash_base_objects(batch, nr);
+	}
+	return NULL;
+}
+
+static void queue_base_object(struct object_entry *obj, void *data)
+{
+	struct base_object *e;
+
+	work_lock();
+	while (first_pass_nr == first_pass_alloc ||
+	       (first_pass_nr &&
+		first_pass_bytes + obj->size > FIRST_PASS_QUEUE_BYTES))
+		pthread_cond_wait(&first_pass_room, &work_mutex);
+	e = &first_pass_queue[(first_pass_first + first_pass_nr) %
+			      first_pass_alloc];
+	e->obj = obj;
+	e->data = data;
+	first_pass_nr++;
+	first_pass_bytes += obj->size;
+	pthread_cond_signal(&first_pass_avail);
+	work_unlock();
+}
+
+static void start_first_pass_threads(void)
+{
+	int i;
+
+	init_thread();
+	pthread_cond_init(&first_pass_avail, NULL);
+	pthread_cond_init(&first_pass_room, NULL);
+	first_pass_alloc = 2 * nr_threads * BASE_BATCH;
+	first_pass_queue = xcalloc(first_pass_alloc, sizeof(*first_pass_queue));
+	first_pass_first = first_pass_nr = first_pass_done = 0;
+	first_pass_bytes = 0;
+	for (i = 0; i < nr_threads; i++) {
+		int ret = pthread_create(&thread_data[i].thread, NULL,
+					 threaded_first_pass, thread_data + i);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+}
+
+static void finish_first_pass_threads(void)
+{
+	int i;
+
+	work_lock();
+	first_pass_done = 1;
+	pthread_cond_broadcast(&first_pass_avail);
+	work_unlock();
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(thread_data[i].thread, NULL);
+	pthread_cond_destroy(&first_pass_avail);
+	pthread_cond_destroy(&first_pass_room);
+	free(first_pass_queue);
+	first_pass_queue = NULL;
+	cleanup_thread();
+}
+#endif
+
 /*
  * First pass:
  * - find locations of all objects;
@@ -998,6 +1134,17 @@ static void parse_pack_objects(unsigned char *sha1)
 	int i, nr_delays = 0;
 	struct delta_entry *delta = deltas;
 	struct stat st;
+	struct base_object batch[BASE_BATCH];
+	int batch_nr = 0;
+	unsigned long batch_bytes = 0;
+#ifndef NO_PTHREADS
+	int threaded = 0;
+
+	if (nr_threads > 1 || getenv("GIT_FORCE_THREADS")) {
+		start_first_pass_threads();
+		threaded = 1;
+	}
+#endif
 
 	if (verbose)
 		progress = start_progress(
@@ -1011,18 +1158,39 @@ static void parse_pack_objects(unsigned char *sha1)
 			nr_deltas++;
 			delta->obj_no = i;
 			delta++;
+			free(data);
 		} else if (!data) {
 			/* large blobs, check later */
 			obj->real_type = OBJ_BAD;
 			nr_delays++;
-		} else
-			sha1_object(data, NULL, obj->size, obj->type, obj->idx.sha1);
-		free(data);
+		}
+#ifndef NO_PTHREADS
+		else if (threaded)
+			queue_base_object(obj, data);
+#endif
+		else {
+			batch[batch_nr].obj = obj;
+			batch[batch_nr].data = data;
+			batch_bytes += obj->size;
+			if (++batch_nr == BASE_BATCH ||
+			    batch_bytes >= BASE_BATCH_BYTES) {
+				hash_base_objects(batch, batch_nr);
+				batch_nr = 0;
+				batch_bytes = 0;
+			}
+		}
 		display_progress(progress, i+1);
 	}
+	if (batch_nr)
+		hash_base_objects(batch, batch_nr);
 	objects[i].idx.offset = consumed_bytes;
 	stop_progress(&progress);
 
+#ifndef NO_PTHREADS
+	if (threaded)
+		finish_first_pass_threads();
+#endif
+
 	/* Check pack integrity */
 	flush();
 	git_SHA1_Final(sha1, &input_ctx);
@@ -1258,6 +1426,7 @@ static void fix_unresolved_deltas(struct sha1file *f, int nr_unresolved)
 
 static void final(const char *final_pack_name, const char *curr_pack_name,
 		  const char *final_index_name, const char *curr_index_name,
+		  const char *final_rev_name, const char *curr_rev_name,
 		  const char *keep_name, const char *keep_msg,
 		  unsigned char *sha1)
 {
@@ -1309,6 +1478,17 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 	} else if (from_stdin)
 		chmod(final_pack_name, 0444);
 
+	if (curr_rev_name && final_rev_name != curr_rev_name) {
+		if (!final_rev_name) {
+			snprintf(name, sizeof(name), "%s/pack/pack-%s.rev",
+				 get_object_directory(), sha1_to_hex(sha1));
+			final_rev_name = name;
+		}
+		if (move_temp_to_file(curr_rev_name, final_rev_name))
+			die(_("cannot store reverse index file"));
+	} else if (curr_rev_name)
+		chmod(final_rev_name, 0444);
+
 	if (final_index_name != curr_index_name) {
 		if (!final_index_name) {
 			snprintf(name, sizeof(name), "%s/pack/pack-%s.idx",
@@ -1352,6 +1532,13 @@ static int git_index_pack_config(const char *k, const char *v, void *cb)
 			die(_("bad pack.indexversion=%"PRIu32), opts->version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		if (git_config_bool(k, v))
+			opts->flags |= WRITE_REV;
+		else
+			opts->flags &= ~WRITE_REV;
+		return 0;
+	}
 	if (!strcmp(k, "pack.threads")) {
 		nr_threads = git_config_int(k, v);
 		if (nr_threads < 0)
@@ -1484,13 +1671,13 @@ static void show_pack_info(int stat_only)
 int cmd_index_pack(int argc, const char **argv, const char *prefix)
 {
 	int i, fix_thin_pack = 0, verify = 0, stat_only = 0;
-	const char *curr_pack, *curr_index;
-	const char *index_name = NULL, *pack_name = NULL;
+	const char *curr_pack, *curr_index, *curr_rev = NULL;
+	const char *index_name = NULL, *pack_name = NULL, *rev_name = NULL;
 	const char *keep_name = NULL, *keep_msg = NULL;
-	char *index_name_buf = NULL, *keep_name_buf = NULL;
+	char *index_name_buf = NULL, *keep_name_buf = NULL, *rev_name_buf = NULL;
 	struct pack_idx_entry **idx_objects;
 	struct pack_idx_option opts;
-	unsigned char pack_sha1[20];
+	unsigned char pack_sha1[20], pack_checksum[20];
 
 	if (argc == 2 && !strcmp(argv[1], "-h"))
 		usage(index_pack_usage);
@@ -1512,6 +1699,10 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 				fix_thin_pack = 1;
 			} else if (!strcmp(arg, "--strict")) {
 				strict = 1;
+			} else if (!strcmp(arg, "--rev-index")) {
+				opts.flags |= WRITE_REV;
+			} else if (!strcmp(arg, "--no-rev-index")) {
+				opts.flags &= ~WRITE_REV;
 			} else if (!strcmp(arg, "--verify")) {
 				verify = 1;
 			} else if (!strcmp(arg, "--verify-stat")) {
@@ -1603,6 +1794,17 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 			die(_("--verify with no packfile name given"));
 		read_idx_option(&opts, index_name);
 		opts.flags |= WRITE_IDX_VERIFY | WRITE_IDX_STRICT;
+		opts.flags &= ~WRITE_REV;
+	}
+	if ((opts.flags & WRITE_REV) && index_name) {
+		int len = strlen(index_name);
+		if (!has_extension(index_name, ".idx"))
+			die(_("index file '%s' does not end with '.idx'"),
+			    index_name);
+		rev_name_buf = xmalloc(len + 1);
+		memcpy(rev_name_buf, index_name, len - 4);
+		strcpy(rev_name_buf + len - 4, ".rev");
+		rev_name = rev_name_buf;
 	}
 	if (strict)
 		opts.flags |= WRITE_IDX_STRICT;
@@ -1633,12 +1835,17 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	idx_objects = xmalloc((nr_objects) * sizeof(struct pack_idx_entry *));
 	for (i = 0; i < nr_objects; i++)
 		idx_objects[i] = &objects[i].idx;
+	hashcpy(pack_checksum, pack_sha1);
 	curr_index = write_idx_file(index_name, idx_objects, nr_objects, &opts, pack_sha1);
+	if (opts.flags & WRITE_REV)
+		curr_rev = write_rev_file(rev_name, idx_objects, nr_objects,
+					  pack_checksum);
 	free(idx_objects);
 
 	if (!verify)
 		final(pack_name, curr_pack,
 		      index_name, curr_index,
+		      rev_name, curr_rev,
 		      keep_name, keep_msg,
 		      pack_sha1);
 	else
@@ -1646,6 +1853,9 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	free(objects);
 	free(index_name_buf);
 	free(keep_name_buf);
+	free(rev_name_buf);
+	if (rev_name == NULL)
+		free((void *) curr_rev);
 	if (pack_name == NULL)
 		free((void *) curr_pack);
 	if (index_name == NULL)
@@ -0,0 +1,38 @@
+/*
+ * Builtin "git multi-pack-index".
+ */
+#include "cache.h"
+#include "builtin.h"
+#include "midx.h"
+#include "parse-options.h"
+
+static const char * const builtin_multi_pack_index_usage[] = {
+	N_("git multi-pack-index write"),
+	N_("git multi-pack-index verify"),
+	N_("git multi-pack-index expire"),
+	NULL
+};
+
+int cmd_multi_pack_index(int argc, const char **argv, const char *prefix)
+{
+	struct option options[] = {
+		OPT_END()
+	};
+
+	git_config(git_default_config, NULL);
+	argc = parse_options(argc, argv, prefix, options,
+			     builtin_multi_pack_index_usage,
+			     PARSE_OPT_STOP_AT_NON_OPTION);
+	if (argc != 1)
+		usage_with_options(builtin_multi_pack_index_usage, options);
+
+	if (!strcmp(argv[0], "write"))
+		return !!write_multi_pack_index();
+	if (!strcmp(argv[0], "verify"))
+		return !!verify_multi_pack_index();
+	if (!strcmp(argv[0], "expire"))
+		return !!expire_multi_pack_index();
+
+	error(_("unknown subcommand: %s"), argv[0]);
+	usage_with_options(builtin_multi_pack_index_usage, options);
+}
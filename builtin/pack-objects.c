@@ -18,6 +18,9 @@
 #include "refs.h"
 #include "streaming.h"
 #include "thread-utils.h"
+#include "pack-bitmap.h"
+#include "delta-islands.h"
+#include "sha1-array.h"
 
 static const char *pack_usage[] = {
 	N_("git pack-objects --stdout [options...] [< ref-list | < object-list]"),
@@ -49,6 +52,7 @@ struct object_entry {
 	unsigned char no_try_delta;
 	unsigned char tagged; /* near the very tip of refs */
 	unsigned char filled; /* assigned write-order */
+	unsigned tree_depth; /* deepest path a tree is seen at */
 };
 
 /*
@@ -68,6 +72,7 @@ static unsigned long unpack_unreachable_expiration;
 static int local;
 static int incremental;
 static int ignore_packed_keep;
+static int ignore_packed_keep_in_core;
 static int allow_ofs_delta;
 static struct pack_idx_option pack_idx_opts;
 static const char *base_name;
@@ -76,7 +81,11 @@ static int window = 10;
 static unsigned long pack_size_limit;
 static int depth = 50;
 static int delta_search_threads;
+static int use_delta_islands;
 static int pack_to_stdout;
+static int use_bitmap_index = 1;
+static int write_bitmap;
+static int allow_pack_reuse = 1;
 static int num_preferred_base;
 static struct progress *progress_state;
 static int pack_compression_level = Z_DEFAULT_COMPRESSION;
@@ -103,6 +112,14 @@ static struct object_entry *locate_object_entry(const unsigned char *sha1);
 static uint32_t written, written_delta;
 static uint32_t reused, reused_delta;
 
+/*
+ * The objects at the start of the bitmapped pack that are copied to
+ * the output as they are, without an object_entry of their own.
+ */
+static struct packed_git *reuse_packfile;
+static uint32_t reuse_packfile_objects;
+static off_t reuse_packfile_offset;
+
 
 static void *get_delta(struct object_entry *entry)
 {
@@ -125,6 +142,34 @@ static void *get_delta(struct object_entry *entry)
 	return delta_buf;
 }
 
+#ifndef NO_PTHREADS
+
+static pthread_mutex_t read_mutex;
+#define read_lock()		pthread_mutex_lock(&read_mutex)
+#define read_unlock()		pthread_mutex_unlock(&read_mutex)
+
+static pthread_mutex_t cache_mutex;
+#define cache_lock()		pthread_mutex_lock(&cache_mutex)
+#define cache_unlock()		pthread_mutex_unlock(&cache_mutex)
+
+static pthread_mutex_t progress_mutex;
+#define progress_lock()		pthread_mutex_lock(&progress_mutex)
+#define progress_unlock()	pthread_mutex_unlock(&progress_mutex)
+
+static void init_threaded_search(void);
+static void cleanup_threaded_search(void);
+
+#else
+
+#define read_lock()		(void)0
+#define read_unlock()		(void)0
+#define cache_lock()		(void)0
+#define cache_unlock()		(void)0
+#define progress_lock()		(void)0
+#define progress_unlock()	(void)0
+
+#endif
+
 static unsigned long do_compress(void **pptr, unsigned long size)
 {
 	git_zstream stream;
@@ -151,6 +196,264 @@ static unsigned long do_compress(void **pptr, unsigned long size)
 	return stream.total_out;
 }
 
+/*
+ * An object that is stored whole and has to be deflated afresh,
+ * compressed ahead of the writer.
+ */
+struct compressed_object {
+	void *buf;
+	unsigned long size;	/* inflated */
+	unsigned long datalen;	/* deflated */
+	enum object_type type;
+};
+
+static int want_reuse(struct object_entry *entry, int usable_delta)
+{
+	if (!reuse_object)
+		return 0;	/* explicit */
+	else if (!entry->in_pack)
+		return 0;	/* can't reuse what we don't have */
+	else if (entry->type == OBJ_REF_DELTA || entry->type == OBJ_OFS_DELTA)
+				/* check_object() decided it for us ... */
+		return usable_delta;
+				/* ... but pack split may override that */
+	else if (entry->type != entry->in_pack_type)
+		return 0;	/* pack has delta which is unusable */
+	else if (entry->delta)
+		return 0;	/* we want to pack afresh */
+	else
+		return 1;	/* we have it in-pack undeltified,
+				 * and we do not need to deltify it.
+				 */
+}
+
+#ifndef NO_PTHREADS
+
+/*
+ * Deflating objects that cannot be reused is the bulk of the work of
+ * the write phase with --no-reuse-object or after a deeper delta
+ * search.  Worker threads compress the objects that will be stored
+ * whole, in write order, at most COMPRESS_WINDOW_PER_THREAD per
+ * thread ahead of the writer; the writer still appends everything in
+ * order, so the pack is the same as when written by a single thread.
+ *
+ * Each position of the write order is in one of the states below.
+ * Positions the workers have nothing to do for, or which the writer
+ * is done with, are COMPRESS_NONE.
+ */
+#define COMPRESS_WINDOW_PER_THREAD 16
+
+enum compress_state {
+	COMPRESS_NONE = 0,
+	COMPRESS_WANTED,	/* nobody has started on it yet */
+	COMPRESS_BUSY,		/* a worker is compressing it */
+	COMPRESS_DONE		/* waiting in its slot for the writer */
+};
+
+static int compress_threads;
+static pthread_t *compress_thread;
+static struct object_entry **compress_order;
+static uint32_t *compress_position;	/* indexed by objects[] */
+static unsigned char *compress_state;	/* indexed by write position */
+static struct compressed_object *compress_slot;
+static uint32_t compress_window;
+static uint32_t compress_next;		/* next position to look at */
+static uint32_t compress_consumed;	/* oldest position not COMPRESS_NONE */
+static int compress_stop;
+static pthread_mutex_t compress_mutex;
+static pthread_cond_t compress_cond;
+
+static void *threaded_compress(void *arg)
+{
+	pthread_mutex_lock(&compress_mutex);
+	for (;;) {
+		struct object_entry *entry;
+		struct compressed_object z;
+		uint32_t pos;
+
+		while (compress_next < nr_objects &&
+		       compress_state[compress_next] != COMPRESS_WANTED)
+			compress_next++;
+		if (compress_stop || compress_next >= nr_objects)
+			break;
+		if (compress_next >= compress_consumed + compress_window) {
+			pthread_cond_wait(&compress_cond, &compress_mutex);
+			continue;
+		}
+		pos = compress_next++;
+		compress_state[pos] = COMPRESS_BUSY;
+		pthread_mutex_unlock(&compress_mutex);
+
+		entry = compress_order[pos];
+		read_lock();
+		z.buf = read_sha1_file(entry->idx.sha1, &z.type, &z.size);
+		read_unlock();
+		if (!z.buf)
+			die(_("unable to read %s"), sha1_to_hex(entry->idx.sha1));
+		z.datalen = do_compress(&z.buf, z.size);
+
+		pthread_mutex_lock(&compress_mutex);
+		compress_slot[pos % compress_window] = z;
+		compress_state[pos] = COMPRESS_DONE;
+		pthread_cond_broadcast(&compress_cond);
+	}
+	pthread_mutex_unlock(&compress_mutex);
+	return NULL;
+}
+
+static void start_compress_threads(struct object_entry **write_order)
+{
+	uint32_t i, wanted = 0;
+	int nr_threads, ret;
+
+	/*
+	 * A split pack decides whether a delta is usable only while
+	 * writing; leave that case to the writer alone.
+	 */
+	if (pack_size_limit)
+		return;
+	nr_threads = delta_search_threads ? delta_search_threads : online_cpus();
+	if (nr_threads <= 1)
+		return;
+
+	compress_position = xmalloc(nr_objects * sizeof(*compress_position));
+	compress_state = xcalloc(nr_objects, sizeof(*compress_state));
+	for (i = 0; i < nr_objects; i++) {
+		struct object_entry *entry = write_order[i];
+		compress_position[entry - objects] = i;
+		if (entry->preferred_base || entry->delta ||
+		    want_reuse(entry, 0) ||
+		    (entry->type == OBJ_BLOB && entry->size > big_file_threshold))
+			continue;
+		compress_state[i] = COMPRESS_WANTED;
+		wanted++;
+	}
+	if (wanted < nr_threads) {
+		free(compress_position);
+		free(compress_state);
+		return;
+	}
+
+	init_threaded_search();
+	pthread_mutex_init(&compress_mutex, NULL);
+	pthread_cond_init(&compress_cond, NULL);
+	compress_order = write_order;
+	compress_window = nr_threads * COMPRESS_WINDOW_PER_THREAD;
+	compress_slot = xcalloc(compress_window, sizeof(*compress_slot));
+	compress_next = compress_consumed = 0;
+	while (compress_consumed < nr_objects &&
+	       compress_state[compress_consumed] == COMPRESS_NONE)
+		compress_consumed++;
+	compress_stop = 0;
+	compress_threads = nr_threads;
+	compress_thread = xcalloc(nr_threads, sizeof(*compress_thread));
+	for (i = 0; i < nr_threads; i++) {
+		ret = pthread_create(&compress_thread[i], NULL,
+				     threaded_compress, NULL);
+		if (ret)
+			die("unable to create thread: %s", strerror(ret));
+	}
+}
+
+static void finish_compress_threads(void)
+{
+	uint32_t i;
+
+	if (!compress_threads)
+		return;
+	pthread_mutex_lock(&compress_mutex);
+	compress_stop = 1;
+	pthread_cond_broadcast(&compress_cond);
+	pthread_mutex_unlock(&compress_mutex);
+	for (i = 0; i < compress_threads; i++)
+		pthread_join(compress_thread[i], NULL);
+	for (i = 0; i < compress_window; i++)
+		free(compress_slot[i].buf);
+	free(compress_slot);
+	free(compress_thread);
+	free(compress_state);
+	free(compress_position);
+	pthread_cond_destroy(&compress_cond);
+	pthread_mutex_destroy(&compress_mutex);
+	cleanup_threaded_search();
+	compress_threads = 0;
+}
+
+/*
+ * Hand the compressed form of "entry" over to the writer, waiting for
+ * a worker that is busy with it.  If no worker has started on it, the
+ * writer is going to compress it itself, so keep them off it.
+ */
+static int take_compressed_object(struct object_entry *entry,
+				  struct compressed_object *z)
+{
+	uint32_t pos;
+	int ret = 0;
+
+	if (!compress_threads)
+		return 0;
+	pos = compress_position[entry - objects];
+	pthread_mutex_lock(&compress_mutex);
+	while (compress_state[pos] == COMPRESS_BUSY)
+		pthread_cond_wait(&compress_cond, &compress_mutex);
+	if (compress_state[pos] == COMPRESS_DONE) {
+		*z = compress_slot[pos % compress_window];
+		memset(&compress_slot[pos % compress_window], 0, sizeof(*z));
+		ret = 1;
+	}
+	compress_state[pos] = COMPRESS_NONE;
+	pthread_mutex_unlock(&compress_mutex);
+	return ret;
+}
+
+/*
+ * The writer is done with write position "pos"; let the workers move
+ * their window past it.
+ */
+static void release_compressed_position(uint32_t pos)
+{
+	if (!compress_threads)
+		return;
+	pthread_mutex_lock(&compress_mutex);
+	if (compress_state[pos] == COMPRESS_DONE) {
+		free(compress_slot[pos % compress_window].buf);
+		memset(&compress_slot[pos % compress_window], 0,
+		       sizeof(struct compressed_object));
+	}
+	compress_state[pos] = COMPRESS_NONE;
+	while (compress_consumed < nr_objects &&
+	       compress_state[compress_consumed] == COMPRESS_NONE)
+		compress_consumed++;
+	pthread_cond_broadcast(&compress_cond);
+	pthread_mutex_unlock(&compress_mutex);
+}
+
+/*
+ * While the workers run, the writer shares the object store with them.
+ */
+static void lock_object_store(void)
+{
+	if (compress_threads)
+		read_lock();
+}
+
+static void unlock_object_store(void)
+{
+	if (compress_threads)
+		read_unlock();
+}
+
+#else
+
+#define start_compress_threads(write_order)	(void)0
+#define finish_compress_threads()		(void)0
+#define take_compressed_object(entry, z)	0
+#define release_compressed_position(pos)	(void)0
+#define lock_object_store()			(void)0
+#define unlock_object_store()			(void)0
+
+#endif
+
 static unsigned long write_large_blob_data(struct git_istream *st, struct sha1file *f,
 					   const unsigned char *sha1)
 {
@@ -242,7 +545,8 @@ static void copy_pack_data(struct sha1file *f,
 
 /* Return 0 if we will bust the pack-size limit */
 static unsigned long write_no_reuse_object(struct sha1file *f, struct object_entry *entry,
-					   unsigned long limit, int usable_delta)
+					   unsigned long limit, int usable_delta,
+					   struct compressed_object *z)
 {
 	unsigned long size, datalen;
 	unsigned char header[10], dheader[10];
@@ -251,7 +555,14 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 	void *buf;
 	struct git_istream *st = NULL;
 
-	if (!usable_delta) {
+	if (z) {
+		buf = z->buf;
+		size = z->size;
+		type = z->type;
+		free(entry->delta_data);
+		entry->delta_data = NULL;
+		entry->z_delta_size = 0;
+	} else if (!usable_delta) {
 		if (entry->type == OBJ_BLOB &&
 		    entry->size > big_file_threshold &&
 		    (st = open_istream(entry->idx.sha1, &type, &size, NULL)) != NULL)
@@ -283,6 +594,8 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 
 	if (st)	/* large blob case, just assume we don't compress well */
 		datalen = size;
+	else if (z)
+		datalen = z->datalen;
 	else if (entry->z_delta_size)
 		datalen = entry->z_delta_size;
 	else
@@ -354,7 +667,7 @@ static unsigned long write_reuse_object(struct sha1file *f, struct object_entry
 {
 	struct packed_git *p = entry->in_pack;
 	struct pack_window *w_curs = NULL;
-	struct revindex_entry *revidx;
+	uint32_t pos;
 	off_t offset;
 	enum object_type type = entry->type;
 	unsigned long datalen;
@@ -367,13 +680,16 @@ static unsigned long write_reuse_object(struct sha1file *f, struct object_entry
 	hdrlen = encode_in_pack_object_header(type, entry->size, header);
 
 	offset = entry->in_pack_offset;
-	revidx = find_pack_revindex(p, offset);
-	datalen = revidx[1].offset - offset;
+	if (offset_to_pack_pos(p, offset, &pos))
+		die("unable to find the size of %s in %s",
+		    sha1_to_hex(entry->idx.sha1), p->pack_name);
+	datalen = pack_pos_to_offset(p, pos + 1) - offset;
 	if (!pack_to_stdout && p->index_version > 1 &&
-	    check_pack_crc(p, &w_curs, offset, datalen, revidx->nr)) {
+	    check_pack_crc(p, &w_curs, offset, datalen,
+			   pack_pos_to_index(p, pos))) {
 		error("bad packed object CRC for %s", sha1_to_hex(entry->idx.sha1));
 		unuse_pack(&w_curs);
-		return write_no_reuse_object(f, entry, limit, usable_delta);
+		return write_no_reuse_object(f, entry, limit, usable_delta, NULL);
 	}
 
 	offset += entry->in_pack_header_size;
@@ -383,7 +699,7 @@ static unsigned long write_reuse_object(struct sha1file *f, struct object_entry
 	    check_pack_inflate(p, &w_curs, offset, datalen, entry->size)) {
 		error("corrupt packed object for %s", sha1_to_hex(entry->idx.sha1));
 		unuse_pack(&w_curs);
-		return write_no_reuse_object(f, entry, limit, usable_delta);
+		return write_no_reuse_object(f, entry, limit, usable_delta, NULL);
 	}
 
 	if (type == OBJ_OFS_DELTA) {
@@ -429,6 +745,8 @@ static unsigned long write_object(struct sha1file *f,
 {
 	unsigned long limit, len;
 	int usable_delta, to_reuse;
+	struct compressed_object z;
+	int precompressed = 0;
 
 	if (!pack_to_stdout)
 		crc32_begin(f);
@@ -456,27 +774,19 @@ static unsigned long write_object(struct sha1file *f,
 	else
 		usable_delta = 0;	/* base could end up in another pack */
 
-	if (!reuse_object)
-		to_reuse = 0;	/* explicit */
-	else if (!entry->in_pack)
-		to_reuse = 0;	/* can't reuse what we don't have */
-	else if (entry->type == OBJ_REF_DELTA || entry->type == OBJ_OFS_DELTA)
-				/* check_object() decided it for us ... */
-		to_reuse = usable_delta;
-				/* ... but pack split may override that */
-	else if (entry->type != entry->in_pack_type)
-		to_reuse = 0;	/* pack has delta which is unusable */
-	else if (entry->delta)
-		to_reuse = 0;	/* we want to pack afresh */
-	else
-		to_reuse = 1;	/* we have it in-pack undeltified,
-				 * and we do not need to deltify it.
-				 */
+	to_reuse = want_reuse(entry, usable_delta);
+	if (!to_reuse && !usable_delta)
+		precompressed = take_compressed_object(entry, &z);
 
+	if (!precompressed)
+		lock_object_store();
 	if (!to_reuse)
-		len = write_no_reuse_object(f, entry, limit, usable_delta);
+		len = write_no_reuse_object(f, entry, limit, usable_delta,
+					    precompressed ? &z : NULL);
 	else
 		len = write_reuse_object(f, entry, limit, usable_delta);
+	if (!precompressed)
+		unlock_object_store();
 	if (!len)
 		return 0;
 
@@ -712,6 +1022,59 @@ static struct object_entry **compute_write_order(void)
 	return wo;
 }
 
+/*
+ * Called right after the .idx named "idx_name" was written, while
+ * written_list is still sorted in .idx order.
+ */
+static void write_pack_bitmap(const char *idx_name)
+{
+	enum object_type *types;
+	char *bitmap_name;
+	uint32_t i;
+	size_t len = strlen(idx_name);
+
+	if (nr_written != nr_result) {
+		warning("not writing a bitmap index: the objects were split "
+			"across several packs");
+		return;
+	}
+
+	types = xmalloc(nr_written * sizeof(*types));
+	for (i = 0; i < nr_written; i++) {
+		struct object_entry *entry = (struct object_entry *)written_list[i];
+
+		/* a reused delta only knows it is a delta */
+		if (entry->type == OBJ_OFS_DELTA || entry->type == OBJ_REF_DELTA)
+			types[i] = sha1_object_info(entry->idx.sha1, NULL);
+		else
+			types[i] = entry->type;
+	}
+	bitmap_name = xmalloc(len + 4);
+	memcpy(bitmap_name, idx_name, len - 4);
+	strcpy(bitmap_name + len - 4, ".bitmap");
+	if (write_bitmap_index(idx_name, bitmap_name, types))
+		warning("not writing a bitmap index for %s", idx_name);
+	free(bitmap_name);
+	free(types);
+}
+
+static off_t write_reused_pack(struct sha1file *f)
+{
+	struct pack_window *w_curs = NULL;
+	off_t len = reuse_packfile_offset - sizeof(struct pack_header);
+
+	if (!is_pack_valid(reuse_packfile))
+		die("packfile %s cannot be accessed", reuse_packfile->pack_name);
+	copy_pack_data(f, reuse_packfile, &w_curs,
+		       sizeof(struct pack_header), len);
+	unuse_pack(&w_curs);
+
+	written += reuse_packfile_objects;
+	reused += reuse_packfile_objects;
+	display_progress(progress_state, written);
+	return len;
+}
+
 static void write_pack_file(void)
 {
 	uint32_t i = 0, j;
@@ -738,13 +1101,21 @@ static void write_pack_file(void)
 		offset = write_pack_header(f, nr_remaining);
 		if (!offset)
 			die_errno("unable to write pack header");
+		if (reuse_packfile) {
+			/* only done for packs to stdout, which are never split */
+			offset += write_reused_pack(f);
+			nr_remaining -= reuse_packfile_objects;
+		}
 		nr_written = 0;
+		start_compress_threads(write_order);
 		for (; i < nr_objects; i++) {
 			struct object_entry *e = write_order[i];
 			if (write_one(f, e, &offset) == WRITE_ONE_BREAK)
 				break;
+			release_compressed_position(i);
 			display_progress(progress_state, written);
 		}
+		finish_compress_threads();
 
 		/*
 		 * Did we write the wrong # entries in the header?
@@ -793,6 +1164,8 @@ static void write_pack_file(void)
 			finish_tmp_packfile(tmpname, pack_tmp_name,
 					    written_list, nr_written,
 					    &pack_idx_opts, sha1);
+			if (write_bitmap)
+				write_pack_bitmap(tmpname);
 			free(pack_tmp_name);
 			puts(sha1_to_hex(sha1));
 		}
@@ -924,6 +1297,9 @@ static int add_object_entry(const unsigned char *sha1, enum object_type type,
 	if (!exclude && local && has_loose_object_nonlocal(sha1))
 		return 0;
 
+	if (reuse_packfile && bitmap_reused_object(sha1))
+		return 0;
+
 	for (p = packed_git; p; p = p->next) {
 		off_t offset = find_pack_entry_one(sha1, p);
 		if (offset) {
@@ -943,6 +1319,8 @@ static int add_object_entry(const unsigned char *sha1, enum object_type type,
 				return 0;
 			if (ignore_packed_keep && p->pack_local && p->pack_keep)
 				return 0;
+			if (ignore_packed_keep_in_core && p->pack_keep_in_core)
+				return 0;
 		}
 	}
 
@@ -1251,6 +1629,30 @@ static void cleanup_preferred_base(void)
 	done_pbase_paths_num = done_pbase_paths_alloc = 0;
 }
 
+/*
+ * check_object() may run in several threads at once, see
+ * get_object_details(); the pack windows, the revindex and the rest
+ * of the object store are shared, so access them under read_lock().
+ */
+static unsigned char *use_pack_locked(struct packed_git *p,
+				      struct pack_window **w_curs,
+				      off_t offset, unsigned long *left)
+{
+	unsigned char *buf;
+
+	read_lock();
+	buf = use_pack(p, w_curs, offset, left);
+	read_unlock();
+	return buf;
+}
+
+static void unuse_pack_locked(struct pack_window **w_curs)
+{
+	read_lock();
+	unuse_pack(w_curs);
+	read_unlock();
+}
+
 static void check_object(struct object_entry *entry)
 {
 	if (entry->in_pack) {
@@ -1263,7 +1665,7 @@ static void check_object(struct object_entry *entry)
 		off_t ofs;
 		unsigned char *buf, c;
 
-		buf = use_pack(p, &w_curs, entry->in_pack_offset, &avail);
+		buf = use_pack_locked(p, &w_curs, entry->in_pack_offset, &avail);
 
 		/*
 		 * We want in_pack_type even if we do not reuse delta
@@ -1287,17 +1689,17 @@ static void check_object(struct object_entry *entry)
 			entry->in_pack_header_size = used;
 			if (entry->type < OBJ_COMMIT || entry->type > OBJ_BLOB)
 				goto give_up;
-			unuse_pack(&w_curs);
+			unuse_pack_locked(&w_curs);
 			return;
 		case OBJ_REF_DELTA:
 			if (reuse_delta && !entry->preferred_base)
-				base_ref = use_pack(p, &w_curs,
+				base_ref = use_pack_locked(p, &w_curs,
 						entry->in_pack_offset + used, NULL);
 			entry->in_pack_header_size = used + 20;
 			break;
 		case OBJ_OFS_DELTA:
-			buf = use_pack(p, &w_curs,
-				       entry->in_pack_offset + used, NULL);
+			buf = use_pack_locked(p, &w_curs,
+					      entry->in_pack_offset + used, NULL);
 			used_0 = 0;
 			c = buf[used_0++];
 			ofs = c & 127;
@@ -1318,17 +1720,24 @@ static void check_object(struct object_entry *entry)
 				goto give_up;
 			}
 			if (reuse_delta && !entry->preferred_base) {
-				struct revindex_entry *revidx;
-				revidx = find_pack_revindex(p, ofs);
-				if (!revidx)
+				uint32_t pos;
+				int ret;
+				read_lock();
+				ret = offset_to_pack_pos(p, ofs, &pos);
+				if (!ret)
+					pos = pack_pos_to_index(p, pos);
+				read_unlock();
+				if (ret)
 					goto give_up;
-				base_ref = nth_packed_object_sha1(p, revidx->nr);
+				base_ref = nth_packed_object_sha1(p, pos);
 			}
 			entry->in_pack_header_size = used + used_0;
 			break;
 		}
 
-		if (base_ref && (base_entry = locate_object_entry(base_ref))) {
+		if (base_ref && (base_entry = locate_object_entry(base_ref)) &&
+		    (!use_delta_islands ||
+		     in_same_island(entry->idx.sha1, base_entry->idx.sha1))) {
 			/*
 			 * If base_ref was set above that means we wish to
 			 * reuse delta data, and we even found that base
@@ -1338,13 +1747,14 @@ static void check_object(struct object_entry *entry)
 			 * never consider reused delta as the base object to
 			 * deltify other objects against, in order to avoid
 			 * circular deltas.
+			 *
+			 * The caller links the entry into delta_child list
+			 * of its base.
 			 */
 			entry->type = entry->in_pack_type;
 			entry->delta = base_entry;
 			entry->delta_size = entry->size;
-			entry->delta_sibling = base_entry->delta_child;
-			base_entry->delta_child = entry;
-			unuse_pack(&w_curs);
+			unuse_pack_locked(&w_curs);
 			return;
 		}
 
@@ -1354,11 +1764,13 @@ static void check_object(struct object_entry *entry)
 			 * final object type is.  Let's extract the actual
 			 * object size from the delta header.
 			 */
+			read_lock();
 			entry->size = get_size_from_delta(p, &w_curs,
 					entry->in_pack_offset + entry->in_pack_header_size);
+			read_unlock();
 			if (entry->size == 0)
 				goto give_up;
-			unuse_pack(&w_curs);
+			unuse_pack_locked(&w_curs);
 			return;
 		}
 
@@ -1368,10 +1780,12 @@ static void check_object(struct object_entry *entry)
 		 * at this point...
 		 */
 		give_up:
-		unuse_pack(&w_curs);
+		unuse_pack_locked(&w_curs);
 	}
 
+	read_lock();
 	entry->type = sha1_object_info(entry->idx.sha1, &entry->size);
+	read_unlock();
 	/*
 	 * The error condition is checked in prepare_pack().  This is
 	 * to permit a missing preferred base object to be ignored
@@ -1397,6 +1811,83 @@ static int pack_offset_sort(const void *_a, const void *_b)
 			(a->in_pack_offset > b->in_pack_offset);
 }
 
+static void check_objects(struct object_entry **list, uint32_t nr)
+{
+	uint32_t i;
+
+	for (i = 0; i < nr; i++) {
+		struct object_entry *entry = list[i];
+		check_object(entry);
+		if (big_file_threshold < entry->size)
+			entry->no_try_delta = 1;
+	}
+}
+
+#ifndef NO_PTHREADS
+
+/*
+ * Looking at the pack header of each object is mostly waiting for
+ * the pack data to be paged in, which several threads can do at once.
+ */
+#define OBJECTS_PER_DETAILS_THREAD 1024
+
+struct details_thread {
+	pthread_t thread;
+	struct object_entry **list;
+	uint32_t nr;
+};
+
+static void *threaded_check_objects(void *arg)
+{
+	struct details_thread *me = arg;
+	check_objects(me->list, me->nr);
+	return NULL;
+}
+
+static void ll_check_objects(struct object_entry **list, uint32_t nr)
+{
+	struct details_thread *p;
+	int i, ret, nr_threads;
+
+	init_threaded_search();
+
+	if (!delta_search_threads)	/* --threads=0 means autodetect */
+		delta_search_threads = online_cpus();
+	nr_threads = delta_search_threads;
+	if (nr_threads > nr / OBJECTS_PER_DETAILS_THREAD)
+		nr_threads = nr / OBJECTS_PER_DETAILS_THREAD;
+	if (nr_threads <= 1) {
+		check_objects(list, nr);
+		cleanup_threaded_search();
+		return;
+	}
+
+	p = xcalloc(nr_threads, sizeof(*p));
+	/*
+	 * Give each thread a contiguous range of the list, so that
+	 * it walks its part of a pack front to back.
+	 */
+	for (i = 0; i < nr_threads; i++) {
+		uint32_t sub_size = nr / (nr_threads - i);
+		p[i].list = list;
+		p[i].nr = sub_size;
+		list += sub_size;
+		nr -= sub_size;
+		ret = pthread_create(&p[i].thread, NULL,
+				     threaded_check_objects, &p[i]);
+		if (ret)
+			die("unable to create thread: %s", strerror(ret));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(p[i].thread, NULL);
+	free(p);
+	cleanup_threaded_search();
+}
+
+#else
+#define ll_check_objects check_objects
+#endif
+
 static void get_object_details(void)
 {
 	uint32_t i;
@@ -1407,11 +1898,18 @@ static void get_object_details(void)
 		sorted_by_offset[i] = objects + i;
 	qsort(sorted_by_offset, nr_objects, sizeof(*sorted_by_offset), pack_offset_sort);
 
+	ll_check_objects(sorted_by_offset, nr_objects);
+
+	/*
+	 * Link the reused deltas to their bases only now, in the same
+	 * order whether or not the objects were looked at in threads.
+	 */
 	for (i = 0; i < nr_objects; i++) {
 		struct object_entry *entry = sorted_by_offset[i];
-		check_object(entry);
-		if (big_file_threshold < entry->size)
-			entry->no_try_delta = 1;
+		if (entry->delta) {
+			entry->delta_sibling = entry->delta->delta_child;
+			entry->delta->delta_child = entry;
+		}
 	}
 
 	free(sorted_by_offset);
@@ -1443,6 +1941,11 @@ static int type_size_sort(const void *_a, const void *_b)
 		return -1;
 	if (a->preferred_base < b->preferred_base)
 		return 1;
+	if (use_delta_islands) {
+		int cmp = island_delta_cmp(a->idx.sha1, b->idx.sha1);
+		if (cmp)
+			return cmp;
+	}
 	if (a->size > b->size)
 		return -1;
 	if (a->size < b->size)
@@ -1473,31 +1976,6 @@ static int delta_cacheable(unsigned long src_size, unsigned long trg_size,
 	return 0;
 }
 
-#ifndef NO_PTHREADS
-
-static pthread_mutex_t read_mutex;
-#define read_lock()		pthread_mutex_lock(&read_mutex)
-#define read_unlock()		pthread_mutex_unlock(&read_mutex)
-
-static pthread_mutex_t cache_mutex;
-#define cache_lock()		pthread_mutex_lock(&cache_mutex)
-#define cache_unlock()		pthread_mutex_unlock(&cache_mutex)
-
-static pthread_mutex_t progress_mutex;
-#define progress_lock()		pthread_mutex_lock(&progress_mutex)
-#define progress_unlock()	pthread_mutex_unlock(&progress_mutex)
-
-#else
-
-#define read_lock()		(void)0
-#define read_unlock()		(void)0
-#define cache_lock()		(void)0
-#define cache_unlock()		(void)0
-#define progress_lock()		(void)0
-#define progress_unlock()	(void)0
-
-#endif
-
 static int try_delta(struct unpacked *trg, struct unpacked *src,
 		     unsigned max_depth, unsigned long *mem_usage)
 {
@@ -1512,6 +1990,14 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	if (trg_entry->type != src_entry->type)
 		return -1;
 
+	/*
+	 * Nor against a base that some of the islands of the target
+	 * cannot reach: a pack for such an island could not reuse it.
+	 */
+	if (use_delta_islands &&
+	    !in_same_island(trg_entry->idx.sha1, src_entry->idx.sha1))
+		return -1;
+
 	/*
 	 * We do not bother to try a delta that we discarded on an
 	 * earlier try, but only when reusing delta data.  Note that
@@ -2033,7 +2519,8 @@ static int add_ref_tag(const char *path, const unsigned char *sha1, int flag, vo
 
 	if (!prefixcmp(path, "refs/tags/") && /* is a tag? */
 	    !peel_ref(path, peeled)        && /* peelable? */
-	    locate_object_entry(peeled))      /* object packed? */
+	    (locate_object_entry(peeled) ||   /* object packed? */
+	     (reuse_packfile && bitmap_reused_object(peeled))))
 		add_object_entry(sha1, OBJ_TAG, NULL, 0);
 	return 0;
 }
@@ -2111,6 +2598,8 @@ static void prepare_pack(int window, int depth)
 
 static int git_pack_config(const char *k, const char *v, void *cb)
 {
+	if (!strcmp(k, "pack.island"))
+		return island_config_callback(k, v, cb);
 	if (!strcmp(k, "pack.window")) {
 		window = git_config_int(k, v);
 		return 0;
@@ -2152,6 +2641,18 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 #endif
 		return 0;
 	}
+	if (!strcmp(k, "pack.usebitmaps")) {
+		use_bitmap_index = git_config_bool(k, v);
+		return 0;
+	}
+	if (!strcmp(k, "pack.allowpackreuse")) {
+		allow_pack_reuse = git_config_bool(k, v);
+		return 0;
+	}
+	if (!strcmp(k, "pack.writebitmaps")) {
+		write_bitmap = git_config_bool(k, v);
+		return 0;
+	}
 	if (!strcmp(k, "pack.indexversion")) {
 		pack_idx_opts.version = git_config_int(k, v);
 		if (pack_idx_opts.version > 2)
@@ -2159,6 +2660,13 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 			    pack_idx_opts.version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		if (git_config_bool(k, v))
+			pack_idx_opts.flags |= WRITE_REV;
+		else
+			pack_idx_opts.flags &= ~WRITE_REV;
+		return 0;
+	}
 	return git_default_config(k, v, cb);
 }
 
@@ -2199,6 +2707,9 @@ static void show_commit(struct commit *commit, void *data)
 {
 	add_object_entry(commit->object.sha1, OBJ_COMMIT, NULL, 0);
 	commit->object.flags |= OBJECT_ADDED;
+
+	if (use_delta_islands)
+		propagate_island_marks(commit);
 }
 
 static void show_object(struct object *obj,
@@ -2211,6 +2722,20 @@ static void show_object(struct object *obj,
 	add_object_entry(obj->sha1, obj->type, name, 0);
 	obj->flags |= OBJECT_ADDED;
 
+	if (use_delta_islands && obj->type == OBJ_TREE) {
+		struct object_entry *entry = locate_object_entry(obj->sha1);
+		unsigned depth = 0;
+		const char *p;
+
+		for (p = name; *p; p++)
+			if (*p == '/')
+				depth++;
+		if (*name)
+			depth++;
+		if (entry && entry->tree_depth < depth)
+			entry->tree_depth = depth;
+	}
+
 	/*
 	 * We will have generated the hash from the name,
 	 * but not saved a pointer to it - we can free it
@@ -2349,6 +2874,142 @@ static void loosen_unused_packed_objects(struct rev_info *revs)
 	}
 }
 
+static const char *pack_basename(struct packed_git *p)
+{
+	const char *slash = strrchr(p->pack_name, '/');
+	return slash ? slash + 1 : p->pack_name;
+}
+
+/*
+ * Read "pack-<sha1>.pack" names from the standard input, one per
+ * line.  Objects in the named packs are packed, unless they also
+ * appear in a pack whose name was given with a leading '^'.  No
+ * history is walked, so the objects are added in the order they
+ * appear in their packs, like add_objects_in_unpacked_packs() does.
+ */
+static void read_packs_list_from_stdin(void)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct packed_git *p, **include = NULL;
+	int nr_include = 0, alloc_include = 0, j;
+	struct in_pack in_pack;
+	uint32_t i;
+
+	while (strbuf_getline(&buf, stdin, '\n') != EOF) {
+		const char *name = buf.buf;
+		int exclude = 0;
+
+		if (!buf.len)
+			continue;
+		if (*name == '^') {
+			exclude = 1;
+			name++;
+		}
+		for (p = packed_git; p; p = p->next)
+			if (!strcmp(pack_basename(p), name))
+				break;
+		if (!p)
+			die("could not find pack '%s'", name);
+		if (exclude) {
+			p->pack_keep_in_core = 1;
+		} else {
+			ALLOC_GROW(include, nr_include + 1, alloc_include);
+			include[nr_include++] = p;
+		}
+	}
+	strbuf_release(&buf);
+
+	memset(&in_pack, 0, sizeof(in_pack));
+
+	for (j = 0; j < nr_include; j++) {
+		p = include[j];
+		if (p->pack_keep_in_core)
+			continue;
+		if (open_pack_index(p))
+			die("cannot open pack index");
+
+		ALLOC_GROW(in_pack.array,
+			   in_pack.nr + p->num_objects,
+			   in_pack.alloc);
+
+		for (i = 0; i < p->num_objects; i++) {
+			const unsigned char *sha1 = nth_packed_object_sha1(p, i);
+			struct object *o = lookup_unknown_object(sha1);
+			if (!(o->flags & OBJECT_ADDED))
+				mark_in_pack_object(o, p, &in_pack);
+			o->flags |= OBJECT_ADDED;
+		}
+	}
+
+	if (in_pack.nr) {
+		qsort(in_pack.array, in_pack.nr, sizeof(in_pack.array[0]),
+		      ofscmp);
+		for (i = 0; i < in_pack.nr; i++) {
+			struct object *o = in_pack.array[i].object;
+			add_object_entry(o->sha1, o->type, "", 0);
+		}
+	}
+	free(in_pack.array);
+	free(include);
+}
+
+static void add_loose_object_entry(const unsigned char *sha1, void *data)
+{
+	add_object_entry(sha1, 0, "", 0);
+}
+
+static void add_loose_objects(void)
+{
+	int i;
+
+	for (i = 0; i < 256; i++)
+		sha1_array_for_each_unique(odb_loose_cache(NULL, i),
+					   add_loose_object_entry, NULL);
+}
+
+static void add_object_entry_from_bitmap(const unsigned char *sha1,
+					 enum object_type type,
+					 struct packed_git *found_pack,
+					 off_t found_offset)
+{
+	add_object_entry(sha1, type, NULL, 0);
+}
+
+static int tree_depth_sort(const void *_a, const void *_b)
+{
+	const struct object_entry *a = *(struct object_entry **)_a;
+	const struct object_entry *b = *(struct object_entry **)_b;
+
+	if (a->tree_depth != b->tree_depth)
+		return a->tree_depth < b->tree_depth ? -1 : 1;
+	return a < b ? -1 : (a > b);
+}
+
+/*
+ * A tree is always deeper than the trees containing it, so passing
+ * island marks down trees sorted by depth reaches every entry.
+ */
+static void resolve_tree_islands_of_entries(void)
+{
+	struct object_entry **list;
+	struct tree **trees;
+	uint32_t i, nr = 0;
+
+	list = xmalloc(nr_objects * sizeof(*list));
+	for (i = 0; i < nr_objects; i++)
+		if (objects[i].type == OBJ_TREE)
+			list[nr++] = objects + i;
+	qsort(list, nr, sizeof(*list), tree_depth_sort);
+
+	trees = xmalloc(nr * sizeof(*trees));
+	for (i = 0; i < nr; i++)
+		trees[i] = lookup_tree(list[i]->idx.sha1);
+	resolve_tree_islands(trees, nr);
+
+	free(trees);
+	free(list);
+}
+
 static void get_object_list(int ac, const char **av)
 {
 	struct rev_info revs;
@@ -2376,11 +3037,31 @@ static void get_object_list(int ac, const char **av)
 			die("bad revision '%s'", line);
 	}
 
+	if (use_bitmap_index && !prepare_bitmap_walk(&revs)) {
+		/*
+		 * The client must understand OFS_DELTA, which is what the
+		 * deltas we copy along with the objects refer to.
+		 */
+		if (allow_pack_reuse && allow_ofs_delta && reuse_delta &&
+		    !reuse_partial_packfile_from_bitmap(&reuse_packfile,
+							&reuse_packfile_objects,
+							&reuse_packfile_offset))
+			nr_result += reuse_packfile_objects;
+		traverse_bitmap_commit_list(add_object_entry_from_bitmap);
+		return;
+	}
+
+	if (use_delta_islands)
+		load_delta_islands();
+
 	if (prepare_revision_walk(&revs))
 		die("revision walk setup failed");
 	mark_edges_uninteresting(revs.commits, &revs, show_edge);
 	traverse_commit_list(&revs, show_commit, show_object, NULL);
 
+	if (use_delta_islands)
+		resolve_tree_islands_of_entries();
+
 	if (keep_unreachable)
 		add_objects_in_unpacked_packs(&revs);
 	if (unpack_unreachable)
@@ -2437,9 +3118,10 @@ static int option_parse_ulong(const struct option *opt,
 int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 {
 	int use_internal_rev_list = 0;
+	int stdin_packs = 0;
 	int thin = 0;
 	int all_progress_implied = 0;
-	const char *rp_av[6];
+	const char *rp_av[7];
 	int rp_ac = 0;
 	int rev_list_unpacked = 0, rev_list_all = 0, rev_list_reflog = 0;
 	struct option pack_objects_options[] = {
@@ -2479,6 +3161,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			 N_("do not create an empty pack output")),
 		OPT_BOOL(0, "revs", &use_internal_rev_list,
 			 N_("read revision arguments from standard input")),
+		OPT_BOOL(0, "stdin-packs", &stdin_packs,
+			 N_("read packs from stdin whose objects are packed")),
 		{ OPTION_SET_INT, 0, "unpacked", &rev_list_unpacked, NULL,
 		  N_("limit the objects to those that are not yet packed"),
 		  PARSE_OPT_NOARG | PARSE_OPT_NONEG, NULL, 1 },
@@ -2505,6 +3189,12 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			    N_("pack compression level")),
 		OPT_SET_INT(0, "keep-true-parents", &grafts_replace_parents,
 			    N_("do not hide commits by grafts"), 0),
+		OPT_BOOL(0, "use-bitmap-index", &use_bitmap_index,
+			 N_("use a bitmap index if available to speed up counting objects")),
+		OPT_BOOL(0, "write-bitmap-index", &write_bitmap,
+			 N_("write a bitmap index together with the pack index")),
+		OPT_BOOL(0, "delta-islands", &use_delta_islands,
+			 N_("respect islands during delta compression")),
 		OPT_END(),
 	};
 
@@ -2541,10 +3231,13 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		use_internal_rev_list = 1;
 		rp_av[rp_ac++] = "--reflog";
 	}
-	if (rev_list_unpacked) {
+	if (rev_list_unpacked && !stdin_packs) {
 		use_internal_rev_list = 1;
 		rp_av[rp_ac++] = "--unpacked";
 	}
+	/* see children before their parents, to pass island marks down */
+	if (use_delta_islands)
+		rp_av[rp_ac++] = "--topo-order";
 
 	if (!reuse_object)
 		reuse_delta = 0;
@@ -2571,14 +3264,35 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (keep_unreachable && unpack_unreachable)
 		die("--keep-unreachable and --unpack-unreachable are incompatible.");
 
+	if (stdin_packs && (use_internal_rev_list || keep_unreachable ||
+			    unpack_unreachable))
+		die("--stdin-packs cannot be used with a revision walk.");
+
 	if (progress && all_progress_implied)
 		progress = 2;
 
+	/*
+	 * The bitmaps only know about reachability within a single pack;
+	 * anything that filters by where an object is stored, or packs
+	 * for anything but a transfer, has to walk the history.
+	 */
+	if (!pack_to_stdout || rev_list_unpacked || rev_list_reflog ||
+	    keep_unreachable || unpack_unreachable || local || incremental ||
+	    ignore_packed_keep)
+		use_bitmap_index = 0;
+	if (pack_to_stdout || stdin_packs)
+		write_bitmap = 0;
+
 	prepare_packed_git();
 
 	if (progress)
 		progress_state = start_progress("Counting objects", 0);
-	if (!use_internal_rev_list)
+	if (stdin_packs) {
+		ignore_packed_keep_in_core = 1;
+		read_packs_list_from_stdin();
+		if (rev_list_unpacked)
+			add_loose_objects();
+	} else if (!use_internal_rev_list)
 		read_object_list_from_stdin();
 	else {
 		rp_av[rp_ac] = NULL;
@@ -2591,7 +3305,7 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 
 	if (non_empty && !nr_result)
 		return 0;
-	if (nr_result)
+	if (nr_result > reuse_packfile_objects)
 		prepare_pack(window, depth);
 	write_pack_file();
 	if (progress)
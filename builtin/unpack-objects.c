@@ -299,10 +299,109 @@ static void added_object(unsigned nr, enum object_type type,
 	}
 }
 
+struct input_zstream_data {
+	git_zstream *zstream;
+	unsigned char buf[8192];
+	int status;
+};
+
+static const void *feed_input_zstream(struct input_stream *in_stream,
+				      unsigned long *readlen)
+{
+	struct input_zstream_data *data = in_stream->data;
+	git_zstream *zstream = data->zstream;
+
+	if (in_stream->is_finished) {
+		*readlen = 0;
+		return NULL;
+	}
+	zstream->next_out = data->buf;
+	zstream->avail_out = sizeof(data->buf);
+	zstream->next_in = fill(1);
+	zstream->avail_in = len;
+	data->status = git_inflate(zstream, 0);
+	in_stream->is_finished = data->status != Z_OK;
+	use(len - zstream->avail_in);
+	*readlen = sizeof(data->buf) - zstream->avail_out;
+	return data->buf;
+}
+
+/* Is an unresolved delta waiting for the nr-th object as its base? */
+static int has_delta_for(unsigned nr)
+{
+	struct delta_info *info;
+
+	for (info = delta_list; info; info = info->next)
+		if (!hashcmp(info->base_sha1, obj_list[nr].sha1) ||
+		    info->base_offset == obj_list[nr].offset)
+			return 1;
+	return 0;
+}
+
+/*
+ * Large blobs are inflated and written out piecewise instead of
+ * being held in core.  Deltas against them, which pack-objects does
+ * not make, read them back from the object store.
+ */
+static void stream_blob(unsigned long size, unsigned nr)
+{
+	git_zstream zstream;
+	struct input_zstream_data data;
+	struct input_stream in_stream = {
+		feed_input_zstream,
+		&data,
+		0,
+	};
+
+	memset(&zstream, 0, sizeof(zstream));
+	memset(&data, 0, sizeof(data));
+	data.zstream = &zstream;
+	git_inflate_init(&zstream);
+
+	if (dry_run) {
+		unsigned long readlen;
+		while (!in_stream.is_finished)
+			feed_input_zstream(&in_stream, &readlen);
+	} else if (stream_loose_object(&in_stream, size, obj_list[nr].sha1))
+		die("failed to write object in stream");
+	if (data.status != Z_STREAM_END || zstream.total_out != size)
+		die("inflate returned %d", data.status);
+	git_inflate_end(&zstream);
+	if (dry_run)
+		return;
+
+	if (strict) {
+		struct blob *blob = lookup_blob(obj_list[nr].sha1);
+		if (blob)
+			blob->object.flags |= FLAG_WRITTEN;
+		else
+			die("invalid blob object");
+	}
+	obj_list[nr].obj = NULL;
+
+	if (has_delta_for(nr)) {
+		enum object_type type;
+		unsigned long base_size;
+		void *base = read_sha1_file(obj_list[nr].sha1, &type, &base_size);
+		if (!base)
+			die("failed to read object %s",
+			    sha1_to_hex(obj_list[nr].sha1));
+		added_object(nr, type, base, base_size);
+		free(base);
+	}
+}
+
 static void unpack_non_delta_entry(enum object_type type, unsigned long size,
 				   unsigned nr)
 {
-	void *buf = get_data(size);
+	void *buf;
+
+	if (type == OBJ_BLOB && size > big_file_threshold) {
+		stream_blob(size, nr);
+		return;
+	}
+
+	buf = get_data(size);
 
 	if (!dry_run && buf)
 		write_object(nr, type, buf, size);
@@ -2,23 +2,219 @@
 #include "refs.h"
 #include "builtin.h"
 #include "parse-options.h"
+#include "quote.h"
 
 static const char * const git_update_ref_usage[] = {
 	N_("git update-ref [options] -d <refname> [<oldval>]"),
 	N_("git update-ref [options]    <refname> <newval> [<oldval>]"),
+	N_("git update-ref [options] --stdin [-z]"),
 	NULL
 };
 
+static struct ref_transaction *transaction;
+static int update_flags;
+static int line_termination = '\n';
+
+/*
+ * Parse one argument starting at next, which ends at whitespace or
+ * is C-quoted, into arg.  Return a pointer past it.  Only used
+ * without -z.
+ */
+static const char *parse_arg(const char *next, struct strbuf *arg)
+{
+	if (*next == '"') {
+		const char *orig = next;
+		if (unquote_c_style(arg, next, &next))
+			die("badly quoted argument: %s", orig);
+		if (*next && !isspace(*next))
+			die("unexpected character after quoted argument: %s", orig);
+		return next;
+	}
+	while (*next && !isspace(*next))
+		strbuf_addch(arg, *next++);
+	return next;
+}
+
+/*
+ * Read the next argument of a command into arg, from the rest of the
+ * command line at *next or, with -z, as the next NUL-terminated field
+ * of the input.  Return 1 if a command line has no more arguments.
+ */
+static int next_arg(const char **next, struct strbuf *arg)
+{
+	strbuf_reset(arg);
+	if (!line_termination) {
+		if (strbuf_getline(arg, stdin, '\0') == EOF)
+			die("unexpected end of input");
+		return 0;
+	}
+	if (!**next)
+		return 1;
+	if (**next != ' ')
+		die("expected SP but got: %s", *next);
+	*next = parse_arg(*next + 1, arg);
+	return 0;
+}
+
+/* The <ref> right after "<command> SP", which is checked for validity. */
+static char *parse_refname(const char *command, const char **next)
+{
+	struct strbuf ref = STRBUF_INIT;
+
+	if (line_termination)
+		*next = parse_arg(*next, &ref);
+	else {
+		strbuf_addstr(&ref, *next);
+		*next += ref.len;
+	}
+	if (!ref.len)
+		die("%s: missing <ref>", command);
+	if (check_refname_format(ref.buf, REFNAME_ALLOW_ONELEVEL))
+		die("%s: invalid ref format: %s", command, ref.buf);
+	return strbuf_detach(&ref, NULL);
+}
+
+/*
+ * Parse the next argument as an object name into sha1; an empty one
+ * is the null sha1.  Return 1 if it is missing, which with -z is
+ * spelled as an empty field.
+ */
+static int parse_next_sha1(const char **next, unsigned char *sha1,
+			   const char *command, const char *refname,
+			   const char *what)
+{
+	struct strbuf arg = STRBUF_INIT;
+	int missing = next_arg(next, &arg);
+
+	if (!missing && !arg.len && !line_termination)
+		missing = 1;
+	if (missing || !arg.len)
+		hashclr(sha1);
+	else if (get_sha1(arg.buf, sha1))
+		die("%s %s: invalid %s: %s", command, refname, what, arg.buf);
+	strbuf_release(&arg);
+	return missing;
+}
+
+static void parse_end(const char *command, const char *refname,
+		      const char *next)
+{
+	if (*next)
+		die("%s %s: extra input: %s", command, refname, next);
+}
+
+static void parse_cmd_update(const char *next)
+{
+	unsigned char new_sha1[20], old_sha1[20];
+	char *refname = parse_refname("update", &next);
+	int have_old;
+
+	if (parse_next_sha1(&next, new_sha1, "update", refname, "<newvalue>"))
+		die("update %s: missing <newvalue>", refname);
+	have_old = !parse_next_sha1(&next, old_sha1, "update", refname,
+				    "<oldvalue>");
+	parse_end("update", refname, next);
+
+	ref_transaction_update(transaction, refname, new_sha1, old_sha1,
+			       update_flags, have_old);
+	update_flags = 0;
+	free(refname);
+}
+
+static void parse_cmd_create(const char *next)
+{
+	unsigned char new_sha1[20];
+	char *refname = parse_refname("create", &next);
+
+	if (parse_next_sha1(&next, new_sha1, "create", refname, "<newvalue>"))
+		die("create %s: missing <newvalue>", refname);
+	if (is_null_sha1(new_sha1))
+		die("create %s: zero <newvalue>", refname);
+	parse_end("create", refname, next);
+
+	ref_transaction_create(transaction, refname, new_sha1, update_flags);
+	update_flags = 0;
+	free(refname);
+}
+
+static void parse_cmd_delete(const char *next)
+{
+	unsigned char old_sha1[20];
+	char *refname = parse_refname("delete", &next);
+	int have_old;
+
+	have_old = !parse_next_sha1(&next, old_sha1, "delete", refname,
+				    "<oldvalue>");
+	if (have_old && is_null_sha1(old_sha1))
+		die("delete %s: zero <oldvalue>", refname);
+	parse_end("delete", refname, next);
+
+	ref_transaction_delete(transaction, refname, old_sha1,
+			       update_flags, have_old);
+	update_flags = 0;
+	free(refname);
+}
+
+static void parse_cmd_verify(const char *next)
+{
+	unsigned char old_sha1[20];
+	char *refname = parse_refname("verify", &next);
+
+	/* a missing <oldvalue> means the ref must not exist */
+	parse_next_sha1(&next, old_sha1, "verify", refname, "<oldvalue>");
+	parse_end("verify", refname, next);
+
+	ref_transaction_update(transaction, refname, old_sha1, old_sha1,
+			       update_flags, 1);
+	update_flags = 0;
+	free(refname);
+}
+
+static void parse_cmd_option(const char *next)
+{
+	if (!strcmp(next, "no-deref"))
+		update_flags |= REF_NODEREF;
+	else
+		die("option unknown: %s", next);
+}
+
+static void update_refs_stdin(void)
+{
+	struct strbuf cmd = STRBUF_INIT;
+
+	while (strbuf_getline(&cmd, stdin, line_termination) != EOF) {
+		if (!cmd.buf[0])
+			die("empty command in input");
+		else if (isspace(cmd.buf[0]))
+			die("whitespace before command: %s", cmd.buf);
+		else if (!prefixcmp(cmd.buf, "update "))
+			parse_cmd_update(cmd.buf + 7);
+		else if (!prefixcmp(cmd.buf, "create "))
+			parse_cmd_create(cmd.buf + 7);
+		else if (!prefixcmp(cmd.buf, "delete "))
+			parse_cmd_delete(cmd.buf + 7);
+		else if (!prefixcmp(cmd.buf, "verify "))
+			parse_cmd_verify(cmd.buf + 7);
+		else if (!prefixcmp(cmd.buf, "option "))
+			parse_cmd_option(cmd.buf + 7);
+		else
+			die("unknown command: %s", cmd.buf);
+	}
+	strbuf_release(&cmd);
+}
+
 int cmd_update_ref(int argc, const char **argv, const char *prefix)
 {
 	const char *refname, *oldval, *msg = NULL;
 	unsigned char sha1[20], oldsha1[20];
-	int delete = 0, no_deref = 0, flags = 0;
+	int delete = 0, no_deref = 0, read_stdin = 0, end_null = 0, flags = 0;
 	struct option options[] = {
 		OPT_STRING( 'm', NULL, &msg, N_("reason"), N_("reason of the update")),
 		OPT_BOOLEAN('d', NULL, &delete, N_("delete the reference")),
 		OPT_BOOLEAN( 0 , "no-deref", &no_deref,
 					N_("update <refname> not the one it points to")),
+		OPT_BOOLEAN('z', NULL, &end_null, N_("stdin has NUL-terminated arguments")),
+		OPT_BOOLEAN( 0 , "stdin", &read_stdin, N_("read updates from stdin")),
 		OPT_END(),
 	};
 
@@ -28,6 +224,23 @@ int cmd_update_ref(int argc, const char **argv, const char *prefix)
 	if (msg && !*msg)
 		die("Refusing to perform update with empty message.");
 
+	if (read_stdin) {
+		int ret;
+
+		if (delete || no_deref || argc > 0)
+			usage_with_options(git_update_ref_usage, options);
+		if (end_null)
+			line_termination = '\0';
+		transaction = ref_transaction_begin();
+		update_refs_stdin();
+		ret = ref_transaction_commit(transaction, msg, DIE_ON_ERR);
+		ref_transaction_free(transaction);
+		return ret;
+	}
+
+	if (end_null)
+		usage_with_options(git_update_ref_usage, options);
+
 	if (delete) {
 		if (argc < 1 || argc > 2)
 			usage_with_options(git_update_ref_usage, options);
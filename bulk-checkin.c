@@ -4,9 +4,15 @@
 #include "bulk-checkin.h"
 #include "csum-file.h"
 #include "pack.h"
+#include "hash.h"
 
 static int pack_compression_level = Z_DEFAULT_COMPRESSION;
 
+struct written_object {
+	struct pack_idx_entry idx;	/* must be first */
+	struct written_object *next;	/* with the same hash */
+};
+
 static struct bulk_checkin_state {
 	unsigned plugged:1;
 
@@ -18,12 +24,39 @@ static struct bulk_checkin_state {
 	struct pack_idx_entry **written;
 	uint32_t alloc_written;
 	uint32_t nr_written;
+	struct hash_table written_hash;
 } state;
 
+static unsigned int written_hash(const unsigned char *sha1)
+{
+	unsigned int hash;
+	memcpy(&hash, sha1, sizeof(hash));
+	return hash;
+}
+
+static void add_written(struct bulk_checkin_state *state,
+			struct written_object *obj)
+{
+	void **pos;
+
+	ALLOC_GROW(state->written,
+		   state->nr_written + 1,
+		   state->alloc_written);
+	state->written[state->nr_written++] = &obj->idx;
+
+	pos = insert_hash(written_hash(obj->idx.sha1), obj,
+			  &state->written_hash);
+	if (pos) {
+		obj->next = *pos;
+		*pos = obj;
+	}
+}
+
 static void finish_bulk_checkin(struct bulk_checkin_state *state)
 {
 	unsigned char sha1[20];
 	char packname[PATH_MAX];
+	unsigned plugged = state->plugged;
 	int i;
 
 	if (!state->f)
@@ -52,7 +85,9 @@ static void finish_bulk_checkin(struct bulk_checkin_state *state)
 
 clear_exit:
 	free(state->written);
+	free_hash(&state->written_hash);
 	memset(state, 0, sizeof(*state));
+	state->plugged = plugged;
 
 	/* Make objects we just wrote available to ourselves */
 	reprepare_packed_git();
@@ -60,15 +95,15 @@ clear_exit:
 
 static int already_written(struct bulk_checkin_state *state, unsigned char sha1[])
 {
-	int i;
+	struct written_object *obj;
 
 	/* The object may already exist in the repository */
 	if (has_sha1_file(sha1))
 		return 1;
 
-	/* Might want to keep the list sorted */
-	for (i = 0; i < state->nr_written; i++)
-		if (!hashcmp(state->written[i]->sha1, sha1))
+	obj = lookup_hash(written_hash(sha1), &state->written_hash);
+	for (; obj; obj = obj->next)
+		if (!hashcmp(obj->idx.sha1, sha1))
 			return 1;
 
 	/* This is a new object we need to keep */
@@ -192,6 +227,7 @@ static int deflate_to_pack(struct bulk_checkin_state *state,
 	unsigned char obuf[16384];
 	unsigned header_len;
 	struct sha1file_checkpoint checkpoint;
+	struct written_object *obj = NULL;
 	struct pack_idx_entry *idx = NULL;
 
 	seekback = lseek(fd, 0, SEEK_CUR);
@@ -204,8 +240,10 @@ static int deflate_to_pack(struct bulk_checkin_state *state,
 	git_SHA1_Update(&ctx, obuf, header_len);
 
 	/* Note: idx is non-NULL when we are writing */
-	if ((flags & HASH_WRITE_OBJECT) != 0)
-		idx = xcalloc(1, sizeof(*idx));
+	if ((flags & HASH_WRITE_OBJECT) != 0) {
+		obj = xcalloc(1, sizeof(*obj));
+		idx = &obj->idx;
+	}
 
 	already_hashed_to = 0;
 
@@ -240,17 +278,100 @@ static int deflate_to_pack(struct bulk_checkin_state *state,
 	if (already_written(state, result_sha1)) {
 		sha1file_truncate(state->f, &checkpoint);
 		state->offset = checkpoint.offset;
-		free(idx);
+		free(obj);
 	} else {
 		hashcpy(idx->sha1, result_sha1);
-		ALLOC_GROW(state->written,
-			   state->nr_written + 1,
-			   state->alloc_written);
-		state->written[state->nr_written++] = idx;
+		add_written(state, obj);
 	}
 	return 0;
 }
 
+/*
+ * Like stream_to_pack(), but deflate an object that is already in
+ * core, and whose name the caller has already computed.
+ */
+static int write_buf_to_pack(struct bulk_checkin_state *state,
+			     const void *buf, size_t size,
+			     enum object_type type)
+{
+	git_zstream s;
+	unsigned char obuf[16384];
+	unsigned hdrlen;
+	int status = Z_OK;
+
+	memset(&s, 0, sizeof(s));
+	git_deflate_init(&s, pack_compression_level);
+
+	hdrlen = encode_in_pack_object_header(type, size, obuf);
+	s.next_out = obuf + hdrlen;
+	s.avail_out = sizeof(obuf) - hdrlen;
+	s.next_in = (void *)buf;
+	s.avail_in = size;
+
+	while (status != Z_STREAM_END) {
+		status = git_deflate(&s, Z_FINISH);
+
+		if (!s.avail_out || status == Z_STREAM_END) {
+			size_t written = s.next_out - obuf;
+
+			/* would we bust the size limit? */
+			if (state->nr_written &&
+			    pack_size_limit_cfg &&
+			    pack_size_limit_cfg < state->offset + written) {
+				git_deflate_abort(&s);
+				return -1;
+			}
+
+			sha1write(state->f, obuf, written);
+			state->offset += written;
+			s.next_out = obuf;
+			s.avail_out = sizeof(obuf);
+		}
+
+		switch (status) {
+		case Z_OK:
+		case Z_BUF_ERROR:
+		case Z_STREAM_END:
+			continue;
+		default:
+			die("unexpected deflate failure: %d", status);
+		}
+	}
+	git_deflate_end(&s);
+	return 0;
+}
+
+static int deflate_buf_to_pack(struct bulk_checkin_state *state,
+			       unsigned char result_sha1[],
+			       const void *buf, size_t size,
+			       enum object_type type)
+{
+	struct sha1file_checkpoint checkpoint;
+	struct written_object *obj;
+
+	hash_sha1_file(buf, size, typename(type), result_sha1);
+	if (already_written(state, result_sha1))
+		return 0;
+
+	obj = xcalloc(1, sizeof(*obj));
+	while (1) {
+		prepare_to_stream(state, HASH_WRITE_OBJECT);
+		sha1file_checkpoint(state->f, &checkpoint);
+		obj->idx.offset = state->offset;
+		crc32_begin(state->f);
+		if (!write_buf_to_pack(state, buf, size, type))
+			break;
+		/* Too big for the current pack; start a new one */
+		sha1file_truncate(state->f, &checkpoint);
+		state->offset = checkpoint.offset;
+		finish_bulk_checkin(state);
+	}
+	obj->idx.crc32 = crc32_end(state->f);
+	hashcpy(obj->idx.sha1, result_sha1);
+	add_written(state, obj);
+	return 0;
+}
+
 int index_bulk_checkin(unsigned char *sha1,
 		       int fd, size_t size, enum object_type type,
 		       const char *path, unsigned flags)
@@ -262,6 +383,21 @@ int index_bulk_checkin(unsigned char *sha1,
 	return status;
 }
 
+int index_bulk_checkin_mem(unsigned char *sha1,
+			   const void *buf, size_t size,
+			   enum object_type type)
+{
+	int status = deflate_buf_to_pack(&state, sha1, buf, size, type);
+	if (!state.plugged)
+		finish_bulk_checkin(&state);
+	return status;
+}
+
+int bulk_checkin_all_objects(void)
+{
+	return state.plugged && core_bulk_checkin;
+}
+
 void plug_bulk_checkin(void)
 {
 	state.plugged = 1;
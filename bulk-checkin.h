@@ -10,6 +10,20 @@ extern int index_bulk_checkin(unsigned char sha1[],
 			      int fd, size_t size, enum object_type type,
 			      const char *path, unsigned flags);
 
+/*
+ * Write an object that is already in core to the pack, instead of
+ * as a loose object.
+ */
+extern int index_bulk_checkin_mem(unsigned char sha1[],
+				  const void *buf, size_t size,
+				  enum object_type type);
+
+/*
+ * True when objects of any size should go to the pack, which is
+ * while plugged with core.bulkCheckin; otherwise only large blobs do.
+ */
+extern int bulk_checkin_all_objects(void);
+
 extern void plug_bulk_checkin(void);
 extern void unplug_bulk_checkin(void);
 
@@ -41,6 +41,9 @@ int git_deflate_end_gently(git_zstream *);
 int git_deflate(git_zstream *, int flush);
 unsigned long git_deflate_bound(git_zstream *, unsigned long);
 
+/* zlib's crc32(), faster where the CPU helps */
+uint32_t git_crc32(uint32_t crc, const void *buf, unsigned long len);
+
 #if defined(DT_UNKNOWN) && !defined(NO_D_TYPE_IN_DIRENT)
 #define DTYPE(de)	((de)->d_type)
 #else
@@ -565,8 +568,13 @@ extern unsigned long big_file_threshold;
 extern unsigned long pack_size_limit_cfg;
 extern int read_replace_refs;
 extern int fsync_object_files;
+extern int core_bulk_checkin;
+extern int core_reflog_index;
 extern int core_preload_index;
 extern int core_apply_sparse_checkout;
+extern int core_commit_graph;
+extern int core_multi_pack_index;
+extern int core_loose_object_cache;
 extern int precomposed_unicode;
 
 /*
@@ -759,12 +767,39 @@ static inline const unsigned char *lookup_replace_object(const unsigned char *sh
 /* Read and unpack a sha1 file into memory, write memory to a sha1 file */
 extern int sha1_object_info(const unsigned char *, unsigned long *);
 extern int hash_sha1_file(const void *buf, unsigned long len, const char *type, unsigned char *sha1);
+
+struct hash_sha1_request {
+	const void *buf;
+	unsigned long len;
+	const char *type;
+	unsigned char *sha1;
+};
+/* Same as hash_sha1_file() on each of them, but hashes them side by side */
+extern void hash_sha1_files(struct hash_sha1_request *req, int nr);
 extern int write_sha1_file(const void *buf, unsigned long len, const char *type, unsigned char *return_sha1);
 extern int pretend_sha1_file(void *, unsigned long, enum object_type, unsigned char *);
 extern int force_object_loose(const unsigned char *sha1, time_t mtime);
+
+/*
+ * Source of the contents for stream_loose_object(): read() returns
+ * the next chunk and its length, and sets is_finished with the last.
+ */
+struct input_stream {
+	const void *(*read)(struct input_stream *, unsigned long *len);
+	void *data;
+	int is_finished;
+};
+
+/*
+ * Write a blob of "len" bytes as a loose object without holding its
+ * contents in core, and return its name in "sha1".
+ */
+extern int stream_loose_object(struct input_stream *in_stream,
+			       unsigned long len, unsigned char *sha1);
 extern void *map_sha1_file(const unsigned char *sha1, unsigned long *size);
 extern int unpack_sha1_header(git_zstream *stream, unsigned char *map, unsigned long mapsize, void *buffer, unsigned long bufsiz);
 extern int parse_sha1_header(const char *hdr, unsigned long *sizep);
+extern int read_loose_object(const char *path, enum object_type *type, unsigned long *size, void **contents);
 
 /* global flag to enable extra checks when accessing packed objects */
 extern int do_check_packed_object_crc;
@@ -969,6 +1004,7 @@ extern void remove_scheduled_dirs(void);
 
 extern struct alternate_object_database {
 	struct alternate_object_database *next;
+	struct loose_object_cache *loose_objects;
 	char *name;
 	char base[FLEX_ARRAY]; /* more */
 } *alt_odb_list;
@@ -978,6 +1014,21 @@ extern void add_to_alternates_file(const char *reference);
 typedef int alt_odb_fn(struct alternate_object_database *, void *);
 extern void foreach_alt_odb(alt_odb_fn, void*);
 
+/*
+ * With core.looseObjectCache, the loose objects whose names start
+ * with the byte "subdir_nr" in the object directory "odb" (or our own
+ * object directory if NULL), as read from the subdirectory once.
+ */
+struct sha1_array;
+extern struct sha1_array *odb_loose_cache(struct alternate_object_database *odb,
+					  int subdir_nr);
+/*
+ * Record a loose object we have just written to our own object
+ * directory, so that the cache of its subdirectory, if already read,
+ * stays accurate.
+ */
+extern void add_to_loose_object_cache(const unsigned char *sha1);
+
 struct pack_window {
 	struct pack_window *next;
 	unsigned char *base;
@@ -1001,7 +1052,9 @@ extern struct packed_git {
 	int pack_fd;
 	unsigned pack_local:1,
 		 pack_keep:1,
-		 do_not_close:1;
+		 pack_keep_in_core:1,	/* excluded by pack-objects --stdin-packs */
+		 do_not_close:1,
+		 multi_pack_index:1;	/* covered by a multi-pack-index */
 	unsigned char sha1[20];
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[FLEX_ARRAY]; /* more */
@@ -1087,7 +1140,9 @@ extern struct packed_git *add_packed_git(const char *, int, int);
 extern const unsigned char *nth_packed_object_sha1(struct packed_git *, uint32_t);
 extern off_t nth_packed_object_offset(const struct packed_git *, uint32_t);
 extern off_t find_pack_entry_one(const unsigned char *, struct packed_git *);
+extern int find_pack_entry_pos(const unsigned char *, struct packed_git *);
 extern int is_pack_valid(struct packed_git *);
+extern void mark_bad_packed_object(struct packed_git *, const unsigned char *);
 extern void *unpack_entry(struct packed_git *, off_t, enum object_type *, unsigned long *);
 extern unsigned long unpack_object_header_buffer(const unsigned char *buf, unsigned long len, enum object_type *type, unsigned long *sizep);
 extern unsigned long get_size_from_delta(struct packed_git *, struct pack_window **, off_t);
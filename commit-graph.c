@@ -0,0 +1,774 @@
+#include "cache.h"
+#include "commit.h"
+#include "commit-graph.h"
+#include "csum-file.h"
+#include "refs.h"
+#include "sha1-lookup.h"
+
+#define GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
+#define GRAPH_VERSION 1
+#define GRAPH_HASH_VERSION 1 /* SHA-1 */
+
+#define GRAPH_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define GRAPH_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define GRAPH_CHUNKID_DATA 0x43444154 /* "CDAT" */
+#define GRAPH_CHUNKID_LARGEEDGES 0x45444745 /* "EDGE" */
+
+#define GRAPH_HEADER_SIZE 8
+#define GRAPH_FANOUT_SIZE (4 * 256)
+#define GRAPH_CHUNKLOOKUP_WIDTH 12
+#define GRAPH_DATA_WIDTH 36
+#define GRAPH_MIN_SIZE (GRAPH_HEADER_SIZE + 4 * GRAPH_CHUNKLOOKUP_WIDTH + \
+			GRAPH_FANOUT_SIZE + 20)
+
+#define GRAPH_PARENT_NONE 0x70000000
+#define GRAPH_OCTOPUS_EDGES_NEEDED 0x80000000
+#define GRAPH_EDGE_LAST_MASK 0x7fffffff
+#define GRAPH_LAST_EDGE 0x80000000
+
+/* Used only while collecting the commits to write */
+#define GRAPH_SEEN (1u<<20)
+
+struct commit_graph {
+	const unsigned char *data;
+	size_t data_len;
+	uint32_t num_commits;
+	uint32_t num_large_edges;
+	const unsigned char *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_commit_data;
+	const unsigned char *chunk_large_edges;
+};
+
+static struct commit_graph *the_graph;
+static int graph_prepared;
+
+static inline uint32_t graph_u32(const unsigned char *p)
+{
+	return ntohl(*(uint32_t *)p);
+}
+
+static char *get_commit_graph_filename(void)
+{
+	return mkpathdup("%s/info/commit-graph", get_object_directory());
+}
+
+static struct commit_graph *parse_commit_graph(const unsigned char *data,
+					       size_t len, const char *path)
+{
+	struct commit_graph *g;
+	const unsigned char *chunk_lookup;
+	uint32_t i, num_chunks, num_commit_data = 0;
+	uint64_t end = len - 20;
+
+	if (graph_u32(data) != GRAPH_SIGNATURE) {
+		error("commit-graph signature %X does not match signature %X",
+		      graph_u32(data), GRAPH_SIGNATURE);
+		return NULL;
+	}
+	if (data[4] != GRAPH_VERSION) {
+		error("commit-graph %s is version %d and is not supported"
+		      " by this binary", path, data[4]);
+		return NULL;
+	}
+	if (data[5] != GRAPH_HASH_VERSION) {
+		error("commit-graph %s uses unknown hash version %d",
+		      path, data[5]);
+		return NULL;
+	}
+	num_chunks = data[6];
+	if (len < GRAPH_HEADER_SIZE + (num_chunks + 1) * GRAPH_CHUNKLOOKUP_WIDTH
+		  + 20) {
+		error("commit-graph %s is too small", path);
+		return NULL;
+	}
+
+	g = xcalloc(1, sizeof(*g));
+	g->data = data;
+	g->data_len = len;
+
+	chunk_lookup = data + GRAPH_HEADER_SIZE;
+	for (i = 0; i < num_chunks; i++) {
+		uint32_t chunk_id = graph_u32(chunk_lookup);
+		uint64_t offset = ((uint64_t)graph_u32(chunk_lookup + 4) << 32) |
+				  graph_u32(chunk_lookup + 8);
+		uint64_t next = ((uint64_t)graph_u32(chunk_lookup + 16) << 32) |
+				graph_u32(chunk_lookup + 20);
+		const unsigned char *chunk = data + offset;
+
+		chunk_lookup += GRAPH_CHUNKLOOKUP_WIDTH;
+		if (offset > next || next > end || (offset & 3)) {
+			error("commit-graph %s has an improper chunk offset %"
+			      PRIuMAX, path, (uintmax_t)offset);
+			goto bad;
+		}
+
+		switch (chunk_id) {
+		case GRAPH_CHUNKID_OIDFANOUT:
+			if (next - offset != GRAPH_FANOUT_SIZE)
+				goto bad_chunk;
+			g->chunk_oid_fanout = chunk;
+			break;
+		case GRAPH_CHUNKID_OIDLOOKUP:
+			g->chunk_oid_lookup = chunk;
+			g->num_commits = (next - offset) / 20;
+			break;
+		case GRAPH_CHUNKID_DATA:
+			if ((next - offset) % GRAPH_DATA_WIDTH)
+				goto bad_chunk;
+			g->chunk_commit_data = chunk;
+			num_commit_data = (next - offset) / GRAPH_DATA_WIDTH;
+			break;
+		case GRAPH_CHUNKID_LARGEEDGES:
+			g->chunk_large_edges = chunk;
+			g->num_large_edges = (next - offset) / 4;
+			break;
+		}
+		continue;
+	bad_chunk:
+		error("commit-graph %s has a malformed chunk %08x",
+		      path, chunk_id);
+		goto bad;
+	}
+
+	if (!g->chunk_oid_fanout || !g->chunk_oid_lookup ||
+	    !g->chunk_commit_data) {
+		error("commit-graph %s is missing a required chunk", path);
+		goto bad;
+	}
+	if (graph_u32(g->chunk_oid_fanout + 4 * 255) != g->num_commits ||
+	    num_commit_data != g->num_commits) {
+		error("commit-graph %s has inconsistent commit counts", path);
+		goto bad;
+	}
+	return g;
+
+bad:
+	free(g);
+	return NULL;
+}
+
+static struct commit_graph *load_commit_graph(const char *path)
+{
+	struct commit_graph *g;
+	struct stat st;
+	size_t len;
+	void *data;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	len = xsize_t(st.st_size);
+	if (len < GRAPH_MIN_SIZE) {
+		close(fd);
+		error("commit-graph %s is too small", path);
+		return NULL;
+	}
+	data = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	g = parse_commit_graph(data, len, path);
+	if (!g)
+		munmap(data, len);
+	return g;
+}
+
+static int mark_replace_ref(const char *refname, const unsigned char *sha1,
+			    int flags, void *cb_data)
+{
+	return 1;
+}
+
+static void prepare_commit_graph(void)
+{
+	char *graph_name;
+
+	if (graph_prepared)
+		return;
+	graph_prepared = 1;
+
+	if (!core_commit_graph)
+		return;
+	/*
+	 * The graph records the parents found in the commit objects;
+	 * grafts, shallow boundaries and replacements rewrite history
+	 * in ways that are not reflected in it.
+	 */
+	if (commit_grafts_present())
+		return;
+	if (read_replace_refs && for_each_replace_ref(mark_replace_ref, NULL))
+		return;
+
+	graph_name = get_commit_graph_filename();
+	the_graph = load_commit_graph(graph_name);
+	free(graph_name);
+}
+
+void close_commit_graph(void)
+{
+	if (the_graph) {
+		munmap((void *)the_graph->data, the_graph->data_len);
+		free(the_graph);
+		the_graph = NULL;
+	}
+	graph_prepared = 0;
+}
+
+static const unsigned char *graph_oid(struct commit_graph *g, uint32_t pos)
+{
+	return g->chunk_oid_lookup + 20 * pos;
+}
+
+static int bsearch_graph(struct commit_graph *g, const unsigned char *sha1,
+			 uint32_t *pos)
+{
+	uint32_t lo, hi;
+
+	lo = sha1[0] ? graph_u32(g->chunk_oid_fanout + 4 * (sha1[0] - 1)) : 0;
+	hi = graph_u32(g->chunk_oid_fanout + 4 * sha1[0]);
+	if (hi > g->num_commits)
+		hi = g->num_commits;
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(sha1, graph_oid(g, mi));
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+static struct commit_list **insert_parent(struct commit_graph *g,
+					  uint32_t pos,
+					  struct commit_list **pptr)
+{
+	struct commit *parent;
+
+	if (pos >= g->num_commits)
+		die("commit-graph has invalid parent position %"PRIu32, pos);
+	parent = lookup_commit(graph_oid(g, pos));
+	if (!parent)
+		return pptr;
+	return &commit_list_insert(parent, pptr)->next;
+}
+
+static void fill_commit_in_graph(struct commit_graph *g, struct commit *item,
+				 uint32_t pos)
+{
+	const unsigned char *commit_data =
+		g->chunk_commit_data + GRAPH_DATA_WIDTH * pos;
+	struct commit_list **pptr = &item->parents;
+	uint32_t edge, gen_and_date;
+
+	item->object.parsed = 1;
+	item->tree = lookup_tree(commit_data);
+
+	gen_and_date = graph_u32(commit_data + 28);
+	item->generation = gen_and_date >> 2;
+	item->date = (unsigned long)(((uint64_t)(gen_and_date & 3) << 32) |
+				     graph_u32(commit_data + 32));
+
+	edge = graph_u32(commit_data + 20);
+	if (edge == GRAPH_PARENT_NONE)
+		return;
+	pptr = insert_parent(g, edge, pptr);
+
+	edge = graph_u32(commit_data + 24);
+	if (edge == GRAPH_PARENT_NONE)
+		return;
+	if (!(edge & GRAPH_OCTOPUS_EDGES_NEEDED)) {
+		insert_parent(g, edge, pptr);
+		return;
+	}
+
+	pos = edge & GRAPH_EDGE_LAST_MASK;
+	do {
+		if (pos >= g->num_large_edges)
+			die("commit-graph has invalid octopus edge %"PRIu32, pos);
+		edge = graph_u32(g->chunk_large_edges + 4 * pos++);
+		pptr = insert_parent(g, edge & GRAPH_EDGE_LAST_MASK, pptr);
+	} while (!(edge & GRAPH_LAST_EDGE));
+}
+
+int parse_commit_in_graph(struct commit *item)
+{
+	uint32_t pos;
+
+	if (item->object.parsed)
+		return 1;
+	prepare_commit_graph();
+	if (!the_graph)
+		return 0;
+	/* shallow boundaries may be registered after the graph is loaded */
+	if (lookup_commit_graft(item->object.sha1))
+		return 0;
+	if (!bsearch_graph(the_graph, item->object.sha1, &pos))
+		return 0;
+	fill_commit_in_graph(the_graph, item, pos);
+	return 1;
+}
+
+static unsigned int graph_generation(struct commit_graph *g,
+				     const unsigned char *sha1)
+{
+	uint32_t pos;
+
+	if (!bsearch_graph(g, sha1, &pos))
+		return 0;
+	return graph_u32(g->chunk_commit_data + GRAPH_DATA_WIDTH * pos + 28) >> 2;
+}
+
+unsigned int commit_graph_generation(struct commit *item)
+{
+	if (item->generation)
+		return item->generation;
+	prepare_commit_graph();
+	if (!the_graph || lookup_commit_graft(item->object.sha1))
+		return 0;
+	item->generation = graph_generation(the_graph, item->object.sha1);
+	return item->generation;
+}
+
+/*
+ * Writing
+ */
+struct packed_commit_list {
+	struct commit **list;
+	int nr, alloc;
+};
+
+static void add_to_graph_list(struct packed_commit_list *commits,
+			      struct commit *commit)
+{
+	if (commit->object.flags & GRAPH_SEEN)
+		return;
+	commit->object.flags |= GRAPH_SEEN;
+	ALLOC_GROW(commits->list, commits->nr + 1, commits->alloc);
+	commits->list[commits->nr++] = commit;
+}
+
+static int add_ref_to_graph(const char *refname, const unsigned char *sha1,
+			    int flags, void *cb_data)
+{
+	struct commit *commit = lookup_commit_reference_gently(sha1, 1);
+
+	if (commit)
+		add_to_graph_list(cb_data, commit);
+	return 0;
+}
+
+static void collect_reachable_commits(struct packed_commit_list *commits)
+{
+	int i;
+
+	head_ref(add_ref_to_graph, commits);
+	for_each_ref(add_ref_to_graph, commits);
+
+	for (i = 0; i < commits->nr; i++) {
+		struct commit *commit = commits->list[i];
+		struct commit_list *parent;
+
+		if (parse_commit(commit))
+			die("unable to parse commit %s",
+			    sha1_to_hex(commit->object.sha1));
+		if (!commit->tree)
+			die("commit %s has no tree",
+			    sha1_to_hex(commit->object.sha1));
+		for (parent = commit->parents; parent; parent = parent->next)
+			add_to_graph_list(commits, parent->item);
+	}
+
+	for (i = 0; i < commits->nr; i++)
+		commits->list[i]->object.flags &= ~GRAPH_SEEN;
+}
+
+static int commit_sha1_cmp(const void *a_, const void *b_)
+{
+	struct commit *a = *(struct commit **)a_;
+	struct commit *b = *(struct commit **)b_;
+	return hashcmp(a->object.sha1, b->object.sha1);
+}
+
+static const unsigned char *commit_sha1_access(size_t index, void *table)
+{
+	struct commit **commits = table;
+	return commits[index]->object.sha1;
+}
+
+static void compute_generation_numbers(struct packed_commit_list *commits)
+{
+	struct commit **stack = NULL;
+	int i, stack_nr = 0, stack_alloc = 0;
+
+	for (i = 0; i < commits->nr; i++) {
+		if (commits->list[i]->generation)
+			continue;
+
+		ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+		stack[stack_nr++] = commits->list[i];
+
+		while (stack_nr) {
+			struct commit *current = stack[stack_nr - 1];
+			struct commit_list *parent;
+			unsigned int max_generation = 0;
+			int all_parents_computed = 1;
+
+			if (current->generation) {
+				stack_nr--;
+				continue;
+			}
+			for (parent = current->parents; parent; parent = parent->next) {
+				unsigned int g = parent->item->generation;
+				if (!g) {
+					ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+					stack[stack_nr++] = parent->item;
+					all_parents_computed = 0;
+				} else if (g > max_generation)
+					max_generation = g;
+			}
+			if (!all_parents_computed)
+				continue;
+			if (max_generation >= GENERATION_NUMBER_MAX)
+				max_generation = GENERATION_NUMBER_MAX - 1;
+			current->generation = max_generation + 1;
+			stack_nr--;
+		}
+	}
+	free(stack);
+}
+
+static uint32_t graph_position(struct packed_commit_list *commits,
+			       struct commit *commit)
+{
+	int pos = sha1_pos(commit->object.sha1, commits->list, commits->nr,
+			   commit_sha1_access);
+	if (pos < 0)
+		die("BUG: parent %s missing from commit-graph",
+		    sha1_to_hex(commit->object.sha1));
+	return pos;
+}
+
+static void write_be32(struct sha1file *f, uint32_t value)
+{
+	value = htonl(value);
+	sha1write(f, &value, 4);
+}
+
+static void write_graph_chunk_fanout(struct sha1file *f,
+				     struct packed_commit_list *commits)
+{
+	int i, count = 0;
+
+	for (i = 0; i < 256; i++) {
+		while (count < commits->nr &&
+		       commits->list[count]->object.sha1[0] == i)
+			count++;
+		write_be32(f, count);
+	}
+}
+
+static void write_graph_chunk_oids(struct sha1file *f,
+				   struct packed_commit_list *commits)
+{
+	int i;
+
+	for (i = 0; i < commits->nr; i++)
+		sha1write(f, commits->list[i]->object.sha1, 20);
+}
+
+static void write_graph_chunk_data(struct sha1file *f,
+				   struct packed_commit_list *commits)
+{
+	uint32_t num_extra_edges = 0;
+	int i;
+
+	for (i = 0; i < commits->nr; i++) {
+		struct commit *commit = commits->list[i];
+		struct commit_list *parent = commit->parents;
+		uint64_t date = commit->date;
+		uint32_t edge;
+
+		sha1write(f, commit->tree->object.sha1, 20);
+
+		edge = parent ? graph_position(commits, parent->item)
+			      : GRAPH_PARENT_NONE;
+		write_be32(f, edge);
+
+		if (parent)
+			parent = parent->next;
+		if (!parent)
+			edge = GRAPH_PARENT_NONE;
+		else if (parent->next) {
+			edge = GRAPH_OCTOPUS_EDGES_NEEDED | num_extra_edges;
+			for (; parent; parent = parent->next)
+				num_extra_edges++;
+		} else
+			edge = graph_position(commits, parent->item);
+		write_be32(f, edge);
+
+		write_be32(f, (commit->generation << 2) |
+			      (uint32_t)((date >> 32) & 3));
+		write_be32(f, (uint32_t)date);
+	}
+}
+
+static void write_graph_chunk_large_edges(struct sha1file *f,
+					  struct packed_commit_list *commits)
+{
+	int i;
+
+	for (i = 0; i < commits->nr; i++) {
+		struct commit_list *parent = commits->list[i]->parents;
+
+		if (!parent || !parent->next || !parent->next->next)
+			continue;
+		for (parent = parent->next; parent; parent = parent->next) {
+			uint32_t edge = graph_position(commits, parent->item);
+			if (!parent->next)
+				edge |= GRAPH_LAST_EDGE;
+			write_be32(f, edge);
+		}
+	}
+}
+
+static uint32_t count_large_edges(struct packed_commit_list *commits)
+{
+	uint32_t num_extra_edges = 0;
+	int i;
+
+	for (i = 0; i < commits->nr; i++) {
+		struct commit_list *parent = commits->list[i]->parents;
+		int nr_parents = commit_list_count(parent);
+
+		if (nr_parents > 2)
+			num_extra_edges += nr_parents - 1;
+	}
+	return num_extra_edges;
+}
+
+int write_commit_graph(void)
+{
+	static struct lock_file lock;
+	struct packed_commit_list commits = { NULL, 0, 0 };
+	struct sha1file *f;
+	uint32_t chunk_ids[5];
+	uint64_t chunk_offsets[5];
+	uint32_t num_extra_edges;
+	unsigned char header[4];
+	int i, fd, num_chunks;
+	char *graph_name;
+
+	if (commit_grafts_present())
+		return error("cannot write a commit-graph in a repository"
+			     " with grafts or shallow history");
+
+	/* Read everything from the commit objects themselves */
+	close_commit_graph();
+	graph_prepared = 1;
+	read_replace_refs = 0;
+
+	collect_reachable_commits(&commits);
+	qsort(commits.list, commits.nr, sizeof(*commits.list), commit_sha1_cmp);
+	compute_generation_numbers(&commits);
+	num_extra_edges = count_large_edges(&commits);
+
+	num_chunks = num_extra_edges ? 4 : 3;
+	chunk_ids[0] = GRAPH_CHUNKID_OIDFANOUT;
+	chunk_ids[1] = GRAPH_CHUNKID_OIDLOOKUP;
+	chunk_ids[2] = GRAPH_CHUNKID_DATA;
+	chunk_ids[3] = num_extra_edges ? GRAPH_CHUNKID_LARGEEDGES : 0;
+	chunk_ids[4] = 0;
+
+	chunk_offsets[0] = GRAPH_HEADER_SIZE +
+		(num_chunks + 1) * GRAPH_CHUNKLOOKUP_WIDTH;
+	chunk_offsets[1] = chunk_offsets[0] + GRAPH_FANOUT_SIZE;
+	chunk_offsets[2] = chunk_offsets[1] + 20 * commits.nr;
+	chunk_offsets[3] = chunk_offsets[2] + GRAPH_DATA_WIDTH * commits.nr;
+	chunk_offsets[4] = chunk_offsets[3] + 4 * num_extra_edges;
+
+	graph_name = get_commit_graph_filename();
+	if (safe_create_leading_directories(graph_name))
+		die_errno("unable to create leading directories of %s",
+			  graph_name);
+	fd = hold_lock_file_for_update(&lock, graph_name, LOCK_DIE_ON_ERROR);
+	f = sha1fd(fd, lock.filename);
+
+	write_be32(f, GRAPH_SIGNATURE);
+	header[0] = GRAPH_VERSION;
+	header[1] = GRAPH_HASH_VERSION;
+	header[2] = num_chunks;
+	header[3] = 0; /* reserved */
+	sha1write(f, header, 4);
+
+	for (i = 0; i <= num_chunks; i++) {
+		write_be32(f, chunk_ids[i]);
+		write_be32(f, (uint32_t)(chunk_offsets[i] >> 32));
+		write_be32(f, (uint32_t)chunk_offsets[i]);
+	}
+
+	write_graph_chunk_fanout(f, &commits);
+	write_graph_chunk_oids(f, &commits);
+	write_graph_chunk_data(f, &commits);
+	write_graph_chunk_large_edges(f, &commits);
+
+	sha1close(f, NULL, CSUM_FSYNC);
+	lock.fd = -1;
+	if (commit_lock_file(&lock))
+		die_errno("unable to write commit-graph %s", graph_name);
+
+	free(graph_name);
+	free(commits.list);
+	return 0;
+}
+
+/*
+ * Verification
+ */
+static int verify_commit_graph_error;
+
+static void graph_report(const char *fmt, ...)
+{
+	va_list ap;
+	struct strbuf sb = STRBUF_INIT;
+
+	va_start(ap, fmt);
+	strbuf_vaddf(&sb, fmt, ap);
+	va_end(ap);
+	error("%s", sb.buf);
+	strbuf_release(&sb);
+	verify_commit_graph_error = 1;
+}
+
+static int verify_graph_checksum(struct commit_graph *g)
+{
+	git_SHA_CTX ctx;
+	unsigned char sha1[20];
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, g->data, g->data_len - 20);
+	git_SHA1_Final(sha1, &ctx);
+	return hashcmp(sha1, g->data + g->data_len - 20);
+}
+
+int verify_commit_graph(void)
+{
+	struct commit_graph *g;
+	char *graph_name;
+	uint32_t i, fanout_value = 0;
+
+	/* Compare against the commit objects, not the graph itself */
+	close_commit_graph();
+	graph_prepared = 1;
+	read_replace_refs = 0;
+	verify_commit_graph_error = 0;
+
+	graph_name = get_commit_graph_filename();
+	g = load_commit_graph(graph_name);
+	if (!g) {
+		int missing = access(graph_name, F_OK);
+		free(graph_name);
+		return missing ? 0 : -1;
+	}
+
+	if (verify_graph_checksum(g))
+		graph_report("commit-graph %s has incorrect checksum",
+			     graph_name);
+
+	for (i = 0; i < 256; i++) {
+		uint32_t value = graph_u32(g->chunk_oid_fanout + 4 * i);
+		if (value < fanout_value)
+			graph_report("commit-graph fanout values out of order");
+		fanout_value = value;
+	}
+
+	for (i = 0; i < g->num_commits; i++) {
+		const unsigned char *sha1 = graph_oid(g, i);
+		struct commit *graph_commit, *odb_commit;
+		struct commit_list *graph_parents, *odb_parents;
+		unsigned int max_generation = 0;
+
+		if (i && hashcmp(graph_oid(g, i - 1), sha1) >= 0) {
+			graph_report("commit-graph has incorrect OID order: "
+				     "%s then %s",
+				     sha1_to_hex(graph_oid(g, i - 1)),
+				     sha1_to_hex(sha1));
+			continue;
+		}
+		if (graph_u32(g->chunk_oid_fanout + 4 * sha1[0]) <= i ||
+		    (sha1[0] &&
+		     graph_u32(g->chunk_oid_fanout + 4 * (sha1[0] - 1)) > i))
+			graph_report("commit-graph has incorrect fanout value "
+				     "for %s", sha1_to_hex(sha1));
+
+		/*
+		 * The in-core commit is parsed from the object; compare it
+		 * with a scratch commit filled from the graph.
+		 */
+		odb_commit = lookup_commit(sha1);
+		if (!odb_commit || parse_commit(odb_commit)) {
+			graph_report("failed to parse commit %s from object"
+				     " database", sha1_to_hex(sha1));
+			continue;
+		}
+		graph_commit = xcalloc(1, sizeof(*graph_commit));
+		hashcpy(graph_commit->object.sha1, sha1);
+		fill_commit_in_graph(g, graph_commit, i);
+
+		if (!odb_commit->tree || graph_commit->tree != odb_commit->tree)
+			graph_report("root tree for commit %s in commit-graph is"
+				     " %s != %s", sha1_to_hex(sha1),
+				     sha1_to_hex(g->chunk_commit_data +
+						 GRAPH_DATA_WIDTH * i),
+				     odb_commit->tree ?
+				     sha1_to_hex(odb_commit->tree->object.sha1) :
+				     "(none)");
+
+		graph_parents = graph_commit->parents;
+		odb_parents = odb_commit->parents;
+		while (graph_parents && odb_parents) {
+			unsigned int g_gen = graph_generation(g,
+					graph_parents->item->object.sha1);
+			if (graph_parents->item != odb_parents->item)
+				graph_report("commit-graph parent for %s is %s"
+					     " != %s", sha1_to_hex(sha1),
+					     sha1_to_hex(graph_parents->item->object.sha1),
+					     sha1_to_hex(odb_parents->item->object.sha1));
+			if (g_gen > max_generation)
+				max_generation = g_gen;
+			graph_parents = graph_parents->next;
+			odb_parents = odb_parents->next;
+		}
+		if (graph_parents || odb_parents)
+			graph_report("commit-graph parent list for commit %s"
+				     " has the wrong length", sha1_to_hex(sha1));
+
+		if (max_generation >= GENERATION_NUMBER_MAX)
+			max_generation = GENERATION_NUMBER_MAX - 1;
+		if (graph_commit->generation != max_generation + 1)
+			graph_report("commit-graph generation for commit %s"
+				     " is %u != %u", sha1_to_hex(sha1),
+				     graph_commit->generation,
+				     max_generation + 1);
+		if (graph_commit->date != odb_commit->date)
+			graph_report("commit date for commit %s in commit-graph"
+				     " is %lu != %lu", sha1_to_hex(sha1),
+				     graph_commit->date, odb_commit->date);
+
+		free_commit_list(graph_commit->parents);
+		free(graph_commit);
+	}
+
+	munmap((void *)g->data, g->data_len);
+	free(g);
+	free(graph_name);
+	return verify_commit_graph_error;
+}
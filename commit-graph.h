@@ -0,0 +1,34 @@
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+
+#include "commit.h"
+
+/*
+ * The commit-graph file in $GIT_OBJECT_DIRECTORY/info/commit-graph
+ * records, for every commit reachable from the refs at the time it
+ * was written, the root tree, the parents, the committer date and
+ * the generation number.  See Documentation/technical/commit-graph-format.txt.
+ */
+
+#define GENERATION_NUMBER_MAX 0x3FFFFFFF
+
+/*
+ * Fill in "item" from the commit-graph without reading the commit
+ * object.  Returns 1 if the commit was found in the graph (and is now
+ * parsed), 0 if the caller has to parse the object itself.
+ */
+extern int parse_commit_in_graph(struct commit *item);
+
+/*
+ * Return the generation number of "item" as recorded in the
+ * commit-graph, or 0 if it is unknown.  A commit can only reach
+ * commits with a strictly smaller generation number.
+ */
+extern unsigned int commit_graph_generation(struct commit *item);
+
+extern void close_commit_graph(void);
+
+extern int write_commit_graph(void);
+extern int verify_commit_graph(void);
+
+#endif
@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "tag.h"
 #include "commit.h"
+#include "commit-graph.h"
 #include "pkt-line.h"
 #include "utf8.h"
 #include "diff.h"
@@ -230,6 +231,12 @@ struct commit_graft *lookup_commit_graft(const unsigned char *sha1)
 	return commit_graft[pos];
 }
 
+int commit_grafts_present(void)
+{
+	prepare_commit_graft();
+	return commit_graft_nr != 0;
+}
+
 int for_each_commit_graft(each_commit_graft_fn fn, void *cb_data)
 {
 	int i, ret;
@@ -317,6 +324,12 @@ int parse_commit(struct commit *item)
 		return -1;
 	if (item->object.parsed)
 		return 0;
+	/*
+	 * The commit-graph gives us everything but the buffer, so it
+	 * can only be used when the caller does not want to keep it.
+	 */
+	if (!save_commit_buffer && parse_commit_in_graph(item))
+		return 0;
 	buffer = read_sha1_file(item->object.sha1, &type, &size);
 	if (!buffer)
 		return error("Could not read %s",
@@ -864,6 +877,7 @@ int is_descendant_of(struct commit *commit, struct commit_list *with_commit)
 int in_merge_bases_many(struct commit *commit, int nr_reference, struct commit **reference)
 {
 	struct commit_list *bases;
+	unsigned int generation;
 	int ret = 0, i;
 
 	if (parse_commit(commit))
@@ -872,6 +886,23 @@ int in_merge_bases_many(struct commit *commit, int nr_reference, struct commit *
 		if (parse_commit(reference[i]))
 			return ret;
 
+	/*
+	 * A commit can only reach commits with a smaller generation
+	 * number, so there is no need to walk if all references are
+	 * known to be at or below "commit".
+	 */
+	generation = commit_graph_generation(commit);
+	for (i = 0; generation && i < nr_reference; i++) {
+		unsigned int ref_generation;
+		if (reference[i] == commit)
+			break;
+		ref_generation = commit_graph_generation(reference[i]);
+		if (!ref_generation || ref_generation > generation)
+			break;
+	}
+	if (generation && i == nr_reference)
+		return 0;
+
 	bases = paint_down_to_common(commit, nr_reference, reference);
 	if (commit->object.flags & PARENT2)
 		ret = 1;
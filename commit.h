@@ -16,6 +16,7 @@ struct commit {
 	struct object object;
 	void *util;
 	unsigned int indegree;
+	unsigned int generation;
 	unsigned long date;
 	struct commit_list *parents;
 	struct tree *tree;
@@ -172,6 +173,8 @@ extern struct commit_list *get_octopus_merge_bases(struct commit_list *in);
 extern int register_shallow(const unsigned char *sha1);
 extern int unregister_shallow(const unsigned char *sha1);
 extern int for_each_commit_graft(each_commit_graft_fn, void *);
+/* Are there grafts or shallow boundaries rewriting the history? */
+extern int commit_grafts_present(void);
 extern int is_repository_shallow(void);
 extern struct commit_list *get_shallow_commits(struct object_array *heads,
 		int depth, int shallow_flag, int not_shallow_flag);
@@ -0,0 +1,157 @@
+/*
+ * CRC32 of pack data, as stored in pack index v2.  This is the CRC
+ * zlib computes; where the CPU has a carry-less multiply, the bulk of
+ * a buffer is folded 64 bytes at a time with PCLMULQDQ instead.
+ *
+ * The SSE4.2 crc32 instruction does not help here: it computes the
+ * Castagnoli CRC, not the one the index format uses.
+ */
+#include "cache.h"
+
+#if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__)) && \
+    defined(__x86_64__) && !defined(NO_CRC32_CLMUL)
+#define CRC32_CLMUL
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+/* zlib counts lengths in uInt */
+static uint32_t zlib_crc32(uint32_t crc, const unsigned char *buf,
+			   unsigned long len)
+{
+	while (len) {
+		uInt n = len > (uInt)-1 ? (uInt)-1 : len;
+		crc = crc32(crc, buf, n);
+		buf += n;
+		len -= n;
+	}
+	return crc;
+}
+
+#ifdef CRC32_CLMUL
+
+/*
+ * Fold the 64-byte multiples of buf into "crc" (the bit-inverted
+ * register, not the zlib-style value).  This is the folding scheme
+ * from Intel's "Fast CRC Computation for Generic Polynomials Using
+ * PCLMULQDQ Instruction", with the constants for the reflected
+ * polynomial 0xedb88320; len must be at least 64.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_clmul(uint32_t crc, const unsigned char *buf,
+			    unsigned long len)
+{
+	static const uint64_t k1k2[] __attribute__((aligned(16))) = {
+		0x0154442bd4, 0x01c6e41596
+	};
+	static const uint64_t k3k4[] __attribute__((aligned(16))) = {
+		0x01751997d0, 0x00ccaa009e
+	};
+	static const uint64_t k5k0[] __attribute__((aligned(16))) = {
+		0x0163cd6124, 0x0000000000
+	};
+	static const uint64_t poly[] __attribute__((aligned(16))) = {
+		0x01db710641, 0x01f7011641
+	};
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	x0 = _mm_load_si128((const __m128i *)k1k2);
+	buf += 64;
+	len -= 64;
+
+	/* fold four 128-bit lanes in parallel */
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		y5 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+		y6 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+		y7 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+		y8 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+		buf += 64;
+		len -= 64;
+	}
+
+	/* fold the four lanes into one */
+	x0 = _mm_load_si128((const __m128i *)k3k4);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/* 128 bits down to 64 */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+	x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x0 = _mm_load_si128((const __m128i *)poly);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return _mm_extract_epi32(x1, 1);
+}
+
+static int use_clmul = -1;
+
+static int have_clmul(void)
+{
+	if (use_clmul < 0) {
+		unsigned int eax, ebx, ecx, edx;
+		use_clmul = __get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+			    (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1) &&
+			    !git_env_bool("GIT_TEST_CRC32_NO_CLMUL", 0);
+	}
+	return use_clmul;
+}
+
+uint32_t git_crc32(uint32_t crc, const void *buf, unsigned long len)
+{
+	const unsigned char *p = buf;
+
+	/* below a few blocks, zlib's table lookups win */
+	if (len >= 256 && have_clmul()) {
+		unsigned long bulk = len & ~63UL;
+		crc = ~crc32_clmul(~crc, p, bulk);
+		p += bulk;
+		len -= bulk;
+	}
+	return zlib_crc32(crc, p, len);
+}
+
+#else
+
+uint32_t git_crc32(uint32_t crc, const void *buf, unsigned long len)
+{
+	return zlib_crc32(crc, buf, len);
+}
+
+#endif
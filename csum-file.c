@@ -95,7 +95,7 @@ int sha1write(struct sha1file *f, void *buf, unsigned int count)
 		void *data;
 
 		if (f->do_crc)
-			f->crc32 = crc32(f->crc32, buf, nr);
+			f->crc32 = git_crc32(f->crc32, buf, nr);
 
 		if (nr == sizeof(f->buffer)) {
 			/* process full buffer directly without copy */
@@ -0,0 +1,272 @@
+#include "cache.h"
+#include "commit.h"
+#include "tree.h"
+#include "tree-walk.h"
+#include "tag.h"
+#include "refs.h"
+#include "decorate.h"
+#include "string-list.h"
+#include "sha1-array.h"
+#include "delta-islands.h"
+
+/*
+ * The islands an object is reachable from, one bit per island.
+ * Objects reachable from the same islands share their bitmap, which
+ * is copied when one of them gets more marks.
+ */
+struct island_bitmap {
+	uint32_t refcount;
+	uint32_t bits[FLEX_ARRAY];
+};
+
+static uint32_t island_bitmap_size; /* in 32-bit words */
+
+static struct decoration island_marks;
+
+static regex_t *island_regexes;
+static int island_regexes_nr, island_regexes_alloc;
+
+/* island names, with a sha1_array of the tips of their refs as util */
+static struct string_list islands = STRING_LIST_INIT_DUP;
+
+static struct island_bitmap *island_bitmap_new(const struct island_bitmap *old)
+{
+	size_t size = sizeof(struct island_bitmap) + island_bitmap_size * 4;
+	struct island_bitmap *b = xcalloc(1, size);
+
+	if (old)
+		memcpy(b, old, size);
+	b->refcount = 1;
+	return b;
+}
+
+static int island_bitmap_is_subset(const struct island_bitmap *self,
+				   const struct island_bitmap *super)
+{
+	uint32_t i;
+
+	if (self == super)
+		return 1;
+	for (i = 0; i < island_bitmap_size; i++)
+		if ((self->bits[i] & super->bits[i]) != self->bits[i])
+			return 0;
+	return 1;
+}
+
+static void island_bitmap_or(struct island_bitmap *dst,
+			     const struct island_bitmap *src)
+{
+	uint32_t i;
+
+	for (i = 0; i < island_bitmap_size; i++)
+		dst->bits[i] |= src->bits[i];
+}
+
+int island_config_callback(const char *k, const char *v, void *cb)
+{
+	regex_t *re;
+	int ret;
+
+	if (strcmp(k, "pack.island"))
+		return 0;
+	if (!v)
+		return config_error_nonbool(k);
+
+	ALLOC_GROW(island_regexes, island_regexes_nr + 1, island_regexes_alloc);
+	re = &island_regexes[island_regexes_nr];
+	ret = regcomp(re, v, REG_EXTENDED);
+	if (ret) {
+		char errbuf[1024];
+		regerror(ret, re, errbuf, sizeof(errbuf));
+		die("bad regex '%s' in %s: %s", v, k, errbuf);
+	}
+	island_regexes_nr++;
+	return 0;
+}
+
+/*
+ * The regexes are anchored at the start of the refname.  The island
+ * of a ref is named after what the capture groups of the last
+ * matching regex matched, joined by dashes.
+ */
+static int find_island_for_ref(const char *refname, const unsigned char *sha1,
+			       int flags, void *data)
+{
+	struct strbuf name = STRBUF_INIT;
+	struct string_list_item *item;
+	regmatch_t matches[16];
+	int i, m;
+
+	for (i = island_regexes_nr - 1; i >= 0; i--)
+		if (!regexec(&island_regexes[i], refname,
+			     ARRAY_SIZE(matches), matches, 0) &&
+		    !matches[0].rm_so)
+			break;
+	if (i < 0)
+		return 0;
+
+	for (m = 1; m < ARRAY_SIZE(matches); m++) {
+		regmatch_t *match = &matches[m];
+		if (match->rm_so == -1)
+			continue;
+		if (name.len)
+			strbuf_addch(&name, '-');
+		strbuf_add(&name, refname + match->rm_so,
+			   match->rm_eo - match->rm_so);
+	}
+
+	item = string_list_insert(&islands, name.buf);
+	if (!item->util)
+		item->util = xcalloc(1, sizeof(struct sha1_array));
+	sha1_array_append(item->util, sha1);
+	strbuf_release(&name);
+	return 0;
+}
+
+static void mark_island(struct object *obj, int island)
+{
+	struct island_bitmap *b = lookup_decoration(&island_marks, obj);
+
+	if (!b) {
+		b = island_bitmap_new(NULL);
+		add_decoration(&island_marks, obj, b);
+	} else if (b->refcount > 1) {
+		b->refcount--;
+		b = island_bitmap_new(b);
+		add_decoration(&island_marks, obj, b);
+	}
+	b->bits[island / 32] |= 1u << (island % 32);
+}
+
+void load_delta_islands(void)
+{
+	int i;
+
+	for_each_ref(find_island_for_ref, NULL);
+	island_bitmap_size = (islands.nr + 31) / 32;
+
+	for (i = 0; i < islands.nr; i++) {
+		struct sha1_array *tips = islands.items[i].util;
+		int j;
+
+		for (j = 0; j < tips->nr; j++) {
+			struct object *obj = parse_object(tips->sha1[j]);
+
+			while (obj) {
+				mark_island(obj, i);
+				if (obj->type != OBJ_TAG)
+					break;
+				obj = ((struct tag *)obj)->tagged;
+				if (obj)
+					obj = parse_object(obj->sha1);
+			}
+		}
+		sha1_array_clear(tips);
+		free(tips);
+		islands.items[i].util = NULL;
+	}
+}
+
+static void set_island_marks(struct object *obj, struct island_bitmap *marks)
+{
+	struct island_bitmap *b = lookup_decoration(&island_marks, obj);
+
+	if (!b) {
+		/* share the marks until one of the objects gets more */
+		marks->refcount++;
+		add_decoration(&island_marks, obj, marks);
+		return;
+	}
+	if (island_bitmap_is_subset(marks, b))
+		return;
+	if (b->refcount > 1) {
+		b->refcount--;
+		b = island_bitmap_new(b);
+		add_decoration(&island_marks, obj, b);
+	}
+	island_bitmap_or(b, marks);
+}
+
+void propagate_island_marks(struct commit *commit)
+{
+	struct island_bitmap *marks;
+	struct commit_list *p;
+
+	marks = lookup_decoration(&island_marks, &commit->object);
+	if (!marks)
+		return;
+	if (commit->tree)
+		set_island_marks(&commit->tree->object, marks);
+	for (p = commit->parents; p; p = p->next)
+		set_island_marks(&p->item->object, marks);
+}
+
+void resolve_tree_islands(struct tree **trees, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		struct island_bitmap *marks;
+		struct tree_desc desc;
+		struct name_entry entry;
+		enum object_type type;
+		unsigned long size;
+		void *buf;
+
+		marks = lookup_decoration(&island_marks, &trees[i]->object);
+		if (!marks)
+			continue;
+		buf = read_sha1_file(trees[i]->object.sha1, &type, &size);
+		if (!buf || type != OBJ_TREE)
+			die("unable to read tree %s",
+			    sha1_to_hex(trees[i]->object.sha1));
+
+		init_tree_desc(&desc, buf, size);
+		while (tree_entry(&desc, &entry)) {
+			struct object *obj;
+
+			if (S_ISGITLINK(entry.mode))
+				continue;
+			obj = lookup_object(entry.sha1);
+			if (obj)
+				set_island_marks(obj, marks);
+		}
+		free(buf);
+	}
+}
+
+int in_same_island(const unsigned char *trg_sha1, const unsigned char *src_sha1)
+{
+	struct island_bitmap *trg_marks, *src_marks;
+	struct object *obj;
+
+	obj = lookup_object(trg_sha1);
+	trg_marks = obj ? lookup_decoration(&island_marks, obj) : NULL;
+	/* an object in no island may be a delta of anything */
+	if (!trg_marks)
+		return 1;
+
+	obj = lookup_object(src_sha1);
+	src_marks = obj ? lookup_decoration(&island_marks, obj) : NULL;
+	if (!src_marks)
+		return 0;
+
+	return island_bitmap_is_subset(trg_marks, src_marks);
+}
+
+int island_delta_cmp(const unsigned char *a, const unsigned char *b)
+{
+	struct island_bitmap *a_marks, *b_marks;
+	struct object *obj;
+
+	obj = lookup_object(a);
+	a_marks = obj ? lookup_decoration(&island_marks, obj) : NULL;
+	obj = lookup_object(b);
+	b_marks = obj ? lookup_decoration(&island_marks, obj) : NULL;
+
+	if (a_marks && (!b_marks || !island_bitmap_is_subset(a_marks, b_marks)))
+		return -1;
+	if (b_marks && (!a_marks || !island_bitmap_is_subset(b_marks, a_marks)))
+		return 1;
+	return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef DELTA_ISLANDS_H
+#define DELTA_ISLANDS_H
+
+/*
+ * Delta islands are groups of refs, defined by the "pack.island"
+ * regexes.  pack-objects run with --delta-islands only makes an
+ * object a delta of a base that is reachable from all the islands
+ * the object is reachable from, so that a pack sent for the refs of
+ * any single island can reuse the deltas stored on disk.
+ */
+
+struct commit;
+struct tree;
+
+extern int island_config_callback(const char *k, const char *v, void *cb);
+
+/*
+ * Mark the tips of the refs of every island.  Call before walking
+ * the commits to pack.
+ */
+extern void load_delta_islands(void);
+
+/* Pass the marks of a commit on to its tree and its parents. */
+extern void propagate_island_marks(struct commit *commit);
+
+/*
+ * Pass the marks of the trees on to their entries.  The trees must
+ * come after all the trees containing them, e.g. sorted by depth.
+ */
+extern void resolve_tree_islands(struct tree **trees, int nr);
+
+/*
+ * Whether "src" is reachable from every island "trg" is, so that
+ * "trg" may be stored as a delta of "src".
+ */
+extern int in_same_island(const unsigned char *trg_sha1,
+			  const unsigned char *src_sha1);
+
+/*
+ * Sort order for delta search, putting objects that are in islands
+ * others are not in first, so that they are tried as bases.
+ */
+extern int island_delta_cmp(const unsigned char *a, const unsigned char *b);
+
+#endif
@@ -14,6 +14,13 @@
 #include "git-compat-util.h"
 #include "delta.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 /* maximum hash entry list for the same hash bucket */
 #define HASH_LIMIT 64
 
@@ -112,9 +119,14 @@ static const unsigned int U[256] = {
 	0x133eb0ac, 0x6d8b90a1, 0x450d4467, 0x3bb8646a
 };
 
+/*
+ * The hash value comes first and the position in the source buffer is
+ * kept as an offset, so that a bucket is a short run of 8-byte entries
+ * whose values can be scanned without touching anything else.
+ */
 struct index_entry {
-	const unsigned char *ptr;
 	unsigned int val;
+	unsigned int ofs;
 };
 
 struct unpacked_index_entry {
@@ -188,12 +200,12 @@ struct delta_index * create_delta_index(const void *buf, unsigned long bufsize)
 			val = ((val << 8) | data[i]) ^ T[val >> RABIN_SHIFT];
 		if (val == prev_val) {
 			/* keep the lowest of consecutive identical blocks */
-			entry[-1].entry.ptr = data + RABIN_WINDOW;
+			entry[-1].entry.ofs = data + RABIN_WINDOW - buffer;
 			--entries;
 		} else {
 			prev_val = val;
 			i = val & hmask;
-			entry->entry.ptr = data + RABIN_WINDOW;
+			entry->entry.ofs = data + RABIN_WINDOW - buffer;
 			entry->entry.val = val;
 			entry->next = hash[i];
 			hash[i] = entry++;
@@ -308,6 +320,87 @@ unsigned long sizeof_delta_index(struct delta_index *index)
 		return 0;
 }
 
+/*
+ * Number of leading bytes that are the same in "a" and "b", at most
+ * "max".  Matches are usually long, so compare a vector (or at least a
+ * word) at a time and find the first difference with a bit scan.
+ */
+static inline unsigned int match_forward(const unsigned char *a,
+					 const unsigned char *b,
+					 unsigned int max)
+{
+	unsigned int n = 0;
+
+#if defined(__AVX2__)
+	while (max - n >= 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(a + n));
+		__m256i y = _mm256_loadu_si256((const __m256i *)(b + n));
+		unsigned int neq = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+		if (neq)
+			return n + __builtin_ctz(neq);
+		n += 32;
+	}
+#endif
+#if defined(__SSE2__)
+	while (max - n >= 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + n));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b + n));
+		unsigned int neq = ~_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xffff;
+		if (neq)
+			return n + __builtin_ctz(neq);
+		n += 16;
+	}
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && \
+      __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (max - n >= 8) {
+		uint64_t x, y;
+		memcpy(&x, a + n, 8);
+		memcpy(&y, b + n, 8);
+		if (x != y)
+			return n + (__builtin_ctzll(x ^ y) >> 3);
+		n += 8;
+	}
+#endif
+	while (n < max && a[n] == b[n])
+		n++;
+	return n;
+}
+
+/*
+ * Number of bytes right before "a" and "b" that are the same, at most
+ * "max".
+ */
+static inline unsigned int match_backward(const unsigned char *a,
+					  const unsigned char *b,
+					  unsigned int max)
+{
+	unsigned int n = 0;
+
+#if defined(__SSE2__)
+	while (max - n >= 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a - n - 16));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b - n - 16));
+		unsigned int neq = ~_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xffff;
+		if (neq)
+			return n + __builtin_clz(neq) - 16;
+		n += 16;
+	}
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && \
+      __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (max - n >= 8) {
+		uint64_t x, y;
+		memcpy(&x, a - n - 8, 8);
+		memcpy(&y, b - n - 8, 8);
+		if (x != y)
+			return n + (__builtin_clzll(x ^ y) >> 3);
+		n += 8;
+	}
+#endif
+	while (n < max && a[-1 - (int)n] == b[-1 - (int)n])
+		n++;
+	return n;
+}
+
 /*
  * The maximum size for any opcode sequence, including the initial header
  * plus Rabin window plus biggest copy.
@@ -373,21 +466,21 @@ create_delta(const struct delta_index *index,
 			val = ((val << 8) | *data) ^ T[val >> RABIN_SHIFT];
 			i = val & index->hash_mask;
 			for (entry = index->hash[i]; entry < index->hash[i+1]; entry++) {
-				const unsigned char *ref = entry->ptr;
-				const unsigned char *src = data;
-				unsigned int ref_size = ref_top - ref;
+				const unsigned char *ref;
+				unsigned int ref_size, len;
 				if (entry->val != val)
 					continue;
-				if (ref_size > top - src)
-					ref_size = top - src;
+				ref = ref_data + entry->ofs;
+				ref_size = ref_top - ref;
+				if (ref_size > top - data)
+					ref_size = top - data;
 				if (ref_size <= msize)
 					break;
-				while (ref_size-- && *src++ == *ref)
-					ref++;
-				if (msize < ref - entry->ptr) {
+				len = match_forward(data, ref, ref_size);
+				if (msize < len) {
 					/* this is our best match so far */
-					msize = ref - entry->ptr;
-					moff = entry->ptr - ref_data;
+					msize = len;
+					moff = entry->ofs;
 					if (msize >= 4096) /* good enough */
 						break;
 				}
@@ -409,19 +502,19 @@ create_delta(const struct delta_index *index,
 			unsigned char *op;
 
 			if (inscnt) {
-				while (moff && ref_data[moff-1] == data[-1]) {
-					/* we can match one byte back */
-					msize++;
-					moff--;
-					data--;
-					outpos--;
-					if (--inscnt)
-						continue;
+				/* we may be able to match some bytes back */
+				unsigned int back;
+				back = match_backward(data, ref_data + moff,
+						      moff < inscnt ? moff : inscnt);
+				msize += back;
+				moff -= back;
+				data -= back;
+				outpos -= back;
+				inscnt -= back;
+				if (inscnt)
+					out[outpos - inscnt - 1] = inscnt;
+				else
 					outpos--;  /* remove count slot */
-					inscnt--;  /* make it -1 */
-					break;
-				}
-				out[outpos - inscnt - 1] = inscnt;
 				inscnt = 0;
 			}
 
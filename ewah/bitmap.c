@@ -0,0 +1,156 @@
+/*
+ * Plain (uncompressed) bitmaps, and conversion to and from EWAH.
+ */
+#include "cache.h"
+#include "ewok.h"
+
+#define EWAH_MASK(x) ((eword_t)1 << (x % BITS_IN_EWORD))
+#define EWAH_BLOCK(x) (x / BITS_IN_EWORD)
+
+struct bitmap *bitmap_new(void)
+{
+	struct bitmap *bitmap = xmalloc(sizeof(struct bitmap));
+	bitmap->words = xcalloc(32, sizeof(eword_t));
+	bitmap->word_alloc = 32;
+	return bitmap;
+}
+
+void bitmap_free(struct bitmap *bitmap)
+{
+	if (!bitmap)
+		return;
+	free(bitmap->words);
+	free(bitmap);
+}
+
+static void bitmap_grow(struct bitmap *self, size_t words)
+{
+	size_t old_size = self->word_alloc;
+
+	if (words <= old_size)
+		return;
+	self->word_alloc = alloc_nr(old_size);
+	if (self->word_alloc < words)
+		self->word_alloc = words;
+	self->words = xrealloc(self->words, self->word_alloc * sizeof(eword_t));
+	memset(self->words + old_size, 0,
+	       (self->word_alloc - old_size) * sizeof(eword_t));
+}
+
+void bitmap_set(struct bitmap *self, size_t pos)
+{
+	size_t block = EWAH_BLOCK(pos);
+
+	bitmap_grow(self, block + 1);
+	self->words[block] |= EWAH_MASK(pos);
+}
+
+int bitmap_get(struct bitmap *self, size_t pos)
+{
+	size_t block = EWAH_BLOCK(pos);
+	return block < self->word_alloc &&
+		(self->words[block] & EWAH_MASK(pos)) != 0;
+}
+
+void bitmap_or(struct bitmap *self, const struct bitmap *other)
+{
+	size_t i;
+
+	bitmap_grow(self, other->word_alloc);
+	for (i = 0; i < other->word_alloc; i++)
+		self->words[i] |= other->words[i];
+}
+
+void bitmap_and_not(struct bitmap *self, const struct bitmap *other)
+{
+	size_t i, count = other->word_alloc;
+
+	if (self->word_alloc < count)
+		count = self->word_alloc;
+	for (i = 0; i < count; i++)
+		self->words[i] &= ~other->words[i];
+}
+
+void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
+{
+	struct ewah_iterator it;
+	eword_t word;
+	size_t i = 0;
+
+	bitmap_grow(self, (other->bit_size + BITS_IN_EWORD - 1) / BITS_IN_EWORD);
+	ewah_iterator_init(&it, other);
+	while (ewah_iterator_next(&word, &it)) {
+		if (word) {
+			bitmap_grow(self, i + 1);
+			self->words[i] |= word;
+		}
+		i++;
+	}
+}
+
+static inline int popcount64(eword_t word)
+{
+#if defined(__GNUC__)
+	return __builtin_popcountll(word);
+#else
+	int count = 0;
+	while (word) {
+		word &= word - 1;
+		count++;
+	}
+	return count;
+#endif
+}
+
+size_t bitmap_popcount(struct bitmap *self)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < self->word_alloc; i++)
+		count += popcount64(self->words[i]);
+	return count;
+}
+
+struct bitmap *ewah_to_bitmap(struct ewah_bitmap *ewah)
+{
+	struct bitmap *bitmap = bitmap_new();
+	bitmap_or_ewah(bitmap, ewah);
+	return bitmap;
+}
+
+struct ewah_bitmap *bitmap_to_ewah(struct bitmap *bitmap)
+{
+	struct ewah_bitmap *ewah = ewah_new();
+	size_t i, running_empty_words = 0;
+
+	for (i = 0; i < bitmap->word_alloc; i++) {
+		if (!bitmap->words[i]) {
+			running_empty_words++;
+			continue;
+		}
+		if (running_empty_words) {
+			ewah_add_empty_words(ewah, 0, running_empty_words);
+			running_empty_words = 0;
+		}
+		ewah_add(ewah, bitmap->words[i]);
+	}
+	return ewah;
+}
+
+void bitmap_each_bit(struct bitmap *self, bitmap_each_fn fn, void *data)
+{
+	size_t i;
+
+	for (i = 0; i < self->word_alloc; i++) {
+		eword_t word = self->words[i];
+		size_t offset = i * BITS_IN_EWORD;
+
+		while (word) {
+			int bit = 0;
+			while (!(word & ((eword_t)1 << bit)))
+				bit++;
+			fn(offset + bit, data);
+			word &= word - 1;
+		}
+	}
+}
@@ -0,0 +1,224 @@
+/*
+ * EWAH compressed bitmaps: construction, serialization and iteration.
+ */
+#include "cache.h"
+#include "ewok.h"
+
+#define RLW_RUNNING_BITS 32
+#define RLW_LITERAL_BITS (BITS_IN_EWORD - 1 - RLW_RUNNING_BITS)
+#define RLW_LARGEST_RUNNING_COUNT (((eword_t)1 << RLW_RUNNING_BITS) - 1)
+#define RLW_LARGEST_LITERAL_COUNT (((eword_t)1 << RLW_LITERAL_BITS) - 1)
+#define RLW_RUNNING_LEN_SHIFT 1
+#define RLW_LITERAL_SHIFT (1 + RLW_RUNNING_BITS)
+
+static inline int rlw_get_run_bit(eword_t word)
+{
+	return word & 1;
+}
+
+static inline eword_t rlw_get_running_len(eword_t word)
+{
+	return (word >> RLW_RUNNING_LEN_SHIFT) & RLW_LARGEST_RUNNING_COUNT;
+}
+
+static inline eword_t rlw_get_literal_words(eword_t word)
+{
+	return word >> RLW_LITERAL_SHIFT;
+}
+
+static inline void rlw_set_run_bit(eword_t *word, int b)
+{
+	if (b)
+		*word |= (eword_t)1;
+	else
+		*word &= ~(eword_t)1;
+}
+
+static inline void rlw_set_running_len(eword_t *word, eword_t l)
+{
+	*word &= ~(RLW_LARGEST_RUNNING_COUNT << RLW_RUNNING_LEN_SHIFT);
+	*word |= l << RLW_RUNNING_LEN_SHIFT;
+}
+
+static inline void rlw_set_literal_words(eword_t *word, eword_t l)
+{
+	*word &= ~(RLW_LARGEST_LITERAL_COUNT << RLW_LITERAL_SHIFT);
+	*word |= l << RLW_LITERAL_SHIFT;
+}
+
+static void buffer_push(struct ewah_bitmap *self, eword_t value)
+{
+	ALLOC_GROW(self->buffer, self->buffer_size + 1, self->alloc_size);
+	self->buffer[self->buffer_size++] = value;
+}
+
+static void buffer_push_rlw(struct ewah_bitmap *self, eword_t value)
+{
+	buffer_push(self, value);
+	self->rlw = self->buffer_size - 1;
+}
+
+struct ewah_bitmap *ewah_new(void)
+{
+	struct ewah_bitmap *self = xcalloc(1, sizeof(*self));
+	ewah_clear(self);
+	return self;
+}
+
+void ewah_clear(struct ewah_bitmap *self)
+{
+	self->buffer_size = 0;
+	self->bit_size = 0;
+	buffer_push_rlw(self, 0);
+}
+
+void ewah_free(struct ewah_bitmap *self)
+{
+	if (!self)
+		return;
+	free(self->buffer);
+	free(self);
+}
+
+static void add_empty_word(struct ewah_bitmap *self, int v)
+{
+	eword_t *rlw = self->buffer + self->rlw;
+	int no_literal = !rlw_get_literal_words(*rlw);
+	eword_t run_len = rlw_get_running_len(*rlw);
+
+	if (no_literal && !run_len)
+		rlw_set_run_bit(rlw, v);
+
+	if (no_literal && rlw_get_run_bit(*rlw) == v &&
+	    run_len < RLW_LARGEST_RUNNING_COUNT) {
+		rlw_set_running_len(rlw, run_len + 1);
+		return;
+	}
+
+	buffer_push_rlw(self, 0);
+	rlw = self->buffer + self->rlw;
+	rlw_set_run_bit(rlw, v);
+	rlw_set_running_len(rlw, 1);
+}
+
+void ewah_add_empty_words(struct ewah_bitmap *self, int v, size_t nr)
+{
+	self->bit_size += nr * BITS_IN_EWORD;
+	while (nr--)
+		add_empty_word(self, v);
+}
+
+void ewah_add(struct ewah_bitmap *self, eword_t word)
+{
+	eword_t literals;
+
+	if (!word) {
+		ewah_add_empty_words(self, 0, 1);
+		return;
+	}
+	if (word == (eword_t)(~0)) {
+		ewah_add_empty_words(self, 1, 1);
+		return;
+	}
+
+	self->bit_size += BITS_IN_EWORD;
+	literals = rlw_get_literal_words(self->buffer[self->rlw]);
+	if (literals >= RLW_LARGEST_LITERAL_COUNT) {
+		buffer_push_rlw(self, 0);
+		literals = 0;
+	}
+	rlw_set_literal_words(self->buffer + self->rlw, literals + 1);
+	buffer_push(self, word);
+}
+
+static void put_be32(struct strbuf *out, uint32_t value)
+{
+	value = htonl(value);
+	strbuf_add(out, &value, 4);
+}
+
+static uint32_t get_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+void ewah_serialize_strbuf(struct ewah_bitmap *self, struct strbuf *out)
+{
+	size_t i;
+
+	put_be32(out, self->bit_size);
+	put_be32(out, self->buffer_size);
+	for (i = 0; i < self->buffer_size; i++) {
+		put_be32(out, (uint32_t)(self->buffer[i] >> 32));
+		put_be32(out, (uint32_t)self->buffer[i]);
+	}
+	put_be32(out, self->rlw);
+}
+
+ssize_t ewah_read_mmap(struct ewah_bitmap *self, const void *map, size_t len)
+{
+	const unsigned char *ptr = map;
+	size_t i, words;
+
+	if (len < 8)
+		return -1;
+	self->bit_size = get_be32(ptr);
+	words = get_be32(ptr + 4);
+	ptr += 8;
+	len -= 8;
+	if (len / 8 < words || len - words * 8 < 4)
+		return -1;
+
+	self->buffer_size = 0;
+	ALLOC_GROW(self->buffer, words ? words : 1, self->alloc_size);
+	for (i = 0; i < words; i++) {
+		self->buffer[i] = ((eword_t)get_be32(ptr) << 32) |
+				  get_be32(ptr + 4);
+		ptr += 8;
+	}
+	self->buffer_size = words;
+	self->rlw = get_be32(ptr);
+	ptr += 4;
+	if (!words) {
+		buffer_push_rlw(self, 0);
+		self->rlw = 0;
+	} else if (self->rlw >= words)
+		return -1;
+	return ptr - (const unsigned char *)map;
+}
+
+void ewah_iterator_init(struct ewah_iterator *it, struct ewah_bitmap *parent)
+{
+	it->buffer = parent->buffer;
+	it->buffer_size = parent->buffer_size;
+	it->pointer = 0;
+	it->run_left = 0;
+	it->literals_left = 0;
+	it->run_word = 0;
+}
+
+int ewah_iterator_next(eword_t *next, struct ewah_iterator *it)
+{
+	while (!it->run_left && !it->literals_left) {
+		eword_t rlw;
+
+		if (it->pointer >= it->buffer_size)
+			return 0;
+		rlw = it->buffer[it->pointer++];
+		it->run_word = rlw_get_run_bit(rlw) ? (eword_t)(~0) : 0;
+		it->run_left = rlw_get_running_len(rlw);
+		it->literals_left = rlw_get_literal_words(rlw);
+		if (it->literals_left > it->buffer_size - it->pointer)
+			it->literals_left = it->buffer_size - it->pointer;
+	}
+
+	if (it->run_left) {
+		it->run_left--;
+		*next = it->run_word;
+	} else {
+		it->literals_left--;
+		*next = it->buffer[it->pointer++];
+	}
+	return 1;
+}
@@ -0,0 +1,84 @@
+/*
+ * EWAH compressed bitmaps
+ *
+ * An EWAH bitmap is a sequence of 64-bit words.  Each "marker" word
+ * describes a run of identical all-zero or all-one words followed by
+ * a number of literal (uncompressed) words, which come right after
+ * the marker:
+ *
+ *   bit 0       value of the words in the run
+ *   bits 1-32   number of words in the run
+ *   bits 33-63  number of literal words following the marker
+ *
+ * Compressed bitmaps are only appended to or iterated over; set
+ * operations are done on plain "struct bitmap"s.
+ */
+#ifndef EWOK_H
+#define EWOK_H
+
+struct strbuf;
+typedef uint64_t eword_t;
+#define BITS_IN_EWORD (sizeof(eword_t) * 8)
+
+struct ewah_bitmap {
+	eword_t *buffer;
+	size_t buffer_size;
+	size_t alloc_size;
+	size_t bit_size;
+	size_t rlw;	/* position of the current marker word */
+};
+
+struct ewah_bitmap *ewah_new(void);
+void ewah_clear(struct ewah_bitmap *self);
+void ewah_free(struct ewah_bitmap *self);
+
+/* Append "nr" words of all ones (v == 1) or all zeroes (v == 0) */
+void ewah_add_empty_words(struct ewah_bitmap *self, int v, size_t nr);
+/* Append one uncompressed word */
+void ewah_add(struct ewah_bitmap *self, eword_t word);
+
+/*
+ * Serialized form: 32-bit bit size, 32-bit word count, the words in
+ * network byte order and the 32-bit position of the last marker.
+ */
+void ewah_serialize_strbuf(struct ewah_bitmap *self, struct strbuf *out);
+/* Returns the number of bytes consumed, or -1 on malformed input */
+ssize_t ewah_read_mmap(struct ewah_bitmap *self, const void *map, size_t len);
+
+struct ewah_iterator {
+	const eword_t *buffer;
+	size_t buffer_size;
+	size_t pointer;
+	eword_t run_word;
+	size_t run_left;
+	size_t literals_left;
+};
+
+void ewah_iterator_init(struct ewah_iterator *it, struct ewah_bitmap *parent);
+/* Store the next uncompressed word in *next; returns 0 at the end */
+int ewah_iterator_next(eword_t *next, struct ewah_iterator *it);
+
+/*
+ * Uncompressed bitmaps
+ */
+struct bitmap {
+	eword_t *words;
+	size_t word_alloc;
+};
+
+struct bitmap *bitmap_new(void);
+void bitmap_free(struct bitmap *self);
+void bitmap_set(struct bitmap *self, size_t pos);
+int bitmap_get(struct bitmap *self, size_t pos);
+void bitmap_or(struct bitmap *self, const struct bitmap *other);
+void bitmap_and_not(struct bitmap *self, const struct bitmap *other);
+void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other);
+size_t bitmap_popcount(struct bitmap *self);
+
+struct bitmap *ewah_to_bitmap(struct ewah_bitmap *ewah);
+struct ewah_bitmap *bitmap_to_ewah(struct bitmap *bitmap);
+
+typedef void (*bitmap_each_fn)(size_t pos, void *data);
+void bitmap_each_bit(struct bitmap *self, bitmap_each_fn fn, void *data);
+
+#endif
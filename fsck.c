@@ -335,7 +335,8 @@ static int fsck_commit(struct commit *commit, fsck_error error_func)
 	if (err)
 		return err;
 	if (!commit->tree)
-		return error_func(&commit->object, FSCK_ERROR, "could not load commit's tree %s", sha1_to_hex(tree_sha1));
+		/* not sha1_to_hex(), which may not be called from threads */
+		return error_func(&commit->object, FSCK_ERROR, "could not load commit's tree %.40s", commit->buffer + 5);
 
 	return 0;
 }
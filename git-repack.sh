@@ -15,6 +15,9 @@ F               pass --no-reuse-object to git-pack-objects
 n               do not run git-update-server-info
 q,quiet         be quiet
 l               pass --local to git-pack-objects
+b,write-bitmap-index  with -a, write a bitmap index for the new pack
+i,delta-islands pass --delta-islands to git-pack-objects
+g,geometric=    roll up small packs so pack sizes grow by this factor
 unpack-unreachable=  with -A, do not loosen objects older than this
  Packing constraints
 window=         size of the window used for delta compression
@@ -26,7 +29,7 @@ SUBDIRECTORY_OK='Yes'
 . git-sh-setup
 
 no_update_info= all_into_one= remove_redundant= unpack_unreachable=
-local= no_reuse= extra=
+local= no_reuse= extra= write_bitmap= geometric=
 while test $# != 0
 do
 	case "$1" in
@@ -41,6 +44,9 @@ do
 	-f)	no_reuse=--no-reuse-delta ;;
 	-F)	no_reuse=--no-reuse-object ;;
 	-l)	local=--local ;;
+	-b)	write_bitmap=t ;;
+	-i)	extra="$extra --delta-islands" ;;
+	-g)	geometric="$2"; shift ;;
 	--max-pack-size|--window|--window-memory|--depth)
 		extra="$extra $1=$2"; shift ;;
 	--) shift; break;;
@@ -54,17 +60,83 @@ true)
 	extra="$extra --delta-base-offset" ;;
 esac
 
+test -n "$write_bitmap" ||
+case "`git config --bool repack.writebitmaps`" in
+true)
+	write_bitmap=t ;;
+esac
+
+case "$geometric" in
+'')	;;
+*[!0-9]*|0|1)
+	die "--geometric needs an integer factor greater than 1" ;;
+*)
+	test -z "$all_into_one" ||
+	die "--geometric cannot be used with -a or -A" ;;
+esac
+
 PACKDIR="$GIT_OBJECT_DIRECTORY/pack"
 PACKTMP="$PACKDIR/.tmp-$$-pack"
 rm -f "$PACKTMP"-*
 trap 'rm -f "$PACKTMP"-*' 0 1 2 3 15
 
+# The number of objects, as recorded in the header of the pack $1
+pack_object_count () {
+	set -- $(od -An -tu1 -j8 -N4 "$1")
+	echo $(( (($1 * 256 + $2) * 256 + $3) * 256 + $4 ))
+}
+
 # There will be more repacking strategies to come...
-case ",$all_into_one," in
-,,)
+case ",$all_into_one,$geometric," in
+,,,)
 	args='--unpacked --incremental'
 	;;
-,t,)
+,,*)
+	# Sort the packs by their number of objects, and find the
+	# smallest ones that have to be rolled up into one new pack
+	# (together with the loose objects) for each pack to have at
+	# least $geometric times as many objects as the next smaller
+	# one.  The packs we leave alone are excluded from the new
+	# pack, so that none of their objects is written again.
+	args= existing= stdin_packs=
+	if [ -d "$PACKDIR" ]; then
+		for e in `cd "$PACKDIR" && find . -type f -name '*.pack' \
+			| sed -e 's/^\.\///' -e 's/\.pack$//'`
+		do
+			test -e "$PACKDIR/$e.keep" ||
+			echo "$(pack_object_count "$PACKDIR/$e.pack") $e"
+		done |
+		sort -n |
+		awk -v factor="$geometric" '
+		{
+			count[NR] = $1
+			name[NR] = $2
+		}
+		END {
+			# The heaviest packs may already be a progression.
+			for (i = NR; i > 1; i--)
+				if (count[i] < factor * count[i - 1])
+					break
+			roll = i > 1 ? i : 0
+			total = 0
+			for (i = 1; i <= roll; i++)
+				total += count[i]
+			# But the new pack may be too big to precede the
+			# lightest of them, which are then rolled up, too.
+			for (i = roll + 1; i <= NR; i++) {
+				if (count[i] >= factor * total)
+					break
+				roll = i
+				total += count[i]
+			}
+			for (i = 1; i <= NR; i++)
+				print (i <= roll ? "" : "^") name[i]
+		}' >"$PACKTMP-geometry" || exit
+		existing=$(sed -n -e '/^\^/d' -e p "$PACKTMP-geometry")
+	fi
+	stdin_packs="$PACKTMP-geometry"
+	;;
+,t,,)
 	args= existing=
 	if [ -d "$PACKDIR" ]; then
 		for e in `cd "$PACKDIR" && find . -type f -name '*.pack' \
@@ -87,13 +159,21 @@ case ",$all_into_one," in
 			args="$args $(echo "$unpack_unreachable" | tr ' ' .)"
 		fi
 	fi
+	test -z "$write_bitmap" || args="$args --write-bitmap-index"
 	;;
 esac
 
 mkdir -p "$PACKDIR" || exit
 
 args="$args $local ${GIT_QUIET:+-q} $no_reuse$extra"
-names=$(git pack-objects --keep-true-parents --honor-pack-keep --non-empty --all --reflog $args </dev/null "$PACKTMP") ||
+if test -n "$geometric"
+then
+	names=$(sed -e 's/$/.pack/' "$stdin_packs" 2>/dev/null |
+		git pack-objects --honor-pack-keep --non-empty --stdin-packs \
+			--unpacked $args "$PACKTMP")
+else
+	names=$(git pack-objects --keep-true-parents --honor-pack-keep --non-empty --all --reflog $args </dev/null "$PACKTMP")
+fi ||
 	exit 1
 if [ -z "$names" ]; then
 	say Nothing new to pack.
@@ -156,9 +236,22 @@ do
 	fullbases="$fullbases pack-$name"
 	chmod a-w "$PACKTMP-$name.pack"
 	chmod a-w "$PACKTMP-$name.idx"
+	if test -f "$PACKTMP-$name.rev"
+	then
+		chmod a-w "$PACKTMP-$name.rev" &&
+		mv -f "$PACKTMP-$name.rev" "$PACKDIR/pack-$name.rev"
+	else
+		rm -f "$PACKDIR/pack-$name.rev"
+	fi &&
 	mv -f "$PACKTMP-$name.pack" "$PACKDIR/pack-$name.pack" &&
 	mv -f "$PACKTMP-$name.idx"  "$PACKDIR/pack-$name.idx" ||
 	exit
+	if test -f "$PACKTMP-$name.bitmap"
+	then
+		chmod a-w "$PACKTMP-$name.bitmap" &&
+		mv -f "$PACKTMP-$name.bitmap" "$PACKDIR/pack-$name.bitmap" ||
+		exit
+	fi
 done
 
 # Remove the "old-" files
@@ -180,7 +273,7 @@ then
 		  do
 			case " $fullbases " in
 			*" $e "*) ;;
-			*)	rm -f "$e.pack" "$e.idx" "$e.keep" ;;
+			*)	rm -f "$e.pack" "$e.idx" "$e.keep" "$e.bitmap" "$e.rev" ;;
 			esac
 		  done
 		)
@@ -188,6 +281,12 @@ then
 	git prune-packed ${GIT_QUIET:+-q}
 fi
 
+# Keep an existing multi-pack-index in step with the packs
+if test -f "$PACKDIR/multi-pack-index"
+then
+	git multi-pack-index write || exit
+fi
+
 case "$no_update_info" in
 t) : ;;
 *) git update-server-info ;;
@@ -0,0 +1,790 @@
+#include "cache.h"
+#include "csum-file.h"
+#include "string-list.h"
+#include "midx.h"
+
+#define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
+#define MIDX_VERSION 1
+#define MIDX_HASH_VERSION 1 /* SHA-1 */
+
+#define MIDX_CHUNKID_PACKNAMES 0x504e414d /* "PNAM" */
+#define MIDX_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define MIDX_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define MIDX_CHUNKID_OBJECTOFFSETS 0x4f4f4646 /* "OOFF" */
+#define MIDX_CHUNKID_LARGEOFFSETS 0x4c4f4646 /* "LOFF" */
+
+#define MIDX_HEADER_SIZE 12
+#define MIDX_CHUNKLOOKUP_WIDTH 12
+#define MIDX_FANOUT_SIZE (4 * 256)
+#define MIDX_OFFSET_WIDTH 8
+#define MIDX_LARGE_OFFSET_WIDTH 8
+#define MIDX_MIN_SIZE (MIDX_HEADER_SIZE + 5 * MIDX_CHUNKLOOKUP_WIDTH + \
+		       MIDX_FANOUT_SIZE + 20)
+
+#define MIDX_LARGE_OFFSET_NEEDED 0x80000000
+
+struct multi_pack_index {
+	struct multi_pack_index *next;
+	const unsigned char *data;
+	size_t data_len;
+	uint32_t num_packs;
+	uint32_t num_objects;
+	uint32_t num_large_offsets;
+	const unsigned char *chunk_pack_names;
+	const unsigned char *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_object_offsets;
+	const unsigned char *chunk_large_offsets;
+	const char **pack_names;
+	struct packed_git **packs;
+	char object_dir[FLEX_ARRAY];
+};
+
+static struct multi_pack_index *multi_pack_index;
+
+static inline uint32_t midx_u32(const unsigned char *p)
+{
+	return ntohl(*(uint32_t *)p);
+}
+
+static char *get_midx_filename(const char *object_dir)
+{
+	return mkpathdup("%s/pack/multi-pack-index", object_dir);
+}
+
+static int parse_pack_names(struct multi_pack_index *m, uint64_t chunk_size,
+			    const char *path)
+{
+	const char *name = (const char *)m->chunk_pack_names;
+	const char *end = name + chunk_size;
+	uint32_t i;
+
+	m->pack_names = xcalloc(m->num_packs, sizeof(*m->pack_names));
+	for (i = 0; i < m->num_packs; i++) {
+		const char *nul = memchr(name, '\0', end - name);
+
+		if (!nul)
+			return error("multi-pack-index %s has a truncated"
+				     " pack-name chunk", path);
+		if (i && strcmp(m->pack_names[i - 1], name) >= 0)
+			return error("multi-pack-index %s has pack names out"
+				     " of order: '%s' before '%s'", path,
+				     m->pack_names[i - 1], name);
+		m->pack_names[i] = name;
+		name = nul + 1;
+	}
+	return 0;
+}
+
+static struct multi_pack_index *parse_multi_pack_index(const unsigned char *data,
+						       size_t len,
+						       const char *path,
+						       const char *object_dir)
+{
+	struct multi_pack_index *m;
+	const unsigned char *chunk_lookup;
+	uint32_t i, num_chunks;
+	uint64_t end = len - 20, pack_names_size = 0, num_offsets = 0;
+
+	if (midx_u32(data) != MIDX_SIGNATURE) {
+		error("multi-pack-index signature %X does not match"
+		      " signature %X", midx_u32(data), MIDX_SIGNATURE);
+		return NULL;
+	}
+	if (data[4] != MIDX_VERSION) {
+		error("multi-pack-index %s is version %d and is not"
+		      " supported by this binary", path, data[4]);
+		return NULL;
+	}
+	if (data[5] != MIDX_HASH_VERSION) {
+		error("multi-pack-index %s uses unknown hash version %d",
+		      path, data[5]);
+		return NULL;
+	}
+	num_chunks = data[6];
+	if (len < MIDX_HEADER_SIZE + (num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH
+		  + 20) {
+		error("multi-pack-index %s is too small", path);
+		return NULL;
+	}
+
+	m = xcalloc(1, sizeof(*m) + strlen(object_dir) + 1);
+	strcpy(m->object_dir, object_dir);
+	m->data = data;
+	m->data_len = len;
+	m->num_packs = midx_u32(data + 8);
+
+	chunk_lookup = data + MIDX_HEADER_SIZE;
+	for (i = 0; i < num_chunks; i++) {
+		uint32_t chunk_id = midx_u32(chunk_lookup);
+		uint64_t offset = ((uint64_t)midx_u32(chunk_lookup + 4) << 32) |
+				  midx_u32(chunk_lookup + 8);
+		uint64_t next = ((uint64_t)midx_u32(chunk_lookup + 16) << 32) |
+				midx_u32(chunk_lookup + 20);
+		const unsigned char *chunk = data + offset;
+
+		chunk_lookup += MIDX_CHUNKLOOKUP_WIDTH;
+		if (offset > next || next > end || (offset & 3)) {
+			error("multi-pack-index %s has an improper chunk"
+			      " offset %"PRIuMAX, path, (uintmax_t)offset);
+			goto bad;
+		}
+
+		switch (chunk_id) {
+		case MIDX_CHUNKID_PACKNAMES:
+			m->chunk_pack_names = chunk;
+			pack_names_size = next - offset;
+			break;
+		case MIDX_CHUNKID_OIDFANOUT:
+			if (next - offset != MIDX_FANOUT_SIZE)
+				goto bad_chunk;
+			m->chunk_oid_fanout = chunk;
+			break;
+		case MIDX_CHUNKID_OIDLOOKUP:
+			m->chunk_oid_lookup = chunk;
+			m->num_objects = (next - offset) / 20;
+			break;
+		case MIDX_CHUNKID_OBJECTOFFSETS:
+			if ((next - offset) % MIDX_OFFSET_WIDTH)
+				goto bad_chunk;
+			m->chunk_object_offsets = chunk;
+			num_offsets = (next - offset) / MIDX_OFFSET_WIDTH;
+			break;
+		case MIDX_CHUNKID_LARGEOFFSETS:
+			if ((next - offset) % MIDX_LARGE_OFFSET_WIDTH)
+				goto bad_chunk;
+			m->chunk_large_offsets = chunk;
+			m->num_large_offsets =
+				(next - offset) / MIDX_LARGE_OFFSET_WIDTH;
+			break;
+		}
+		continue;
+	bad_chunk:
+		error("multi-pack-index %s has a malformed chunk %08x",
+		      path, chunk_id);
+		goto bad;
+	}
+
+	if (!m->chunk_pack_names || !m->chunk_oid_fanout ||
+	    !m->chunk_oid_lookup || !m->chunk_object_offsets) {
+		error("multi-pack-index %s is missing a required chunk", path);
+		goto bad;
+	}
+	if (midx_u32(m->chunk_oid_fanout + 4 * 255) != m->num_objects ||
+	    num_offsets != m->num_objects) {
+		error("multi-pack-index %s has inconsistent object counts",
+		      path);
+		goto bad;
+	}
+	if (parse_pack_names(m, pack_names_size, path))
+		goto bad;
+	m->packs = xcalloc(m->num_packs, sizeof(*m->packs));
+	return m;
+
+bad:
+	free(m->pack_names);
+	free(m);
+	return NULL;
+}
+
+static struct multi_pack_index *load_multi_pack_index(const char *object_dir)
+{
+	struct multi_pack_index *m = NULL;
+	char *path = get_midx_filename(object_dir);
+	struct stat st;
+	size_t len;
+	void *data;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		goto out;
+	if (fstat(fd, &st)) {
+		close(fd);
+		goto out;
+	}
+	len = xsize_t(st.st_size);
+	if (len < MIDX_MIN_SIZE) {
+		close(fd);
+		error("multi-pack-index %s is too small", path);
+		goto out;
+	}
+	data = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	m = parse_multi_pack_index(data, len, path, object_dir);
+	if (!m)
+		munmap(data, len);
+out:
+	free(path);
+	return m;
+}
+
+static void free_multi_pack_index(struct multi_pack_index *m)
+{
+	munmap((void *)m->data, m->data_len);
+	free(m->pack_names);
+	free(m->packs);
+	free(m);
+}
+
+/* Find the packs of packed_git the multi-pack-index refers to */
+static void link_midx_packs(struct multi_pack_index *m)
+{
+	struct strbuf path = STRBUF_INIT;
+	uint32_t i;
+
+	for (i = 0; i < m->num_packs; i++) {
+		const char *name = m->pack_names[i];
+		size_t len = strlen(name);
+		struct packed_git *p;
+
+		if (len < 4 || strcmp(name + len - 4, ".idx"))
+			continue;
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s/pack/%.*s.pack", m->object_dir,
+			    (int)(len - 4), name);
+		for (p = packed_git; p; p = p->next) {
+			if (strcmp(p->pack_name, path.buf))
+				continue;
+			m->packs[i] = p;
+			break;
+		}
+	}
+	strbuf_release(&path);
+}
+
+void prepare_multi_pack_index_one(const char *object_dir)
+{
+	struct multi_pack_index *m;
+	uint32_t i;
+
+	if (!core_multi_pack_index)
+		return;
+	for (m = multi_pack_index; m; m = m->next)
+		if (!strcmp(m->object_dir, object_dir))
+			return;
+
+	m = load_multi_pack_index(object_dir);
+	if (!m)
+		return;
+	link_midx_packs(m);
+	for (i = 0; i < m->num_packs; i++)
+		if (m->packs[i])
+			m->packs[i]->multi_pack_index = 1;
+	m->next = multi_pack_index;
+	multi_pack_index = m;
+}
+
+void close_multi_pack_index(void)
+{
+	while (multi_pack_index) {
+		struct multi_pack_index *m = multi_pack_index;
+		uint32_t i;
+
+		for (i = 0; i < m->num_packs; i++)
+			if (m->packs[i])
+				m->packs[i]->multi_pack_index = 0;
+		multi_pack_index = m->next;
+		free_multi_pack_index(m);
+	}
+}
+
+static const unsigned char *midx_oid(struct multi_pack_index *m, uint32_t pos)
+{
+	return m->chunk_oid_lookup + 20 * pos;
+}
+
+static int bsearch_midx(struct multi_pack_index *m, const unsigned char *sha1,
+			uint32_t *pos)
+{
+	uint32_t lo, hi;
+
+	lo = sha1[0] ? midx_u32(m->chunk_oid_fanout + 4 * (sha1[0] - 1)) : 0;
+	hi = midx_u32(m->chunk_oid_fanout + 4 * sha1[0]);
+	if (hi > m->num_objects)
+		hi = m->num_objects;
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(sha1, midx_oid(m, mi));
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+static uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m,
+				       uint32_t pos)
+{
+	uint32_t pack_int_id =
+		midx_u32(m->chunk_object_offsets + MIDX_OFFSET_WIDTH * pos);
+
+	if (pack_int_id >= m->num_packs)
+		die("multi-pack-index refers to pack %"PRIu32
+		    " of %"PRIu32, pack_int_id, m->num_packs);
+	return pack_int_id;
+}
+
+static off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
+{
+	const unsigned char *offset_data =
+		m->chunk_object_offsets + MIDX_OFFSET_WIDTH * pos + 4;
+	uint32_t offset = midx_u32(offset_data);
+
+	if (!(offset & MIDX_LARGE_OFFSET_NEEDED))
+		return offset;
+
+	offset &= ~MIDX_LARGE_OFFSET_NEEDED;
+	if (offset >= m->num_large_offsets)
+		die("multi-pack-index has an invalid large offset %"PRIu32,
+		    offset);
+	offset_data = m->chunk_large_offsets + MIDX_LARGE_OFFSET_WIDTH * offset;
+	return ((off_t)midx_u32(offset_data) << 32) |
+		midx_u32(offset_data + 4);
+}
+
+int find_midx_entry(const unsigned char *sha1,
+		    struct packed_git **pack, off_t *offset)
+{
+	struct multi_pack_index *m;
+	uint32_t pos;
+
+	for (m = multi_pack_index; m; m = m->next) {
+		if (!bsearch_midx(m, sha1, &pos))
+			continue;
+		*pack = m->packs[nth_midxed_pack_int_id(m, pos)];
+		*offset = nth_midxed_offset(m, pos);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Writing
+ */
+struct midx_pack {
+	char *name;		/* "pack-<sha1>.idx" */
+	struct packed_git *p;
+};
+
+struct midx_entry {
+	unsigned char sha1[20];
+	uint32_t pack_int_id;
+	time_t pack_mtime;
+	off_t offset;
+};
+
+static int midx_pack_cmp(const void *a_, const void *b_)
+{
+	const struct midx_pack *a = a_, *b = b_;
+	return strcmp(a->name, b->name);
+}
+
+/*
+ * Sort by object name; of several copies of an object, the one in the
+ * youngest pack comes first and is the one that is kept, just like
+ * find_pack_entry() would find it first.
+ */
+static int midx_entry_cmp(const void *a_, const void *b_)
+{
+	const struct midx_entry *a = a_, *b = b_;
+	int cmp = hashcmp(a->sha1, b->sha1);
+
+	if (cmp)
+		return cmp;
+	if (a->pack_mtime != b->pack_mtime)
+		return a->pack_mtime > b->pack_mtime ? -1 : 1;
+	return a->pack_int_id < b->pack_int_id ? -1 :
+		a->pack_int_id > b->pack_int_id;
+}
+
+static char *pack_idx_basename(struct packed_git *p)
+{
+	const char *slash = strrchr(p->pack_name, '/');
+	const char *base = slash ? slash + 1 : p->pack_name;
+	size_t len = strlen(base);
+	char *name;
+
+	if (len > 5 && !strcmp(base + len - 5, ".pack"))
+		len -= 5;
+	name = xmalloc(len + 5);
+	memcpy(name, base, len);
+	strcpy(name + len, ".idx");
+	return name;
+}
+
+static void write_be32(struct sha1file *f, uint32_t value)
+{
+	value = htonl(value);
+	sha1write(f, &value, 4);
+}
+
+static void write_midx_chunk_pack_names(struct sha1file *f,
+					struct midx_pack *packs, int nr_packs)
+{
+	static unsigned char padding[4];
+	size_t written = 0;
+	int i;
+
+	for (i = 0; i < nr_packs; i++) {
+		size_t len = strlen(packs[i].name) + 1;
+		sha1write(f, packs[i].name, len);
+		written += len;
+	}
+	if (written & 3)
+		sha1write(f, padding, 4 - (written & 3));
+}
+
+static void write_midx_chunk_fanout(struct sha1file *f,
+				    struct midx_entry *entries, uint32_t nr)
+{
+	uint32_t i, count = 0;
+
+	for (i = 0; i < 256; i++) {
+		while (count < nr && entries[count].sha1[0] == i)
+			count++;
+		write_be32(f, count);
+	}
+}
+
+static void write_midx_chunk_oids(struct sha1file *f,
+				  struct midx_entry *entries, uint32_t nr)
+{
+	uint32_t i;
+
+	for (i = 0; i < nr; i++)
+		sha1write(f, entries[i].sha1, 20);
+}
+
+static void write_midx_chunk_offsets(struct sha1file *f,
+				     struct midx_entry *entries, uint32_t nr)
+{
+	uint32_t i, num_large_offsets = 0;
+
+	for (i = 0; i < nr; i++) {
+		write_be32(f, entries[i].pack_int_id);
+		if (entries[i].offset >> 31)
+			write_be32(f, MIDX_LARGE_OFFSET_NEEDED |
+				      num_large_offsets++);
+		else
+			write_be32(f, (uint32_t)entries[i].offset);
+	}
+}
+
+static void write_midx_chunk_large_offsets(struct sha1file *f,
+					   struct midx_entry *entries,
+					   uint32_t nr)
+{
+	uint32_t i;
+
+	for (i = 0; i < nr; i++) {
+		uint64_t offset = entries[i].offset;
+		if (!(offset >> 31))
+			continue;
+		write_be32(f, (uint32_t)(offset >> 32));
+		write_be32(f, (uint32_t)offset);
+	}
+}
+
+/* Write a multi-pack-index of the local packs except those in "drop" */
+static int write_midx_internal(const struct string_list *drop)
+{
+	static struct lock_file lock;
+	struct midx_pack *packs = NULL;
+	struct midx_entry *entries;
+	struct packed_git *p;
+	struct sha1file *f;
+	uint32_t chunk_ids[6];
+	uint64_t chunk_offsets[6];
+	uint32_t i, nr_entries, total = 0, num_large_offsets = 0;
+	size_t pack_names_size = 0;
+	int nr_packs = 0, alloc_packs = 0, num_chunks, fd;
+	unsigned char header[8];
+	char *midx_name;
+
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next) {
+		if (!p->pack_local)
+			continue;
+		if (drop && string_list_has_string(drop, p->pack_name))
+			continue;
+		if (open_pack_index(p)) {
+			free(packs);
+			return error("unable to open index of %s",
+				     p->pack_name);
+		}
+		ALLOC_GROW(packs, nr_packs + 1, alloc_packs);
+		packs[nr_packs].name = pack_idx_basename(p);
+		packs[nr_packs].p = p;
+		nr_packs++;
+		total += p->num_objects;
+	}
+	qsort(packs, nr_packs, sizeof(*packs), midx_pack_cmp);
+
+	entries = xmalloc(total * sizeof(*entries));
+	nr_entries = 0;
+	for (i = 0; i < nr_packs; i++) {
+		struct packed_git *p = packs[i].p;
+		uint32_t j;
+
+		pack_names_size += strlen(packs[i].name) + 1;
+		for (j = 0; j < p->num_objects; j++) {
+			struct midx_entry *e = &entries[nr_entries++];
+			hashcpy(e->sha1, nth_packed_object_sha1(p, j));
+			e->pack_int_id = i;
+			e->pack_mtime = p->mtime;
+			e->offset = nth_packed_object_offset(p, j);
+		}
+	}
+	qsort(entries, nr_entries, sizeof(*entries), midx_entry_cmp);
+	for (i = total = 0; i < nr_entries; i++) {
+		if (total && !hashcmp(entries[total - 1].sha1, entries[i].sha1))
+			continue;
+		entries[total++] = entries[i];
+		if (entries[i].offset >> 31)
+			num_large_offsets++;
+	}
+	nr_entries = total;
+	pack_names_size = (pack_names_size + 3) & ~(size_t)3;
+
+	num_chunks = num_large_offsets ? 5 : 4;
+	chunk_ids[0] = MIDX_CHUNKID_PACKNAMES;
+	chunk_ids[1] = MIDX_CHUNKID_OIDFANOUT;
+	chunk_ids[2] = MIDX_CHUNKID_OIDLOOKUP;
+	chunk_ids[3] = MIDX_CHUNKID_OBJECTOFFSETS;
+	chunk_ids[4] = num_large_offsets ? MIDX_CHUNKID_LARGEOFFSETS : 0;
+	chunk_ids[5] = 0;
+
+	chunk_offsets[0] = MIDX_HEADER_SIZE +
+		(num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH;
+	chunk_offsets[1] = chunk_offsets[0] + pack_names_size;
+	chunk_offsets[2] = chunk_offsets[1] + MIDX_FANOUT_SIZE;
+	chunk_offsets[3] = chunk_offsets[2] + 20 * nr_entries;
+	chunk_offsets[4] = chunk_offsets[3] + MIDX_OFFSET_WIDTH * nr_entries;
+	chunk_offsets[5] = chunk_offsets[4] +
+		MIDX_LARGE_OFFSET_WIDTH * num_large_offsets;
+
+	midx_name = get_midx_filename(get_object_directory());
+	if (safe_create_leading_directories(midx_name))
+		die_errno("unable to create leading directories of %s",
+			  midx_name);
+	fd = hold_lock_file_for_update(&lock, midx_name, LOCK_DIE_ON_ERROR);
+	f = sha1fd(fd, lock.filename);
+
+	write_be32(f, MIDX_SIGNATURE);
+	header[0] = MIDX_VERSION;
+	header[1] = MIDX_HASH_VERSION;
+	header[2] = num_chunks;
+	header[3] = 0; /* number of base multi-pack-index files */
+	sha1write(f, header, 4);
+	write_be32(f, nr_packs);
+
+	for (i = 0; i <= num_chunks; i++) {
+		write_be32(f, chunk_ids[i]);
+		write_be32(f, (uint32_t)(chunk_offsets[i] >> 32));
+		write_be32(f, (uint32_t)chunk_offsets[i]);
+	}
+
+	write_midx_chunk_pack_names(f, packs, nr_packs);
+	write_midx_chunk_fanout(f, entries, nr_entries);
+	write_midx_chunk_oids(f, entries, nr_entries);
+	write_midx_chunk_offsets(f, entries, nr_entries);
+	write_midx_chunk_large_offsets(f, entries, nr_entries);
+
+	sha1close(f, NULL, CSUM_FSYNC);
+	lock.fd = -1;
+	if (commit_lock_file(&lock))
+		die_errno("unable to write multi-pack-index %s", midx_name);
+
+	for (i = 0; i < nr_packs; i++)
+		free(packs[i].name);
+	free(packs);
+	free(entries);
+	free(midx_name);
+	return 0;
+}
+
+int write_multi_pack_index(void)
+{
+	return write_midx_internal(NULL);
+}
+
+/*
+ * Verification
+ */
+static int verify_midx_error;
+
+static void midx_report(const char *fmt, ...)
+{
+	va_list ap;
+	struct strbuf sb = STRBUF_INIT;
+
+	va_start(ap, fmt);
+	strbuf_vaddf(&sb, fmt, ap);
+	va_end(ap);
+	error("%s", sb.buf);
+	strbuf_release(&sb);
+	verify_midx_error = 1;
+}
+
+static int verify_midx_checksum(struct multi_pack_index *m)
+{
+	git_SHA_CTX ctx;
+	unsigned char sha1[20];
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, m->data, m->data_len - 20);
+	git_SHA1_Final(sha1, &ctx);
+	return hashcmp(sha1, m->data + m->data_len - 20);
+}
+
+int verify_multi_pack_index(void)
+{
+	struct multi_pack_index *m;
+	char *midx_name;
+	uint32_t i, fanout_value = 0;
+
+	verify_midx_error = 0;
+	midx_name = get_midx_filename(get_object_directory());
+	m = load_multi_pack_index(get_object_directory());
+	if (!m) {
+		int missing = access(midx_name, F_OK);
+		free(midx_name);
+		return missing ? 0 : -1;
+	}
+
+	if (verify_midx_checksum(m))
+		midx_report("multi-pack-index %s has incorrect checksum",
+			    midx_name);
+
+	prepare_packed_git();
+	link_midx_packs(m);
+	for (i = 0; i < m->num_packs; i++) {
+		if (!m->packs[i])
+			midx_report("multi-pack-index refers to missing pack %s",
+				    m->pack_names[i]);
+		else if (open_pack_index(m->packs[i]))
+			midx_report("unable to open index of pack %s",
+				    m->pack_names[i]);
+	}
+
+	for (i = 0; i < 256; i++) {
+		uint32_t value = midx_u32(m->chunk_oid_fanout + 4 * i);
+		if (value < fanout_value)
+			midx_report("multi-pack-index fanout values out of order");
+		fanout_value = value;
+	}
+
+	for (i = 0; i < m->num_objects; i++) {
+		const unsigned char *sha1 = midx_oid(m, i);
+		uint32_t pack_int_id;
+		struct packed_git *p;
+		off_t offset, pack_offset;
+
+		if (i && hashcmp(midx_oid(m, i - 1), sha1) >= 0) {
+			midx_report("multi-pack-index has incorrect OID order:"
+				    " %s then %s",
+				    sha1_to_hex(midx_oid(m, i - 1)),
+				    sha1_to_hex(sha1));
+			continue;
+		}
+		if (midx_u32(m->chunk_oid_fanout + 4 * sha1[0]) <= i ||
+		    (sha1[0] &&
+		     midx_u32(m->chunk_oid_fanout + 4 * (sha1[0] - 1)) > i))
+			midx_report("multi-pack-index has incorrect fanout"
+				    " value for %s", sha1_to_hex(sha1));
+
+		pack_int_id = midx_u32(m->chunk_object_offsets +
+				       MIDX_OFFSET_WIDTH * i);
+		if (pack_int_id >= m->num_packs) {
+			midx_report("multi-pack-index refers to pack %"PRIu32
+				    " for %s", pack_int_id, sha1_to_hex(sha1));
+			continue;
+		}
+		p = m->packs[pack_int_id];
+		if (!p || !p->index_data)
+			continue;
+		offset = nth_midxed_offset(m, i);
+		pack_offset = find_pack_entry_one(sha1, p);
+		if (offset != pack_offset)
+			midx_report("multi-pack-index offset for %s is %"PRIuMAX
+				    " != %"PRIuMAX" in %s", sha1_to_hex(sha1),
+				    (uintmax_t)offset, (uintmax_t)pack_offset,
+				    m->pack_names[pack_int_id]);
+	}
+
+	free_multi_pack_index(m);
+	free(midx_name);
+	return verify_midx_error ? -1 : 0;
+}
+
+/*
+ * Expiring
+ */
+static void unlink_pack(struct packed_git *p)
+{
+	static const char *exts[] = { ".pack", ".idx", ".bitmap", ".rev" };
+	struct strbuf path = STRBUF_INIT;
+	size_t len = strlen(p->pack_name) - strlen(".pack");
+	int i;
+
+	close_pack_windows(p);
+	for (i = 0; i < ARRAY_SIZE(exts); i++) {
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%.*s%s", (int)len, p->pack_name, exts[i]);
+		unlink_or_warn(path.buf);
+	}
+	strbuf_release(&path);
+}
+
+int expire_multi_pack_index(void)
+{
+	struct multi_pack_index *m;
+	struct string_list drop = STRING_LIST_INIT_DUP;
+	uint32_t i, *counts;
+	int ret;
+
+	m = load_multi_pack_index(get_object_directory());
+	if (!m)
+		return 0;
+	prepare_packed_git();
+	link_midx_packs(m);
+
+	counts = xcalloc(m->num_packs, sizeof(*counts));
+	for (i = 0; i < m->num_objects; i++)
+		counts[nth_midxed_pack_int_id(m, i)]++;
+
+	/*
+	 * A pack we drop may hold the only other copy of objects that
+	 * the multi-pack-index found in a pack which is gone by now.
+	 */
+	for (i = 0; i < m->num_packs; i++) {
+		if (counts[i] && !m->packs[i]) {
+			error("multi-pack-index refers to missing pack %s;"
+			      " write it again first", m->pack_names[i]);
+			free(counts);
+			free_multi_pack_index(m);
+			return -1;
+		}
+	}
+
+	for (i = 0; i < m->num_packs; i++) {
+		struct packed_git *p = m->packs[i];
+
+		if (counts[i] || !p || p->pack_keep)
+			continue;
+		unlink_pack(p);
+		string_list_insert(&drop, p->pack_name);
+	}
+	free(counts);
+	free_multi_pack_index(m);
+
+	ret = write_midx_internal(&drop);
+	string_list_clear(&drop, 0);
+	return ret;
+}
@@ -0,0 +1,38 @@
+#ifndef MIDX_H
+#define MIDX_H
+
+/*
+ * The multi-pack-index in $GIT_OBJECT_DIRECTORY/pack/multi-pack-index
+ * lists the objects of all packs of that directory in one sorted
+ * table, so that an object can be found with a single binary search
+ * however many packs there are.  See
+ * Documentation/technical/multi-pack-index-format.txt.
+ */
+
+/*
+ * Load the multi-pack-index of "object_dir", if core.multiPackIndex
+ * is set and there is one, and mark the packs of packed_git it covers.
+ * Called by prepare_packed_git() for every object directory.
+ */
+extern void prepare_multi_pack_index_one(const char *object_dir);
+
+/*
+ * Look "sha1" up in the loaded multi-pack-indexes.  Returns 1 and
+ * fills in "pack" and "offset" if found; "pack" is NULL if the pack
+ * the object was recorded in has disappeared since.
+ */
+extern int find_midx_entry(const unsigned char *sha1,
+			   struct packed_git **pack, off_t *offset);
+
+extern void close_multi_pack_index(void);
+
+extern int write_multi_pack_index(void);
+extern int verify_multi_pack_index(void);
+
+/*
+ * Delete the packs none of whose objects the multi-pack-index refers
+ * to (all of them have a copy in another pack) and rewrite it.
+ */
+extern int expire_multi_pack_index(void);
+
+#endif
@@ -5,17 +5,44 @@
 #include "commit.h"
 #include "tag.h"
 
-static struct object **obj_hash;
+/*
+ * The object hash is an open-addressing table with linear probing.
+ * Each slot keeps the first four bytes of the object name next to
+ * the pointer, so that a probe only has to follow the pointer (and
+ * miss the cache) when those bytes match.
+ *
+ * When the table fills up, a table twice the size is started and the
+ * slots of the old one are moved over a chunk at a time by later
+ * insertions, so that a big walk does not stop to rehash everything
+ * at once.  Until then, lookups that miss the new table look in the
+ * old one too; slots are never cleared there, so its probe sequences
+ * stay intact.
+ */
+struct obj_hash_slot {
+	uint32_t hash;
+	struct object *obj;
+};
+
+static struct obj_hash_slot *obj_hash;
 static int nr_objs, obj_hash_size;
 
+/* slots [0, old_hash_moved) of old_hash are in obj_hash already */
+static struct obj_hash_slot *old_hash;
+static unsigned int old_hash_size, old_hash_moved;
+
+#define REHASH_CHUNK 16
+
 unsigned int get_max_object_index(void)
 {
-	return obj_hash_size;
+	return obj_hash_size + old_hash_size;
 }
 
 struct object *get_indexed_object(unsigned int idx)
 {
-	return obj_hash[idx];
+	if (idx < obj_hash_size)
+		return obj_hash[idx].obj;
+	idx -= obj_hash_size;
+	return idx < old_hash_moved ? NULL : old_hash[idx].obj;
 }
 
 static const char *object_type_strings[] = {
@@ -43,67 +70,96 @@ int type_from_string(const char *str)
 	die("invalid object type \"%s\"", str);
 }
 
-static unsigned int hash_obj(struct object *obj, unsigned int n)
+static inline uint32_t sha1_hash32(const unsigned char *sha1)
 {
-	unsigned int hash;
-	memcpy(&hash, obj->sha1, sizeof(unsigned int));
-	return hash % n;
+	uint32_t hash;
+	memcpy(&hash, sha1, sizeof(hash));
+	return hash;
 }
 
-static void insert_obj_hash(struct object *obj, struct object **hash, unsigned int size)
+static void insert_obj_hash(struct object *obj, uint32_t hash,
+			    struct obj_hash_slot *table, unsigned int size)
 {
-	unsigned int j = hash_obj(obj, size);
+	unsigned int j = hash % size;
 
-	while (hash[j]) {
+	while (table[j].obj) {
 		j++;
 		if (j >= size)
 			j = 0;
 	}
-	hash[j] = obj;
+	table[j].hash = hash;
+	table[j].obj = obj;
 }
 
-static unsigned int hashtable_index(const unsigned char *sha1)
+static struct object *find_obj_hash(const unsigned char *sha1, uint32_t hash,
+				    struct obj_hash_slot *table, unsigned int size)
 {
-	unsigned int i;
-	memcpy(&i, sha1, sizeof(unsigned int));
-	return i % obj_hash_size;
+	unsigned int i = hash % size;
+	struct object *obj;
+
+	while ((obj = table[i].obj) != NULL) {
+		if (table[i].hash == hash && !hashcmp(sha1, obj->sha1))
+			break;
+		i++;
+		if (i == size)
+			i = 0;
+	}
+	return obj;
 }
 
 struct object *lookup_object(const unsigned char *sha1)
 {
-	unsigned int i;
+	uint32_t hash;
 	struct object *obj;
 
 	if (!obj_hash)
 		return NULL;
 
-	i = hashtable_index(sha1);
-	while ((obj = obj_hash[i]) != NULL) {
-		if (!hashcmp(sha1, obj->sha1))
-			break;
-		i++;
-		if (i == obj_hash_size)
-			i = 0;
-	}
+	hash = sha1_hash32(sha1);
+	obj = find_obj_hash(sha1, hash, obj_hash, obj_hash_size);
+	if (!obj && old_hash)
+		obj = find_obj_hash(sha1, hash, old_hash, old_hash_size);
 	return obj;
 }
 
+/* Move up to "nr" slots of the old table over to the new one. */
+static void rehash_some(unsigned int nr)
+{
+	unsigned int end = old_hash_moved + nr;
+
+	if (end > old_hash_size)
+		end = old_hash_size;
+	for (; old_hash_moved < end; old_hash_moved++) {
+		struct obj_hash_slot *slot = &old_hash[old_hash_moved];
+		if (slot->obj)
+			insert_obj_hash(slot->obj, slot->hash,
+					obj_hash, obj_hash_size);
+	}
+	if (old_hash_moved == old_hash_size) {
+		free(old_hash);
+		old_hash = NULL;
+		old_hash_size = old_hash_moved = 0;
+	}
+}
+
 static void grow_object_hash(void)
 {
-	int i;
 	int new_hash_size = obj_hash_size < 32 ? 32 : 2 * obj_hash_size;
-	struct object **new_hash;
-
-	new_hash = xcalloc(new_hash_size, sizeof(struct object *));
-	for (i = 0; i < obj_hash_size; i++) {
-		struct object *obj = obj_hash[i];
-		if (!obj)
-			continue;
-		insert_obj_hash(obj, new_hash, new_hash_size);
-	}
-	free(obj_hash);
-	obj_hash = new_hash;
+
+	/*
+	 * The table doubles after nr_objs has doubled, and each
+	 * insertion moves REHASH_CHUNK slots, so the previous move is
+	 * long over by now; finish it anyway in case it is not.
+	 */
+	if (old_hash)
+		rehash_some(old_hash_size);
+	old_hash = obj_hash;
+	old_hash_size = obj_hash_size;
+	old_hash_moved = 0;
+	obj_hash = xcalloc(new_hash_size, sizeof(*obj_hash));
 	obj_hash_size = new_hash_size;
+	if (!old_hash)
+		old_hash_size = 0;
 }
 
 void *create_object(const unsigned char *sha1, int type, void *o)
@@ -118,8 +174,10 @@ void *create_object(const unsigned char *sha1, int type, void *o)
 
 	if (obj_hash_size - 1 <= nr_objs * 2)
 		grow_object_hash();
+	if (old_hash)
+		rehash_some(REHASH_CHUNK);
 
-	insert_obj_hash(obj, obj_hash, obj_hash_size);
+	insert_obj_hash(obj, sha1_hash32(sha1), obj_hash, obj_hash_size);
 	nr_objs++;
 	return obj;
 }
@@ -299,10 +357,10 @@ void object_array_remove_duplicates(struct object_array *array)
 
 void clear_object_flags(unsigned flags)
 {
-	int i;
+	unsigned int i, max = get_max_object_index();
 
-	for (i=0; i < obj_hash_size; i++) {
-		struct object *obj = obj_hash[i];
+	for (i = 0; i < max; i++) {
+		struct object *obj = get_indexed_object(i);
 		if (obj)
 			obj->flags &= ~flags;
 	}
@@ -0,0 +1,200 @@
+#include "cache.h"
+#include "commit.h"
+#include "refs.h"
+#include "decorate.h"
+#include "csum-file.h"
+#include "pack-bitmap.h"
+
+/* Besides the ref tips, every this many commits get a bitmap */
+#define BITMAP_COMMIT_INTERVAL 100
+
+static struct bitmap_writer {
+	struct packed_git *pack;
+	uint32_t *order;		/* .idx position -> bit */
+	struct decoration stored;	/* struct commit -> struct ewah_bitmap */
+	struct commit **selected;
+	int selected_nr, selected_alloc;
+} writer;
+
+static void select_commit(struct commit *commit)
+{
+	ALLOC_GROW(writer.selected, writer.selected_nr + 1,
+		   writer.selected_alloc);
+	writer.selected[writer.selected_nr++] = commit;
+}
+
+static int select_ref_tip(const char *refname, const unsigned char *sha1,
+			  int flags, void *cb_data)
+{
+	struct commit *commit = lookup_commit_reference_gently(sha1, 1);
+
+	if (commit && find_pack_entry_pos(commit->object.sha1, writer.pack) >= 0)
+		select_commit(commit);
+	return 0;
+}
+
+static int commit_date_desc_cmp(const void *a_, const void *b_)
+{
+	const struct commit *a = *(const struct commit **)a_;
+	const struct commit *b = *(const struct commit **)b_;
+
+	if (a->date != b->date)
+		return a->date < b->date ? 1 : -1;
+	return hashcmp(a->object.sha1, b->object.sha1);
+}
+
+static void select_commits(const enum object_type *types)
+{
+	struct commit **commits = NULL;
+	int i, nr = 0, alloc = 0, last;
+
+	for (i = 0; i < writer.pack->num_objects; i++) {
+		struct commit *commit;
+
+		if (types[i] != OBJ_COMMIT)
+			continue;
+		commit = lookup_commit(nth_packed_object_sha1(writer.pack, i));
+		if (!commit || parse_commit(commit))
+			die("unable to parse commit %s",
+			    sha1_to_hex(nth_packed_object_sha1(writer.pack, i)));
+		ALLOC_GROW(commits, nr + 1, alloc);
+		commits[nr++] = commit;
+	}
+	qsort(commits, nr, sizeof(*commits), commit_date_desc_cmp);
+	for (i = 0; i < nr; i += BITMAP_COMMIT_INTERVAL)
+		select_commit(commits[i]);
+	free(commits);
+
+	for_each_ref(select_ref_tip, NULL);
+
+	/*
+	 * Build the oldest bitmaps first, so that the walks for the
+	 * younger ones can stop at them.
+	 */
+	qsort(writer.selected, writer.selected_nr, sizeof(*writer.selected),
+	      commit_date_desc_cmp);
+	for (i = last = 0; i < writer.selected_nr; i++)
+		if (!last || writer.selected[last - 1] != writer.selected[i])
+			writer.selected[last++] = writer.selected[i];
+	writer.selected_nr = last;
+	for (i = 0; i < last / 2; i++) {
+		struct commit *tmp = writer.selected[i];
+		writer.selected[i] = writer.selected[last - 1 - i];
+		writer.selected[last - 1 - i] = tmp;
+	}
+}
+
+static struct ewah_bitmap *type_bitmap(const enum object_type *types,
+				       enum object_type type)
+{
+	struct bitmap *bitmap = bitmap_new();
+	struct ewah_bitmap *ewah;
+	uint32_t i;
+
+	for (i = 0; i < writer.pack->num_objects; i++)
+		if (types[i] == type)
+			bitmap_set(bitmap, writer.order[i]);
+	ewah = bitmap_to_ewah(bitmap);
+	bitmap_free(bitmap);
+	return ewah;
+}
+
+static void write_ewah(struct sha1file *f, struct ewah_bitmap *ewah)
+{
+	struct strbuf sb = STRBUF_INIT;
+
+	ewah_serialize_strbuf(ewah, &sb);
+	sha1write(f, sb.buf, sb.len);
+	strbuf_release(&sb);
+}
+
+int write_bitmap_index(const char *idx_name, const char *bitmap_name,
+		       const enum object_type *types)
+{
+	static struct lock_file lock;
+	static const enum object_type type_order[] = {
+		OBJ_COMMIT, OBJ_TREE, OBJ_BLOB, OBJ_TAG
+	};
+	struct bitmap_disk_header header;
+	struct sha1file *f;
+	int i, fd, ret = 0;
+
+	/* the bitmaps would record the grafted history, not the real one */
+	if (commit_grafts_present())
+		return error("not writing a bitmap index with grafts in use");
+
+	writer.pack = add_packed_git(idx_name, strlen(idx_name), 1);
+	if (!writer.pack || open_pack_index(writer.pack))
+		die("unable to open pack index %s", idx_name);
+	writer.order = bitmap_pack_order(writer.pack);
+
+	select_commits(types);
+
+	fd = hold_lock_file_for_update(&lock, bitmap_name, LOCK_DIE_ON_ERROR);
+	f = sha1fd(fd, lock.filename);
+
+	memset(&header, 0, sizeof(header));
+	header.signature = htonl(BITMAP_IDX_SIGNATURE);
+	header.version = htons(BITMAP_IDX_VERSION);
+	header.options = htons(BITMAP_OPT_FULL_DAG);
+	header.entry_count = htonl(writer.selected_nr);
+	hashcpy(header.checksum, (const unsigned char *)writer.pack->index_data +
+		writer.pack->index_size - 40);
+	sha1write(f, &header, sizeof(header));
+
+	for (i = 0; i < ARRAY_SIZE(type_order); i++) {
+		struct ewah_bitmap *ewah = type_bitmap(types, type_order[i]);
+		write_ewah(f, ewah);
+		ewah_free(ewah);
+	}
+
+	for (i = 0; i < writer.selected_nr; i++) {
+		struct commit *commit = writer.selected[i];
+		struct bitmap *bitmap = bitmap_new();
+		struct ewah_bitmap *ewah;
+		unsigned char entry_header[6];
+		uint32_t pos;
+
+		if (bitmap_fill_reachable(writer.pack, writer.order,
+					  &writer.stored, bitmap,
+					  &commit->object)) {
+			bitmap_free(bitmap);
+			ret = error("history of %s is not contained in the pack",
+				    sha1_to_hex(commit->object.sha1));
+			break;
+		}
+		ewah = bitmap_to_ewah(bitmap);
+		bitmap_free(bitmap);
+		add_decoration(&writer.stored, &commit->object, ewah);
+
+		pos = htonl(find_pack_entry_pos(commit->object.sha1,
+						writer.pack));
+		memcpy(entry_header, &pos, 4);
+		entry_header[4] = 0; /* xor offset */
+		entry_header[5] = 0; /* flags */
+		sha1write(f, entry_header, sizeof(entry_header));
+		write_ewah(f, ewah);
+	}
+
+	if (ret) {
+		sha1close(f, NULL, CSUM_CLOSE);
+		lock.fd = -1;
+		rollback_lock_file(&lock);
+	} else {
+		sha1close(f, NULL, CSUM_FSYNC);
+		lock.fd = -1;
+		if (commit_lock_file(&lock))
+			ret = error("unable to write bitmap index %s: %s",
+				    bitmap_name, strerror(errno));
+	}
+
+	for (i = 0; i < writer.stored.size; i++)
+		ewah_free(writer.stored.hash[i].decoration);
+	free(writer.stored.hash);
+	close_pack_index(writer.pack);
+	free(writer.pack);
+	free(writer.order);
+	free(writer.selected);
+	memset(&writer, 0, sizeof(writer));
+	return ret;
+}
@@ -0,0 +1,453 @@
+#include "cache.h"
+#include "commit.h"
+#include "tag.h"
+#include "tree.h"
+#include "tree-walk.h"
+#include "decorate.h"
+#include "diff.h"
+#include "revision.h"
+#include "pack-revindex.h"
+#include "pack-bitmap.h"
+
+/*
+ * The one bitmap index we use; only a single pack in the repository
+ * (normally the result of "repack -a") is expected to carry one.
+ */
+static struct bitmap_index {
+	struct packed_git *pack;
+	uint32_t *idx_to_bit;
+	uint32_t *bit_to_idx;
+	struct decoration stored;	/* struct commit -> struct ewah_bitmap */
+	struct bitmap *commits;
+	struct bitmap *trees;
+	struct bitmap *blobs;
+	struct bitmap *tags;
+	struct bitmap *result;
+	uint32_t reuse_objects;
+	int loaded;
+} bitmap_git;
+
+static int offset_cmp(const void *a_, const void *b_)
+{
+	const struct revindex_entry *a = a_, *b = b_;
+	return (a->offset < b->offset) ? -1 : (a->offset > b->offset) ? 1 : 0;
+}
+
+uint32_t *bitmap_pack_order(struct packed_git *pack)
+{
+	struct revindex_entry *entries;
+	uint32_t *idx_to_bit, i;
+
+	entries = xmalloc(pack->num_objects * sizeof(*entries));
+	for (i = 0; i < pack->num_objects; i++) {
+		entries[i].offset = nth_packed_object_offset(pack, i);
+		entries[i].nr = i;
+	}
+	qsort(entries, pack->num_objects, sizeof(*entries), offset_cmp);
+
+	idx_to_bit = xmalloc(pack->num_objects * sizeof(*idx_to_bit));
+	for (i = 0; i < pack->num_objects; i++)
+		idx_to_bit[entries[i].nr] = i;
+	free(entries);
+	return idx_to_bit;
+}
+
+static int bit_position(struct packed_git *pack, const uint32_t *order,
+			const unsigned char *sha1)
+{
+	int pos = find_pack_entry_pos(sha1, pack);
+	return pos < 0 ? -1 : order[pos];
+}
+
+static int set_object_bit(struct packed_git *pack, const uint32_t *order,
+			  struct bitmap *result, const unsigned char *sha1)
+{
+	int pos = bit_position(pack, order, sha1);
+	if (pos < 0)
+		return -1;
+	bitmap_set(result, pos);
+	return 0;
+}
+
+static int fill_tree(struct packed_git *pack, const uint32_t *order,
+		     struct bitmap *result, const unsigned char *sha1)
+{
+	struct tree_desc desc;
+	struct name_entry entry;
+	enum object_type type;
+	unsigned long size;
+	void *buffer;
+	int pos, ret = 0;
+
+	pos = bit_position(pack, order, sha1);
+	if (pos < 0)
+		return -1;
+	/* a tree is only ever marked together with everything it contains */
+	if (bitmap_get(result, pos))
+		return 0;
+	bitmap_set(result, pos);
+
+	buffer = read_sha1_file(sha1, &type, &size);
+	if (!buffer)
+		return -1;
+	if (type != OBJ_TREE) {
+		free(buffer);
+		return -1;
+	}
+	init_tree_desc(&desc, buffer, size);
+	while (!ret && tree_entry(&desc, &entry)) {
+		if (S_ISGITLINK(entry.mode))
+			continue;
+		if (S_ISDIR(entry.mode))
+			ret = fill_tree(pack, order, result, entry.sha1);
+		else
+			ret = set_object_bit(pack, order, result, entry.sha1);
+	}
+	free(buffer);
+	return ret;
+}
+
+static int fill_commit(struct packed_git *pack, const uint32_t *order,
+		       struct decoration *stored, struct bitmap *result,
+		       struct commit *tip)
+{
+	struct commit_list *stack = NULL;
+	int ret = 0;
+
+	commit_list_insert(tip, &stack);
+	while (stack) {
+		struct commit *commit = pop_commit(&stack);
+		struct ewah_bitmap *ewah;
+		struct commit_list *parent;
+		int pos;
+
+		pos = bit_position(pack, order, commit->object.sha1);
+		if (pos < 0) {
+			ret = -1;
+			break;
+		}
+		if (bitmap_get(result, pos))
+			continue;
+		ewah = stored ? lookup_decoration(stored, &commit->object) : NULL;
+		if (ewah) {
+			bitmap_or_ewah(result, ewah);
+			continue;
+		}
+		bitmap_set(result, pos);
+
+		if (parse_commit(commit) || !commit->tree ||
+		    fill_tree(pack, order, result, commit->tree->object.sha1)) {
+			ret = -1;
+			break;
+		}
+		for (parent = commit->parents; parent; parent = parent->next)
+			commit_list_insert(parent->item, &stack);
+	}
+	free_commit_list(stack);
+	return ret;
+}
+
+int bitmap_fill_reachable(struct packed_git *pack, const uint32_t *order,
+			  struct decoration *stored, struct bitmap *result,
+			  struct object *obj)
+{
+	while (obj && obj->type == OBJ_TAG) {
+		if (set_object_bit(pack, order, result, obj->sha1))
+			return -1;
+		obj = ((struct tag *)obj)->tagged;
+		if (obj)
+			obj = parse_object(obj->sha1);
+	}
+	if (!obj)
+		return -1;
+
+	switch (obj->type) {
+	case OBJ_COMMIT:
+		return fill_commit(pack, order, stored, result,
+				   (struct commit *)obj);
+	case OBJ_TREE:
+		return fill_tree(pack, order, result, obj->sha1);
+	case OBJ_BLOB:
+		return set_object_bit(pack, order, result, obj->sha1);
+	default:
+		return -1;
+	}
+}
+
+static struct bitmap *read_type_bitmap(const unsigned char **ptr,
+				       const unsigned char *end)
+{
+	struct ewah_bitmap *ewah = ewah_new();
+	struct bitmap *bitmap;
+	ssize_t len = ewah_read_mmap(ewah, *ptr, end - *ptr);
+
+	if (len < 0) {
+		ewah_free(ewah);
+		return NULL;
+	}
+	*ptr += len;
+	bitmap = ewah_to_bitmap(ewah);
+	ewah_free(ewah);
+	return bitmap;
+}
+
+static int load_bitmap_index(struct packed_git *p, const unsigned char *data,
+			     size_t size, const char *path)
+{
+	const struct bitmap_disk_header *header = (const void *)data;
+	const unsigned char *ptr, *end = data + size - 20;
+	const unsigned char *pack_checksum;
+	uint32_t i, entry_count;
+
+	if (size < sizeof(*header) + 20 ||
+	    ntohl(header->signature) != BITMAP_IDX_SIGNATURE)
+		return error("corrupted bitmap index file %s", path);
+	if (ntohs(header->version) != BITMAP_IDX_VERSION)
+		return error("unsupported version %d for bitmap index file %s",
+			     ntohs(header->version), path);
+	if (!(ntohs(header->options) & BITMAP_OPT_FULL_DAG))
+		return error("unsupported options for bitmap index file %s",
+			     path);
+	if (open_pack_index(p))
+		return -1;
+	pack_checksum = (const unsigned char *)p->index_data +
+		p->index_size - 40;
+	if (hashcmp(header->checksum, pack_checksum))
+		return error("bitmap index %s does not match its pack", path);
+
+	bitmap_git.idx_to_bit = bitmap_pack_order(p);
+	bitmap_git.bit_to_idx = xmalloc(p->num_objects *
+					sizeof(*bitmap_git.bit_to_idx));
+	for (i = 0; i < p->num_objects; i++)
+		bitmap_git.bit_to_idx[bitmap_git.idx_to_bit[i]] = i;
+
+	ptr = data + sizeof(*header);
+	if (!(bitmap_git.commits = read_type_bitmap(&ptr, end)) ||
+	    !(bitmap_git.trees = read_type_bitmap(&ptr, end)) ||
+	    !(bitmap_git.blobs = read_type_bitmap(&ptr, end)) ||
+	    !(bitmap_git.tags = read_type_bitmap(&ptr, end)))
+		return error("corrupted type bitmaps in %s", path);
+
+	entry_count = ntohl(header->entry_count);
+	for (i = 0; i < entry_count; i++) {
+		struct ewah_bitmap *ewah;
+		struct commit *commit;
+		uint32_t pos;
+		ssize_t len;
+
+		if (end - ptr < 6)
+			return error("truncated bitmap index %s", path);
+		pos = ntohl(*(uint32_t *)ptr);
+		/* ptr[4] is the xor offset and ptr[5] the flags; both unused */
+		ptr += 6;
+		if (pos >= p->num_objects)
+			return error("bitmap index %s has an invalid entry", path);
+
+		ewah = ewah_new();
+		len = ewah_read_mmap(ewah, ptr, end - ptr);
+		if (len < 0) {
+			ewah_free(ewah);
+			return error("corrupted bitmap for entry %"PRIu32" in %s",
+				     i, path);
+		}
+		ptr += len;
+
+		commit = lookup_commit(nth_packed_object_sha1(p, pos));
+		if (!commit) {
+			ewah_free(ewah);
+			continue;
+		}
+		ewah_free(add_decoration(&bitmap_git.stored, &commit->object,
+					 ewah));
+	}
+	return 0;
+}
+
+/* Returns 1 if the pack has no bitmap, -1 if it is unusable */
+static int open_pack_bitmap_1(struct packed_git *p)
+{
+	struct stat st;
+	size_t len = strlen(p->pack_name), size;
+	char *path;
+	void *map;
+	int fd, ret;
+
+	if (len < 5 || strcmp(p->pack_name + len - 5, ".pack"))
+		return 1;
+	path = mkpathdup("%.*s.bitmap", (int)(len - 5), p->pack_name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		free(path);
+		return 1;
+	}
+	if (fstat(fd, &st)) {
+		close(fd);
+		free(path);
+		return -1;
+	}
+	size = xsize_t(st.st_size);
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	ret = load_bitmap_index(p, map, size, path);
+	munmap(map, size);
+	free(path);
+	if (!ret)
+		bitmap_git.pack = p;
+	return ret;
+}
+
+static int open_pack_bitmap(void)
+{
+	struct packed_git *p;
+
+	if (bitmap_git.loaded)
+		return bitmap_git.pack ? 0 : -1;
+	bitmap_git.loaded = 1;
+
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next) {
+		int ret;
+		if (!p->pack_local)
+			continue;
+		ret = open_pack_bitmap_1(p);
+		if (ret <= 0)
+			return ret;
+	}
+	return -1;
+}
+
+int prepare_bitmap_walk(struct rev_info *revs)
+{
+	struct bitmap *wants, *haves;
+	unsigned int i;
+
+	if (commit_grafts_present() || open_pack_bitmap())
+		return -1;
+
+	wants = bitmap_new();
+	haves = bitmap_new();
+	for (i = 0; i < revs->pending.nr; i++) {
+		struct object *obj = revs->pending.objects[i].item;
+
+		if (obj->flags & UNINTERESTING) {
+			/*
+			 * A "have" we cannot resolve only means we
+			 * send more than strictly necessary.
+			 */
+			struct bitmap *have = bitmap_new();
+			if (!bitmap_fill_reachable(bitmap_git.pack,
+						   bitmap_git.idx_to_bit,
+						   &bitmap_git.stored,
+						   have, obj))
+				bitmap_or(haves, have);
+			bitmap_free(have);
+			continue;
+		}
+		if (bitmap_fill_reachable(bitmap_git.pack, bitmap_git.idx_to_bit,
+					  &bitmap_git.stored, wants, obj)) {
+			bitmap_free(wants);
+			bitmap_free(haves);
+			return -1;
+		}
+	}
+
+	bitmap_and_not(wants, haves);
+	bitmap_free(haves);
+	bitmap_free(bitmap_git.result);
+	bitmap_git.result = wants;
+	return 0;
+}
+
+static enum object_type bitmap_object_type(uint32_t pos)
+{
+	if (bitmap_get(bitmap_git.commits, pos))
+		return OBJ_COMMIT;
+	if (bitmap_get(bitmap_git.trees, pos))
+		return OBJ_TREE;
+	if (bitmap_get(bitmap_git.blobs, pos))
+		return OBJ_BLOB;
+	if (bitmap_get(bitmap_git.tags, pos))
+		return OBJ_TAG;
+	return sha1_object_info(nth_packed_object_sha1(bitmap_git.pack,
+						       bitmap_git.bit_to_idx[pos]),
+				NULL);
+}
+
+static void show_bit(size_t pos, void *data)
+{
+	show_reachable_fn show = *(show_reachable_fn *)data;
+	uint32_t nr = bitmap_git.bit_to_idx[pos];
+
+	if (pos < bitmap_git.reuse_objects)
+		return;
+
+	show(nth_packed_object_sha1(bitmap_git.pack, nr),
+	     bitmap_object_type(pos), bitmap_git.pack,
+	     nth_packed_object_offset(bitmap_git.pack, nr));
+}
+
+void traverse_bitmap_commit_list(show_reachable_fn show)
+{
+	if (!bitmap_git.result)
+		die("BUG: traverse_bitmap_commit_list without a bitmap walk");
+
+	/* the bits are in pack order, which is the order of recency */
+	bitmap_each_bit(bitmap_git.result, show_bit, &show);
+	bitmap_free(bitmap_git.result);
+	bitmap_git.result = NULL;
+}
+
+int reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
+				       uint32_t *entries, off_t *up_to)
+{
+	struct bitmap *result = bitmap_git.result;
+	struct packed_git *p = bitmap_git.pack;
+	struct pack_window *w_curs = NULL;
+	size_t i = 0;
+	uint32_t pos, nr;
+
+	if (!result)
+		die("BUG: reuse_partial_packfile_from_bitmap without a bitmap walk");
+
+	/* the wanted objects at the start of the pack, a word at a time */
+	while (i < result->word_alloc && result->words[i] == (eword_t)~0)
+		i++;
+	nr = i * BITS_IN_EWORD;
+	if (nr > p->num_objects)
+		nr = p->num_objects;
+	while (nr < p->num_objects && bitmap_get(result, nr))
+		nr++;
+
+	/*
+	 * The base of an OFS_DELTA comes earlier in the pack, so it is
+	 * in the run as well, but that of a REF_DELTA may be anywhere.
+	 */
+	for (pos = 0; pos < nr; pos++) {
+		off_t ofs = nth_packed_object_offset(p, bitmap_git.bit_to_idx[pos]);
+		unsigned long size;
+
+		if (unpack_object_header(p, &w_curs, &ofs, &size) == OBJ_REF_DELTA)
+			break;
+	}
+	unuse_pack(&w_curs);
+	if (!pos)
+		return -1;
+
+	bitmap_git.reuse_objects = *entries = pos;
+	*up_to = pos < p->num_objects ?
+		nth_packed_object_offset(p, bitmap_git.bit_to_idx[pos]) :
+		p->pack_size - 20;
+	*packfile = p;
+	return 0;
+}
+
+int bitmap_reused_object(const unsigned char *sha1)
+{
+	int pos;
+
+	if (!bitmap_git.reuse_objects)
+		return 0;
+	pos = bit_position(bitmap_git.pack, bitmap_git.idx_to_bit, sha1);
+	return pos >= 0 && pos < bitmap_git.reuse_objects;
+}
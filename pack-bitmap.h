@@ -0,0 +1,85 @@
+#ifndef PACK_BITMAP_H
+#define PACK_BITMAP_H
+
+#include "ewah/ewok.h"
+
+/*
+ * A .bitmap file next to a pack holds, for a selection of commits in
+ * the pack, the set of objects reachable from them as an EWAH bitmap
+ * whose bit i stands for the i-th object in pack (offset) order.
+ */
+#define BITMAP_IDX_SIGNATURE 0x4249544d /* "BITM" */
+#define BITMAP_IDX_VERSION 1
+
+/* every object reachable from a bitmapped commit is in the pack */
+#define BITMAP_OPT_FULL_DAG 1
+
+struct bitmap_disk_header {
+	uint32_t signature;
+	uint16_t version;
+	uint16_t options;
+	uint32_t entry_count;
+	unsigned char checksum[20];
+};
+
+struct decoration;
+struct rev_info;
+
+/*
+ * Map each .idx position of "pack" to its bit position; the caller
+ * frees the returned array.
+ */
+extern uint32_t *bitmap_pack_order(struct packed_git *pack);
+
+/*
+ * Set in "result" the bit of every object reachable from "obj", which
+ * must all be in "pack" ("order" as returned by bitmap_pack_order()).
+ * The walk stops at commits that have a bitmap in "stored" (a struct
+ * commit -> struct ewah_bitmap mapping) and ORs that in instead.
+ * Returns -1 if an object is not in the pack.
+ */
+extern int bitmap_fill_reachable(struct packed_git *pack,
+				 const uint32_t *order,
+				 struct decoration *stored,
+				 struct bitmap *result, struct object *obj);
+
+typedef void (*show_reachable_fn)(const unsigned char *sha1,
+				  enum object_type type,
+				  struct packed_git *found_pack,
+				  off_t found_offset);
+
+/*
+ * Compute the objects reachable from the interesting tips in
+ * revs->pending but not from the uninteresting ones, using the
+ * bitmap index.  Returns -1 if the bitmaps cannot answer the query,
+ * in which case the caller should fall back to a regular walk.
+ */
+extern int prepare_bitmap_walk(struct rev_info *revs);
+
+/* Report the result of prepare_bitmap_walk() in pack order */
+extern void traverse_bitmap_commit_list(show_reachable_fn show);
+
+/*
+ * After prepare_bitmap_walk(), find the run of wanted objects at the
+ * start of the bitmapped pack that can be copied to a new pack byte
+ * for byte.  Returns 0 and sets the pack, the number of objects in
+ * the run and the offset just past it, which traverse_bitmap_commit_list()
+ * then no longer reports.  Returns -1 if there is no such run.
+ */
+extern int reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
+					      uint32_t *entries,
+					      off_t *up_to);
+
+/* Is "sha1" in the run found by reuse_partial_packfile_from_bitmap()? */
+extern int bitmap_reused_object(const unsigned char *sha1);
+
+/*
+ * Write "bitmap_name" for the pack whose index is "idx_name";
+ * "types" gives the type of each object in index order.  Returns -1
+ * without writing anything if the pack is not closed under
+ * reachability.
+ */
+extern int write_bitmap_index(const char *idx_name, const char *bitmap_name,
+			      const enum object_type *types);
+
+#endif
@@ -2,6 +2,11 @@
 #include "pack.h"
 #include "pack-revindex.h"
 #include "progress.h"
+#include "delta.h"
+#include "thread-utils.h"
+
+/* 0 means one thread per CPU */
+int verify_pack_threads;
 
 struct idx_entry {
 	off_t                offset;
@@ -20,10 +25,76 @@ static int compare_entries(const void *e1, const void *e2)
 	return 0;
 }
 
+/*
+ * Unpacked objects are hashed in batches, so that hash_sha1_files()
+ * can work on several of them at once.
+ */
+#define VERIFY_BATCH 16
+#define VERIFY_BATCH_BYTES (1024 * 1024)
+
+struct unpacked_object {
+	const struct idx_entry *entry;
+	void *data;
+	enum object_type type;
+	unsigned long size;
+	unsigned char sha1[20];
+};
+
+/* Hash the objects of a batch that could be unpacked. */
+static void hash_unpacked(struct unpacked_object *obj, int nr)
+{
+	struct hash_sha1_request req[VERIFY_BATCH];
+	int i, n = 0;
+
+	for (i = 0; i < nr; i++) {
+		if (!obj[i].data)
+			continue;
+		req[n].buf = obj[i].data;
+		req[n].len = obj[i].size;
+		req[n].type = typename(obj[i].type);
+		req[n].sha1 = obj[i].sha1;
+		n++;
+	}
+	if (n)
+		hash_sha1_files(req, n);
+}
+
+static int verify_unpacked(struct packed_git *p, verify_fn fn,
+			   struct unpacked_object *obj, int nr)
+{
+	int i, err = 0;
+
+	hash_unpacked(obj, nr);
+
+	for (i = 0; i < nr; i++) {
+		void *data = obj[i].data;
+
+		if (hashcmp(obj[i].sha1, obj[i].entry->sha1))
+			err = error("packed %s from %s is corrupt",
+				    sha1_to_hex(obj[i].entry->sha1), p->pack_name);
+		else if (fn) {
+			int eaten = 0;
+			fn(obj[i].entry->sha1, obj[i].type, obj[i].size,
+			   data, &eaten);
+			if (eaten)
+				data = NULL;
+		}
+		free(data);
+	}
+	return err;
+}
+
+static int index_crc_mismatch(struct packed_git *p, unsigned int nr,
+			      uint32_t data_crc)
+{
+	const uint32_t *index_crc = p->index_data;
+	index_crc += 2 + 256 + p->num_objects * (20/4) + nr;
+	return data_crc != ntohl(*index_crc);
+}
+
 int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 		   off_t offset, off_t len, unsigned int nr)
 {
-	const uint32_t *index_crc;
 	uint32_t data_crc = crc32(0, NULL, 0);
 
 	do {
@@ -31,17 +102,647 @@ int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 		void *data = use_pack(p, w_curs, offset, &avail);
 		if (avail > len)
 			avail = len;
-		data_crc = crc32(data_crc, data, avail);
+		data_crc = git_crc32(data_crc, data, avail);
 		offset += avail;
 		len -= avail;
 	} while (len);
 
-	index_crc = p->index_data;
-	index_crc += 2 + 256 + p->num_objects * (20/4) + nr;
+	return index_crc_mismatch(p, nr, data_crc);
+}
 
-	return data_crc != ntohl(*index_crc);
+static struct idx_entry *sorted_entries(struct packed_git *p, off_t pack_sig_ofs)
+{
+	uint32_t nr_objects = p->num_objects, i;
+	struct idx_entry *entries;
+
+	entries = xmalloc((nr_objects + 1) * sizeof(*entries));
+	entries[nr_objects].offset = pack_sig_ofs;
+	/* first sort entries by pack offset, since unpacking them is more efficient that way */
+	for (i = 0; i < nr_objects; i++) {
+		entries[i].sha1 = nth_packed_object_sha1(p, i);
+		if (!entries[i].sha1)
+			die("internal error pack-check nth-packed-object");
+		entries[i].offset = nth_packed_object_offset(p, i);
+		entries[i].nr = i;
+	}
+	qsort(entries, nr_objects, sizeof(*entries), compare_entries);
+	return entries;
+}
+
+#ifndef NO_PTHREADS
+
+/*
+ * Verifying the objects of a big pack is mostly inflating them and
+ * applying deltas, which threads can do side by side as long as they
+ * stay away from the pack windows and the delta base cache of
+ * sha1_file.c.  Each thread reads the pack through its own file
+ * descriptor and keeps its own cache of delta bases.
+ *
+ * A delta and its base are given to the same thread, so that the
+ * base of a delta chain is inflated once rather than once per
+ * thread.  A thread keeps the bases it unpacks until their last delta
+ * has been unpacked, within its share of core.deltaBaseCacheLimit,
+ * evicting the least recently used ones to make room.  The threads hash what they unpack in batches, as the
+ * serial code does.  The results are checked and handed to the
+ * callback in pack order by the calling thread, so that the output
+ * does not depend on the number of threads.  The threads stay at
+ * most VERIFY_WINDOW objects, and about VERIFY_BATCH_BYTES of
+ * inflated data per thread, ahead of it; the object it waits for is
+ * always let through.  The pack checksum is computed in a thread of
+ * its own and, as in the serial code, reported first.
+ */
+#define VERIFY_WINDOW 1024
+
+struct verify_object {
+	/* from the header pass */
+	int base;		/* position of the delta base, or -1 */
+	int thread;
+	enum object_type in_pack_type;
+	unsigned long in_pack_size;
+	unsigned int hdrlen;
+	unsigned int is_base:1;
+	unsigned int bad_header:1;
+
+	/* only touched by the thread the object is given to */
+	int deltas_left;	/* deltas against it not yet unpacked */
+	struct cached_base *cached;
+
+	/* from the threads */
+	void *data;
+	enum object_type type;
+	unsigned long size;
+	unsigned int done:1;
+	unsigned int bad_crc:1;
+	unsigned int bad_sha1:1;
+};
+
+struct cached_base {
+	struct cached_base *prev, *next;	/* least recently used first */
+	int pos;
+	void *data;
+	enum object_type type;
+	unsigned long size;
+};
+
+struct verify_thread {
+	pthread_t thread;
+	struct verify_pack_state *v;
+	int fd;
+	int *list;
+	int nr, alloc;
+	struct cached_base lru;
+	unsigned long cache_bytes;
+};
+
+struct verify_pack_state {
+	struct packed_git *p;
+	struct idx_entry *entries;
+	struct verify_object *obj;
+	unsigned long cache_limit;
+	uint32_t consumed;
+	unsigned long pending_bytes, pending_limit;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+struct checksum_thread {
+	pthread_t thread;
+	struct packed_git *p;
+	off_t pack_sig_ofs;
+	unsigned char sha1[20];
+	unsigned char pack_sig[20];
+	int err;
+};
+
+static pthread_mutex_t pack_memory_mutex;
+static try_to_free_t old_try_to_free_routine;
+
+static void try_to_free_from_threads(size_t size)
+{
+	pthread_mutex_lock(&pack_memory_mutex);
+	release_pack_memory(size, -1);
+	pthread_mutex_unlock(&pack_memory_mutex);
 }
 
+/* Checksum the whole pack, reading it on a descriptor of our own. */
+static void *threaded_checksum(void *arg)
+{
+	struct checksum_thread *c = arg;
+	git_SHA_CTX ctx;
+	unsigned char buf[65536];
+	off_t offset = 0;
+	int fd;
+
+	c->err = 0;
+	fd = open(c->p->pack_name, O_RDONLY);
+	if (fd < 0) {
+		c->err = -1;
+		return NULL;
+	}
+	git_SHA1_Init(&ctx);
+	while (offset < c->pack_sig_ofs) {
+		size_t n = sizeof(buf);
+		ssize_t got;
+		if (c->pack_sig_ofs - offset < n)
+			n = c->pack_sig_ofs - offset;
+		got = pread(fd, buf, n, offset);
+		if (got <= 0) {
+			c->err = -1;
+			break;
+		}
+		git_SHA1_Update(&ctx, buf, got);
+		offset += got;
+	}
+	git_SHA1_Final(c->sha1, &ctx);
+	if (!c->err && pread(fd, c->pack_sig, 20, c->pack_sig_ofs) != 20)
+		c->err = -1;
+	close(fd);
+	return NULL;
+}
+
+static int read_in_pack(int fd, void *buf, size_t len, off_t offset)
+{
+	char *p = buf;
+
+	while (len) {
+		ssize_t got = pread(fd, p, len, offset);
+		if (got <= 0)
+			return -1;
+		p += got;
+		offset += got;
+		len -= got;
+	}
+	return 0;
+}
+
+static void lru_unlink(struct cached_base *c)
+{
+	c->prev->next = c->next;
+	c->next->prev = c->prev;
+}
+
+static void lru_append(struct verify_thread *t, struct cached_base *c)
+{
+	c->prev = t->lru.prev;
+	c->next = &t->lru;
+	c->prev->next = c;
+	t->lru.prev = c;
+}
+
+static struct cached_base *cached(struct verify_thread *t, int pos)
+{
+	struct cached_base *c = t->v->obj[pos].cached;
+
+	if (c) {
+		lru_unlink(c);
+		lru_append(t, c);
+	}
+	return c;
+}
+
+static void uncache_base(struct verify_thread *t, struct cached_base *c)
+{
+	lru_unlink(c);
+	t->v->obj[c->pos].cached = NULL;
+	t->cache_bytes -= c->size;
+	free(c->data);
+	free(c);
+}
+
+/* Keep a base that deltas still to be unpacked need. */
+static void cache_base(struct verify_thread *t, int pos, const void *data,
+		       enum object_type type, unsigned long size)
+{
+	struct verify_object *obj = &t->v->obj[pos];
+	struct cached_base *c;
+
+	if (obj->cached || !obj->deltas_left || size > t->v->cache_limit)
+		return;
+	while (t->cache_bytes + size > t->v->cache_limit)
+		uncache_base(t, t->lru.next);
+	c = xmalloc(sizeof(*c));
+	c->pos = pos;
+	c->data = xmemdupz(data, size);
+	c->type = type;
+	c->size = size;
+	lru_append(t, c);
+	obj->cached = c;
+	t->cache_bytes += size;
+}
+
+/* A delta against "base" has been unpacked. */
+static void base_used(struct verify_thread *t, int base)
+{
+	struct verify_object *obj = &t->v->obj[base];
+
+	if (!--obj->deltas_left && obj->cached)
+		uncache_base(t, obj->cached);
+}
+
+static void clear_cache(struct verify_thread *t)
+{
+	while (t->lru.next != &t->lru)
+		uncache_base(t, t->lru.next);
+}
+
+/*
+ * Inflate the object at position "pos" of the sorted entries,
+ * applying deltas as needed; check its CRC on the way if "check_crc".
+ * Returns NULL if it cannot be unpacked.
+ */
+static void *unpack_in_thread(struct verify_thread *t, int pos,
+			      enum object_type *type, unsigned long *size,
+			      int check_crc, int *bad_crc)
+{
+	struct verify_pack_state *v = t->v;
+	struct verify_object *obj = &v->obj[pos];
+	off_t offset = v->entries[pos].offset;
+	unsigned long len = v->entries[pos + 1].offset - offset;
+	unsigned char *raw;
+	void *data, *result;
+	z_stream stream;
+	int st;
+
+	if (obj->bad_header || len <= obj->hdrlen)
+		return NULL;
+	raw = xmalloc(len);
+	if (read_in_pack(t->fd, raw, len, offset)) {
+		free(raw);
+		return NULL;
+	}
+	if (check_crc && v->p->index_version > 1 &&
+	    index_crc_mismatch(v->p, v->entries[pos].nr,
+			       git_crc32(crc32(0, NULL, 0), raw, len)))
+		*bad_crc = 1;
+
+	data = xmallocz(obj->in_pack_size);
+	memset(&stream, 0, sizeof(stream));
+	stream.next_in = raw + obj->hdrlen;
+	stream.avail_in = len - obj->hdrlen;
+	stream.next_out = data;
+	stream.avail_out = obj->in_pack_size;
+	/* plain zlib: git_inflate() would report errors out of order */
+	inflateInit(&stream);
+	st = inflate(&stream, Z_FINISH);
+	inflateEnd(&stream);
+	free(raw);
+	if (st != Z_STREAM_END || stream.total_out != obj->in_pack_size) {
+		free(data);
+		return NULL;
+	}
+
+	if (obj->base < 0) {
+		*type = obj->in_pack_type;
+		*size = obj->in_pack_size;
+		return data;
+	}
+
+	{
+		struct cached_base *c = cached(t, obj->base);
+		void *base;
+		unsigned long base_size;
+		enum object_type base_type;
+
+		if (c) {
+			result = patch_delta(c->data, c->size,
+					     data, obj->in_pack_size, size);
+			*type = c->type;
+		} else {
+			int dummy;
+			base = unpack_in_thread(t, obj->base, &base_type,
+						&base_size, 0, &dummy);
+			if (!base) {
+				free(data);
+				return NULL;
+			}
+			cache_base(t, obj->base, base, base_type, base_size);
+			result = patch_delta(base, base_size,
+					     data, obj->in_pack_size, size);
+			*type = base_type;
+			free(base);
+		}
+	}
+	free(data);
+	return result;
+}
+
+/* Whether the thread unpacking "pos" should let the others catch up. */
+static int must_wait(struct verify_pack_state *v, int pos)
+{
+	return pos != v->consumed &&
+		(pos >= v->consumed + VERIFY_WINDOW ||
+		 v->pending_bytes >= v->pending_limit);
+}
+
+/* Hash the objects unpacked by a thread and hand them over. */
+static void publish_unpacked(struct verify_pack_state *v,
+			     struct unpacked_object *batch, int *bad_crc,
+			     int nr)
+{
+	int i;
+
+	hash_unpacked(batch, nr);
+	pthread_mutex_lock(&v->mutex);
+	for (i = 0; i < nr; i++) {
+		struct verify_object *obj = &v->obj[batch[i].entry - v->entries];
+
+		obj->data = batch[i].data;
+		obj->type = batch[i].type;
+		obj->size = batch[i].size;
+		obj->bad_crc = bad_crc[i];
+		obj->bad_sha1 = batch[i].data &&
+			!!hashcmp(batch[i].sha1, batch[i].entry->sha1);
+		obj->done = 1;
+		if (batch[i].data)
+			v->pending_bytes += batch[i].size;
+	}
+	pthread_cond_broadcast(&v->cond);
+	pthread_mutex_unlock(&v->mutex);
+}
+
+static void *threaded_verify(void *arg)
+{
+	struct verify_thread *t = arg;
+	struct verify_pack_state *v = t->v;
+	struct unpacked_object batch[VERIFY_BATCH];
+	int bad_crc[VERIFY_BATCH];
+	int batch_nr = 0;
+	unsigned long batch_bytes = 0;
+	int i;
+
+	for (i = 0; i < t->nr; i++) {
+		int pos = t->list[i];
+		struct unpacked_object *u = &batch[batch_nr];
+
+		pthread_mutex_lock(&v->mutex);
+		if (batch_nr && must_wait(v, pos)) {
+			/* the caller may be waiting for one of ours */
+			pthread_mutex_unlock(&v->mutex);
+			publish_unpacked(v, batch, bad_crc, batch_nr);
+			batch_nr = 0;
+			batch_bytes = 0;
+			u = &batch[0];
+			pthread_mutex_lock(&v->mutex);
+		}
+		while (must_wait(v, pos))
+			pthread_cond_wait(&v->cond, &v->mutex);
+		pthread_mutex_unlock(&v->mutex);
+
+		u->entry = &v->entries[pos];
+		u->type = OBJ_BAD;
+		u->size = 0;
+		bad_crc[batch_nr] = 0;
+		u->data = unpack_in_thread(t, pos, &u->type, &u->size, 1,
+					   &bad_crc[batch_nr]);
+		if (u->data)
+			cache_base(t, pos, u->data, u->type, u->size);
+		if (v->obj[pos].base >= 0 && !v->obj[pos].bad_header)
+			base_used(t, v->obj[pos].base);
+		if (u->data)
+			batch_bytes += u->size;
+		if (++batch_nr == VERIFY_BATCH ||
+		    batch_bytes >= VERIFY_BATCH_BYTES) {
+			publish_unpacked(v, batch, bad_crc, batch_nr);
+			batch_nr = 0;
+			batch_bytes = 0;
+		}
+	}
+	if (batch_nr)
+		publish_unpacked(v, batch, bad_crc, batch_nr);
+	clear_cache(t);
+	return NULL;
+}
+
+/*
+ * Read the header of every object, to learn its delta base, and give
+ * each delta chain to one thread, keeping the amount of pack data
+ * each thread reads about the same.
+ */
+static void plan_threads(struct verify_pack_state *v, struct pack_window **w_curs,
+			 struct verify_thread *thread, int nr_threads)
+{
+	struct packed_git *p = v->p;
+	uint32_t nr_objects = p->num_objects, i;
+	int *root = xmalloc(nr_objects * sizeof(*root));
+	off_t *weight = xcalloc(nr_objects, sizeof(*weight));
+	off_t total, sum = 0;
+	int t = 0;
+
+	for (i = 0; i < nr_objects; i++) {
+		struct verify_object *obj = &v->obj[i];
+		off_t offset = v->entries[i].offset, curpos = offset;
+		off_t base_offset = 0;
+
+		obj->base = -1;
+		obj->in_pack_type = unpack_object_header(p, w_curs, &curpos,
+							 &obj->in_pack_size);
+		if (obj->in_pack_type == OBJ_OFS_DELTA) {
+			unsigned char *base_info = use_pack(p, w_curs, curpos, NULL);
+			unsigned used = 0;
+			unsigned char c = base_info[used++];
+			base_offset = c & 127;
+			while (c & 128) {
+				base_offset += 1;
+				if (!base_offset || MSB(base_offset, 7))
+					break;
+				c = base_info[used++];
+				base_offset = (base_offset << 7) + (c & 127);
+			}
+			base_offset = offset - base_offset;
+			curpos += used;
+		} else if (obj->in_pack_type == OBJ_REF_DELTA) {
+			unsigned char *base_info = use_pack(p, w_curs, curpos, NULL);
+			base_offset = find_pack_entry_one(base_info, p);
+			curpos += 20;
+		} else if (obj->in_pack_type <= OBJ_NONE ||
+			   obj->in_pack_type > OBJ_TAG)
+			obj->bad_header = 1;
+		obj->hdrlen = curpos - offset;
+
+		if (base_offset) {
+			/* find the position of the base */
+			uint32_t lo = 0, hi = nr_objects;
+			while (lo < hi) {
+				uint32_t mi = lo + (hi - lo) / 2;
+				if (v->entries[mi].offset == base_offset) {
+					obj->base = mi;
+					break;
+				}
+				if (v->entries[mi].offset < base_offset)
+					lo = mi + 1;
+				else
+					hi = mi;
+			}
+			if (obj->base < 0 || obj->base == i)
+				obj->bad_header = 1, obj->base = -1;
+			else
+				v->obj[obj->base].is_base = 1;
+		}
+	}
+	unuse_pack(w_curs);
+
+	/* follow each chain to its root; give up on cycles */
+	for (i = 0; i < nr_objects; i++) {
+		uint32_t steps = 0;
+		int r = i;
+		while (v->obj[r].base >= 0 && steps++ < nr_objects)
+			r = v->obj[r].base;
+		if (v->obj[r].base >= 0)
+			v->obj[i].bad_header = 1;
+		root[i] = r;
+		weight[r] += v->entries[i + 1].offset - v->entries[i].offset;
+	}
+	for (i = 0; i < nr_objects; i++)
+		if (v->obj[i].base >= 0 && !v->obj[i].bad_header)
+			v->obj[v->obj[i].base].deltas_left++;
+
+	/* roots in pack order, cut into ranges of about the same weight */
+	total = v->entries[nr_objects].offset - v->entries[0].offset;
+	for (i = 0; i < nr_objects; i++) {
+		if (root[i] != i)
+			continue;
+		if (sum >= total / nr_threads * (t + 1) && t < nr_threads - 1)
+			t++;
+		v->obj[i].thread = t;
+		sum += weight[i];
+	}
+	for (i = 0; i < nr_objects; i++) {
+		struct verify_thread *th = &thread[v->obj[root[i]].thread];
+		ALLOC_GROW(th->list, th->nr + 1, th->alloc);
+		th->list[th->nr++] = i;
+	}
+	free(weight);
+	free(root);
+}
+
+static int verify_packfile_threaded(struct packed_git *p,
+				    struct pack_window **w_curs,
+				    verify_fn fn,
+				    struct progress *progress, uint32_t base_count,
+				    int nr_threads)
+{
+	struct verify_pack_state v;
+	struct verify_thread *thread;
+	struct checksum_thread checksum;
+	uint32_t nr_objects = p->num_objects, i;
+	int err = 0, ret;
+
+	if (!is_pack_valid(p))
+		return error("packfile %s cannot be accessed", p->pack_name);
+
+	memset(&v, 0, sizeof(v));
+	v.p = p;
+	v.entries = sorted_entries(p, p->pack_size - 20);
+	v.obj = xcalloc(nr_objects, sizeof(*v.obj));
+	v.cache_limit = delta_base_cache_limit / nr_threads;
+	v.pending_limit = VERIFY_BATCH_BYTES * nr_threads;
+	pthread_mutex_init(&v.mutex, NULL);
+	pthread_cond_init(&v.cond, NULL);
+	pthread_mutex_init(&pack_memory_mutex, NULL);
+	old_try_to_free_routine = set_try_to_free_routine(try_to_free_from_threads);
+
+	memset(&checksum, 0, sizeof(checksum));
+	checksum.p = p;
+	checksum.pack_sig_ofs = p->pack_size - 20;
+	ret = pthread_create(&checksum.thread, NULL, threaded_checksum, &checksum);
+	if (ret)
+		die("unable to create thread: %s", strerror(ret));
+
+	thread = xcalloc(nr_threads, sizeof(*thread));
+	pthread_mutex_lock(&pack_memory_mutex);
+	plan_threads(&v, w_curs, thread, nr_threads);
+	pthread_mutex_unlock(&pack_memory_mutex);
+	for (i = 0; i < nr_threads; i++) {
+		thread[i].v = &v;
+		thread[i].lru.prev = thread[i].lru.next = &thread[i].lru;
+		thread[i].fd = open(p->pack_name, O_RDONLY);
+		if (thread[i].fd < 0)
+			die_errno("unable to open %s", p->pack_name);
+		ret = pthread_create(&thread[i].thread, NULL,
+				     threaded_verify, &thread[i]);
+		if (ret)
+			die("unable to create thread: %s", strerror(ret));
+	}
+
+	pthread_join(checksum.thread, NULL);
+	if (checksum.err)
+		err = error("cannot read %s", p->pack_name);
+	else {
+		if (hashcmp(checksum.sha1, checksum.pack_sig))
+			err = error("%s SHA1 checksum mismatch",
+				    p->pack_name);
+		if (hashcmp(p->index_data + p->index_size - 40, checksum.pack_sig))
+			err = error("%s SHA1 does not match its index",
+				    p->pack_name);
+	}
+
+	for (i = 0; i < nr_objects; i++) {
+		struct verify_object *obj = &v.obj[i];
+		const unsigned char *sha1 = v.entries[i].sha1;
+		unsigned long pending;
+		void *data;
+
+		pthread_mutex_lock(&v.mutex);
+		while (!obj->done)
+			pthread_cond_wait(&v.cond, &v.mutex);
+		pthread_mutex_unlock(&v.mutex);
+
+		data = obj->data;
+		obj->data = NULL;
+		pending = data ? obj->size : 0;
+		if (obj->bad_crc)
+			err = error("index CRC mismatch for object %s "
+				    "from %s at offset %"PRIuMAX"",
+				    sha1_to_hex(sha1), p->pack_name,
+				    (uintmax_t)v.entries[i].offset);
+		if (!data) {
+			err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
+				    sha1_to_hex(sha1), p->pack_name,
+				    (uintmax_t)v.entries[i].offset);
+			/* its deltas could not be read from this pack either */
+			if (obj->is_base)
+				mark_bad_packed_object(p, sha1);
+		}
+		else if (obj->bad_sha1)
+			err = error("packed %s from %s is corrupt",
+				    sha1_to_hex(sha1), p->pack_name);
+		else if (fn) {
+			int eaten = 0;
+			fn(sha1, obj->type, obj->size, data, &eaten);
+			if (eaten)
+				data = NULL;
+		}
+		free(data);
+
+		pthread_mutex_lock(&v.mutex);
+		v.pending_bytes -= pending;
+		v.consumed = i + 1;
+		pthread_cond_broadcast(&v.cond);
+		pthread_mutex_unlock(&v.mutex);
+
+		if (((base_count + i) & 1023) == 0)
+			display_progress(progress, base_count + i);
+	}
+	display_progress(progress, base_count + i);
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(thread[i].thread, NULL);
+		close(thread[i].fd);
+		free(thread[i].list);
+	}
+	free(thread);
+
+	set_try_to_free_routine(old_try_to_free_routine);
+	pthread_mutex_destroy(&pack_memory_mutex);
+	pthread_cond_destroy(&v.cond);
+	pthread_mutex_destroy(&v.mutex);
+	free(v.obj);
+	free(v.entries);
+	return err;
+}
+
+#endif
+
 static int verify_packfile(struct packed_git *p,
 			   struct pack_window **w_curs,
 			   verify_fn fn,
@@ -56,6 +757,16 @@ static int verify_packfile(struct packed_git *p,
 	uint32_t nr_objects, i;
 	int err = 0;
 	struct idx_entry *entries;
+	struct unpacked_object batch[VERIFY_BATCH];
+	int batch_nr = 0;
+	unsigned long batch_bytes = 0;
+
+#ifndef NO_PTHREADS
+	int nr_threads = verify_pack_threads ? verify_pack_threads : online_cpus();
+	if (nr_threads > 1 && p->num_objects > 1)
+		return verify_packfile_threaded(p, w_curs, fn, progress,
+						base_count, nr_threads);
+#endif
 
 	/* Note that the pack header checks are actually performed by
 	 * use_pack when it first opens the pack file.  If anything
@@ -89,17 +800,7 @@ static int verify_packfile(struct packed_git *p,
 	 * we do not do scan-streaming check on the pack file.
 	 */
 	nr_objects = p->num_objects;
-	entries = xmalloc((nr_objects + 1) * sizeof(*entries));
-	entries[nr_objects].offset = pack_sig_ofs;
-	/* first sort entries by pack offset, since unpacking them is more efficient that way */
-	for (i = 0; i < nr_objects; i++) {
-		entries[i].sha1 = nth_packed_object_sha1(p, i);
-		if (!entries[i].sha1)
-			die("internal error pack-check nth-packed-object");
-		entries[i].offset = nth_packed_object_offset(p, i);
-		entries[i].nr = i;
-	}
-	qsort(entries, nr_objects, sizeof(*entries), compare_entries);
+	entries = sorted_entries(p, pack_sig_ofs);
 
 	for (i = 0; i < nr_objects; i++) {
 		void *data;
@@ -121,20 +822,24 @@ static int verify_packfile(struct packed_git *p,
 			err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
 				    sha1_to_hex(entries[i].sha1), p->pack_name,
 				    (uintmax_t)entries[i].offset);
-		else if (check_sha1_signature(entries[i].sha1, data, size, typename(type)))
-			err = error("packed %s from %s is corrupt",
-				    sha1_to_hex(entries[i].sha1), p->pack_name);
-		else if (fn) {
-			int eaten = 0;
-			fn(entries[i].sha1, type, size, data, &eaten);
-			if (eaten)
-				data = NULL;
+		else {
+			batch[batch_nr].entry = &entries[i];
+			batch[batch_nr].data = data;
+			batch[batch_nr].type = type;
+			batch[batch_nr].size = size;
+			batch_bytes += size;
+			if (++batch_nr == VERIFY_BATCH ||
+			    batch_bytes >= VERIFY_BATCH_BYTES) {
+				err |= verify_unpacked(p, fn, batch, batch_nr);
+				batch_nr = 0;
+				batch_bytes = 0;
+			}
 		}
 		if (((base_count + i) & 1023) == 0)
 			display_progress(progress, base_count + i);
-		free(data);
-
 	}
+	if (batch_nr)
+		err |= verify_unpacked(p, fn, batch, batch_nr);
 	display_progress(progress, base_count + i);
 	free(entries);
 
@@ -1,4 +1,5 @@
 #include "cache.h"
+#include "pack.h"
 #include "pack-revindex.h"
 
 /*
@@ -14,11 +15,18 @@
  * ordered by offset, so if you know the offset of an object, next offset
  * is where its packed representation ends and the index_nr can be used to
  * get the object sha1 from the main index.
+ *
+ * When the pack comes with a pack-*.rev file, which lists the index_nr
+ * of the objects in offset order, we map it instead and look offsets up
+ * in the pack index as we go, saving the sort.
  */
 
 struct pack_revindex {
 	struct packed_git *p;
 	struct revindex_entry *revindex;
+	const uint32_t *rev_data;
+	void *rev_map;
+	size_t rev_map_size;
 };
 
 static struct pack_revindex *pack_revindex;
@@ -111,12 +119,75 @@ static void create_pack_revindex(struct pack_revindex *rix)
 	qsort(rix->revindex, num_ent, sizeof(*rix->revindex), cmp_offset);
 }
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs)
+/*
+ * Map the pack-*.rev file of the pack, if there is one that matches it.
+ */
+static int load_pack_rev_file(struct pack_revindex *rix)
+{
+	struct packed_git *p = rix->p;
+	const uint32_t *hdr;
+	struct stat st;
+	char *rev_name;
+	size_t len;
+	void *map;
+	int fd;
+
+	if (!has_extension(p->pack_name, ".pack") || open_pack_index(p))
+		return -1;
+	len = strlen(p->pack_name) - strlen(".pack");
+	rev_name = xmalloc(len + strlen(".rev") + 1);
+	memcpy(rev_name, p->pack_name, len);
+	strcpy(rev_name + len, ".rev");
+
+	fd = open(rev_name, O_RDONLY);
+	if (fd < 0) {
+		free(rev_name);
+		return -1;
+	}
+	if (fstat(fd, &st)) {
+		close(fd);
+		free(rev_name);
+		return -1;
+	}
+	len = xsize_t(st.st_size);
+	if (len != 12 + 4 * (size_t)p->num_objects + 40) {
+		close(fd);
+		error("reverse index %s has the wrong size", rev_name);
+		free(rev_name);
+		return -1;
+	}
+	map = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	hdr = map;
+	if (ntohl(hdr[0]) != RIDX_SIGNATURE ||
+	    ntohl(hdr[1]) != RIDX_VERSION ||
+	    ntohl(hdr[2]) != 1) {
+		error("reverse index %s has an unknown format", rev_name);
+		goto fail;
+	}
+	if (hashcmp((unsigned char *)map + len - 40,
+		    (unsigned char *)p->index_data + p->index_size - 40)) {
+		error("reverse index %s does not match its pack", rev_name);
+		goto fail;
+	}
+
+	rix->rev_map = map;
+	rix->rev_map_size = len;
+	rix->rev_data = hdr + 3;
+	free(rev_name);
+	return 0;
+
+fail:
+	munmap(map, len);
+	free(rev_name);
+	return -1;
+}
+
+static struct pack_revindex *get_pack_revindex(struct packed_git *p)
 {
 	int num;
-	int lo, hi;
 	struct pack_revindex *rix;
-	struct revindex_entry *revindex;
 
 	if (!pack_revindex_hashsz)
 		init_pack_revindex();
@@ -125,31 +196,76 @@ struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs)
 		die("internal error: pack revindex fubar");
 
 	rix = &pack_revindex[num];
-	if (!rix->revindex)
+	if (!rix->revindex && !rix->rev_data &&
+	    load_pack_rev_file(rix))
 		create_pack_revindex(rix);
-	revindex = rix->revindex;
+	return rix;
+}
+
+static uint32_t rix_index(struct pack_revindex *rix, uint32_t pos)
+{
+	uint32_t nr;
+
+	if (!rix->rev_data)
+		return rix->revindex[pos].nr;
+	nr = ntohl(rix->rev_data[pos]);
+	if (nr >= rix->p->num_objects)
+		die("reverse index of %s is corrupt", rix->p->pack_name);
+	return nr;
+}
+
+static off_t rix_offset(struct pack_revindex *rix, uint32_t pos)
+{
+	struct packed_git *p = rix->p;
+
+	if (!rix->rev_data)
+		return rix->revindex[pos].offset;
+	if (pos == p->num_objects)
+		return p->pack_size - 20;
+	return nth_packed_object_offset(p, rix_index(rix, pos));
+}
+
+int offset_to_pack_pos(struct packed_git *p, off_t ofs, uint32_t *pos)
+{
+	struct pack_revindex *rix = get_pack_revindex(p);
+	uint32_t lo, hi;
 
 	lo = 0;
 	hi = p->num_objects + 1;
 	do {
-		int mi = (lo + hi) / 2;
-		if (revindex[mi].offset == ofs) {
-			return revindex + mi;
-		} else if (ofs < revindex[mi].offset)
+		uint32_t mi = lo + (hi - lo) / 2;
+		off_t mi_ofs = rix_offset(rix, mi);
+		if (mi_ofs == ofs) {
+			*pos = mi;
+			return 0;
+		} else if (ofs < mi_ofs)
 			hi = mi;
 		else
 			lo = mi + 1;
 	} while (lo < hi);
-	error("bad offset for revindex");
-	return NULL;
+	return error("bad offset for revindex");
+}
+
+uint32_t pack_pos_to_index(struct packed_git *p, uint32_t pos)
+{
+	return rix_index(get_pack_revindex(p), pos);
+}
+
+off_t pack_pos_to_offset(struct packed_git *p, uint32_t pos)
+{
+	return rix_offset(get_pack_revindex(p), pos);
 }
 
 void discard_revindex(void)
 {
 	if (pack_revindex_hashsz) {
 		int i;
-		for (i = 0; i < pack_revindex_hashsz; i++)
+		for (i = 0; i < pack_revindex_hashsz; i++) {
 			free(pack_revindex[i].revindex);
+			if (pack_revindex[i].rev_map)
+				munmap(pack_revindex[i].rev_map,
+				       pack_revindex[i].rev_map_size);
+		}
 		free(pack_revindex);
 		pack_revindex_hashsz = 0;
 	}
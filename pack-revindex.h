@@ -6,7 +6,25 @@ struct revindex_entry {
 	unsigned int nr;
 };
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs);
+/*
+ * The objects of a pack are numbered by "pack position", their rank
+ * when sorted by offset in the pack.  offset_to_pack_pos() finds the
+ * position of the object starting at "ofs", returning -1 with an
+ * error message if there is none.
+ *
+ * pack_pos_to_index() gives the position of that object in the .idx,
+ * and pack_pos_to_offset() its offset; position p->num_objects gives
+ * the end of the last object, so that the size of the packed
+ * representation of the object at "pos" is
+ * pack_pos_to_offset(p, pos + 1) - pack_pos_to_offset(p, pos).
+ *
+ * The mapping comes from the pack-*.rev file when there is a usable
+ * one, and is computed from the .idx otherwise.
+ */
+int offset_to_pack_pos(struct packed_git *p, off_t ofs, uint32_t *pos);
+uint32_t pack_pos_to_index(struct packed_git *p, uint32_t pos);
+off_t pack_pos_to_offset(struct packed_git *p, uint32_t pos);
+
 void discard_revindex(void);
 
 #endif
@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "pack.h"
 #include "csum-file.h"
+#include "pack-revindex.h"
 
 void reset_pack_idx_option(struct pack_idx_option *opts)
 {
@@ -182,6 +183,59 @@ const char *write_idx_file(const char *index_name, struct pack_idx_entry **objec
 	return index_name;
 }
 
+static int rev_offset_cmp(const void *a_, const void *b_)
+{
+	const struct revindex_entry *a = a_, *b = b_;
+	return (a->offset < b->offset) ? -1 : (a->offset > b->offset) ? 1 : 0;
+}
+
+/*
+ * Write the reverse index of a pack.  The objects array must be
+ * sorted by SHA1, as write_idx_file() leaves it, and pack_sha1 is the
+ * checksum found in the trailer of the pack.
+ */
+const char *write_rev_file(const char *rev_name, struct pack_idx_entry **objects,
+			   uint32_t nr_objects, unsigned char *pack_sha1)
+{
+	struct sha1file *f;
+	struct revindex_entry *entries;
+	uint32_t hdr[3], i;
+	int fd;
+
+	if (!rev_name) {
+		static char tmp_file[PATH_MAX];
+		fd = odb_mkstemp(tmp_file, sizeof(tmp_file), "pack/tmp_rev_XXXXXX");
+		rev_name = xstrdup(tmp_file);
+	} else {
+		unlink(rev_name);
+		fd = open(rev_name, O_CREAT|O_EXCL|O_WRONLY, 0600);
+	}
+	if (fd < 0)
+		die_errno("unable to create '%s'", rev_name);
+	f = sha1fd(fd, rev_name);
+
+	hdr[0] = htonl(RIDX_SIGNATURE);
+	hdr[1] = htonl(RIDX_VERSION);
+	hdr[2] = htonl(1); /* SHA-1 */
+	sha1write(f, hdr, sizeof(hdr));
+
+	entries = xmalloc(sizeof(*entries) * (nr_objects ? nr_objects : 1));
+	for (i = 0; i < nr_objects; i++) {
+		entries[i].offset = objects[i]->offset;
+		entries[i].nr = i;
+	}
+	qsort(entries, nr_objects, sizeof(*entries), rev_offset_cmp);
+	for (i = 0; i < nr_objects; i++) {
+		uint32_t nr = htonl(entries[i].nr);
+		sha1write(f, &nr, 4);
+	}
+	free(entries);
+
+	sha1write(f, pack_sha1, 20);
+	sha1close(f, NULL, CSUM_FSYNC);
+	return rev_name;
+}
+
 off_t write_pack_header(struct sha1file *f, uint32_t nr_entries)
 {
 	struct pack_header hdr;
@@ -350,23 +404,40 @@ void finish_tmp_packfile(char *name_buffer,
 			 struct pack_idx_option *pack_idx_opts,
 			 unsigned char sha1[])
 {
-	const char *idx_tmp_name;
+	const char *idx_tmp_name, *rev_tmp_name = NULL;
 	char *end_of_name_prefix = strrchr(name_buffer, 0);
+	unsigned char pack_sha1[20];
 
 	if (adjust_shared_perm(pack_tmp_name))
 		die_errno("unable to make temporary pack file readable");
 
+	/* write_idx_file() replaces the pack checksum with the pack name */
+	hashcpy(pack_sha1, sha1);
 	idx_tmp_name = write_idx_file(NULL, written_list, nr_written,
 				      pack_idx_opts, sha1);
 	if (adjust_shared_perm(idx_tmp_name))
 		die_errno("unable to make temporary index file readable");
 
+	if (pack_idx_opts->flags & WRITE_REV) {
+		rev_tmp_name = write_rev_file(NULL, written_list, nr_written,
+					      pack_sha1);
+		if (adjust_shared_perm(rev_tmp_name))
+			die_errno("unable to make temporary reverse index file readable");
+	}
+
 	sprintf(end_of_name_prefix, "%s.pack", sha1_to_hex(sha1));
 	free_pack_by_name(name_buffer);
 
 	if (rename(pack_tmp_name, name_buffer))
 		die_errno("unable to rename temporary pack file");
 
+	if (rev_tmp_name) {
+		sprintf(end_of_name_prefix, "%s.rev", sha1_to_hex(sha1));
+		if (rename(rev_tmp_name, name_buffer))
+			die_errno("unable to rename temporary reverse index file");
+		free((void *)rev_tmp_name);
+	}
+
 	sprintf(end_of_name_prefix, "%s.idx", sha1_to_hex(sha1));
 	if (rename(idx_tmp_name, name_buffer))
 		die_errno("unable to rename temporary index file");
@@ -676,23 +676,48 @@ static int name_conflict_fn(const char *existingrefname, const unsigned char *sh
 
 /*
  * Return true iff a reference named refname could be created without
- * conflicting with the name of an existing reference in array.  If
+ * conflicting with the name of an existing reference in dir.  If
  * oldrefname is non-NULL, ignore potential conflicts with oldrefname
  * (e.g., because oldrefname is scheduled for deletion in the same
- * operation).
+ * operation).  dir must represent the top-level directory.
+ *
+ * Only the references that can conflict are looked at, i.e. those
+ * named like a leading part of refname and those under "refname/",
+ * so that no other loose ref directories need to be read.
  */
 static int is_refname_available(const char *refname, const char *oldrefname,
 				struct ref_dir *dir)
 {
 	struct name_conflict_cb data;
+	struct strbuf dirname = STRBUF_INIT;
+	struct ref_dir *subdir;
+	const char *slash;
 	data.refname = refname;
 	data.oldrefname = oldrefname;
 	data.conflicting_refname = NULL;
 
-	sort_ref_dir(dir);
-	if (do_for_each_ref_in_dir(dir, 0, "", name_conflict_fn,
-				   0, DO_FOR_EACH_INCLUDE_BROKEN,
-				   &data)) {
+	for (slash = strchr(refname, '/'); slash; slash = strchr(slash + 1, '/')) {
+		struct ref_entry *entry;
+
+		strbuf_reset(&dirname);
+		strbuf_add(&dirname, refname, slash - refname);
+		entry = find_ref(dir, dirname.buf);
+		if (entry && name_conflict_fn(entry->name, NULL, 0, &data))
+			break;
+	}
+
+	strbuf_reset(&dirname);
+	strbuf_addf(&dirname, "%s/", refname);
+	subdir = data.conflicting_refname
+		? NULL : find_containing_dir(dir, dirname.buf, 0);
+	strbuf_release(&dirname);
+	if (subdir) {
+		sort_ref_dir(subdir);
+		do_for_each_ref_in_dir(subdir, 0, "", name_conflict_fn,
+				       0, DO_FOR_EACH_INCLUDE_BROKEN, &data);
+	}
+
+	if (data.conflicting_refname) {
 		error("'%s' exists; cannot create '%s'",
 		      data.conflicting_refname, refname);
 		return 0;
@@ -704,20 +729,35 @@ static int is_refname_available(const char *refname, const char *oldrefname,
  * Future: need to be in "struct repository"
  * when doing a full libification.
  */
+struct packed_ref_file;
+struct packed_ref_prefix;
+
 static struct ref_cache {
 	struct ref_cache *next;
 	struct ref_entry *loose;
 	struct ref_entry *packed;
+	/*
+	 * A sorted packed-refs file that is searched in place as long as
+	 * "packed" has not been read, the packed references found in it
+	 * so far under some prefixes, and the last one looked up.
+	 */
+	struct packed_ref_file *packed_file;
+	int packed_file_checked;
+	struct packed_ref_prefix *packed_prefixes;
+	struct ref_entry *packed_found;
 	/* The submodule name, or "" for the main repo. */
 	char name[FLEX_ARRAY];
 } *ref_cache;
 
+static void release_packed_ref_file(struct ref_cache *refs);
+
 static void clear_packed_ref_cache(struct ref_cache *refs)
 {
 	if (refs->packed) {
 		free_ref_entry(refs->packed);
 		refs->packed = NULL;
 	}
+	release_packed_ref_file(refs);
 }
 
 static void clear_loose_ref_cache(struct ref_cache *refs)
@@ -803,6 +843,17 @@ static const char *parse_ref_line(char *line, unsigned char *sha1)
 	return line;
 }
 
+enum packed_peeled { PEELED_NONE, PEELED_TAGS, PEELED_FULLY };
+
+static enum packed_peeled parse_packed_traits(const char *traits)
+{
+	if (strstr(traits, " fully-peeled "))
+		return PEELED_FULLY;
+	if (strstr(traits, " peeled "))
+		return PEELED_TAGS;
+	return PEELED_NONE;
+}
+
 /*
  * Read f, which is a packed-refs file, into dir.
  *
@@ -829,12 +880,19 @@ static const char *parse_ref_line(char *line, unsigned char *sha1)
  *      trait should typically be written alongside "peeled" for
  *      compatibility with older clients, but we do not require it
  *      (i.e., "peeled" is a no-op if "fully-peeled" is set).
+ *
+ *   sorted:
+ *
+ *      The references are listed in strcmp() order of their names,
+ *      each followed by its peeled line, if any.  This does not
+ *      change what is read here, but lets get_packed_ref_file()
+ *      search the file without reading it all.
  */
 static void read_packed_refs(FILE *f, struct ref_dir *dir)
 {
 	struct ref_entry *last = NULL;
 	char refline[PATH_MAX];
-	enum { PEELED_NONE, PEELED_TAGS, PEELED_FULLY } peeled = PEELED_NONE;
+	enum packed_peeled peeled = PEELED_NONE;
 
 	while (fgets(refline, sizeof(refline), f)) {
 		unsigned char sha1[20];
@@ -842,12 +900,7 @@ static void read_packed_refs(FILE *f, struct ref_dir *dir)
 		static const char header[] = "# pack-refs with:";
 
 		if (!strncmp(refline, header, sizeof(header)-1)) {
-			const char *traits = refline + sizeof(header) - 1;
-			if (strstr(traits, " fully-peeled "))
-				peeled = PEELED_FULLY;
-			else if (strstr(traits, " peeled "))
-				peeled = PEELED_TAGS;
-			/* perhaps other traits later as well */
+			peeled = parse_packed_traits(refline + sizeof(header) - 1);
 			continue;
 		}
 
@@ -876,26 +929,383 @@ static void read_packed_refs(FILE *f, struct ref_dir *dir)
 	}
 }
 
+static const char *packed_refs_path(struct ref_cache *refs)
+{
+	if (*refs->name)
+		return git_path_submodule(refs->name, "packed-refs");
+	return git_path("packed-refs");
+}
+
+static void unmap_packed_ref_file(struct ref_cache *refs);
+
 static struct ref_dir *get_packed_refs(struct ref_cache *refs)
 {
 	if (!refs->packed) {
-		const char *packed_refs_file;
 		FILE *f;
 
 		refs->packed = create_dir_entry(refs, "", 0, 0);
-		if (*refs->name)
-			packed_refs_file = git_path_submodule(refs->name, "packed-refs");
-		else
-			packed_refs_file = git_path("packed-refs");
-		f = fopen(packed_refs_file, "r");
+		f = fopen(packed_refs_path(refs), "r");
 		if (f) {
 			read_packed_refs(f, get_ref_dir(refs->packed));
 			fclose(f);
 		}
+		/* from now on refs->packed is used instead */
+		unmap_packed_ref_file(refs);
 	}
 	return get_ref_dir(refs->packed);
 }
 
+/*
+ * A packed-refs file with the "sorted" trait need not be read as a
+ * whole to look up a few references, or the references under some
+ * prefix: it is mapped and searched in place instead, one record (a
+ * reference and its peeled line, if any) at a time.  Only iterating
+ * over all packed references or changing them reads it into
+ * refs->packed.
+ *
+ * Any record that does not parse makes us give up on the mapped file
+ * and read it the old way, which skips such lines.
+ */
+struct packed_ref_file {
+	char *buf;
+	size_t size;
+	const char *start;	/* the first record, after the header */
+	const char *end;
+	enum packed_peeled peeled;
+};
+
+/* The entries under base read from the mapped file so far. */
+struct packed_ref_prefix {
+	struct packed_ref_prefix *next;
+	struct ref_entry *dir;
+	char base[FLEX_ARRAY];
+};
+
+static void unmap_packed_ref_file(struct ref_cache *refs)
+{
+	struct packed_ref_file *file = refs->packed_file;
+
+	if (file) {
+		munmap(file->buf, file->size);
+		free(file);
+		refs->packed_file = NULL;
+	}
+}
+
+static void release_packed_ref_file(struct ref_cache *refs)
+{
+	unmap_packed_ref_file(refs);
+	refs->packed_file_checked = 0;
+	while (refs->packed_prefixes) {
+		struct packed_ref_prefix *p = refs->packed_prefixes;
+		refs->packed_prefixes = p->next;
+		free_ref_entry(p->dir);
+		free(p);
+	}
+	if (refs->packed_found) {
+		free_ref_entry(refs->packed_found);
+		refs->packed_found = NULL;
+	}
+}
+
+/*
+ * Return the mapped packed-refs file of refs, or NULL if it has to be
+ * read with get_packed_refs() (or already has been).
+ */
+static struct packed_ref_file *get_packed_ref_file(struct ref_cache *refs)
+{
+	static const char header[] = "# pack-refs with:";
+	struct packed_ref_file *file;
+	struct stat st;
+	const char *eol;
+	char *traits;
+	int fd;
+
+	if (refs->packed || refs->packed_file_checked)
+		return refs->packed_file;
+	refs->packed_file_checked = 1;
+
+	fd = open(packed_refs_path(refs), O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) || st.st_size < sizeof(header)) {
+		close(fd);
+		return NULL;
+	}
+	file = xcalloc(1, sizeof(*file));
+	file->size = xsize_t(st.st_size);
+	file->buf = xmmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	file->end = file->buf + file->size;
+
+	eol = memchr(file->buf, '\n', file->size);
+	if (!eol || memcmp(file->buf, header, sizeof(header) - 1)) {
+		munmap(file->buf, file->size);
+		free(file);
+		return NULL;
+	}
+	traits = xmemdupz(file->buf + sizeof(header) - 1,
+			  eol - file->buf - (sizeof(header) - 1));
+	if (!strstr(traits, " sorted ")) {
+		free(traits);
+		munmap(file->buf, file->size);
+		free(file);
+		return NULL;
+	}
+	file->peeled = parse_packed_traits(traits);
+	free(traits);
+	file->start = eol + 1;
+	refs->packed_file = file;
+	return file;
+}
+
+/* Give up on the mapped file; see struct packed_ref_file. */
+static struct ref_dir *packed_ref_file_corrupt(struct ref_cache *refs)
+{
+	unmap_packed_ref_file(refs);
+	return get_packed_refs(refs);
+}
+
+/* The start of the line p is on, looking back no further than start. */
+static const char *packed_line_start(const char *start, const char *p)
+{
+	while (p > start && p[-1] != '\n')
+		p--;
+	return p;
+}
+
+static const char *packed_next_line(const char *p, const char *end)
+{
+	const char *eol = memchr(p, '\n', end - p);
+	return eol ? eol + 1 : end;
+}
+
+static const char *packed_next_record(const char *rec, const char *end)
+{
+	rec = packed_next_line(rec, end);
+	if (rec < end && *rec == '^')
+		rec = packed_next_line(rec, end);
+	return rec;
+}
+
+/* Does rec look like "<sha1> <refname>\n"?  See parse_ref_line(). */
+static int packed_record_ok(const char *rec, const char *end)
+{
+	return end - rec >= 43 && rec[40] == ' ' && !isspace(rec[41]) &&
+		memchr(rec + 41, '\n', end - rec - 41);
+}
+
+/*
+ * Compare the name in the record rec with refname, like strcmp().  If
+ * prefix is set, names that start with refname compare equal.
+ */
+static int packed_record_cmp(const char *rec, const char *refname, int prefix)
+{
+	const unsigned char *name = (const unsigned char *)rec + 41;
+	const unsigned char *s = (const unsigned char *)refname;
+
+	for (; *s; name++, s++) {
+		int c = *name == '\n' ? 0 : *name;
+		if (c != *s)
+			return c - *s;
+	}
+	return (prefix || *name == '\n') ? 0 : 1;
+}
+
+/*
+ * Return the first record whose name does not sort before refname,
+ * file->end if there is none, or NULL if the file is corrupt.
+ */
+static const char *packed_lower_bound(struct packed_ref_file *file,
+				      const char *refname)
+{
+	const char *lo = file->start, *hi = file->end;
+
+	while (lo < hi) {
+		const char *rec = packed_line_start(lo, lo + (hi - lo) / 2);
+
+		if (*rec == '^') {
+			if (rec == lo)
+				return NULL;
+			rec = packed_line_start(lo, rec - 1);
+		}
+		if (!packed_record_ok(rec, file->end))
+			return NULL;
+		if (packed_record_cmp(rec, refname, 0) < 0)
+			lo = packed_next_record(rec, file->end);
+		else
+			hi = rec;
+	}
+	return lo;
+}
+
+/* Make a ref_entry from the record rec, like read_packed_refs() does. */
+static struct ref_entry *packed_record_entry(struct packed_ref_file *file,
+					     const char *rec)
+{
+	unsigned char sha1[20];
+	const char *eol = memchr(rec, '\n', file->end - rec);
+	const char *peeled = eol + 1;
+	struct ref_entry *entry;
+	char *refname;
+
+	if (get_sha1_hex(rec, sha1))
+		return NULL;
+	refname = xmemdupz(rec + 41, eol - rec - 41);
+	entry = create_ref_entry(refname, sha1, REF_ISPACKED, 1);
+	free(refname);
+	if (file->peeled == PEELED_FULLY ||
+	    (file->peeled == PEELED_TAGS && !prefixcmp(entry->name, "refs/tags/")))
+		entry->flag |= REF_KNOWS_PEELED;
+	if (file->end - peeled >= 42 && peeled[0] == '^' && peeled[41] == '\n' &&
+	    !get_sha1_hex(peeled + 1, sha1)) {
+		hashcpy(entry->u.value.peeled, sha1);
+		entry->flag |= REF_KNOWS_PEELED;
+	}
+	return entry;
+}
+
+/*
+ * Look refname up among the packed references of refs.  The entry
+ * returned may go away with the next lookup.
+ */
+static struct ref_entry *find_packed_ref(struct ref_cache *refs,
+					 const char *refname)
+{
+	struct packed_ref_file *file = get_packed_ref_file(refs);
+	struct ref_entry *entry;
+	const char *rec;
+
+	if (!file)
+		return find_ref(get_packed_refs(refs), refname);
+	rec = packed_lower_bound(file, refname);
+	if (!rec)
+		return find_ref(packed_ref_file_corrupt(refs), refname);
+	if (rec == file->end || !packed_record_ok(rec, file->end) ||
+	    packed_record_cmp(rec, refname, 0))
+		return NULL;
+	entry = packed_record_entry(file, rec);
+	if (!entry)
+		return find_ref(packed_ref_file_corrupt(refs), refname);
+	if (refs->packed_found)
+		free_ref_entry(refs->packed_found);
+	refs->packed_found = entry;
+	return entry;
+}
+
+/*
+ * Return a top-level ref_dir that holds at least the packed references
+ * of refs whose names start with base.
+ */
+static struct ref_dir *get_packed_refs_in(struct ref_cache *refs,
+					  const char *base)
+{
+	struct packed_ref_file *file = get_packed_ref_file(refs);
+	struct packed_ref_prefix *p;
+	struct ref_entry *dir;
+	const char *rec;
+	int len;
+
+	if (!file)
+		return get_packed_refs(refs);
+	for (p = refs->packed_prefixes; p; p = p->next)
+		if (!strcmp(p->base, base))
+			return get_ref_dir(p->dir);
+
+	rec = packed_lower_bound(file, base);
+	if (!rec)
+		return packed_ref_file_corrupt(refs);
+	dir = create_dir_entry(refs, "", 0, 0);
+	for (; rec < file->end; rec = packed_next_record(rec, file->end)) {
+		struct ref_entry *entry;
+
+		if (!packed_record_ok(rec, file->end)) {
+			free_ref_entry(dir);
+			return packed_ref_file_corrupt(refs);
+		}
+		if (packed_record_cmp(rec, base, 1))
+			break;
+		entry = packed_record_entry(file, rec);
+		if (!entry) {
+			free_ref_entry(dir);
+			return packed_ref_file_corrupt(refs);
+		}
+		add_ref(get_ref_dir(dir), entry);
+	}
+
+	len = strlen(base) + 1;
+	p = xmalloc(sizeof(*p) + len);
+	memcpy(p->base, base, len);
+	p->dir = dir;
+	p->next = refs->packed_prefixes;
+	refs->packed_prefixes = p;
+	return get_ref_dir(dir);
+}
+
+/*
+ * is_refname_available() for the packed references of refs; with a
+ * mapped file, look up the names refname conflicts with instead of
+ * going through all of them.
+ */
+static int is_packed_refname_available(struct ref_cache *refs,
+				       const char *refname,
+				       const char *oldrefname)
+{
+	struct packed_ref_file *file = get_packed_ref_file(refs);
+	struct strbuf sb = STRBUF_INIT;
+	const char *slash, *rec;
+	char *conflict = NULL;
+
+	if (!file)
+		return is_refname_available(refname, oldrefname,
+					    get_packed_refs(refs));
+
+	/* "foo" and "foo/bar" for "foo/bar/baz" ... */
+	for (slash = strchr(refname, '/'); slash; slash = strchr(slash + 1, '/')) {
+		strbuf_reset(&sb);
+		strbuf_add(&sb, refname, slash - refname);
+		if (oldrefname && !strcmp(oldrefname, sb.buf))
+			continue;
+		if (!find_packed_ref(refs, sb.buf))
+			continue;
+		conflict = strbuf_detach(&sb, NULL);
+		break;
+	}
+
+	/* ... and anything under "foo/bar/baz/" */
+	strbuf_reset(&sb);
+	strbuf_addf(&sb, "%s/", refname);
+	file = get_packed_ref_file(refs);
+	rec = file ? packed_lower_bound(file, sb.buf) : NULL;
+	for (; !conflict && rec && rec < file->end;
+	     rec = packed_next_record(rec, file->end)) {
+		const char *eol;
+
+		if (!packed_record_ok(rec, file->end)) {
+			rec = NULL;
+			break;
+		}
+		if (packed_record_cmp(rec, sb.buf, 1))
+			break;
+		if (oldrefname && !packed_record_cmp(rec, oldrefname, 0))
+			continue;
+		eol = memchr(rec, '\n', file->end - rec);
+		conflict = xmemdupz(rec + 41, eol - rec - 41);
+	}
+	strbuf_release(&sb);
+
+	if (!conflict && !rec)
+		/* the mapped file turned out to be corrupt */
+		return is_refname_available(refname, oldrefname,
+					    packed_ref_file_corrupt(refs));
+	if (conflict) {
+		error("'%s' exists; cannot create '%s'", conflict, refname);
+		free(conflict);
+		return 0;
+	}
+	return 1;
+}
+
 void add_packed_ref(const char *refname, const unsigned char *sha1)
 {
 	add_ref(get_packed_refs(get_ref_cache(NULL)),
@@ -931,7 +1341,7 @@ static void read_loose_refs(const char *dirname, struct ref_dir *dir)
 	while ((de = readdir(d)) != NULL) {
 		unsigned char sha1[20];
 		struct stat st;
-		int flag;
+		int flag, dtype;
 		const char *refdir;
 
 		if (de->d_name[0] == '.')
@@ -942,9 +1352,17 @@ static void read_loose_refs(const char *dirname, struct ref_dir *dir)
 		refdir = *refs->name
 			? git_path_submodule(refs->name, "%s", refname.buf)
 			: git_path("%s", refname.buf);
-		if (stat(refdir, &st) < 0) {
+		/* no need to stat() when readdir() tells us the type */
+		dtype = DTYPE(de);
+		if (dtype != DT_REG && dtype != DT_DIR) {
+			if (stat(refdir, &st) < 0)
+				dtype = DT_UNKNOWN;
+			else
+				dtype = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+		}
+		if (dtype == DT_UNKNOWN) {
 			; /* silently ignore */
-		} else if (S_ISDIR(st.st_mode)) {
+		} else if (dtype == DT_DIR) {
 			strbuf_addch(&refname, '/');
 			add_entry_to_dir(dir,
 					 create_dir_entry(refs, refname.buf,
@@ -1001,9 +1419,8 @@ static int resolve_gitlink_packed_ref(struct ref_cache *refs,
 				      const char *refname, unsigned char *sha1)
 {
 	struct ref_entry *ref;
-	struct ref_dir *dir = get_packed_refs(refs);
 
-	ref = find_ref(dir, refname);
+	ref = find_packed_ref(refs, refname);
 	if (ref == NULL)
 		return -1;
 
@@ -1074,8 +1491,7 @@ int resolve_gitlink_ref(const char *path, const char *refname, unsigned char *sh
  */
 static int get_packed_ref(const char *refname, unsigned char *sha1)
 {
-	struct ref_dir *packed = get_packed_refs(get_ref_cache(NULL));
-	struct ref_entry *entry = find_ref(packed, refname);
+	struct ref_entry *entry = find_packed_ref(get_ref_cache(NULL), refname);
 	if (entry) {
 		hashcpy(sha1, entry->u.value.sha1);
 		return 0;
@@ -1253,8 +1669,7 @@ int peel_ref(const char *refname, unsigned char *sha1)
 		return -1;
 
 	if ((flag & REF_ISPACKED)) {
-		struct ref_dir *dir = get_packed_refs(get_ref_cache(NULL));
-		struct ref_entry *r = find_ref(dir, refname);
+		struct ref_entry *r = find_packed_ref(get_ref_cache(NULL), refname);
 
 		if (r != NULL && r->flag & REF_KNOWS_PEELED) {
 			hashcpy(sha1, r->u.value.peeled);
@@ -1320,7 +1735,8 @@ static int do_for_each_ref(const char *submodule, const char *base, each_ref_fn
 			   int trim, int flags, void *cb_data)
 {
 	struct ref_cache *refs = get_ref_cache(submodule);
-	struct ref_dir *packed_dir = get_packed_refs(refs);
+	struct ref_dir *packed_dir = (base && *base)
+		? get_packed_refs_in(refs, base) : get_packed_refs(refs);
 	struct ref_dir *loose_dir = get_loose_refs(refs);
 	int retval = 0;
 
@@ -1702,7 +2118,7 @@ static struct ref_lock *lock_ref_sha1_basic(const char *refname,
 	 * name is a proper prefix of our refname.
 	 */
 	if (missing &&
-	     !is_refname_available(refname, NULL, get_packed_refs(get_ref_cache(NULL)))) {
+	     !is_packed_refname_available(get_ref_cache(NULL), refname, NULL)) {
 		last_errno = ENOTDIR;
 		goto error_return;
 	}
@@ -1755,7 +2171,7 @@ struct ref_lock *lock_any_ref_for_update(const char *refname,
 }
 
 struct repack_without_ref_sb {
-	const char *refname;
+	struct string_list *refnames;
 	int fd;
 };
 
@@ -1764,9 +2180,10 @@ static int repack_without_ref_fn(const char *refname, const unsigned char *sha1,
 {
 	struct repack_without_ref_sb *data = cb_data;
 	char line[PATH_MAX + 100];
+	unsigned char peeled[20];
 	int len;
 
-	if (!strcmp(data->refname, refname))
+	if (string_list_has_string(data->refnames, refname))
 		return 0;
 	len = snprintf(line, sizeof(line), "%s %s\n",
 		       sha1_to_hex(sha1), refname);
@@ -1774,48 +2191,131 @@ static int repack_without_ref_fn(const char *refname, const unsigned char *sha1,
 	if (len > sizeof(line))
 		die("too long a refname '%s'", refname);
 	write_or_die(data->fd, line, len);
+	/* keep what the old file knew; peel_ref() uses current_ref */
+	if ((flags & REF_KNOWS_PEELED) && !peel_ref(refname, peeled)) {
+		len = snprintf(line, sizeof(line), "^%s\n", sha1_to_hex(peeled));
+		write_or_die(data->fd, line, len);
+	}
 	return 0;
 }
 
 static struct lock_file packlock;
 
-static int repack_without_ref(const char *refname)
+/*
+ * Write the mapped packed-refs file of refs to fd without the records
+ * of refnames (sorted), copying everything else as it is.  Return -1
+ * if the file cannot be spliced like this and has to be rewritten from
+ * the parsed refs instead.
+ */
+static int splice_packed_ref_file(struct ref_cache *refs, int fd,
+				  struct string_list *refnames)
 {
+	struct packed_ref_file *file = get_packed_ref_file(refs);
+	const char **cut = NULL;
+	const char *pos;
+	int i, nr = 0, alloc = 0;
+
+	if (!file)
+		return -1;
+	/* find the records to cut out before writing anything */
+	for (i = 0; i < refnames->nr; i++) {
+		const char *refname = refnames->items[i].string;
+		const char *rec = packed_lower_bound(file, refname), *next;
+
+		if (!rec) {
+			free(cut);
+			return -1;
+		}
+		for (next = rec; next < file->end;
+		     next = packed_next_record(next, file->end))
+			if (!packed_record_ok(next, file->end) ||
+			    packed_record_cmp(next, refname, 0))
+				break;
+		if (next == rec)
+			continue;
+		ALLOC_GROW(cut, nr + 2, alloc);
+		cut[nr++] = rec;
+		cut[nr++] = next;
+	}
+
+	pos = file->buf;
+	for (i = 0; i < nr; i += 2) {
+		write_or_die(fd, pos, cut[i] - pos);
+		pos = cut[i + 1];
+	}
+	write_or_die(fd, pos, file->end - pos);
+	free(cut);
+	return 0;
+}
+
+/* Remove refnames, which must be sorted, from the packed-refs file. */
+static int repack_without_refs(struct string_list *refnames)
+{
+	static const char header[] = "# pack-refs with: sorted \n";
 	struct repack_without_ref_sb data;
 	struct ref_cache *refs = get_ref_cache(NULL);
-	struct ref_dir *packed = get_packed_refs(refs);
-	if (find_ref(packed, refname) == NULL)
-		return 0;
-	data.refname = refname;
+	struct ref_dir *packed;
+	int i;
+
+	for (i = 0; i < refnames->nr; i++)
+		if (find_packed_ref(refs, refnames->items[i].string))
+			break;
+	if (i == refnames->nr)
+		return 0; /* none of them is packed */
+	data.refnames = refnames;
 	data.fd = hold_lock_file_for_update(&packlock, git_path("packed-refs"), 0);
 	if (data.fd < 0) {
 		unable_to_lock_error(git_path("packed-refs"), errno);
-		return error("cannot delete '%s' from packed refs", refname);
+		return error("cannot delete '%s' from packed refs",
+			     refnames->items[i].string);
 	}
 	clear_packed_ref_cache(refs);
-	packed = get_packed_refs(refs);
-	do_for_each_ref_in_dir(packed, 0, "", repack_without_ref_fn, 0, 0, &data);
+	if (splice_packed_ref_file(refs, data.fd, refnames)) {
+		packed = get_packed_refs(refs);
+		write_or_die(data.fd, header, strlen(header));
+		do_for_each_ref_in_dir(packed, 0, "", repack_without_ref_fn,
+				       0, 0, &data);
+	}
+	/* it is out of date, and must not keep the old file mapped */
+	clear_packed_ref_cache(refs);
 	return commit_lock_file(&packlock);
 }
 
-int delete_ref(const char *refname, const unsigned char *sha1, int delopt)
+static int repack_without_ref(const char *refname)
 {
-	struct ref_lock *lock;
-	int err, i = 0, ret = 0, flag = 0;
+	struct string_list refnames = STRING_LIST_INIT_NODUP;
+	int ret;
 
-	lock = lock_ref_sha1_basic(refname, sha1, delopt, &flag);
-	if (!lock)
-		return 1;
+	string_list_append(&refnames, refname);
+	ret = repack_without_refs(&refnames);
+	string_list_clear(&refnames, 0);
+	return ret;
+}
+
+/* Remove the loose file of the ref locked by lock, if there is one. */
+static int delete_ref_loose(struct ref_lock *lock, int flag)
+{
 	if (!(flag & REF_ISPACKED) || flag & REF_ISSYMREF) {
 		/* loose */
-		i = strlen(lock->lk->filename) - 5; /* .lock */
+		int err, i = strlen(lock->lk->filename) - 5; /* .lock */
 		lock->lk->filename[i] = 0;
 		err = unlink_or_warn(lock->lk->filename);
-		if (err && errno != ENOENT)
-			ret = 1;
-
 		lock->lk->filename[i] = '.';
+		if (err && errno != ENOENT)
+			return 1;
 	}
+	return 0;
+}
+
+int delete_ref(const char *refname, const unsigned char *sha1, int delopt)
+{
+	struct ref_lock *lock;
+	int ret = 0, flag = 0;
+
+	lock = lock_ref_sha1_basic(refname, sha1, delopt, &flag);
+	if (!lock)
+		return 1;
+	ret |= delete_ref_loose(lock, flag);
 	/* removing the loose one could have resurrected an earlier
 	 * packed one.  Also, if it was not loose we need to repack
 	 * without it.
@@ -1823,6 +2323,7 @@ int delete_ref(const char *refname, const unsigned char *sha1, int delopt)
 	ret |= repack_without_ref(lock->ref_name);
 
 	unlink_or_warn(git_path("logs/%s", lock->ref_name));
+	unlink(git_path("logs/.index/%s", lock->ref_name));
 	invalidate_ref_cache(NULL);
 	unlock_ref(lock);
 	return ret;
@@ -1857,7 +2358,7 @@ int rename_ref(const char *oldrefname, const char *newrefname, const char *logms
 	if (!symref)
 		return error("refname %s not found", oldrefname);
 
-	if (!is_refname_available(newrefname, oldrefname, get_packed_refs(refs)))
+	if (!is_packed_refname_available(refs, newrefname, oldrefname))
 		return 1;
 
 	if (!is_refname_available(newrefname, oldrefname, get_loose_refs(refs)))
@@ -1866,6 +2367,8 @@ int rename_ref(const char *oldrefname, const char *newrefname, const char *logms
 	if (log && rename(git_path("logs/%s", oldrefname), git_path(TMP_RENAMED_LOG)))
 		return error("unable to move logfile logs/%s to "TMP_RENAMED_LOG": %s",
 			oldrefname, strerror(errno));
+	if (log)
+		unlink(git_path("logs/.index/%s", oldrefname));
 
 	if (delete_ref(oldrefname, orig_sha1, REF_NODEREF)) {
 		error("unable to delete old %s", oldrefname);
@@ -2084,18 +2587,16 @@ static int is_branch(const char *refname)
 	return !strcmp(refname, "HEAD") || !prefixcmp(refname, "refs/heads/");
 }
 
-int write_ref_sha1(struct ref_lock *lock,
-	const unsigned char *sha1, const char *logmsg)
+/*
+ * Write sha1 into the lock file of lock and close it, leaving the
+ * lock in place.  On error, release the lock and return -1.
+ */
+static int write_ref_to_lockfile(struct ref_lock *lock,
+				 const unsigned char *sha1)
 {
 	static char term = '\n';
 	struct object *o;
 
-	if (!lock)
-		return -1;
-	if (!lock->force_write && !hashcmp(lock->old_sha1, sha1)) {
-		unlock_ref(lock);
-		return 0;
-	}
 	o = parse_object(sha1);
 	if (!o) {
 		error("Trying to write ref %s with nonexistent object %s",
@@ -2116,6 +2617,17 @@ int write_ref_sha1(struct ref_lock *lock,
 		unlock_ref(lock);
 		return -1;
 	}
+	return 0;
+}
+
+/*
+ * Log the update of the ref locked by lock to sha1 and move the lock
+ * file written by write_ref_to_lockfile() into place.  The lock is
+ * released either way.
+ */
+static int commit_ref_update(struct ref_lock *lock,
+			     const unsigned char *sha1, const char *logmsg)
+{
 	clear_loose_ref_cache(get_ref_cache(NULL));
 	if (log_ref_write(lock->ref_name, lock->old_sha1, sha1, logmsg) < 0 ||
 	    (strcmp(lock->ref_name, lock->orig_ref_name) &&
@@ -2153,6 +2665,20 @@ int write_ref_sha1(struct ref_lock *lock,
 	return 0;
 }
 
+int write_ref_sha1(struct ref_lock *lock,
+	const unsigned char *sha1, const char *logmsg)
+{
+	if (!lock)
+		return -1;
+	if (!lock->force_write && !hashcmp(lock->old_sha1, sha1)) {
+		unlock_ref(lock);
+		return 0;
+	}
+	if (write_ref_to_lockfile(lock, sha1))
+		return -1;
+	return commit_ref_update(lock, sha1, logmsg);
+}
+
 int create_symref(const char *ref_target, const char *refs_heads_master,
 		  const char *logmsg)
 {
@@ -2226,6 +2752,276 @@ static char *ref_msg(const char *line, const char *endp)
 	return xmemdupz(line, ep - line);
 }
 
+/*
+ * With core.reflogIndex, "logs/.index/<refname>" indexes the reflog
+ * of <refname>, so that read_ref_at() can go straight to the entry it
+ * wants instead of scanning the log backwards line by line.  No
+ * refname component starts with ".", so the index never gets in the
+ * way of a reflog, and for_each_reflog() skips it.
+ *
+ * The file is a header: "RLGX", version, number of entries, flags
+ * (32 bits each), the size of the part of the log that is indexed (64
+ * bits) and the SHA-1 of its first and last lines; followed by the
+ * offset in the log and the timestamp of each entry (64 bits each).
+ * All numbers are in network byte order.
+ *
+ * The readers bring the index up to date as the log is appended to.
+ * A log that does not match its index, e.g. because "reflog expire"
+ * rewrote it, gets a new one.
+ */
+#define REFLOG_INDEX_SIGNATURE 0x524c4758 /* "RLGX" */
+#define REFLOG_INDEX_VERSION 1
+#define REFLOG_INDEX_HEADER 44
+#define REFLOG_INDEX_MONOTONIC 1 /* timestamps never decrease */
+
+struct reflog_index {
+	unsigned char *map;		/* the index as found on disk */
+	size_t mapsz;
+	uint32_t nr_mapped, nr, alloc;
+	uint64_t *added;		/* offset, timestamp pairs after those */
+	uint32_t flags;
+	uint64_t covered;
+};
+
+static uint64_t get_be64(const unsigned char *p)
+{
+	return (uint64_t)ntohl(*(uint32_t *)p) << 32 | ntohl(*(uint32_t *)(p + 4));
+}
+
+static void put_be64(unsigned char *p, uint64_t v)
+{
+	*(uint32_t *)p = htonl(v >> 32);
+	*(uint32_t *)(p + 4) = htonl(v & 0xffffffff);
+}
+
+static uint64_t reflog_index_field(struct reflog_index *ix, uint32_t i, int field)
+{
+	if (i < ix->nr_mapped)
+		return get_be64(ix->map + REFLOG_INDEX_HEADER + 16 * i + 8 * field);
+	return ix->added[2 * (i - ix->nr_mapped) + field];
+}
+#define reflog_index_offset(ix, i) reflog_index_field(ix, i, 0)
+#define reflog_index_date(ix, i) reflog_index_field(ix, i, 1)
+
+/* The SHA-1 of the first and the last line of the indexed log. */
+static void reflog_index_check(struct reflog_index *ix, const char *log,
+			       unsigned char *sha1)
+{
+	uint64_t first_end = ix->nr > 1 ? reflog_index_offset(ix, 1) : ix->covered;
+	uint64_t last = reflog_index_offset(ix, ix->nr - 1);
+	git_SHA_CTX c;
+
+	git_SHA1_Init(&c);
+	git_SHA1_Update(&c, log, first_end);
+	git_SHA1_Update(&c, log + last, ix->covered - last);
+	git_SHA1_Final(sha1, &c);
+}
+
+static void drop_reflog_index(struct reflog_index *ix)
+{
+	if (ix->map)
+		munmap(ix->map, ix->mapsz);
+	free(ix->added);
+	memset(ix, 0, sizeof(*ix));
+}
+
+/* Read the index at path, if it matches the log. */
+static void read_reflog_index(const char *path, const char *log,
+			      size_t logsz, struct reflog_index *ix)
+{
+	unsigned char sha1[20];
+	struct stat st;
+	uint64_t last;
+	int fd;
+
+	memset(ix, 0, sizeof(*ix));
+	ix->flags = REFLOG_INDEX_MONOTONIC;
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st) || st.st_size < REFLOG_INDEX_HEADER + 16) {
+		close(fd);
+		return;
+	}
+	ix->mapsz = xsize_t(st.st_size);
+	ix->map = xmmap(NULL, ix->mapsz, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	ix->nr = ix->nr_mapped = ntohl(*(uint32_t *)(ix->map + 8));
+	ix->flags = ntohl(*(uint32_t *)(ix->map + 12));
+	ix->covered = get_be64(ix->map + 16);
+	if (ntohl(*(uint32_t *)ix->map) != REFLOG_INDEX_SIGNATURE ||
+	    ntohl(*(uint32_t *)(ix->map + 4)) != REFLOG_INDEX_VERSION ||
+	    !ix->nr || (ix->mapsz - REFLOG_INDEX_HEADER) / 16 < ix->nr ||
+	    !ix->covered || ix->covered > logsz ||
+	    log[ix->covered - 1] != '\n' || reflog_index_offset(ix, 0))
+		goto mismatch;
+	last = reflog_index_offset(ix, ix->nr - 1);
+	if (last >= ix->covered || (last && log[last - 1] != '\n') ||
+	    (ix->nr > 1 && reflog_index_offset(ix, 1) > last))
+		goto mismatch;
+	reflog_index_check(ix, log, sha1);
+	if (hashcmp(sha1, ix->map + 24))
+		goto mismatch;
+	return;
+
+mismatch:
+	drop_reflog_index(ix);
+	ix->flags = REFLOG_INDEX_MONOTONIC;
+}
+
+/*
+ * Index the complete lines of the log after those already indexed.
+ * Return -1 if one of them does not parse.
+ */
+static int extend_reflog_index(struct reflog_index *ix, const char *log,
+			       size_t logsz)
+{
+	const char *p = log + ix->covered, *end = log + logsz;
+	uint64_t last_date = ix->nr ? reflog_index_date(ix, ix->nr - 1) : 0;
+
+	while (p < end) {
+		const char *eol = memchr(p, '\n', end - p);
+		const char *gt;
+		unsigned long date;
+
+		if (!eol)
+			break; /* still being written */
+		/* as in read_ref_at(), the date follows the first '>' */
+		gt = memchr(p, '>', eol - p);
+		if (!gt)
+			return -1;
+		date = strtoul(gt + 1, NULL, 10);
+		if (ix->nr && date < last_date)
+			ix->flags &= ~REFLOG_INDEX_MONOTONIC;
+		ALLOC_GROW(ix->added, 2 * (ix->nr - ix->nr_mapped + 1), ix->alloc);
+		ix->added[2 * (ix->nr - ix->nr_mapped)] = p - log;
+		ix->added[2 * (ix->nr - ix->nr_mapped) + 1] = date;
+		ix->nr++;
+		last_date = date;
+		p = eol + 1;
+	}
+	ix->covered = p - log;
+	return 0;
+}
+
+static struct lock_file reflog_index_lock;
+
+/*
+ * Write the entries added to ix.  If the index on disk is still good,
+ * append them to it in place (the lock only keeps other writers out,
+ * and they would write the same bytes anyway); write a new one
+ * otherwise.  This is only an optimization: failing is fine.
+ */
+static void write_reflog_index(char *path, struct reflog_index *ix,
+			       const char *log)
+{
+	uint32_t hdr[REFLOG_INDEX_HEADER / 4], ent[4], i;
+	int fd, lock_fd;
+
+	if (ix->nr == ix->nr_mapped || safe_create_leading_directories(path))
+		return;
+	lock_fd = hold_lock_file_for_update(&reflog_index_lock, path, 0);
+	if (lock_fd < 0)
+		return;
+
+	hdr[0] = htonl(REFLOG_INDEX_SIGNATURE);
+	hdr[1] = htonl(REFLOG_INDEX_VERSION);
+	hdr[2] = htonl(ix->nr);
+	hdr[3] = htonl(ix->flags);
+	put_be64((unsigned char *)(hdr + 4), ix->covered);
+	reflog_index_check(ix, log, (unsigned char *)(hdr + 6));
+
+	fd = ix->nr_mapped ? open(path, O_WRONLY) : lock_fd;
+	if (fd < 0 ||
+	    lseek(fd, REFLOG_INDEX_HEADER + 16 * ix->nr_mapped, SEEK_SET) < 0)
+		goto fail;
+	for (i = ix->nr_mapped; i < ix->nr; i++) {
+		put_be64((unsigned char *)ent, reflog_index_offset(ix, i));
+		put_be64((unsigned char *)(ent + 2), reflog_index_date(ix, i));
+		if (write_in_full(fd, ent, sizeof(ent)) != sizeof(ent))
+			goto fail;
+	}
+	/* the header last, so that readers never see missing entries */
+	if (lseek(fd, 0, SEEK_SET) < 0 ||
+	    write_in_full(fd, hdr, sizeof(hdr)) != sizeof(hdr))
+		goto fail;
+
+	if (fd != lock_fd) {
+		close(fd);
+		rollback_lock_file(&reflog_index_lock);
+	} else if (!commit_lock_file(&reflog_index_lock))
+		adjust_shared_perm(path);
+	return;
+
+fail:
+	if (fd >= 0 && fd != lock_fd)
+		close(fd);
+	rollback_lock_file(&reflog_index_lock);
+}
+
+/*
+ * read_ref_at() looks for the entry "cnt" entries from the end of the
+ * log, or the last one not newer than at_time, whichever comes first
+ * when scanning backwards.  Use the index to start that scan right
+ * after the entry, as if it had skipped *reccnt entries already.
+ */
+static void seek_reflog_index(const char *refname, const char *log,
+			      size_t logsz, unsigned long at_time, int *cnt,
+			      const char **rec, const char **lastrec,
+			      int *reccnt)
+{
+	char *path = git_pathdup("logs/.index/%s", refname);
+	struct reflog_index ix;
+	long i, i_cnt = -1, i_date = -1, nr;
+
+	read_reflog_index(path, log, logsz, &ix);
+	if (extend_reflog_index(&ix, log, logsz) || ix.covered != logsz) {
+		/* let the scan deal with corrupt or incomplete lines */
+		drop_reflog_index(&ix);
+		free(path);
+		return;
+	}
+	write_reflog_index(path, &ix, log);
+	free(path);
+
+	nr = ix.nr;
+	if (*cnt >= 0 && *cnt < nr)
+		i_cnt = nr - 1 - *cnt;
+	if (ix.flags & REFLOG_INDEX_MONOTONIC) {
+		long lo = i_cnt + 1, hi = nr;
+		while (lo < hi) {
+			long mi = lo + (hi - lo) / 2;
+			if (reflog_index_date(&ix, mi) <= at_time)
+				lo = mi + 1;
+			else
+				hi = mi;
+		}
+		if (lo > i_cnt + 1)
+			i_date = lo - 1;
+	} else {
+		for (i = nr - 1; i > i_cnt; i--)
+			if (reflog_index_date(&ix, i) <= at_time) {
+				i_date = i;
+				break;
+			}
+	}
+	i = i_date > i_cnt ? i_date : i_cnt;
+
+	if (i < 0) {
+		/* not there; go straight to the oldest entry */
+		*rec = log;
+		*reccnt = nr;
+	} else {
+		*rec = i + 1 < nr ? log + reflog_index_offset(&ix, i + 1) : log + logsz;
+		*lastrec = i + 1 < nr ? *rec : NULL;
+		*reccnt = nr - 1 - i;
+		if (*cnt > 0)
+			*cnt -= *reccnt;
+	}
+	drop_reflog_index(&ix);
+}
+
 int read_ref_at(const char *refname, unsigned long at_time, int cnt,
 		unsigned char *sha1, char **msg,
 		unsigned long *cutoff_time, int *cutoff_tz, int *cutoff_cnt)
@@ -2253,6 +3049,9 @@ int read_ref_at(const char *refname, unsigned long at_time, int cnt,
 
 	lastrec = NULL;
 	rec = logend = logdata + st.st_size;
+	if (core_reflog_index)
+		seek_reflog_index(refname, logdata, mapsz, at_time, &cnt,
+				  &rec, &lastrec, &reccnt);
 	while (logdata < rec) {
 		reccnt++;
 		if (logdata < rec && *(rec-1) == '\n')
@@ -2519,31 +3318,247 @@ int for_each_reflog(each_ref_fn fn, void *cb_data)
 	return retval;
 }
 
+static int update_ref_error(enum action_on_err onerr, const char *str,
+			    const char *refname)
+{
+	switch (onerr) {
+	case MSG_ON_ERR: error(str, refname); break;
+	case DIE_ON_ERR: die(str, refname); break;
+	case QUIET_ON_ERR: break;
+	}
+	return 1;
+}
+
 int update_ref(const char *action, const char *refname,
 		const unsigned char *sha1, const unsigned char *oldval,
 		int flags, enum action_on_err onerr)
 {
 	static struct ref_lock *lock;
 	lock = lock_any_ref_for_update(refname, oldval, flags);
-	if (!lock) {
-		const char *str = "Cannot lock the ref '%s'.";
-		switch (onerr) {
-		case MSG_ON_ERR: error(str, refname); break;
-		case DIE_ON_ERR: die(str, refname); break;
-		case QUIET_ON_ERR: break;
+	if (!lock)
+		return update_ref_error(onerr, "Cannot lock the ref '%s'.",
+					refname);
+	if (write_ref_sha1(lock, sha1, action) < 0)
+		return update_ref_error(onerr, "Cannot update the ref '%s'.",
+					refname);
+	return 0;
+}
+
+struct ref_update {
+	unsigned char new_sha1[20];
+	unsigned char old_sha1[20];
+	int flags;
+	int have_old;
+	struct ref_lock *lock;
+	int type;
+	int unchanged;
+	char refname[FLEX_ARRAY];
+};
+
+struct ref_transaction {
+	struct ref_update **updates;
+	int nr, alloc;
+};
+
+struct ref_transaction *ref_transaction_begin(void)
+{
+	return xcalloc(1, sizeof(struct ref_transaction));
+}
+
+void ref_transaction_free(struct ref_transaction *transaction)
+{
+	int i;
+
+	if (!transaction)
+		return;
+	for (i = 0; i < transaction->nr; i++) {
+		if (transaction->updates[i]->lock)
+			unlock_ref(transaction->updates[i]->lock);
+		free(transaction->updates[i]);
+	}
+	free(transaction->updates);
+	free(transaction);
+}
+
+void ref_transaction_update(struct ref_transaction *transaction,
+			    const char *refname,
+			    const unsigned char *new_sha1,
+			    const unsigned char *old_sha1,
+			    int flags, int have_old)
+{
+	int len = strlen(refname) + 1;
+	struct ref_update *update = xcalloc(1, sizeof(*update) + len);
+
+	memcpy(update->refname, refname, len);
+	hashcpy(update->new_sha1, new_sha1);
+	if (have_old)
+		hashcpy(update->old_sha1, old_sha1);
+	update->flags = flags;
+	update->have_old = have_old;
+	ALLOC_GROW(transaction->updates, transaction->nr + 1, transaction->alloc);
+	transaction->updates[transaction->nr++] = update;
+}
+
+void ref_transaction_create(struct ref_transaction *transaction,
+			    const char *refname,
+			    const unsigned char *new_sha1,
+			    int flags)
+{
+	ref_transaction_update(transaction, refname, new_sha1, null_sha1,
+			       flags, 1);
+}
+
+void ref_transaction_delete(struct ref_transaction *transaction,
+			    const char *refname,
+			    const unsigned char *old_sha1,
+			    int flags, int have_old)
+{
+	ref_transaction_update(transaction, refname, null_sha1, old_sha1,
+			       flags, have_old);
+}
+
+static int ref_update_compare(const void *r1, const void *r2)
+{
+	const struct ref_update * const *u1 = r1;
+	const struct ref_update * const *u2 = r2;
+	return strcmp((*u1)->refname, (*u2)->refname);
+}
+
+/*
+ * updates is sorted.  Refuse to touch a ref twice, and to create or
+ * update two refs whose names conflict, like "foo" and "foo/bar":
+ * both could be locked, but only one of them could be written.
+ */
+static int ref_update_reject_conflicts(struct ref_update **updates, int n,
+				       enum action_on_err onerr)
+{
+	struct string_list names = STRING_LIST_INIT_NODUP;
+	struct strbuf sb = STRBUF_INIT;
+	int i, ret = 0;
+
+	for (i = 1; i < n; i++)
+		if (!strcmp(updates[i - 1]->refname, updates[i]->refname))
+			return update_ref_error(onerr,
+				"Multiple updates for ref '%s' not allowed.",
+				updates[i]->refname);
+
+	for (i = 0; i < n; i++)
+		if (!is_null_sha1(updates[i]->new_sha1))
+			string_list_append(&names, updates[i]->refname);
+	for (i = 0; !ret && i < names.nr; i++) {
+		const char *refname = names.items[i].string, *slash;
+
+		for (slash = strchr(refname, '/'); slash; slash = strchr(slash + 1, '/')) {
+			strbuf_reset(&sb);
+			strbuf_add(&sb, refname, slash - refname);
+			if (string_list_has_string(&names, sb.buf)) {
+				ret = update_ref_error(onerr,
+					"Cannot update '%s' together with a ref it contains.",
+					sb.buf);
+				break;
+			}
 		}
+	}
+	strbuf_release(&sb);
+	string_list_clear(&names, 0);
+	return ret;
+}
+
+int ref_transaction_commit(struct ref_transaction *transaction,
+			   const char *msg, enum action_on_err onerr)
+{
+	struct ref_update **updates = transaction->updates;
+	struct string_list delnames = STRING_LIST_INIT_DUP;
+	int i, n = transaction->nr, ret = 0;
+
+	if (!n)
+		return 0;
+
+	qsort(updates, n, sizeof(*updates), ref_update_compare);
+	if (ref_update_reject_conflicts(updates, n, onerr))
 		return 1;
+
+	/*
+	 * Lock every ref, checking the old values.  The new values are
+	 * written to the lock files right away, and the lock files
+	 * closed, so that we do not run out of file descriptors with
+	 * many refs.
+	 */
+	for (i = 0; i < n; i++) {
+		struct ref_update *update = updates[i];
+		struct ref_lock *lock;
+
+		if (check_refname_format(update->refname, REFNAME_ALLOW_ONELEVEL))
+			return update_ref_error(onerr, "Cannot lock the ref '%s'.",
+						update->refname);
+		lock = lock_ref_sha1_basic(update->refname,
+					   update->have_old ? update->old_sha1 : NULL,
+					   update->flags, &update->type);
+		if (!lock)
+			return update_ref_error(onerr, "Cannot lock the ref '%s'.",
+						update->refname);
+		update->lock = lock;
+		if (is_null_sha1(update->new_sha1)) {
+			if (close_ref(lock))
+				return update_ref_error(onerr,
+					"Cannot lock the ref '%s'.",
+					update->refname);
+		} else if (!lock->force_write &&
+			   !hashcmp(lock->old_sha1, update->new_sha1)) {
+			/* nothing to write, but keep it locked till the end */
+			update->unchanged = 1;
+			close_ref(lock);
+		} else {
+			update->lock = NULL; /* released on error */
+			if (write_ref_to_lockfile(lock, update->new_sha1))
+				return update_ref_error(onerr,
+					"Cannot update the ref '%s'.",
+					update->refname);
+			update->lock = lock;
+		}
 	}
-	if (write_ref_sha1(lock, sha1, action) < 0) {
-		const char *str = "Cannot update the ref '%s'.";
-		switch (onerr) {
-		case MSG_ON_ERR: error(str, refname); break;
-		case DIE_ON_ERR: die(str, refname); break;
-		case QUIET_ON_ERR: break;
+
+	/* Perform updates first so live commits remain referenced */
+	for (i = 0; i < n; i++) {
+		struct ref_update *update = updates[i];
+		struct ref_lock *lock = update->lock;
+
+		if (is_null_sha1(update->new_sha1) || update->unchanged)
+			continue;
+		update->lock = NULL; /* released by commit_ref_update() */
+		if (commit_ref_update(lock, update->new_sha1, msg))
+			ret |= update_ref_error(onerr,
+					"Cannot update the ref '%s'.",
+					update->refname);
+	}
+
+	/* Perform deletes now that updates are safely completed */
+	for (i = 0; i < n; i++) {
+		struct ref_update *update = updates[i];
+
+		if (!is_null_sha1(update->new_sha1))
+			continue;
+		ret |= delete_ref_loose(update->lock, update->type);
+		string_list_append(&delnames, update->lock->ref_name);
+	}
+	if (delnames.nr) {
+		sort_string_list(&delnames);
+		ret |= repack_without_refs(&delnames);
+		for (i = 0; i < delnames.nr; i++) {
+			const char *name = delnames.items[i].string;
+			unlink_or_warn(git_path("logs/%s", name));
+			unlink(git_path("logs/.index/%s", name));
 		}
-		return 1;
+		invalidate_ref_cache(NULL);
 	}
-	return 0;
+	string_list_clear(&delnames, 0);
+
+	for (i = 0; i < n; i++) {
+		if (updates[i]->lock)
+			unlock_ref(updates[i]->lock);
+		updates[i]->lock = NULL;
+	}
+	return ret;
 }
 
 struct ref *find_ref_by_name(const struct ref *list, const char *name)
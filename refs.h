@@ -147,6 +147,46 @@ int update_ref(const char *action, const char *refname,
 		const unsigned char *sha1, const unsigned char *oldval,
 		int flags, enum action_on_err onerr);
 
+/*
+ * A ref transaction collects updates, creations, deletions and
+ * verifications of refs, and applies them together: all refs are
+ * locked and their old values checked before any of them is changed,
+ * and the packed-refs file is rewritten at most once for all the
+ * deletions.
+ *
+ * A null new_sha1 deletes the ref.  If have_old is set, old_sha1 is
+ * what the ref must hold before the change; a null old_sha1 means it
+ * must not exist.  Updating a ref to the value it must already have
+ * verifies it without changing it.
+ */
+struct ref_transaction;
+
+struct ref_transaction *ref_transaction_begin(void);
+void ref_transaction_update(struct ref_transaction *transaction,
+			    const char *refname,
+			    const unsigned char *new_sha1,
+			    const unsigned char *old_sha1,
+			    int flags, int have_old);
+void ref_transaction_create(struct ref_transaction *transaction,
+			    const char *refname,
+			    const unsigned char *new_sha1,
+			    int flags);
+void ref_transaction_delete(struct ref_transaction *transaction,
+			    const char *refname,
+			    const unsigned char *old_sha1,
+			    int flags, int have_old);
+
+/*
+ * Apply the queued changes, writing msg to the reflogs.  Return 0 on
+ * success; on failure, report it according to onerr and return
+ * non-zero.  If locking any of the refs fails, none is changed.
+ */
+int ref_transaction_commit(struct ref_transaction *transaction,
+			   const char *msg, enum action_on_err onerr);
+
+/* Release the transaction, and any locks a failed commit left behind. */
+void ref_transaction_free(struct ref_transaction *transaction);
+
 extern int parse_hide_refs_config(const char *var, const char *value, const char *);
 extern int ref_is_hidden(const char *);
 
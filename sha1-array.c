@@ -26,6 +26,25 @@ static const unsigned char *sha1_access(size_t index, void *table)
 	return array[index];
 }
 
+void sha1_array_insert(struct sha1_array *array, const unsigned char *sha1)
+{
+	int pos;
+
+	if (!array->sorted) {
+		sha1_array_append(array, sha1);
+		return;
+	}
+	pos = sha1_pos(sha1, array->sha1, array->nr, sha1_access);
+	if (pos >= 0)
+		return;
+	pos = -pos - 1;
+	ALLOC_GROW(array->sha1, array->nr + 1, array->alloc);
+	memmove(array->sha1 + pos + 1, array->sha1 + pos,
+		(array->nr - pos) * sizeof(*array->sha1));
+	hashcpy(array->sha1[pos], sha1);
+	array->nr++;
+}
+
 int sha1_array_lookup(struct sha1_array *array, const unsigned char *sha1)
 {
 	if (!array->sorted)
@@ -11,6 +11,11 @@ struct sha1_array {
 #define SHA1_ARRAY_INIT { NULL, 0, 0, 0 }
 
 void sha1_array_append(struct sha1_array *array, const unsigned char *sha1);
+/*
+ * Like sha1_array_append(), but an array that is already sorted stays
+ * sorted, and an entry already in it is not added again.
+ */
+void sha1_array_insert(struct sha1_array *array, const unsigned char *sha1);
 int sha1_array_lookup(struct sha1_array *array, const unsigned char *sha1);
 void sha1_array_clear(struct sha1_array *array);
 
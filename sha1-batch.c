@@ -0,0 +1,294 @@
+/*
+ * Multi-buffer SHA-1: the 80 rounds of SHA-1 are a long chain of
+ * dependent operations on a single message, so hashing one buffer
+ * leaves most of a modern CPU idle.  Hashing several independent
+ * buffers in the lanes of a vector register keeps it busy instead.
+ */
+#include "cache.h"
+#include "sha1-batch.h"
+
+/*
+ * Buffers longer than this are hashed on their own; a lane stuck with
+ * a long buffer after the others have run dry would do the work of a
+ * whole vector for one message.
+ */
+#define SHA1_BATCH_MAX_LEN (64 * 1024)
+
+#define SHA1_MAX_LANES 16
+
+#if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__)) && !defined(NO_SHA1_BATCH)
+#define SHA1_BATCH_VECTORS
+#if defined(__x86_64__)
+#define SHA1_BATCH_X86_64
+#endif
+#endif
+
+static inline uint32_t get_be32(const unsigned char *p)
+{
+	return	(uint32_t)p[0] << 24 |
+		(uint32_t)p[1] << 16 |
+		(uint32_t)p[2] << 8 |
+		(uint32_t)p[3];
+}
+
+static inline void put_be32(unsigned char *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void hash_one(struct sha1_batch_item *item)
+{
+	git_SHA_CTX c;
+
+	git_SHA1_Init(&c);
+	if (item->hdrlen)
+		git_SHA1_Update(&c, item->hdr, item->hdrlen);
+	git_SHA1_Update(&c, item->buf, item->len);
+	git_SHA1_Final(item->sha1, &c);
+}
+
+#ifdef SHA1_BATCH_VECTORS
+
+typedef uint32_t lane_words[SHA1_MAX_LANES];
+typedef void (*compress_fn)(lane_words *h, lane_words *w);
+
+#define ROL(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+#define W_AT(i) ((i) < 16 ? W[i] : \
+	(W[(i) & 15] = ROL(W[((i) + 13) & 15] ^ W[((i) + 8) & 15] ^ \
+			   W[((i) + 2) & 15] ^ W[(i) & 15], 1)))
+
+#define SHA1_ROUND(i, f, k) do { \
+	t = ROL(a, 5) + (f) + e + (k) + W_AT(i); \
+	e = d; d = c; c = ROL(b, 30); b = a; a = t; \
+} while (0)
+
+/*
+ * One block of each lane: h[] holds the five state words and w[] the
+ * sixteen message words of every lane, lane by lane.
+ */
+#define DEFINE_SHA1_COMPRESS(name, vec, target) \
+target static void name(lane_words *h, lane_words *w) \
+{ \
+	vec a, b, c, d, e, t, W[16], s[5]; \
+	int i; \
+\
+	for (i = 0; i < 5; i++) \
+		memcpy(&s[i], h[i], sizeof(vec)); \
+	for (i = 0; i < 16; i++) \
+		memcpy(&W[i], w[i], sizeof(vec)); \
+	a = s[0]; b = s[1]; c = s[2]; d = s[3]; e = s[4]; \
+\
+	for (i = 0; i < 20; i++) \
+		SHA1_ROUND(i, ((c ^ d) & b) ^ d, 0x5a827999u); \
+	for (; i < 40; i++) \
+		SHA1_ROUND(i, b ^ c ^ d, 0x6ed9eba1u); \
+	for (; i < 60; i++) \
+		SHA1_ROUND(i, (b & c) | (d & (b | c)), 0x8f1bbcdcu); \
+	for (; i < 80; i++) \
+		SHA1_ROUND(i, b ^ c ^ d, 0xca62c1d6u); \
+\
+	s[0] += a; s[1] += b; s[2] += c; s[3] += d; s[4] += e; \
+	for (i = 0; i < 5; i++) \
+		memcpy(h[i], &s[i], sizeof(vec)); \
+}
+
+typedef uint32_t vec4 __attribute__((vector_size(16)));
+DEFINE_SHA1_COMPRESS(compress_4, vec4, )
+
+#ifdef SHA1_BATCH_X86_64
+typedef uint32_t vec8 __attribute__((vector_size(32)));
+typedef uint32_t vec16 __attribute__((vector_size(64)));
+DEFINE_SHA1_COMPRESS(compress_8, vec8, __attribute__((target("avx2"))))
+DEFINE_SHA1_COMPRESS(compress_16, vec16, __attribute__((target("avx512f"))))
+#endif
+
+struct lane {
+	int item;	/* -1 when the lane has run dry */
+	unsigned long block, nr_blocks;
+};
+
+/*
+ * Store block "block" of the padded message of "item" into lane "l"
+ * of w[].  Only the first and the last blocks need the slow path.
+ */
+static void load_block(const struct sha1_batch_item *item,
+		       unsigned long block, unsigned long nr_blocks,
+		       lane_words *w, int l)
+{
+	const unsigned char *buf = item->buf;
+	unsigned long total = item->hdrlen + item->len;
+	unsigned long ofs = block * 64;
+	unsigned char tmp[64];
+	int i;
+
+	if (ofs >= item->hdrlen && ofs + 64 <= total) {
+		buf += ofs - item->hdrlen;
+		for (i = 0; i < 16; i++)
+			w[i][l] = get_be32(buf + 4 * i);
+		return;
+	}
+
+	memset(tmp, 0, sizeof(tmp));
+	for (i = 0; i < 64 && ofs + i < total; ) {
+		unsigned long pos = ofs + i, n;
+		const unsigned char *src;
+
+		if (pos < item->hdrlen) {
+			src = (const unsigned char *)item->hdr + pos;
+			n = item->hdrlen - pos;
+		} else {
+			src = buf + pos - item->hdrlen;
+			n = total - pos;
+		}
+		if (n > 64 - i)
+			n = 64 - i;
+		memcpy(tmp + i, src, n);
+		i += n;
+	}
+	if (i < 64 && ofs + i == total)
+		tmp[i] = 0x80;
+	if (block == nr_blocks - 1) {
+		uint64_t bits = (uint64_t)total << 3;
+		put_be32(tmp + 56, bits >> 32);
+		put_be32(tmp + 60, bits);
+	}
+	for (i = 0; i < 16; i++)
+		w[i][l] = get_be32(tmp + 4 * i);
+}
+
+/* Give lane "l" the next short item, if there is one. */
+static int start_lane(struct lane *lane, lane_words *h, int l,
+		      struct sha1_batch_item *item, int nr, int *next)
+{
+	static const uint32_t init[5] = {
+		0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+	};
+	int i;
+
+	while (*next < nr && item[*next].len > SHA1_BATCH_MAX_LEN)
+		(*next)++;
+	if (*next >= nr) {
+		lane[l].item = -1;
+		return 0;
+	}
+	lane[l].item = (*next)++;
+	lane[l].block = 0;
+	lane[l].nr_blocks = (item[lane[l].item].hdrlen +
+			     item[lane[l].item].len + 8) / 64 + 1;
+	for (i = 0; i < 5; i++)
+		h[i][l] = init[i];
+	return 1;
+}
+
+static void hash_lanes(struct sha1_batch_item *item, int nr,
+		       int lanes, compress_fn compress)
+{
+	lane_words h[5], w[16];
+	struct lane lane[SHA1_MAX_LANES];
+	int next = 0, active = 0, l, i;
+
+	memset(w, 0, sizeof(w));
+	for (l = 0; l < lanes; l++)
+		active += start_lane(lane, h, l, item, nr, &next);
+
+	while (active) {
+		for (l = 0; l < lanes; l++)
+			if (lane[l].item >= 0)
+				load_block(&item[lane[l].item], lane[l].block,
+					   lane[l].nr_blocks, w, l);
+		compress(h, w);
+		for (l = 0; l < lanes; l++) {
+			unsigned char *sha1;
+
+			if (lane[l].item < 0 ||
+			    ++lane[l].block < lane[l].nr_blocks)
+				continue;
+			sha1 = item[lane[l].item].sha1;
+			for (i = 0; i < 5; i++)
+				put_be32(sha1 + 4 * i, h[i][l]);
+			if (!start_lane(lane, h, l, item, nr, &next))
+				active--;
+		}
+	}
+}
+
+static int supported_lanes(void)
+{
+#ifdef SHA1_BATCH_X86_64
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return 16;
+	if (__builtin_cpu_supports("avx2"))
+		return 8;
+#endif
+	return 4;
+}
+
+#else
+
+static int supported_lanes(void)
+{
+	return 1;
+}
+
+#endif
+
+static int batch_lanes, lanes_limit;
+
+int sha1_batch_lanes(void)
+{
+	if (!batch_lanes) {
+		int lanes = supported_lanes();
+		if (lanes_limit)
+			while (lanes > lanes_limit && lanes > 1)
+				lanes = lanes == 4 ? 1 : lanes / 2;
+		batch_lanes = lanes;
+	}
+	return batch_lanes;
+}
+
+void sha1_batch_limit_lanes(int lanes)
+{
+	lanes_limit = lanes;
+	batch_lanes = 0;
+}
+
+void sha1_batch(struct sha1_batch_item *item, int nr)
+{
+	int i, lanes = sha1_batch_lanes(), nr_short = 0;
+
+	for (i = 0; i < nr; i++) {
+		if (lanes > 1 && item[i].len <= SHA1_BATCH_MAX_LEN)
+			nr_short++;
+		else
+			hash_one(&item[i]);
+	}
+	if (nr_short == 1) {
+		for (i = 0; i < nr; i++)
+			if (item[i].len <= SHA1_BATCH_MAX_LEN)
+				hash_one(&item[i]);
+		return;
+	}
+	if (!nr_short)
+		return;
+
+#ifdef SHA1_BATCH_VECTORS
+	switch (lanes) {
+#ifdef SHA1_BATCH_X86_64
+	case 16:
+		hash_lanes(item, nr, 16, compress_16);
+		break;
+	case 8:
+		hash_lanes(item, nr, 8, compress_8);
+		break;
+#endif
+	default:
+		hash_lanes(item, nr, 4, compress_4);
+		break;
+	}
+#endif
+}
@@ -0,0 +1,26 @@
+#ifndef SHA1_BATCH_H
+#define SHA1_BATCH_H
+
+/*
+ * Hashing many independent buffers at once.  Where the compiler and
+ * the CPU allow it, several buffers are hashed side by side in the
+ * lanes of the vector unit; the result is the same as hashing each of
+ * them with git_SHA1_*().
+ */
+struct sha1_batch_item {
+	const void *hdr;	/* hashed before buf; may be NULL */
+	unsigned long hdrlen;
+	const void *buf;
+	unsigned long len;
+	unsigned char *sha1;	/* where the result goes */
+};
+
+/* Number of buffers hashed side by side; 1 without vector support. */
+int sha1_batch_lanes(void);
+
+/* Use no more than "lanes" lanes (for test-sha1; 0 restores the default). */
+void sha1_batch_limit_lanes(int lanes);
+
+void sha1_batch(struct sha1_batch_item *item, int nr);
+
+#endif /* SHA1_BATCH_H */
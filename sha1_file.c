@@ -21,7 +21,10 @@
 #include "sha1-lookup.h"
 #include "bulk-checkin.h"
 #include "streaming.h"
+#include "midx.h"
 #include "dir.h"
+#include "sha1-array.h"
+#include "sha1-batch.h"
 
 #ifndef O_NOATIME
 #if defined(__linux__) && (defined(__i386__) || defined(__PPC__))
@@ -280,6 +283,7 @@ static int link_alt_odb_entry(const char *entry, const char *relative_base, int
 
 	entlen = pfxlen + 43; /* '/' + 2 hex + '/' + 38 hex + NUL */
 	ent = xmalloc(sizeof(*ent) + entlen);
+	ent->loose_objects = NULL;
 	memcpy(ent->base, pathbuf.buf, pfxlen);
 	strbuf_release(&pathbuf);
 
@@ -420,9 +424,113 @@ void prepare_alt_odb(void)
 	read_info_alternates(get_object_directory(), 0);
 }
 
+/*
+ * With core.looseObjectCache, each objects/xx/ directory is read once
+ * and the existence of loose objects answered from the list of names
+ * found there, instead of an access(2) per query.  This is much faster
+ * when there are many queries on a slow filesystem, at the price of
+ * not seeing loose objects that other processes write afterwards,
+ * until reprepare_packed_git() drops the cache.
+ */
+struct loose_object_cache {
+	unsigned char subdir_seen[256];
+	struct sha1_array objects[256];
+};
+
+static struct loose_object_cache *local_loose_objects;
+
+static void read_loose_object_subdir(struct sha1_array *array,
+				     const char *objdir, int objdir_len,
+				     int subdir_nr)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct dirent *de;
+	char hex[41];
+	DIR *dir;
+
+	strbuf_add(&path, objdir, objdir_len);
+	strbuf_addf(&path, "/%02x", subdir_nr);
+	dir = opendir(path.buf);
+	strbuf_release(&path);
+	if (!dir)
+		return;
+
+	sprintf(hex, "%02x", subdir_nr);
+	while ((de = readdir(dir)) != NULL) {
+		unsigned char sha1[20];
+
+		if (strlen(de->d_name) != 38)
+			continue;
+		memcpy(hex + 2, de->d_name, 38);
+		hex[40] = '\0';
+		if (!get_sha1_hex(hex, sha1))
+			sha1_array_append(array, sha1);
+	}
+	closedir(dir);
+}
+
+struct sha1_array *odb_loose_cache(struct alternate_object_database *odb,
+				   int subdir_nr)
+{
+	struct loose_object_cache **cachep, *cache;
+
+	cachep = odb ? &odb->loose_objects : &local_loose_objects;
+	if (!*cachep)
+		*cachep = xcalloc(1, sizeof(**cachep));
+	cache = *cachep;
+
+	if (!cache->subdir_seen[subdir_nr]) {
+		if (odb)
+			read_loose_object_subdir(&cache->objects[subdir_nr],
+						 odb->base,
+						 odb->name - odb->base - 1,
+						 subdir_nr);
+		else
+			read_loose_object_subdir(&cache->objects[subdir_nr],
+						 get_object_directory(),
+						 strlen(get_object_directory()),
+						 subdir_nr);
+		cache->subdir_seen[subdir_nr] = 1;
+	}
+	return &cache->objects[subdir_nr];
+}
+
+static void clear_loose_object_cache(struct loose_object_cache *cache)
+{
+	int i;
+
+	if (!cache)
+		return;
+	for (i = 0; i < 256; i++)
+		sha1_array_clear(&cache->objects[i]);
+	memset(cache->subdir_seen, 0, sizeof(cache->subdir_seen));
+}
+
+static void clear_loose_object_caches(void)
+{
+	struct alternate_object_database *alt;
+
+	clear_loose_object_cache(local_loose_objects);
+	for (alt = alt_odb_list; alt; alt = alt->next)
+		clear_loose_object_cache(alt->loose_objects);
+}
+
+void add_to_loose_object_cache(const unsigned char *sha1)
+{
+	if (local_loose_objects &&
+	    local_loose_objects->subdir_seen[sha1[0]])
+		sha1_array_insert(&local_loose_objects->objects[sha1[0]],
+				  sha1);
+}
+
 static int has_loose_object_local(const unsigned char *sha1)
 {
-	char *name = sha1_file_name(sha1);
+	char *name;
+
+	if (core_loose_object_cache)
+		return sha1_array_lookup(odb_loose_cache(NULL, sha1[0]),
+					 sha1) >= 0;
+	name = sha1_file_name(sha1);
 	return !access(name, F_OK);
 }
 
@@ -431,6 +539,12 @@ int has_loose_object_nonlocal(const unsigned char *sha1)
 	struct alternate_object_database *alt;
 	prepare_alt_odb();
 	for (alt = alt_odb_list; alt; alt = alt->next) {
+		if (core_loose_object_cache) {
+			if (sha1_array_lookup(odb_loose_cache(alt, sha1[0]),
+					      sha1) >= 0)
+				return 1;
+			continue;
+		}
 		fill_sha1_path(alt->name, sha1);
 		if (!access(alt->base, F_OK))
 			return 1;
@@ -1098,7 +1212,8 @@ static void prepare_packed_git_one(char *objdir, int local)
 			continue;
 		}
 
-		if (is_dot_or_dotdot(de->d_name))
+		if (is_dot_or_dotdot(de->d_name) ||
+		    !strcmp(de->d_name, "multi-pack-index"))
 			continue;
 
 		strcpy(path + len, de->d_name);
@@ -1123,6 +1238,8 @@ static void prepare_packed_git_one(char *objdir, int local)
 
 		if (has_extension(de->d_name, ".idx") ||
 		    has_extension(de->d_name, ".pack") ||
+		    has_extension(de->d_name, ".bitmap") ||
+		    has_extension(de->d_name, ".rev") ||
 		    has_extension(de->d_name, ".keep"))
 			string_list_append(&garbage, path);
 		else
@@ -1195,10 +1312,12 @@ void prepare_packed_git(void)
 	if (prepare_packed_git_run_once)
 		return;
 	prepare_packed_git_one(get_object_directory(), 1);
+	prepare_multi_pack_index_one(get_object_directory());
 	prepare_alt_odb();
 	for (alt = alt_odb_list; alt; alt = alt->next) {
 		alt->name[-1] = 0;
 		prepare_packed_git_one(alt->base, 0);
+		prepare_multi_pack_index_one(alt->base);
 		alt->name[-1] = '/';
 	}
 	rearrange_packed_git();
@@ -1208,12 +1327,13 @@ void prepare_packed_git(void)
 void reprepare_packed_git(void)
 {
 	discard_revindex();
+	clear_loose_object_caches();
 	prepare_packed_git_run_once = 0;
 	prepare_packed_git();
 }
 
-static void mark_bad_packed_object(struct packed_git *p,
-				   const unsigned char *sha1)
+void mark_bad_packed_object(struct packed_git *p,
+			    const unsigned char *sha1)
 {
 	unsigned i;
 	for (i = 0; i < p->num_bad_objects; i++)
@@ -1570,6 +1690,96 @@ static void *unpack_sha1_file(void *map, unsigned long mapsize, enum object_type
 	return unpack_sha1_rest(&stream, hdr, *size, sha1);
 }
 
+/*
+ * Read the loose object file at "path" without looking at packs,
+ * alternates or any other shared state, and without printing
+ * anything, so that threads can use it.  Blobs larger than
+ * big_file_threshold are not inflated and *contents is left NULL.
+ * Returns -1 if the file cannot be read or is corrupt.
+ */
+int read_loose_object(const char *path, enum object_type *type,
+		      unsigned long *size, void **contents)
+{
+	unsigned char *map, hdr[8192];
+	unsigned long mapsize, used = 0, hdrlen;
+	struct stat st;
+	z_stream stream;
+	char *buf;
+	int fd, status, ret = -1;
+
+	*contents = NULL;
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) || !st.st_size) {
+		close(fd);
+		return -1;
+	}
+	mapsize = xsize_t(st.st_size);
+	map = xmalloc(mapsize);
+	if (read_in_full(fd, map, mapsize) != mapsize) {
+		close(fd);
+		free(map);
+		return -1;
+	}
+	close(fd);
+
+	memset(&stream, 0, sizeof(stream));
+	if (experimental_loose_object(map)) {
+		used = unpack_object_header_buffer(map, mapsize, type, size);
+		if (!used || *type < OBJ_COMMIT || *type > OBJ_TAG)
+			goto out;
+		hdrlen = 0;
+	}
+	stream.next_in = map + used;
+	stream.avail_in = mapsize - used;
+	if (inflateInit(&stream) != Z_OK)
+		goto out;
+
+	if (!used) {
+		char *nul;
+
+		stream.next_out = hdr;
+		stream.avail_out = sizeof(hdr);
+		status = inflate(&stream, Z_SYNC_FLUSH);
+		if (status != Z_OK && status != Z_STREAM_END)
+			goto out_inflate;
+		nul = memchr(hdr, '\0', stream.total_out);
+		if (!nul || (*type = parse_sha1_header((char *)hdr, size)) < 0)
+			goto out_inflate;
+		hdrlen = nul + 1 - (char *)hdr;
+	}
+
+	if (*type == OBJ_BLOB && *size > big_file_threshold) {
+		ret = 0;
+		goto out_inflate;
+	}
+
+	buf = xmallocz(*size);
+	if (stream.total_out - hdrlen > *size) {
+		free(buf);
+		goto out_inflate;
+	}
+	memcpy(buf, hdr + hdrlen, stream.total_out - hdrlen);
+	stream.next_out = (unsigned char *)buf + stream.total_out - hdrlen;
+	stream.avail_out = *size - (stream.total_out - hdrlen);
+	do {
+		status = inflate(&stream, Z_FINISH);
+	} while (status == Z_OK);
+	if (status == Z_STREAM_END && !stream.avail_in &&
+	    stream.total_out == hdrlen + *size) {
+		*contents = buf;
+		ret = 0;
+	} else
+		free(buf);
+
+out_inflate:
+	inflateEnd(&stream);
+out:
+	free(map);
+	return ret;
+}
+
 unsigned long get_size_from_delta(struct packed_git *p,
 				  struct pack_window **w_curs,
 			          off_t curpos)
@@ -1666,12 +1876,11 @@ static int packed_delta_info(struct packed_git *p,
 		return OBJ_BAD;
 	type = packed_object_info(p, base_offset, NULL, NULL);
 	if (type <= OBJ_NONE) {
-		struct revindex_entry *revidx;
+		uint32_t pos;
 		const unsigned char *base_sha1;
-		revidx = find_pack_revindex(p, base_offset);
-		if (!revidx)
+		if (offset_to_pack_pos(p, base_offset, &pos))
 			return OBJ_BAD;
-		base_sha1 = nth_packed_object_sha1(p, revidx->nr);
+		base_sha1 = nth_packed_object_sha1(p, pack_pos_to_index(p, pos));
 		mark_bad_packed_object(p, base_sha1);
 		type = sha1_object_info(base_sha1, NULL);
 		if (type <= OBJ_NONE)
@@ -1784,7 +1993,20 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	return buffer;
 }
 
-#define MAX_DELTA_CACHE (256)
+/*
+ * Delta bases recently unpacked, so that objects deltified against
+ * the same base (or against each other along a chain) do not each
+ * have to inflate it again.  The entries are in a hash table keyed by
+ * pack and offset, and on a list from least to most recently used.
+ * Only the total size of the cached data is bounded, by
+ * core.deltaBaseCacheLimit; when it is exceeded, least recently used
+ * blobs are evicted first, as they are rarely bases of further deltas,
+ * and then whatever was least recently used.
+ *
+ * With GIT_TRACE_DELTA_BASE_CACHE set, the hit, miss and eviction
+ * counts are reported at exit.
+ */
+static const char delta_base_cache_trace[] = "GIT_TRACE_DELTA_BASE_CACHE";
 
 static size_t delta_base_cached;
 
@@ -1793,14 +2015,23 @@ static struct delta_base_cache_lru_list {
 	struct delta_base_cache_lru_list *next;
 } delta_base_cache_lru = { &delta_base_cache_lru, &delta_base_cache_lru };
 
-static struct delta_base_cache_entry {
-	struct delta_base_cache_lru_list lru;
+struct delta_base_cache_entry {
+	struct delta_base_cache_lru_list lru; /* must be first */
+	struct delta_base_cache_entry *next; /* in the hash chain */
 	void *data;
 	struct packed_git *p;
 	off_t base_offset;
 	unsigned long size;
 	enum object_type type;
-} delta_base_cache[MAX_DELTA_CACHE];
+};
+
+static struct delta_base_cache_entry **delta_base_cache;
+static unsigned int delta_base_cache_size, delta_base_cache_nr;
+
+static struct {
+	unsigned long hits, misses, evictions;
+	size_t peak;
+} delta_base_cache_stats;
 
 static unsigned long pack_entry_hash(struct packed_git *p, off_t base_offset)
 {
@@ -1808,93 +2039,191 @@ static unsigned long pack_entry_hash(struct packed_git *p, off_t base_offset)
 
 	hash = (unsigned long)p + (unsigned long)base_offset;
 	hash += (hash >> 8) + (hash >> 16);
-	return hash % MAX_DELTA_CACHE;
+	return hash;
+}
+
+static struct delta_base_cache_entry **delta_base_cache_slot(struct packed_git *p,
+							     off_t base_offset)
+{
+	struct delta_base_cache_entry **pos;
+
+	if (!delta_base_cache_size)
+		return NULL;
+	pos = &delta_base_cache[pack_entry_hash(p, base_offset) &
+				(delta_base_cache_size - 1)];
+	while (*pos && ((*pos)->p != p || (*pos)->base_offset != base_offset))
+		pos = &(*pos)->next;
+	return pos;
+}
+
+static struct delta_base_cache_entry *get_delta_base_cache_entry(struct packed_git *p,
+								 off_t base_offset)
+{
+	struct delta_base_cache_entry **pos = delta_base_cache_slot(p, base_offset);
+	return pos ? *pos : NULL;
+}
+
+static void report_delta_base_cache_stats(void)
+{
+	struct strbuf sb = STRBUF_INIT;
+
+	strbuf_addf(&sb, "delta base cache: %lu hits, %lu misses, "
+		    "%lu evictions, %lu bytes at most (limit %lu)\n",
+		    delta_base_cache_stats.hits,
+		    delta_base_cache_stats.misses,
+		    delta_base_cache_stats.evictions,
+		    (unsigned long)delta_base_cache_stats.peak,
+		    (unsigned long)delta_base_cache_limit);
+	trace_strbuf(delta_base_cache_trace, &sb);
+	strbuf_release(&sb);
+}
+
+static void grow_delta_base_cache(void)
+{
+	struct delta_base_cache_entry **old = delta_base_cache;
+	unsigned int i, old_size = delta_base_cache_size;
+
+	if (!old_size && trace_want(delta_base_cache_trace))
+		atexit(report_delta_base_cache_stats);
+
+	delta_base_cache_size = old_size ? old_size * 2 : 256;
+	delta_base_cache = xcalloc(delta_base_cache_size,
+				   sizeof(*delta_base_cache));
+	for (i = 0; i < old_size; i++) {
+		struct delta_base_cache_entry *ent = old[i];
+		while (ent) {
+			struct delta_base_cache_entry *next = ent->next;
+			struct delta_base_cache_entry **pos =
+				&delta_base_cache[pack_entry_hash(ent->p, ent->base_offset) &
+						  (delta_base_cache_size - 1)];
+			ent->next = *pos;
+			*pos = ent;
+			ent = next;
+		}
+	}
+	free(old);
 }
 
 static int in_delta_base_cache(struct packed_git *p, off_t base_offset)
 {
-	unsigned long hash = pack_entry_hash(p, base_offset);
-	struct delta_base_cache_entry *ent = delta_base_cache + hash;
-	return (ent->data && ent->p == p && ent->base_offset == base_offset);
+	return !!get_delta_base_cache_entry(p, base_offset);
+}
+
+static void lru_unlink(struct delta_base_cache_entry *ent)
+{
+	ent->lru.next->prev = ent->lru.prev;
+	ent->lru.prev->next = ent->lru.next;
+}
+
+static void lru_append(struct delta_base_cache_entry *ent)
+{
+	ent->lru.next = &delta_base_cache_lru;
+	ent->lru.prev = delta_base_cache_lru.prev;
+	delta_base_cache_lru.prev->next = &ent->lru;
+	delta_base_cache_lru.prev = &ent->lru;
+}
+
+/*
+ * Take the entry out of the cache, leaving its data to the caller.
+ */
+static void detach_delta_base_cache_entry(struct delta_base_cache_entry *ent)
+{
+	struct delta_base_cache_entry **pos =
+		delta_base_cache_slot(ent->p, ent->base_offset);
+
+	*pos = ent->next;
+	lru_unlink(ent);
+	delta_base_cached -= ent->size;
+	delta_base_cache_nr--;
+	free(ent);
 }
 
 static void *cache_or_unpack_entry(struct packed_git *p, off_t base_offset,
 	unsigned long *base_size, enum object_type *type, int keep_cache)
 {
+	struct delta_base_cache_entry *ent;
 	void *ret;
-	unsigned long hash = pack_entry_hash(p, base_offset);
-	struct delta_base_cache_entry *ent = delta_base_cache + hash;
 
-	ret = ent->data;
-	if (!ret || ent->p != p || ent->base_offset != base_offset)
+	ent = get_delta_base_cache_entry(p, base_offset);
+	if (!ent) {
+		delta_base_cache_stats.misses++;
 		return unpack_entry(p, base_offset, type, base_size);
+	}
 
+	delta_base_cache_stats.hits++;
+	*type = ent->type;
+	*base_size = ent->size;
 	if (!keep_cache) {
-		ent->data = NULL;
-		ent->lru.next->prev = ent->lru.prev;
-		ent->lru.prev->next = ent->lru.next;
-		delta_base_cached -= ent->size;
+		ret = ent->data;
+		detach_delta_base_cache_entry(ent);
 	} else {
 		ret = xmemdupz(ent->data, ent->size);
+		lru_unlink(ent);
+		lru_append(ent);
 	}
-	*type = ent->type;
-	*base_size = ent->size;
 	return ret;
 }
 
 static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
 {
-	if (ent->data) {
-		free(ent->data);
-		ent->data = NULL;
-		ent->lru.next->prev = ent->lru.prev;
-		ent->lru.prev->next = ent->lru.next;
-		delta_base_cached -= ent->size;
-	}
+	free(ent->data);
+	detach_delta_base_cache_entry(ent);
 }
 
 void clear_delta_base_cache(void)
 {
-	unsigned long p;
-	for (p = 0; p < MAX_DELTA_CACHE; p++)
-		release_delta_base_cache(&delta_base_cache[p]);
+	while (delta_base_cache_lru.next != &delta_base_cache_lru)
+		release_delta_base_cache((void *)delta_base_cache_lru.next);
 }
 
 static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	void *base, unsigned long base_size, enum object_type type)
 {
-	unsigned long hash = pack_entry_hash(p, base_offset);
-	struct delta_base_cache_entry *ent = delta_base_cache + hash;
-	struct delta_base_cache_lru_list *lru;
+	struct delta_base_cache_entry *ent, **pos;
+	struct delta_base_cache_lru_list *lru, *next;
 
-	release_delta_base_cache(ent);
+	ent = get_delta_base_cache_entry(p, base_offset);
+	if (ent)
+		release_delta_base_cache(ent);
 	delta_base_cached += base_size;
 
 	for (lru = delta_base_cache_lru.next;
 	     delta_base_cached > delta_base_cache_limit
 	     && lru != &delta_base_cache_lru;
-	     lru = lru->next) {
+	     lru = next) {
 		struct delta_base_cache_entry *f = (void *)lru;
-		if (f->type == OBJ_BLOB)
+		next = lru->next;
+		if (f->type == OBJ_BLOB) {
 			release_delta_base_cache(f);
+			delta_base_cache_stats.evictions++;
+		}
 	}
 	for (lru = delta_base_cache_lru.next;
 	     delta_base_cached > delta_base_cache_limit
 	     && lru != &delta_base_cache_lru;
-	     lru = lru->next) {
+	     lru = next) {
 		struct delta_base_cache_entry *f = (void *)lru;
+		next = lru->next;
 		release_delta_base_cache(f);
+		delta_base_cache_stats.evictions++;
 	}
 
+	if (delta_base_cache_nr >= delta_base_cache_size)
+		grow_delta_base_cache();
+	pos = delta_base_cache_slot(p, base_offset);
+
+	ent = xmalloc(sizeof(*ent));
 	ent->p = p;
 	ent->base_offset = base_offset;
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
-	ent->lru.next = &delta_base_cache_lru;
-	ent->lru.prev = delta_base_cache_lru.prev;
-	delta_base_cache_lru.prev->next = &ent->lru;
-	delta_base_cache_lru.prev = &ent->lru;
+	ent->next = NULL;
+	*pos = ent;
+	lru_append(ent);
+	delta_base_cache_nr++;
+	if (delta_base_cache_stats.peak < delta_base_cached)
+		delta_base_cache_stats.peak = delta_base_cached;
 }
 
 static void *read_object(const unsigned char *sha1, enum object_type *type,
@@ -1928,12 +2257,11 @@ static void *unpack_delta_entry(struct packed_git *p,
 		 * This is costly but should happen only in the presence
 		 * of a corrupted pack, and is better than failing outright.
 		 */
-		struct revindex_entry *revidx;
+		uint32_t pos;
 		const unsigned char *base_sha1;
-		revidx = find_pack_revindex(p, base_offset);
-		if (!revidx)
+		if (offset_to_pack_pos(p, base_offset, &pos))
 			return NULL;
-		base_sha1 = nth_packed_object_sha1(p, revidx->nr);
+		base_sha1 = nth_packed_object_sha1(p, pack_pos_to_index(p, pos));
 		error("failed to read delta base object %s"
 		      " at offset %"PRIuMAX" from %s",
 		      sha1_to_hex(base_sha1), (uintmax_t)base_offset,
@@ -1993,11 +2321,15 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 		write_pack_access_log(p, obj_offset);
 
 	if (do_check_packed_object_crc && p->index_version > 1) {
-		struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-		unsigned long len = revidx[1].offset - obj_offset;
-		if (check_pack_crc(p, &w_curs, obj_offset, len, revidx->nr)) {
+		uint32_t pos, nr;
+		unsigned long len;
+		if (offset_to_pack_pos(p, obj_offset, &pos))
+			return NULL;
+		len = pack_pos_to_offset(p, pos + 1) - obj_offset;
+		nr = pack_pos_to_index(p, pos);
+		if (check_pack_crc(p, &w_curs, obj_offset, len, nr)) {
 			const unsigned char *sha1 =
-				nth_packed_object_sha1(p, revidx->nr);
+				nth_packed_object_sha1(p, nr);
 			error("bad packed object CRC for %s",
 			      sha1_to_hex(sha1));
 			mark_bad_packed_object(p, sha1);
@@ -2066,8 +2398,7 @@ off_t nth_packed_object_offset(const struct packed_git *p, uint32_t n)
 	}
 }
 
-off_t find_pack_entry_one(const unsigned char *sha1,
-				  struct packed_git *p)
+int find_pack_entry_pos(const unsigned char *sha1, struct packed_git *p)
 {
 	const uint32_t *level1_ofs = p->index_data;
 	const unsigned char *index = p->index_data;
@@ -2080,7 +2411,7 @@ off_t find_pack_entry_one(const unsigned char *sha1,
 
 	if (!index) {
 		if (open_pack_index(p))
-			return 0;
+			return -1;
 		level1_ofs = p->index_data;
 		index = p->index_data;
 	}
@@ -2107,9 +2438,7 @@ off_t find_pack_entry_one(const unsigned char *sha1,
 	if (use_lookup) {
 		int pos = sha1_entry_pos(index, stride, 0,
 					 lo, hi, p->num_objects, sha1);
-		if (pos < 0)
-			return 0;
-		return nth_packed_object_offset(p, pos);
+		return pos < 0 ? -1 : pos;
 	}
 
 	do {
@@ -2120,13 +2449,22 @@ off_t find_pack_entry_one(const unsigned char *sha1,
 			printf("lo %u hi %u rg %u mi %u\n",
 			       lo, hi, hi - lo, mi);
 		if (!cmp)
-			return nth_packed_object_offset(p, mi);
+			return mi;
 		if (cmp > 0)
 			hi = mi;
 		else
 			lo = mi+1;
 	} while (lo < hi);
-	return 0;
+	return -1;
+}
+
+off_t find_pack_entry_one(const unsigned char *sha1,
+				  struct packed_git *p)
+{
+	int pos = find_pack_entry_pos(sha1, p);
+	if (pos < 0)
+		return 0;
+	return nth_packed_object_offset(p, pos);
 }
 
 int is_pack_valid(struct packed_git *p)
@@ -2150,18 +2488,25 @@ int is_pack_valid(struct packed_git *p)
 	return !open_packed_git(p);
 }
 
+static int is_bad_packed_object(struct packed_git *p,
+				 const unsigned char *sha1)
+{
+	unsigned i;
+
+	for (i = 0; i < p->num_bad_objects; i++)
+		if (!hashcmp(sha1, p->bad_object_sha1 + 20 * i))
+			return 1;
+	return 0;
+}
+
 static int fill_pack_entry(const unsigned char *sha1,
 			   struct pack_entry *e,
 			   struct packed_git *p)
 {
 	off_t offset;
 
-	if (p->num_bad_objects) {
-		unsigned i;
-		for (i = 0; i < p->num_bad_objects; i++)
-			if (!hashcmp(sha1, p->bad_object_sha1 + 20 * i))
-				return 0;
-	}
+	if (is_bad_packed_object(p, sha1))
+		return 0;
 
 	offset = find_pack_entry_one(sha1, p);
 	if (!offset)
@@ -2184,9 +2529,30 @@ static int fill_pack_entry(const unsigned char *sha1,
 	return 1;
 }
 
+/*
+ * Returns 1 if the multi-pack-index knows where "sha1" is, 0 if it does
+ * not cover it, and -1 if the copy it knows about cannot be used.
+ */
+static int fill_midx_pack_entry(const unsigned char *sha1,
+				struct pack_entry *e)
+{
+	struct packed_git *p;
+	off_t offset;
+
+	if (!find_midx_entry(sha1, &p, &offset))
+		return 0;
+	if (!p || is_bad_packed_object(p, sha1) || !is_pack_valid(p))
+		return -1;
+	e->offset = offset;
+	e->p = p;
+	hashcpy(e->sha1, sha1);
+	return 1;
+}
+
 static int find_pack_entry(const unsigned char *sha1, struct pack_entry *e)
 {
 	struct packed_git *p;
+	int skip_covered = 1;
 
 	prepare_packed_git();
 	if (!packed_git)
@@ -2195,8 +2561,20 @@ static int find_pack_entry(const unsigned char *sha1, struct pack_entry *e)
 	if (last_found_pack && fill_pack_entry(sha1, e, last_found_pack))
 		return 1;
 
+	switch (fill_midx_pack_entry(sha1, e)) {
+	case 1:
+		last_found_pack = e->p;
+		return 1;
+	case -1:
+		/* another covered pack may still have a usable copy */
+		skip_covered = 0;
+		break;
+	}
+
 	for (p = packed_git; p; p = p->next) {
-		if (p == last_found_pack || !fill_pack_entry(sha1, e, p))
+		if (p == last_found_pack ||
+		    (skip_covered && p->multi_pack_index) ||
+		    !fill_pack_entry(sha1, e, p))
 			continue;
 
 		last_found_pack = p;
@@ -2537,6 +2915,31 @@ int hash_sha1_file(const void *buf, unsigned long len, const char *type,
 	return 0;
 }
 
+void hash_sha1_files(struct hash_sha1_request *req, int nr)
+{
+	struct sha1_batch_item *item;
+	char (*hdr)[32];
+	int i;
+
+	if (nr == 1) {
+		hash_sha1_file(req->buf, req->len, req->type, req->sha1);
+		return;
+	}
+	item = xmalloc(nr * sizeof(*item));
+	hdr = xmalloc(nr * sizeof(*hdr));
+	for (i = 0; i < nr; i++) {
+		item[i].hdr = hdr[i];
+		item[i].hdrlen = sprintf(hdr[i], "%s %lu",
+					 req[i].type, req[i].len) + 1;
+		item[i].buf = req[i].buf;
+		item[i].len = req[i].len;
+		item[i].sha1 = req[i].sha1;
+	}
+	sha1_batch(item, nr);
+	free(hdr);
+	free(item);
+}
+
 /* Finalize a file on disk, and close it. */
 static void close_sha1_file(int fd)
 {
@@ -2654,7 +3057,10 @@ static int write_loose_object(const unsigned char *sha1, char *hdr, int hdrlen,
 				tmp_file, strerror(errno));
 	}
 
-	return move_temp_to_file(tmp_file, filename);
+	if (move_temp_to_file(tmp_file, filename))
+		return -1;
+	add_to_loose_object_cache(sha1);
+	return 0;
 }
 
 int write_sha1_file(const void *buf, unsigned long len, const char *type, unsigned char *returnsha1)
@@ -2674,6 +3080,87 @@ int write_sha1_file(const void *buf, unsigned long len, const char *type, unsign
 	return write_loose_object(sha1, hdr, hdrlen, buf, len, 0);
 }
 
+int stream_loose_object(struct input_stream *in_stream, unsigned long len,
+			unsigned char *sha1)
+{
+	int fd, ret, flush = 0;
+	unsigned char compressed[4096];
+	git_zstream stream;
+	git_SHA_CTX c;
+	char *filename;
+	static char tmp_file[PATH_MAX];
+	char hdr[32];
+	int hdrlen;
+
+	/* We do not know the name yet; use the object directory itself. */
+	filename = mkpath("%s/tmp_obj", get_object_directory());
+	fd = create_tmpfile(tmp_file, sizeof(tmp_file), filename);
+	if (fd < 0) {
+		if (errno == EACCES)
+			return error("insufficient permission for adding an object to repository database %s", get_object_directory());
+		else
+			return error("unable to create temporary file: %s", strerror(errno));
+	}
+
+	memset(&stream, 0, sizeof(stream));
+	git_deflate_init(&stream, zlib_compression_level);
+	stream.next_out = compressed;
+	stream.avail_out = sizeof(compressed);
+	git_SHA1_Init(&c);
+
+	hdrlen = sprintf(hdr, "%s %lu", typename(OBJ_BLOB), len) + 1;
+	stream.next_in = (unsigned char *)hdr;
+	stream.avail_in = hdrlen;
+	while (git_deflate(&stream, 0) == Z_OK)
+		; /* nothing */
+	git_SHA1_Update(&c, hdr, hdrlen);
+
+	/* Then the data itself, as it comes in */
+	do {
+		unsigned char *in0 = stream.next_in;
+
+		if (!stream.avail_in && !in_stream->is_finished) {
+			unsigned long avail;
+			in0 = (unsigned char *)in_stream->read(in_stream, &avail);
+			stream.next_in = in0;
+			stream.avail_in = avail;
+		}
+		if (in_stream->is_finished)
+			flush = Z_FINISH;
+		ret = git_deflate(&stream, flush);
+		git_SHA1_Update(&c, in0, stream.next_in - in0);
+		if (write_buffer(fd, compressed, stream.next_out - compressed) < 0)
+			die("unable to write loose object file");
+		stream.next_out = compressed;
+		stream.avail_out = sizeof(compressed);
+	} while (ret == Z_OK || ret == Z_BUF_ERROR);
+
+	if (ret != Z_STREAM_END)
+		die("unable to stream deflate new object (%d)", ret);
+	ret = git_deflate_end_gently(&stream);
+	if (ret != Z_OK)
+		die("deflateEnd on stream object failed (%d)", ret);
+	if (stream.total_in != len + hdrlen)
+		die("size mismatch when streaming a new object");
+	git_SHA1_Final(sha1, &c);
+
+	close_sha1_file(fd);
+
+	if (has_sha1_file(sha1)) {
+		unlink_or_warn(tmp_file);
+		return 0;
+	}
+	filename = sha1_file_name(sha1);
+	if (safe_create_leading_directories(filename)) {
+		unlink_or_warn(tmp_file);
+		return error("unable to create directory for %s", filename);
+	}
+	if (move_temp_to_file(tmp_file, filename))
+		return -1;
+	add_to_loose_object_cache(sha1);
+	return 0;
+}
+
 int force_object_loose(const unsigned char *sha1, time_t mtime)
 {
 	void *buf;
@@ -2776,7 +3263,9 @@ static int index_mem(unsigned char *sha1, void *buf, size_t size,
 			check_tag(buf, size);
 	}
 
-	if (write_object)
+	if (write_object && bulk_checkin_all_objects())
+		ret = index_bulk_checkin_mem(sha1, buf, size, type);
+	else if (write_object)
 		ret = write_sha1_file(buf, size, typename(type), sha1);
 	else
 		ret = hash_sha1_file(buf, size, typename(type), sha1);
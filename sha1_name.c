@@ -6,6 +6,7 @@
 #include "tree-walk.h"
 #include "refs.h"
 #include "remote.h"
+#include "sha1-array.h"
 
 static int get_sha1_oneline(const char *, unsigned char *, struct commit_list *);
 
@@ -134,6 +135,36 @@ static int match_sha(unsigned len, const unsigned char *a, const unsigned char *
 	return 1;
 }
 
+static void find_short_cached_loose_object(int len, const unsigned char *bin_pfx,
+					   struct sha1_array *loose,
+					   struct disambiguate_state *ds)
+{
+	int i;
+
+	for (i = 0; i < loose->nr && !ds->ambiguous; i++)
+		if (match_sha(len, bin_pfx, loose->sha1[i]))
+			update_candidates(ds, loose->sha1[i]);
+}
+
+static void find_short_loose_object(int len, const char *hex_pfx,
+				    const unsigned char *bin_pfx,
+				    struct disambiguate_state *ds)
+{
+	struct alternate_object_database *alt;
+
+	if (!core_loose_object_cache) {
+		find_short_object_filename(len, hex_pfx, ds);
+		return;
+	}
+	find_short_cached_loose_object(len, bin_pfx,
+				       odb_loose_cache(NULL, bin_pfx[0]), ds);
+	prepare_alt_odb();
+	for (alt = alt_odb_list; alt && !ds->ambiguous; alt = alt->next)
+		find_short_cached_loose_object(len, bin_pfx,
+					       odb_loose_cache(alt, bin_pfx[0]),
+					       ds);
+}
+
 static void unique_in_pack(int len,
 			  const unsigned char *bin_pfx,
 			   struct packed_git *p,
@@ -334,7 +365,7 @@ static int get_short_sha1(const char *name, int len, unsigned char *sha1,
 	else if (flags & GET_SHA1_BLOB)
 		ds.fn = disambiguate_blob_only;
 
-	find_short_object_filename(len, hex_pfx, &ds);
+	find_short_loose_object(len, hex_pfx, bin_pfx, &ds);
 	find_short_packed_object(len, bin_pfx, &ds);
 	status = finish_object_disambiguation(&ds, sha1);
 
@@ -363,7 +394,7 @@ int for_each_abbrev(const char *prefix, each_abbrev_fn fn, void *cb_data)
 	ds.cb_data = cb_data;
 	ds.fn = fn;
 
-	find_short_object_filename(len, hex_pfx, &ds);
+	find_short_loose_object(len, hex_pfx, bin_pfx, &ds);
 	find_short_packed_object(len, bin_pfx, &ds);
 	return ds.ambiguous;
 }
@@ -0,0 +1,19 @@
+#!/bin/sh
+
+test_description="Tests delta search performance of pack-objects"
+
+. ./perf-lib.sh
+
+test_perf_large_repo
+
+test_perf 'pack-objects --no-reuse-delta' '
+	git pack-objects --all --stdout --no-reuse-delta --threads=1 \
+		</dev/null >/dev/null
+'
+
+test_perf 'pack-objects --no-reuse-delta --window=50' '
+	git pack-objects --all --stdout --no-reuse-delta --threads=1 \
+		--window=50 </dev/null >/dev/null
+'
+
+test_done
@@ -12,6 +12,20 @@ test_expect_success 'character classes (isspace, isalpha etc.)' '
 	test-ctype
 '
 
+test_expect_success 'git_crc32 agrees with zlib' '
+	test-crc32 &&
+	GIT_TEST_CRC32_NO_CLMUL=1 test-crc32
+'
+
+# lanes beyond what the CPU supports fall back to fewer
+test_expect_success 'batched SHA-1 agrees with one at a time' '
+	for lanes in 1 4 8 16
+	do
+		test-sha1 --batch 2000 300 $lanes >/dev/null &&
+		test-sha1 --batch 50 20000 $lanes >/dev/null || return 1
+	done
+'
+
 test_expect_success 'mktemp to nonexistent directory prints filename' '
 	test_must_fail test-mktemp doesnotexist/testXXXXXX 2>err &&
 	grep "doesnotexist/test" err
@@ -0,0 +1,76 @@
+#!/bin/sh
+
+test_description='core.looseObjectCache'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in $(test_seq 1 20)
+	do
+		echo $i >file &&
+		git add file &&
+		test_tick &&
+		git commit -q -m "commit $i" || return 1
+	done &&
+	git clone -s . alt &&
+	(
+		cd alt &&
+		echo alt >alt-file &&
+		git add alt-file &&
+		test_tick &&
+		git commit -m alt
+	)
+'
+
+test_expect_success 'abbreviated names are expanded from the cache' '
+	git rev-list --all --objects | cut -d" " -f1 >objs &&
+	while read obj
+	do
+		short=$(git rev-parse --short $obj) &&
+		git -c core.looseObjectCache=true rev-parse $short || return 1
+	done <objs >actual &&
+	test_cmp objs actual
+'
+
+test_expect_success 'objects of alternates are found in the cache' '
+	(
+		cd alt &&
+		git rev-list --all --objects | cut -d" " -f1 >objs &&
+		git -c core.looseObjectCache=true rev-parse \
+			$(sed -e "s/^\(.......\).*/\1/" objs) >actual &&
+		test_cmp objs actual
+	)
+'
+
+test_expect_success 'fetch of objects we already have loose' '
+	git init dst &&
+	(
+		cd dst &&
+		echo ../../.git/objects >.git/objects/info/alternates &&
+		git -c core.looseObjectCache=true fetch .. master:refs/remotes/origin/master &&
+		test_must_fail ls .git/objects/pack/*.pack &&
+		git rev-parse origin/master >actual &&
+		git --git-dir=../.git rev-parse master >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'objects written by the process itself are seen' '
+	# "commit -a" looks for each new blob before writing it, which
+	# reads its subdirectory, and then checks that the blobs of the
+	# tree it writes exist
+	for i in $(test_seq 1 20)
+	do
+		echo "new $i" >new$i || return 1
+	done &&
+	git add new* &&
+	git commit -q -m new &&
+	for i in $(test_seq 1 20)
+	do
+		echo "changed $i" >new$i || return 1
+	done &&
+	git -c core.looseObjectCache=true commit -q -a -m changed &&
+	git fsck
+'
+
+test_done
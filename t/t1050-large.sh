@@ -151,6 +151,17 @@ test_expect_success 'pack-objects with large loose object' '
 	cmp huge actual
 '
 
+test_expect_success 'unpack-objects streams large blobs' '
+	SHA1=`git hash-object huge` &&
+	test_create_repo unpacked &&
+	echo $SHA1 | git pack-objects --stdout >huge.pack &&
+	GIT_DIR=unpacked/.git git unpack-objects -n <huge.pack &&
+	test_must_fail env GIT_DIR=unpacked/.git git cat-file -e $SHA1 &&
+	GIT_DIR=unpacked/.git git unpack-objects --strict <huge.pack &&
+	GIT_DIR=unpacked/.git git cat-file blob $SHA1 >actual &&
+	cmp huge actual
+'
+
 test_expect_success 'tar achiving' '
 	git archive --format=tar HEAD >/dev/null
 '
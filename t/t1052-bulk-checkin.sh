@@ -0,0 +1,85 @@
+#!/bin/sh
+
+test_description='writing all new objects to one pack with core.bulkCheckin'
+
+. ./test-lib.sh
+
+count_loose () {
+	git count-objects -v | sed -n -e 's/^count: //p'
+}
+
+count_packs () {
+	ls .git/objects/pack/pack-*.pack 2>/dev/null | wc -l | tr -d " "
+}
+
+test_expect_success setup '
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		echo "content $i" >file$i || return 1
+	done &&
+	echo "content 1" >same-as-file1
+'
+
+test_expect_success 'add writes loose objects by default' '
+	git add file1 &&
+	test $(count_loose) = 1 &&
+	test $(count_packs) = 0 &&
+	git rm -q --cached file1 &&
+	rm -rf .git/objects/??
+'
+
+test_expect_success 'add writes one pack with core.bulkCheckin' '
+	git -c core.bulkCheckin=true add . &&
+	test $(count_loose) = 0 &&
+	test $(count_packs) = 1 &&
+	git verify-pack -v .git/objects/pack/pack-*.idx >verify &&
+	test $(grep -c " blob " verify) = 10 &&
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		git cat-file blob :file$i >actual &&
+		test_cmp file$i actual || return 1
+	done &&
+	git fsck
+'
+
+test_expect_success 'existing objects are not written again' '
+	echo "content 11" >file11 &&
+	echo "content 2" >same-as-file2 &&
+	ls .git/objects/pack/pack-*.idx >before &&
+	git -c core.bulkCheckin=true add file11 same-as-file2 &&
+	test $(count_packs) = 2 &&
+	ls .git/objects/pack/pack-*.idx >after &&
+	git verify-pack -v $(comm -13 before after) >verify &&
+	test $(grep -c " blob " verify) = 1
+'
+
+test_expect_success 'hash-object --stdin-paths writes one pack' '
+	rm -f .git/objects/pack/* &&
+	for i in 1 2 3 4 5
+	do
+		echo "other $i" >other$i &&
+		echo other$i || return 1
+	done >paths &&
+	git -c core.bulkCheckin=true hash-object -w --stdin-paths <paths >hashes &&
+	test $(count_loose) = 0 &&
+	test $(count_packs) = 1 &&
+	for h in $(cat hashes)
+	do
+		git cat-file -e $h || return 1
+	done
+'
+
+test_expect_success 'pack size limit starts new packs' '
+	rm -f .git/objects/pack/* &&
+	test-genrandom a 600000 >random1 &&
+	test-genrandom b 600000 >random2 &&
+	git -c core.bulkCheckin=true -c pack.packSizeLimit=1m \
+		hash-object -w random1 random2 file1 >hashes &&
+	test $(count_packs) = 2 &&
+	for h in $(cat hashes)
+	do
+		git cat-file -e $h || return 1
+	done
+'
+
+test_done
@@ -255,6 +255,42 @@ test_expect_success \
 	 test '"$D"' = $(cat o) &&
 	 test "warning: Log .git/logs/'"$m unexpectedly ended on $ld"'." = "$(cat e)"'
 
+# compare the answers to "$@" with and without core.reflogIndex
+query_reflog_index () {
+	for spec in "$@"
+	do
+		git rev-parse --verify -q "$spec" >expect 2>expect.err
+		git -c core.reflogIndex=true rev-parse --verify -q "$spec" \
+			>actual 2>actual.err
+		test_cmp expect actual &&
+		test_cmp expect.err actual.err || return 1
+	done
+}
+
+reflog_queries="master@{0} master@{2} master@{4} master@{5} master@{9}
+master@{2005-05-25} master@{2005-05-26.23:32:00} master@{2005-05-26.23:33:01}
+master@{2005-05-26.23:38:00} master@{2005-05-26.23:43:00} master@{2005-05-28}"
+
+test_expect_success 'core.reflogIndex gives the same answers' '
+	query_reflog_index $reflog_queries &&
+	test -f .git/logs/.index/$m &&
+	query_reflog_index $reflog_queries
+'
+
+test_expect_success 'core.reflogIndex follows appended entries' '
+	GIT_COMMITTER_DATE="2005-05-26 23:50" git update-ref $m $F &&
+	query_reflog_index $reflog_queries master@{2005-05-26.23:49:00} &&
+	GIT_COMMITTER_DATE="2005-05-26 23:35" git update-ref $m $D &&
+	query_reflog_index $reflog_queries master@{2005-05-26.23:36:00}
+'
+
+test_expect_success 'core.reflogIndex notices a rewritten log' '
+	sed -e 2d .git/logs/$m >log &&
+	mv log .git/logs/$m &&
+	query_reflog_index $reflog_queries &&
+	git update-ref -d $m &&
+	! test -f .git/logs/.index/$m
+'
 
 rm -f .git/$m .git/logs/$m expect
 
@@ -302,4 +338,130 @@ test_expect_success \
 	'git cat-file blob master@{2005-05-26 23:42}:F (expect OTHER)' \
 	'test OTHER = $(git cat-file blob "master@{2005-05-26 23:42}:F")'
 
+a=refs/heads/a
+b=refs/heads/b
+c=refs/heads/c
+
+test_expect_success 'stdin test setup' '
+	A=$(git rev-parse HEAD) &&
+	B=$(git rev-parse HEAD~1) &&
+	git update-ref -d $a;
+	git update-ref -d $b;
+	git update-ref -d $c;
+	true
+'
+
+test_expect_success 'stdin fails on unknown command' '
+	echo "unknown $a" >stdin &&
+	test_must_fail git update-ref --stdin <stdin 2>err &&
+	grep "fatal: unknown command: unknown $a" err
+'
+
+test_expect_success 'stdin fails with bad input' '
+	echo "create $a" >stdin &&
+	test_must_fail git update-ref --stdin <stdin 2>err &&
+	grep "fatal: create $a: missing <newvalue>" err &&
+	echo "update $a $A $B extra" >stdin &&
+	test_must_fail git update-ref --stdin <stdin 2>err &&
+	grep "fatal: update $a: extra input:  extra" err &&
+	echo "delete $a 0000000000000000000000000000000000000000" >stdin &&
+	test_must_fail git update-ref --stdin <stdin 2>err &&
+	grep "fatal: delete $a: zero <oldvalue>" err &&
+	test_must_fail git update-ref --stdin $a $A </dev/null &&
+	test_must_fail git update-ref -z $a $A
+'
+
+test_expect_success 'stdin create, update and verify work' '
+	cat >stdin <<-EOF &&
+	create $a $A
+	update $b $B
+	verify $c
+	EOF
+	git update-ref --stdin <stdin &&
+	test $A = $(git rev-parse $a) &&
+	test $B = $(git rev-parse $b) &&
+	test_must_fail git rev-parse --verify -q $c &&
+	cat >stdin <<-EOF &&
+	update $a $B $A
+	verify $b $B
+	update "$c" "$A" ""
+	EOF
+	git update-ref --stdin <stdin &&
+	test $B = $(git rev-parse $a) &&
+	test $B = $(git rev-parse $b) &&
+	test $A = $(git rev-parse $c)
+'
+
+test_expect_success 'stdin changes nothing if one old value is wrong' '
+	cat >stdin <<-EOF &&
+	update $a $A $B
+	update $b $A $A
+	delete $c
+	EOF
+	test_must_fail git update-ref --stdin <stdin 2>err &&
+	grep "fatal: Cannot lock the ref .$b." err &&
+	test $B = $(git rev-parse $a) &&
+	test $B = $(git rev-parse $b) &&
+	test $A = $(git rev-parse $c) &&
+	! test -f .git/$a.lock
+'
+
+test_expect_success 'stdin refuses duplicate and conflicting refs' '
+	cat >stdin <<-EOF &&
+	update $a $A
+	delete $a
+	EOF
+	test_must_fail git update-ref --stdin <stdin 2>err &&
+	grep "fatal: Multiple updates for ref .$a. not allowed." err &&
+	cat >stdin <<-EOF &&
+	create $c/d $A
+	update $c $B
+	EOF
+	test_must_fail git update-ref --stdin <stdin 2>err &&
+	grep "fatal: Cannot update .$c. together with a ref it contains." err &&
+	test_must_fail git rev-parse --verify -q $c/d &&
+	test $A = $(git rev-parse $c)
+'
+
+test_expect_success 'stdin deletes packed refs with one rewrite' '
+	git pack-refs --all &&
+	cat >stdin <<-EOF &&
+	delete $a $B
+	delete $c
+	EOF
+	git update-ref --stdin <stdin &&
+	test_must_fail git rev-parse --verify -q $a &&
+	test_must_fail git rev-parse --verify -q $c &&
+	test $B = $(git rev-parse $b) &&
+	! grep " $a$" .git/packed-refs &&
+	! grep " $c$" .git/packed-refs &&
+	grep " $b$" .git/packed-refs
+'
+
+test_expect_success 'stdin -z works' '
+	printf "create %s\0%s\0update %s\0%s\0\0" $a $A $b $A >stdin &&
+	git update-ref -z --stdin <stdin &&
+	test $A = $(git rev-parse $a) &&
+	test $A = $(git rev-parse $b) &&
+	printf "delete %s\0%s\0" $b $A >stdin &&
+	git update-ref -z --stdin <stdin &&
+	test_must_fail git rev-parse --verify -q $b &&
+	printf "verify %s\0%s\0" $a $B >stdin &&
+	test_must_fail git update-ref -z --stdin <stdin
+'
+
+test_expect_success 'stdin option no-deref' '
+	git symbolic-ref refs/heads/sym $a &&
+	cat >stdin <<-EOF &&
+	option no-deref
+	update refs/heads/sym $B
+	update $a $A $A
+	EOF
+	git update-ref --stdin <stdin &&
+	test $B = $(git rev-parse refs/heads/sym) &&
+	test_must_fail git symbolic-ref refs/heads/sym &&
+	test $A = $(git rev-parse $a) &&
+	git update-ref -d refs/heads/sym
+'
+
 test_done
@@ -268,4 +268,72 @@ test_expect_success 'fsck notices ".git" in trees' '
 	)
 '
 
+test_expect_success 'fsck output does not depend on --threads' '
+	(
+		git init threads &&
+		cd threads &&
+		for i in 1 2 3 4 5 6 7 8
+		do
+			echo $i >file$i &&
+			git add file$i &&
+			test_tick &&
+			git commit -q -m $i || return 1
+		done &&
+		blob=$(echo foo | git hash-object -w --stdin) &&
+		tab=$(printf "\\t") &&
+		for name in . .. .git
+		do
+			echo "100644 blob $blob$tab$name" | git mktree || return 1
+		done &&
+		bad=$(git rev-parse HEAD~3:file2) &&
+		file=.git/objects/$(echo $bad | sed "s#..#&/#") &&
+		chmod +w $file &&
+		echo garbage >>$file &&
+		test_must_fail git fsck --threads=1 --root >out1 2>err1 &&
+		test_must_fail git fsck --threads=4 --root >out4 2>err4 &&
+		test_cmp out1 out4 &&
+		test_cmp err1 err4 &&
+		grep "$bad: object corrupt" err4 &&
+		test $(grep -c "warning in tree" err4) = 3
+	)
+'
+
+test_expect_success 'setup: pack with deltas' '
+	git init packed &&
+	(
+		cd packed &&
+		test-genrandom base 20000 >file &&
+		for i in 1 2 3 4 5 6 7 8 9 10
+		do
+			echo "change $i" >>file &&
+			git add file &&
+			test_tick &&
+			git commit -q -m "change $i" || return 1
+		done &&
+		git repack -a -d -q &&
+		git -c pack.threads=1 fsck --full
+	)
+'
+
+test_expect_success 'fsck --full checks packs the same in threads' '
+	(
+		cd packed &&
+		git -c pack.threads=4 fsck --full &&
+		pack=$(echo .git/objects/pack/pack-*.pack) &&
+		blob=$(git rev-parse HEAD~9:file) &&
+		ofs=$(git show-index <${pack%.pack}.idx | sed -n "s/ $blob.*//p") &&
+		chmod +w $pack &&
+		printf "\377\377\377\377" |
+		dd of=$pack bs=1 seek=$(($ofs + 8)) conv=notrunc &&
+		test_must_fail git -c pack.threads=1 fsck --full 2>serial &&
+		test_must_fail git -c pack.threads=2 fsck --full 2>two &&
+		test_must_fail git -c pack.threads=4 fsck --full 2>four &&
+		test_cmp two four &&
+		grep "cannot unpack $blob" four &&
+		grep "^error: cannot unpack" serial >expect &&
+		grep "^error: cannot unpack" four >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_done
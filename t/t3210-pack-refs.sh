@@ -118,4 +118,52 @@ test_expect_success 'pack, prune and repack' '
 	test_cmp all-of-them again
 '
 
+test_expect_success 'pack-refs writes a sorted file' '
+	git tag -a -m annotated annotated &&
+	git branch sort/x &&
+	git branch sort-y &&
+	git pack-refs --all --prune &&
+	head -n 1 .git/packed-refs | grep " sorted " &&
+	grep -v "^[#^]" .git/packed-refs | cut -d" " -f2 >names &&
+	LC_ALL=C sort names >sorted-names &&
+	test_cmp sorted-names names
+'
+
+check_packed_lookups () {
+	git rev-parse sort/x sort-y annotated annotated^{} &&
+	git show-ref -d --tags &&
+	git for-each-ref refs/heads/sort/ &&
+	git for-each-ref refs/heads/sort &&
+	test_must_fail git rev-parse --verify -q refs/heads/sort &&
+	test_must_fail git branch sort &&
+	test_must_fail git branch sort-y/z &&
+	test_must_fail git branch -m sort-y sort
+}
+
+test_expect_success 'sorted packed-refs are searched in place' '
+	check_packed_lookups >sorted 2>&1 &&
+	sed -e "1s/ sorted / /" .git/packed-refs >unsorted-refs &&
+	cp .git/packed-refs sorted-refs &&
+	cp unsorted-refs .git/packed-refs &&
+	check_packed_lookups >unsorted 2>&1 &&
+	cp sorted-refs .git/packed-refs &&
+	test_cmp unsorted sorted
+'
+
+test_expect_success 'deleting a packed ref keeps the file sorted and peeled' '
+	git branch -d sort-y &&
+	head -n 1 .git/packed-refs | grep " sorted " &&
+	grep "^\^$(git rev-parse annotated^{})" .git/packed-refs &&
+	test_must_fail git show-ref --verify refs/heads/sort-y &&
+	git branch sort-y/z
+'
+
+test_expect_success 'deleting a packed ref leaves the other records alone' '
+	git branch splice-me &&
+	git pack-refs --all --prune &&
+	grep -v " refs/heads/splice-me$" .git/packed-refs >expect &&
+	git branch -d splice-me &&
+	test_cmp expect .git/packed-refs
+'
+
 test_done
@@ -400,6 +400,37 @@ test_expect_success 'verify resulting packs' '
 	git verify-pack test-11-*.pack
 '
 
+test_expect_success 'object details looked up in threads give the same pack' '
+	git init threads &&
+	(
+		cd threads &&
+		test_seq 1 200 >common &&
+		for i in $(test_seq 1 2500)
+		do
+			{ cat common && echo $i; } >file-$i || return 1
+		done &&
+		git add . &&
+		git commit -q -m files &&
+		git repack -adq &&
+		git pack-objects --all --stdout --threads=1 --window=0 \
+			</dev/null >expect.pack &&
+		git pack-objects --all --stdout --threads=4 --window=0 \
+			</dev/null >actual.pack &&
+		test_cmp expect.pack actual.pack
+	)
+'
+
+test_expect_success 'objects compressed in threads give the same pack' '
+	(
+		cd threads &&
+		git pack-objects --all --stdout --threads=1 --window=0 \
+			--no-reuse-object </dev/null >expect.pack &&
+		git pack-objects --all --stdout --threads=4 --window=0 \
+			--no-reuse-object </dev/null >actual.pack &&
+		test_cmp expect.pack actual.pack
+	)
+'
+
 #
 # WARNING!
 #
@@ -65,6 +65,37 @@ test_expect_success \
     'cmp "test-1-${pack1}.idx" "1.idx" &&
      cmp "test-2-${pack2}.idx" "2.idx"'
 
+test_expect_success 'index-pack writes the same index with threads' '
+	git verify-pack -v "test-2-${pack2}.pack" >verify &&
+	grep "^chain length = 2: " verify &&
+	for strict in "" --strict
+	do
+		git index-pack $strict --threads=1 -o threads-1.idx \
+			"test-2-${pack2}.pack" &&
+		git index-pack $strict --threads=4 -o threads-4.idx \
+			"test-2-${pack2}.pack" &&
+		cmp "test-2-${pack2}.idx" threads-1.idx &&
+		cmp "test-2-${pack2}.idx" threads-4.idx || return 1
+	done &&
+	git index-pack --index-version=1 --threads=4 -o threads-v1.idx \
+		"test-1-${pack1}.pack" &&
+	cmp "test-1-${pack1}.idx" threads-v1.idx
+'
+
+test_expect_success 'index-pack --stdin writes the same index with threads' '
+	git init threads &&
+	(
+		cd threads &&
+		git index-pack --threads=1 --stdin <"../test-2-${pack2}.pack" &&
+		mv .git/objects/pack/pack-${pack2}.idx threads-1.idx &&
+		rm -f .git/objects/pack/* &&
+		git index-pack --strict --threads=4 --stdin \
+			<"../test-2-${pack2}.pack" &&
+		cmp threads-1.idx .git/objects/pack/pack-${pack2}.idx &&
+		cmp "../test-2-${pack2}.idx" threads-1.idx
+	)
+'
+
 test_expect_success 'index-pack --verify on index version 1' '
 	git index-pack --verify "test-1-${pack1}.pack"
 '
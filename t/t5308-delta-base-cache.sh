@@ -0,0 +1,58 @@
+#!/bin/sh
+
+test_description='delta base cache statistics'
+
+. ./test-lib.sh
+
+# run "git -c core.deltaBaseCacheLimit=$1 log -p" and leave the
+# counters of the cache in $hits, $misses, $evictions and $peak
+log_with_cache_limit () {
+	rm -f trace &&
+	GIT_TRACE_DELTA_BASE_CACHE="$(pwd)/trace" \
+		git -c core.deltaBaseCacheLimit=$1 log -p >/dev/null &&
+	test_line_count = 1 trace &&
+	set -- $(sed -n -e "s/^delta base cache: \([0-9]*\) hits, \([0-9]*\) misses, \([0-9]*\) evictions, \([0-9]*\) bytes at most (limit $1)\$/\1 \2 \3 \4/p" trace) &&
+	test $# = 4 &&
+	hits=$1 misses=$2 evictions=$3 peak=$4
+}
+
+test_expect_success 'setup delta chains' '
+	for i in $(test_seq 1 20)
+	do
+		for f in a b c d e
+		do
+			test_seq $i $(($i + 400)) | sed -e "s/^/$f /" >$f || return 1
+		done &&
+		git add a b c d e &&
+		test_tick &&
+		git commit -q -m $i || return 1
+	done &&
+	git repack -a -d -f -q --depth=50 --window=50 &&
+	git verify-pack -v .git/objects/pack/*.idx >verify &&
+	grep "^chain length = 2: " verify
+'
+
+test_expect_success 'no trace without GIT_TRACE_DELTA_BASE_CACHE' '
+	git log -p >/dev/null 2>err &&
+	! test -s err
+'
+
+test_expect_success 'bases are reused when the cache is large enough' '
+	log_with_cache_limit 16777216 &&
+	test $hits -gt 0 &&
+	test $misses -gt 0 &&
+	test $evictions = 0 &&
+	test $peak -gt 0 &&
+	test $peak -le 16777216 &&
+	echo $misses >misses_large
+'
+
+test_expect_success 'a small cache evicts and stays within its limit' '
+	log_with_cache_limit 8192 &&
+	test $evictions -gt 0 &&
+	test $peak -gt 0 &&
+	test $peak -le 8192 &&
+	test $misses -gt $(cat misses_large)
+'
+
+test_done
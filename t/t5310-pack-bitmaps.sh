@@ -0,0 +1,145 @@
+#!/bin/sh
+
+test_description='pack bitmap index'
+
+. ./test-lib.sh
+
+objlist () {
+	git show-index <"$1" | cut -d" " -f2 | sort
+}
+
+# pack "$2" (revs on stdin) with and without bitmaps and compare
+rev_list_check () {
+	test_expect_success "$1" "
+		echo $2 | tr ' ' '\n' >revs &&
+		git pack-objects --revs --stdout --no-use-bitmap-index \
+			<revs >expect.pack &&
+		git pack-objects --revs --stdout <revs >actual.pack &&
+		rm -f expect.idx actual.idx &&
+		git index-pack expect.pack &&
+		git index-pack actual.pack &&
+		objlist expect.idx >expect &&
+		objlist actual.idx >actual &&
+		test_cmp expect actual
+	"
+}
+
+test_expect_success 'setup' '
+	for i in $(test_seq 1 120)
+	do
+		echo $i >file-$((i % 10)) &&
+		git add file-$((i % 10)) &&
+		test_tick &&
+		git commit -q -m "commit $i" || return 1
+	done &&
+	git tag -a -m "annotated" annotated HEAD~50 &&
+	git checkout -b side HEAD~30 &&
+	mkdir dir &&
+	echo side >dir/side &&
+	git add dir &&
+	test_tick &&
+	git commit -m side &&
+	git checkout master &&
+	git merge -m merge side
+'
+
+test_expect_success 'repack -b writes a bitmap' '
+	git repack -adb &&
+	ls .git/objects/pack/*.bitmap >bitmaps &&
+	test_line_count = 1 bitmaps
+'
+
+test_expect_success 'repack without -a writes no bitmap' '
+	echo loose >loose &&
+	git add loose &&
+	git commit -m loose &&
+	git repack -db &&
+	ls .git/objects/pack/*.bitmap >bitmaps &&
+	test_line_count = 1 bitmaps &&
+	git repack -adb
+'
+
+rev_list_check 'full history' 'master'
+rev_list_check 'all refs' 'master side annotated'
+rev_list_check 'incremental fetch' 'master ^side'
+rev_list_check 'fetch with an annotated tag as a have' 'side ^annotated'
+rev_list_check 'fetch of a single tree' 'master^{tree}'
+
+test_expect_success 'objects outside the bitmapped pack fall back to a walk' '
+	echo new >new &&
+	git add new &&
+	git commit -m new
+'
+
+rev_list_check 'want outside the pack' 'master ^side'
+
+test_expect_success 'clone from a bitmapped repository' '
+	git repack -adb &&
+	git clone --no-local --bare . clone.git &&
+	git rev-parse master >expect &&
+	git --git-dir=clone.git rev-parse master >actual &&
+	test_cmp expect actual &&
+	git --git-dir=clone.git fsck
+'
+
+test_expect_success 'pack of everything is the bitmapped pack as is' '
+	git pack-objects --all --stdout --delta-base-offset \
+		</dev/null >actual.pack &&
+	test_cmp .git/objects/pack/pack-*.pack actual.pack
+'
+
+test_expect_success 'partial pack reuse sends the same objects' '
+	echo master >revs &&
+	git -c pack.allowPackReuse=false pack-objects --revs --stdout \
+		--delta-base-offset <revs >expect.pack &&
+	git pack-objects --revs --stdout --delta-base-offset \
+		<revs >actual.pack &&
+	rm -f expect.idx actual.idx &&
+	git index-pack expect.pack &&
+	git index-pack actual.pack &&
+	objlist expect.idx >expect &&
+	objlist actual.idx >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'tags of reused objects are included' '
+	git pack-objects --revs --stdout --delta-base-offset --include-tag \
+		<revs >actual.pack &&
+	rm -f actual.idx &&
+	git index-pack actual.pack &&
+	objlist actual.idx >actual &&
+	grep $(git rev-parse annotated) actual
+'
+
+test_expect_success 'corrupt bitmap is ignored' '
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	chmod u+w "$bitmap" &&
+	printf "BITM garbage" >"$bitmap" &&
+	echo master >revs &&
+	git pack-objects --revs --stdout --no-use-bitmap-index \
+		<revs >expect.pack &&
+	git pack-objects --revs --stdout <revs >actual.pack 2>err &&
+	grep "bitmap" err &&
+	rm -f expect.idx actual.idx &&
+	git index-pack expect.pack &&
+	git index-pack actual.pack &&
+	objlist expect.idx >expect &&
+	objlist actual.idx >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'repack -d removes stale bitmaps' '
+	echo newer >new &&
+	git commit -a -m newer &&
+	git repack -ad &&
+	test_must_fail ls .git/objects/pack/*.bitmap
+'
+
+test_expect_success 'repack.writeBitmaps' '
+	git config repack.writeBitmaps true &&
+	git repack -ad &&
+	ls .git/objects/pack/*.bitmap >bitmaps &&
+	test_line_count = 1 bitmaps
+'
+
+test_done
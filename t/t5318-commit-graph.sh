@@ -0,0 +1,108 @@
+#!/bin/sh
+
+test_description='commit-graph file'
+
+. ./test-lib.sh
+
+graph=.git/objects/info/commit-graph
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	test_commit three &&
+	git checkout -b side one &&
+	test_commit side-one &&
+	test_commit side-two &&
+	git checkout -b other two &&
+	test_commit other &&
+	git checkout master &&
+	git merge -m octopus side other &&
+	git tag octopus &&
+	test_commit four
+'
+
+test_expect_success 'verify without a commit-graph file' '
+	git commit-graph verify &&
+	test_path_is_missing $graph
+'
+
+test_expect_success 'write commit-graph' '
+	git commit-graph write &&
+	test_path_is_file $graph &&
+	git commit-graph verify
+'
+
+graph_git_behavior () {
+	test_expect_success "$1" "
+		git rev-list --parents --all >expect &&
+		git -c core.commitGraph=true rev-list --parents --all >actual &&
+		test_cmp expect actual &&
+		git rev-list --topo-order --all >expect &&
+		git -c core.commitGraph=true rev-list --topo-order --all >actual &&
+		test_cmp expect actual &&
+		git merge-base --all side-two four >expect &&
+		git -c core.commitGraph=true merge-base --all side-two four >actual &&
+		test_cmp expect actual
+	"
+}
+
+graph_git_behavior 'graph matches object database'
+
+test_expect_success 'ancestry checks with generation numbers' '
+	git -c core.commitGraph=true merge-base --is-ancestor side-one four &&
+	git -c core.commitGraph=true merge-base --is-ancestor other octopus &&
+	test_must_fail git -c core.commitGraph=true \
+		merge-base --is-ancestor four side-one &&
+	test_must_fail git -c core.commitGraph=true \
+		merge-base --is-ancestor side-two other
+'
+
+test_expect_success 'commits newer than the graph' '
+	test_commit five &&
+	git checkout side &&
+	test_commit side-three &&
+	git checkout master
+'
+
+graph_git_behavior 'graph and new commits'
+
+test_expect_success 'rewrite commit-graph' '
+	git commit-graph write &&
+	git commit-graph verify
+'
+
+graph_git_behavior 'rewritten graph matches object database'
+
+test_expect_success 'grafts disable the commit-graph' '
+	git rev-parse four >.git/info/grafts &&
+	git rev-list --all >expect &&
+	git -c core.commitGraph=true rev-list --all >actual &&
+	test_cmp expect actual &&
+	test_must_fail git commit-graph write &&
+	rm .git/info/grafts
+'
+
+test_expect_success 'detect corrupt checksum' '
+	cp $graph graph.bak &&
+	test_when_finished "mv graph.bak $graph" &&
+	chmod u+w $graph &&
+	size=$(wc -c <$graph) &&
+	printf "\377" |
+	dd of=$graph bs=1 seek=$(($size - 1)) conv=notrunc 2>/dev/null &&
+	test_must_fail git commit-graph verify 2>err &&
+	grep "incorrect checksum" err
+'
+
+test_expect_success 'detect bad signature' '
+	cp $graph graph.bak &&
+	test_when_finished "mv graph.bak $graph" &&
+	chmod u+w $graph &&
+	printf "XXXX" | dd of=$graph bs=1 conv=notrunc 2>/dev/null &&
+	test_must_fail git commit-graph verify 2>err &&
+	grep "signature" err &&
+	git rev-list --all >expect &&
+	git -c core.commitGraph=true rev-list --all >actual 2>/dev/null &&
+	test_cmp expect actual
+'
+
+test_done
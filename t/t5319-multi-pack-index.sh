@@ -0,0 +1,118 @@
+#!/bin/sh
+
+test_description='multi-pack-index'
+
+. ./test-lib.sh
+
+midx=.git/objects/pack/multi-pack-index
+
+# make a new pack with the objects of one more commit
+add_pack () {
+	test_commit "$1" &&
+	git rev-list --objects HEAD^..HEAD | cut -d" " -f1 >objs &&
+	git pack-objects -q .git/objects/pack/pack <objs >/dev/null &&
+	git prune-packed
+}
+
+test_expect_success 'setup' '
+	test_commit one &&
+	git repack -ad &&
+	for i in 2 3 4 5
+	do
+		add_pack commit-$i || return 1
+	done &&
+	ls .git/objects/pack/*.pack >packs &&
+	test_line_count = 5 packs
+'
+
+test_expect_success 'verify without a multi-pack-index' '
+	git multi-pack-index verify &&
+	test_path_is_missing $midx
+'
+
+test_expect_success 'write multi-pack-index' '
+	git multi-pack-index write &&
+	test_path_is_file $midx &&
+	git multi-pack-index verify
+'
+
+test_expect_success 'count-objects does not report it as garbage' '
+	git count-objects -v >out &&
+	grep "^garbage: 0" out
+'
+
+midx_git_behavior () {
+	test_expect_success "$1" '
+		git rev-list --objects --all >expect &&
+		git -c core.multiPackIndex=true rev-list --objects --all >actual &&
+		test_cmp expect actual &&
+		git cat-file --batch-check <expect >expect.info &&
+		git -c core.multiPackIndex=true cat-file --batch-check \
+			<expect >actual.info &&
+		test_cmp expect.info actual.info &&
+		git -c core.multiPackIndex=true fsck
+	'
+}
+
+midx_git_behavior 'objects are found through the multi-pack-index'
+
+test_expect_success 'packs added later are searched as well' '
+	add_pack commit-6 &&
+	git multi-pack-index verify
+'
+
+midx_git_behavior 'uncovered pack'
+
+test_expect_success 'objects of a removed pack are found elsewhere' '
+	git rev-list --objects commit-3..commit-5 | cut -d" " -f1 >objs &&
+	git pack-objects -q .git/objects/pack/pack <objs >name &&
+	test-chmtime =-100 .git/objects/pack/pack-$(cat name).pack &&
+	git multi-pack-index write &&
+	for p in .git/objects/pack/pack-*.idx
+	do
+		if test "$p" != ".git/objects/pack/pack-$(cat name).idx" &&
+		   git show-index <"$p" | grep -q $(git rev-parse commit-5)
+		then
+			rm "$p" "${p%.idx}.pack" || return 1
+		fi
+	done &&
+	test_must_fail git multi-pack-index verify
+'
+
+midx_git_behavior 'stale multi-pack-index'
+
+test_expect_success 'corrupt multi-pack-index is reported' '
+	git multi-pack-index write &&
+	cp $midx midx.bak &&
+	chmod u+w $midx &&
+	printf "\0" | dd of=$midx bs=1 seek=200 conv=notrunc 2>/dev/null &&
+	test_must_fail git multi-pack-index verify &&
+	mv midx.bak $midx
+'
+
+test_expect_success 'expire removes packs whose objects are elsewhere' '
+	git multi-pack-index write &&
+	ls .git/objects/pack/*.pack >before &&
+	git rev-list --objects commit-4..commit-6 | cut -d" " -f1 >objs &&
+	git pack-objects -q .git/objects/pack/pack <objs >name &&
+	test-chmtime =+10 .git/objects/pack/pack-$(cat name).pack &&
+	git multi-pack-index write &&
+	git multi-pack-index expire &&
+	ls .git/objects/pack/*.pack >after &&
+	test_line_count = $(($(wc -l <before) - 1)) after &&
+	test_path_is_file .git/objects/pack/pack-$(cat name).pack &&
+	git multi-pack-index verify
+'
+
+midx_git_behavior 'after expire'
+
+test_expect_success 'repack rewrites the multi-pack-index' '
+	git repack -ad &&
+	git multi-pack-index verify &&
+	ls .git/objects/pack/*.pack >packs &&
+	test_line_count = 1 packs
+'
+
+midx_git_behavior 'after repack'
+
+test_done
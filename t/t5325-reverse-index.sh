@@ -0,0 +1,79 @@
+#!/bin/sh
+
+test_description='pack reverse index'
+
+. ./test-lib.sh
+
+packdir=.git/objects/pack
+
+test_expect_success 'setup' '
+	for i in $(test_seq 1 40)
+	do
+		test_seq 1 $((i * 10)) >file &&
+		git add file &&
+		test_tick &&
+		git commit -q -m "commit $i" || return 1
+	done &&
+	git repack -adf &&
+	test_must_fail ls $packdir/*.rev
+'
+
+test_expect_success 'index-pack --rev-index writes a reverse index' '
+	pack=$(ls $packdir/*.pack) &&
+	cp "$pack" test.pack &&
+	git index-pack --rev-index test.pack &&
+	test_path_is_file test.rev &&
+	nr=$(git show-index <test.idx | wc -l) &&
+	echo $((12 + 4 * nr + 40)) >expect &&
+	wc -c <test.rev | tr -d " " >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'index-pack --no-rev-index overrides the config' '
+	rm -f test.idx test.rev &&
+	git -c pack.writeReverseIndex=true index-pack --no-rev-index test.pack &&
+	test_path_is_file test.idx &&
+	test_path_is_missing test.rev
+'
+
+test_expect_success 'pack.writeReverseIndex makes repack write one' '
+	git -c pack.threads=1 pack-objects --all --stdout </dev/null >expect.pack &&
+	git -c pack.writeReverseIndex=true repack -adf &&
+	ls $packdir/*.rev >revs &&
+	test_line_count = 1 revs &&
+	git count-objects -v >out &&
+	grep "^garbage: 0" out
+'
+
+test_expect_success 'reused objects are the same with the reverse index' '
+	git -c pack.threads=1 pack-objects --all --stdout </dev/null >actual.pack &&
+	test_cmp expect.pack actual.pack &&
+	git fsck
+'
+
+test_expect_success 'corrupt reverse index is ignored' '
+	rev=$(ls $packdir/*.rev) &&
+	chmod u+w "$rev" &&
+	printf "RIDX garbage" >"$rev" &&
+	git -c pack.threads=1 pack-objects --all --stdout </dev/null \
+		>actual.pack 2>err &&
+	grep "reverse index" err &&
+	test_cmp expect.pack actual.pack
+'
+
+test_expect_success 'fetch writes a reverse index with pack.writeReverseIndex' '
+	git init --bare dst.git &&
+	git --git-dir=dst.git config pack.writeReverseIndex true &&
+	git --git-dir=dst.git config fetch.unpackLimit 1 &&
+	git --git-dir=dst.git fetch . master:master &&
+	ls dst.git/objects/pack/*.rev >revs &&
+	test_line_count = 1 revs &&
+	git --git-dir=dst.git fsck
+'
+
+test_expect_success 'repack -d removes stale reverse indexes' '
+	git repack -adf &&
+	test_must_fail ls $packdir/*.rev
+'
+
+test_done
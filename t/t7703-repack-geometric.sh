@@ -0,0 +1,125 @@
+#!/bin/sh
+
+test_description='git repack --geometric'
+
+. ./test-lib.sh
+
+objdir=.git/objects
+packdir=$objdir/pack
+
+# write a pack of $1 new blobs, whose content starts with $2
+make_pack () {
+	test_seq $1 |
+	sed -e "s/^/$2 /" |
+	while read line
+	do
+		echo "$line" | git hash-object -w --stdin || return 1
+	done >objects &&
+	git pack-objects $packdir/pack <objects >/dev/null &&
+	git prune-packed
+}
+
+# the object counts of the packs, smallest first
+pack_counts () {
+	for idx in $packdir/pack-*.idx
+	do
+		git show-index <"$idx" | wc -l
+	done |
+	sort -n |
+	tr -d " " |
+	tr "\n" " "
+}
+
+test_expect_success 'bad factors are rejected' '
+	test_must_fail git repack -g 1 &&
+	test_must_fail git repack -g x &&
+	test_must_fail git repack -a -g 2
+'
+
+test_expect_success 'loose objects only' '
+	echo loose | git hash-object -w --stdin &&
+	git repack -d -g 2 &&
+	test "$(pack_counts)" = "1 " &&
+	git count-objects -v >count &&
+	grep "^count: 0" count
+'
+
+test_expect_success 'packs in a progression are left alone' '
+	rm -f $packdir/* &&
+	make_pack 2 a &&
+	make_pack 4 b &&
+	make_pack 8 c &&
+	ls $packdir >before &&
+	git repack -d -g 2 &&
+	ls $packdir >after &&
+	test_cmp before after
+'
+
+test_expect_success 'the smallest packs are rolled up' '
+	rm -f $packdir/* &&
+	make_pack 20 a &&
+	make_pack 1 b &&
+	make_pack 1 c &&
+	git repack -d -g 2 &&
+	test "$(pack_counts)" = "2 20 " &&
+	make_pack 1 d &&
+	git repack -d -g 2 &&
+	test "$(pack_counts)" = "1 2 20 "
+'
+
+test_expect_success 'rolling up may pull in bigger packs' '
+	rm -f $packdir/* &&
+	make_pack 3 a &&
+	make_pack 7 b &&
+	make_pack 100 c &&
+	make_pack 2 d &&
+	git repack -d -g 2 &&
+	test "$(pack_counts)" = "12 100 "
+'
+
+test_expect_success 'objects of excluded packs are not written again' '
+	rm -f $packdir/* &&
+	make_pack 10 a &&
+	shared=$(echo "a 1" | git hash-object --stdin) &&
+	echo "$shared" | git pack-objects $packdir/pack &&
+	make_pack 1 b &&
+	git repack -d -g 2 &&
+	test "$(pack_counts)" = "1 10 " &&
+	for idx in $packdir/pack-*.idx
+	do
+		git show-index <"$idx" || return 1
+	done >all &&
+	test $(grep -c $shared all) = 1
+'
+
+test_expect_success 'packs with .keep are left alone' '
+	rm -f $packdir/* &&
+	make_pack 8 a &&
+	for idx in $packdir/pack-*.idx
+	do
+		>"${idx%.idx}.keep"
+	done &&
+	make_pack 1 b &&
+	make_pack 1 c &&
+	git repack -d -g 2 &&
+	test "$(pack_counts)" = "2 8 "
+'
+
+test_expect_success 'pack-objects --stdin-packs' '
+	rm -f $packdir/* &&
+	make_pack 4 a &&
+	a=$(cd $packdir && echo pack-*.pack) &&
+	make_pack 4 b &&
+	b=$(cd $packdir && ls pack-*.pack | grep -v $a) &&
+	both=$({ echo $a && echo $b; } |
+	       git pack-objects --stdin-packs both) &&
+	test $(git show-index <both-$both.idx | wc -l) = 8 &&
+	one=$({ echo $a && echo "^$b"; } |
+	      git pack-objects --stdin-packs one) &&
+	test $(git show-index <one-$one.idx | wc -l) = 4 &&
+	echo pack-nonexistent.pack >bogus &&
+	test_must_fail git pack-objects --stdin-packs none <bogus &&
+	test_must_fail git pack-objects --stdin-packs --all none </dev/null
+'
+
+test_done
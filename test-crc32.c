@@ -0,0 +1,43 @@
+#include "cache.h"
+
+/*
+ * Compare git_crc32() with zlib's crc32() over every length up to
+ * "max" at every alignment within 16 bytes, and over the same data
+ * fed in two pieces.
+ */
+static int check(unsigned long max)
+{
+	unsigned char *buf = xmalloc(max + 16);
+	unsigned long i, len;
+	int ofs, rc = 0;
+
+	srand(1);
+	for (i = 0; i < max + 16; i++)
+		buf[i] = rand();
+
+	for (ofs = 0; ofs < 16; ofs++) {
+		for (len = 0; len <= max; len++) {
+			uint32_t expect = crc32(0, buf + ofs, len);
+			uint32_t actual = git_crc32(0, buf + ofs, len);
+			uint32_t split = git_crc32(0, buf + ofs, len / 3);
+
+			split = git_crc32(split, buf + ofs + len / 3,
+					  len - len / 3);
+			if (expect != actual || expect != split) {
+				printf("length %lu at offset %d: "
+				       "expected %08x, got %08x and %08x\n",
+				       len, ofs, expect, actual, split);
+				rc = 1;
+			}
+		}
+	}
+	free(buf);
+	return rc;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		die("usage: test-crc32");
+	return check(2048);
+}
@@ -1,4 +1,71 @@
 #include "cache.h"
+#include "sha1-batch.h"
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*
+ * test-sha1 --batch <count> <size> [<lanes>]
+ *
+ * Hash <count> buffers of up to <size> bytes one by one and as a
+ * batch, check that the results agree and report the throughput.
+ */
+static int batch_benchmark(int ac, char **av)
+{
+	int nr, i, lanes;
+	unsigned long size, total = 0;
+	struct hash_sha1_request *req;
+	unsigned char (*expect)[20], (*actual)[20];
+	double start, serial, batch;
+
+	if (ac < 4)
+		die("usage: test-sha1 --batch <count> <size> [<lanes>]");
+	nr = strtol(av[2], NULL, 10);
+	size = strtoul(av[3], NULL, 10);
+	if (ac > 4)
+		sha1_batch_limit_lanes(strtol(av[4], NULL, 10));
+	lanes = sha1_batch_lanes();
+
+	req = xcalloc(nr, sizeof(*req));
+	expect = xcalloc(nr, sizeof(*expect));
+	actual = xcalloc(nr, sizeof(*actual));
+	srand(1);
+	for (i = 0; i < nr; i++) {
+		unsigned char *buf;
+		unsigned long j;
+
+		/* vary the lengths so that lanes finish at different times */
+		req[i].len = size ? rand() % (size + 1) : 0;
+		buf = xmalloc(req[i].len + 1);
+		for (j = 0; j < req[i].len; j++)
+			buf[j] = rand();
+		req[i].buf = buf;
+		req[i].type = "blob";
+		req[i].sha1 = actual[i];
+		total += req[i].len;
+	}
+
+	start = now();
+	for (i = 0; i < nr; i++)
+		hash_sha1_file(req[i].buf, req[i].len, req[i].type, expect[i]);
+	serial = now() - start;
+	start = now();
+	hash_sha1_files(req, nr);
+	batch = now() - start;
+
+	for (i = 0; i < nr; i++)
+		if (hashcmp(expect[i], actual[i]))
+			die("batch hash of buffer %d (%lu bytes) is wrong",
+			    i, req[i].len);
+	printf("lanes %d: %d buffers, %lu bytes\n", lanes, nr, total);
+	printf("serial: %.1f MB/s\n", total / 1e6 / (serial ? serial : 1e-9));
+	printf("batch:  %.1f MB/s\n", total / 1e6 / (batch ? batch : 1e-9));
+	return 0;
+}
 
 int main(int ac, char **av)
 {
@@ -7,6 +74,9 @@ int main(int ac, char **av)
 	unsigned bufsz = 8192;
 	char *buffer;
 
+	if (ac > 1 && !strcmp(av[1], "--batch"))
+		return batch_benchmark(ac, av);
+
 	if (ac == 2)
 		bufsz = strtoul(av[1], NULL, 10) * 1024 * 1024;
 